@@ -0,0 +1,723 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "sstv.h"
+#include "libsstv.h"
+#include "encoder.h"
+#include "demod.h"
+
+/*
+ * Decoder tuning
+ */
+#define SSTV_DECODER_BLOCK_LENGTH       SSTV_DEMOD_BLOCK_LENGTH
+#define SSTV_DECODER_LEADER_MIN_MS      100 /* minimum leader tone before VIS */
+#define SSTV_DECODER_START_BIT_MIN_MS   15  /* longer than the 10ms break */
+#define SSTV_DECODER_LEADER_TOLERANCE   150 /* Hz */
+#define SSTV_DECODER_TRACK_PHASE_SHIFT  1   /* sync phase loop gain, 1/2 */
+#define SSTV_DECODER_TRACK_DRIFT_SHIFT  3   /* sync drift loop gain, 1/8 */
+#define SSTV_DECODER_MAX_DRIFT_PPM      1000
+#define SSTV_DECODER_MIN_RATE           6000
+#define SSTV_DECODER_MAX_RATE           384000
+
+/*
+ * Decoder state
+ */
+typedef enum {
+    /* looking for the leader tone */
+    SSTV_DECODER_STATE_LEADER,
+
+    /* leader tone interrupted, either by break or by VIS start bit */
+    SSTV_DECODER_STATE_LEADER_LOW,
+
+    /* VIS code */
+    SSTV_DECODER_STATE_VIS,
+
+    /* image lines */
+    SSTV_DECODER_STATE_IMAGE
+} sstv_decoder_state_t;
+
+/*
+ * Decoder context
+ */
+typedef struct {
+    /* output image */
+    sstv_image_t image;
+
+    /* input configuration */
+    sstv_mode_t mode;
+    uint32_t sample_rate;
+
+    /* current state */
+    sstv_decoder_state_t state;
+
+    /* frequency demodulator */
+    sstv_demod_t demod;
+
+    /* transmission timing, following the encoder's segments */
+    sstv_encoder_context_t timing;
+
+    /* header detection */
+    struct {
+        int32_t smooth;
+        uint32_t smooth_shift;
+        uint32_t run;
+        uint32_t leader_min;
+        uint32_t start_bit_min;
+        int32_t leader_low;
+        int32_t leader_high;
+        int32_t leader_break;
+        int32_t vis_bit;
+    } header;
+
+    /* sync tracking: a window of one sync length centered on the expected
+       end of each sync pulse counts samples below the sync/porch midpoint,
+       which gives the timing error of that edge; a second order loop turns
+       the errors into a phase correction, applied to the next sync, and a
+       sample clock drift estimate, applied to every sample */
+    struct {
+        int32_t threshold;
+        uint32_t half;
+        uint32_t skip;
+        uint32_t window;
+        uint32_t low;
+        uint64_t last;
+        int64_t correction; /* usamp */
+        int32_t drift;      /* ppm, Q16 */
+        int32_t frac;       /* fractional usamp, Q16 */
+    } track;
+
+    /* samples spent in timed segments */
+    uint64_t samples;
+
+    /* current segment accumulator */
+    struct {
+        int64_t sum;
+        uint32_t pixel_sum;
+        uint32_t count;
+    } segment;
+
+    /* decoded VIS code */
+    uint8_t vis;
+
+    /* number of completely decoded lines */
+    uint32_t lines;
+
+    /* demodulated block */
+    int32_t freq[SSTV_DECODER_BLOCK_LENGTH];
+    uint8_t pixel[SSTV_DECODER_BLOCK_LENGTH];
+} sstv_decoder_context_t;
+
+/*
+ * Default decoder contexts, for when no allocation/deallocation routines are provided
+ */
+static sstv_decoder_context_t default_decoder_context[SSTV_DEFAULT_DECODER_CONTEXT_COUNT];
+static uint64_t default_decoder_context_usage = 0x0;
+
+
+static void
+sstv_decoder_track_reset(sstv_decoder_context_t *ctx)
+{
+    /* the drift estimate is kept, it belongs to the sample clock */
+    ctx->samples = 0;
+    ctx->track.skip = 0;
+    ctx->track.window = 0;
+    ctx->track.low = 0;
+    ctx->track.last = 0;
+    ctx->track.correction = 0;
+}
+
+static void
+sstv_decoder_search(sstv_decoder_context_t *ctx)
+{
+    ctx->state = SSTV_DECODER_STATE_LEADER;
+    ctx->header.run = 0;
+}
+
+sstv_error_t
+sstv_create_decoder(void **out_ctx, sstv_image_t image, sstv_mode_t mode, uint32_t sample_rate)
+{
+    sstv_decoder_context_t *ctx = NULL;
+    sstv_error_t rc;
+
+    /* check input */
+    if (!out_ctx) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    if (sample_rate < SSTV_DECODER_MIN_RATE || sample_rate > SSTV_DECODER_MAX_RATE) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* check image properties */
+    {
+        uint32_t w, h;
+        sstv_image_format_t fmt;
+
+        rc = sstv_get_mode_image_props(mode, &w, &h, &fmt);
+        if (rc != SSTV_OK) {
+            return rc;
+        }
+        if (w != image.width || h != image.height) {
+            return SSTV_BAD_RESOLUTION;
+        }
+        if (fmt != image.format) {
+            return SSTV_BAD_FORMAT;
+        }
+    }
+
+    /* create context */
+    if (sstv_malloc_user) {
+        /* user allocator */
+        ctx = (sstv_decoder_context_t *) sstv_malloc_user(sizeof(sstv_decoder_context_t));
+        if (!ctx) {
+            return SSTV_ALLOC_FAIL;
+        }
+    } else {
+        uint32_t i;
+        /* use default contexts */
+        for (i = 0; i < SSTV_DEFAULT_DECODER_CONTEXT_COUNT; i++) {
+            if ((default_decoder_context_usage & (0x1 << i)) == 0) {
+                default_decoder_context_usage |= (0x1 << i);
+                ctx = &default_decoder_context[i];
+                break;
+            }
+        }
+        if (!ctx) {
+            return SSTV_NO_DEFAULT_DECODERS;
+        }
+    }
+
+    /* initialize context */
+    ctx->image = image;
+    ctx->mode = mode;
+    ctx->sample_rate = sample_rate;
+    ctx->lines = 0;
+    sstv_decoder_search(ctx);
+
+    /* initialize demodulator and mode timings */
+    rc = sstv_get_mode_descriptor(mode, sample_rate, &ctx->timing.descriptor);
+    if (rc == SSTV_OK) {
+        rc = sstv_demod_init(&ctx->demod, sample_rate,
+                             ctx->timing.descriptor.pixel.val_phase_delta[0],
+                             ctx->timing.descriptor.pixel.val_phase_delta[255]);
+    }
+    if (rc != SSTV_OK) {
+        sstv_delete_decoder(ctx);
+        return rc;
+    }
+
+    /* sync tracking */
+    {
+        sstv_mode_descriptor_t *desc = &ctx->timing.descriptor;
+
+        ctx->track.threshold =
+            (int32_t) ((desc->sync.freq.phase_delta + desc->porch.freq.phase_delta) / 2);
+        ctx->track.half = (uint32_t) (desc->sync.time.usamp / 2000000);
+        ctx->track.drift = 0;
+        ctx->track.frac = 0;
+        sstv_decoder_track_reset(ctx);
+    }
+
+    /* the timing generator walks over the output image, pixel values are
+       irrelevant to it */
+    ctx->timing.image = image;
+    ctx->timing.mode = mode;
+    ctx->timing.sample_rate = sample_rate;
+
+    /* header detection thresholds */
+    {
+        sstv_mode_descriptor_t *desc = &ctx->timing.descriptor;
+        int32_t tolerance = (int32_t) ((((uint64_t)SSTV_DECODER_LEADER_TOLERANCE) << 32) / sample_rate);
+
+        ctx->header.smooth = 0;
+        ctx->header.smooth_shift = 0;
+        while ((sample_rate >> (ctx->header.smooth_shift + 1)) >= 8000) {
+            ctx->header.smooth_shift ++;
+        }
+        ctx->header.leader_min = sample_rate / 1000 * SSTV_DECODER_LEADER_MIN_MS;
+        ctx->header.start_bit_min = sample_rate / 1000 * SSTV_DECODER_START_BIT_MIN_MS;
+        ctx->header.leader_low = (int32_t) desc->leader_tone.freq.phase_delta - tolerance;
+        ctx->header.leader_high = (int32_t) desc->leader_tone.freq.phase_delta + tolerance;
+        ctx->header.leader_break =
+            (int32_t) ((desc->leader_tone.freq.phase_delta + desc->break_tone.freq.phase_delta) / 2);
+        ctx->header.vis_bit =
+            (int32_t) ((desc->vis.low_freq.phase_delta + desc->vis.high_freq.phase_delta) / 2);
+    }
+
+    /* set output */
+    *out_ctx = ctx;
+
+    /* all ok */
+    return SSTV_OK;
+}
+
+sstv_error_t
+sstv_delete_decoder(void *ctx)
+{
+    uint32_t i;
+
+    if (!ctx) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* check default contexts */
+    for (i = 0; i < SSTV_DEFAULT_DECODER_CONTEXT_COUNT; i++) {
+        if (ctx == default_decoder_context+i) {
+            default_decoder_context_usage &= ~(0x1 << i);
+            ctx = NULL;
+            break;
+        }
+    }
+
+    /* deallocate context */
+    if (ctx) {
+        if (!sstv_free_user) {
+            return SSTV_BAD_USER_DEALLOC;
+        }
+        sstv_free_user(ctx);
+    }
+
+    /* all ok */
+    return SSTV_OK;
+}
+
+static uint8_t
+sstv_decode_pixel_value(sstv_decoder_context_t *ctx)
+{
+    /* per-sample values are already mapped and clamped by the demodulator */
+    return (uint8_t) ((ctx->segment.pixel_sum + ctx->segment.count / 2) / ctx->segment.count);
+}
+
+static void
+sstv_decode_store_pixel(sstv_decoder_context_t *ctx, uint8_t val)
+{
+    sstv_encoder_context_t *timing = &ctx->timing;
+    uint32_t width = ctx->image.width;
+    uint32_t line = timing->extra.scan.curr_line;
+    uint32_t col = timing->extra.scan.curr_col - 1; /* already advanced */
+    uint32_t other_line = line;
+    uint32_t channel;
+
+    /* channel and line(s) of the scan that just ended */
+    switch (timing->state) {
+        case SSTV_ENCODER_STATE_Y_SCAN:
+        case SSTV_ENCODER_STATE_Y_EVEN_SCAN:
+            channel = 0;
+            break;
+
+        case SSTV_ENCODER_STATE_Y_ODD_SCAN:
+            channel = 0;
+            line ++;
+            other_line = line;
+            break;
+
+        case SSTV_ENCODER_STATE_RY_SCAN:
+        case SSTV_ENCODER_STATE_BY_SCAN:
+            channel = (timing->state == SSTV_ENCODER_STATE_RY_SCAN ? 2 : 1);
+            switch (ctx->mode) {
+                case SSTV_MODE_ROBOT_C12:
+                case SSTV_MODE_ROBOT_C36:
+                    /* chroma shared by even/odd line pairs */
+                    other_line = line ^ 0x1;
+                    break;
+
+                case SSTV_MODE_ROBOT_C24:
+                case SSTV_MODE_ROBOT_C72:
+                    break;
+
+                default:
+                    /* PD modes: chroma shared by the two lines of a sync */
+                    other_line = line + 1;
+                    break;
+            }
+            break;
+
+        case SSTV_ENCODER_STATE_R_SCAN:
+            channel = 0;
+            break;
+
+        case SSTV_ENCODER_STATE_G_SCAN:
+            channel = 1;
+            break;
+
+        case SSTV_ENCODER_STATE_B_SCAN:
+            channel = 2;
+            break;
+
+        default:
+            return;
+    }
+
+    /* store */
+    if (ctx->image.format == SSTV_FORMAT_Y) {
+        ctx->image.buffer[width * line + col] = val;
+    } else {
+        ctx->image.buffer[(width * line + col) * 3 + channel] = val;
+        ctx->image.buffer[(width * other_line + col) * 3 + channel] = val;
+    }
+}
+
+static void
+sstv_decode_segment_end(sstv_decoder_context_t *ctx)
+{
+    sstv_encoder_context_t *timing = &ctx->timing;
+
+    if (ctx->segment.count == 0) {
+        return;
+    }
+
+    switch (timing->state) {
+        case SSTV_ENCODER_STATE_VIS_BIT:
+            /* VIS bits are sent LSB first; high frequency (1100Hz) is a one */
+            if (ctx->segment.sum / ctx->segment.count < ctx->header.vis_bit) {
+                ctx->vis |= (uint8_t) (1 << (timing->extra.vis.curr_bit - 1));
+            }
+            break;
+
+        case SSTV_ENCODER_STATE_Y_SCAN:
+        case SSTV_ENCODER_STATE_Y_ODD_SCAN:
+        case SSTV_ENCODER_STATE_Y_EVEN_SCAN:
+        case SSTV_ENCODER_STATE_RY_SCAN:
+        case SSTV_ENCODER_STATE_BY_SCAN:
+        case SSTV_ENCODER_STATE_R_SCAN:
+        case SSTV_ENCODER_STATE_G_SCAN:
+        case SSTV_ENCODER_STATE_B_SCAN:
+            sstv_decode_store_pixel(ctx, sstv_decode_pixel_value(ctx));
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void
+sstv_decoder_track_sync(sstv_decoder_context_t *ctx)
+{
+    sstv_encoder_context_t *timing = &ctx->timing;
+    int64_t limit = (int64_t) ctx->track.half * 1000000;
+    int64_t correction = ctx->track.correction;
+
+    if (ctx->track.half == 0) {
+        return;
+    }
+
+    /* at most half a sync either way, so the segment stays longer than a
+       sample */
+    correction = (correction > limit ? limit : (correction < -limit ? -limit : correction));
+    timing->fsk.remaining_usamp += (uint64_t) correction;
+    ctx->track.correction = 0;
+
+    /* window of one sync length, centered on the expected end */
+    uint32_t length = (uint32_t) (timing->fsk.remaining_usamp / 1000000);
+    ctx->track.skip = (length > ctx->track.half ? length - ctx->track.half : 0);
+    ctx->track.window = 2 * ctx->track.half;
+    ctx->track.low = 0;
+}
+
+static void
+sstv_decoder_track_update(sstv_decoder_context_t *ctx)
+{
+    int64_t limit = (int64_t) SSTV_DECODER_MAX_DRIFT_PPM << 16;
+
+    /* no edge within the window (noise, or lost sync), nothing to learn */
+    if (ctx->track.low == 0 || ctx->track.low >= 2 * ctx->track.half) {
+        return;
+    }
+
+    /* positive when the pulse ended later than expected */
+    int64_t error = ((int64_t) ctx->track.low - ctx->track.half) * 1000000;
+
+    ctx->track.correction = error >> SSTV_DECODER_TRACK_PHASE_SHIFT;
+    if (ctx->track.last > 0) {
+        int64_t period = (int64_t) (ctx->samples - ctx->track.last);
+        int64_t drift = ctx->track.drift + (((error << 16) / period) >> SSTV_DECODER_TRACK_DRIFT_SHIFT);
+        ctx->track.drift = (int32_t) (drift > limit ? limit : (drift < -limit ? -limit : drift));
+    }
+    ctx->track.last = ctx->samples;
+}
+
+static sstv_error_t
+sstv_decode_header_sample(sstv_decoder_context_t *ctx, int32_t freq)
+{
+    /* light smoothing for run-length detection */
+    ctx->header.smooth += (freq - ctx->header.smooth) >> ctx->header.smooth_shift;
+    int32_t f = ctx->header.smooth;
+
+    if (ctx->state == SSTV_DECODER_STATE_LEADER) {
+        if (f >= ctx->header.leader_low && f <= ctx->header.leader_high) {
+            /* leader tone continues */
+            ctx->header.run ++;
+        } else if (f < ctx->header.leader_break) {
+            if (ctx->header.run >= ctx->header.leader_min) {
+                /* break or VIS start bit */
+                ctx->state = SSTV_DECODER_STATE_LEADER_LOW;
+                ctx->header.run = 1;
+            } else {
+                ctx->header.run = 0;
+            }
+        } else if (f > ctx->header.leader_high) {
+            ctx->header.run = 0;
+        }
+        /* otherwise we're in transition towards a low tone, hold the run */
+        return SSTV_OK;
+    }
+
+    /* SSTV_DECODER_STATE_LEADER_LOW */
+    if (f >= ctx->header.leader_break) {
+        /* short low tone was the break, wait for the second leader */
+        sstv_decoder_search(ctx);
+        return SSTV_OK;
+    }
+
+    ctx->header.run ++;
+    if (ctx->header.run < ctx->header.start_bit_min) {
+        return SSTV_OK;
+    }
+
+    /* start bit confirmed; sync timing to its beginning */
+    ctx->timing.state = SSTV_ENCODER_STATE_LEADER_TONE_2;
+    ctx->timing.fsk.remaining_usamp = 0;
+    sstv_error_t rc = sstv_encode_state_change(&ctx->timing);
+    if (rc != SSTV_OK) {
+        return rc;
+    }
+
+    /* account for the samples already spent in the start bit (including the
+       delay of the smoothing filter) */
+    uint64_t elapsed = ctx->header.run - ((11 << ctx->header.smooth_shift) >> 4);
+    ctx->timing.fsk.remaining_usamp -= elapsed * 1000000;
+
+    ctx->state = SSTV_DECODER_STATE_VIS;
+    ctx->vis = 0;
+    sstv_decoder_track_reset(ctx);
+    ctx->segment.sum = 0;
+    ctx->segment.pixel_sum = 0;
+    ctx->segment.count = 0;
+    return SSTV_OK;
+}
+
+static sstv_error_t
+sstv_decode_timed_sample(sstv_decoder_context_t *ctx, int32_t freq, uint8_t pixel)
+{
+    sstv_encoder_context_t *timing = &ctx->timing;
+
+    /* length of this sample, corrected by the sample clock drift (32-bit, as
+       this runs for every sample) */
+    ctx->track.frac += ctx->track.drift;
+    int32_t drift = ctx->track.frac >> 16;
+    ctx->track.frac -= drift * 65536;
+    uint64_t usamp = (uint64_t) (1000000 - drift);
+
+    /* segment change? */
+    while (timing->fsk.remaining_usamp < usamp) {
+        sstv_decode_segment_end(ctx);
+
+        sstv_error_t rc = sstv_encode_state_change(timing);
+        if (rc != SSTV_OK) {
+            return rc;
+        }
+
+        ctx->segment.sum = 0;
+        ctx->segment.pixel_sum = 0;
+        ctx->segment.count = 0;
+
+        /* VIS complete? */
+        if (timing->state == SSTV_ENCODER_STATE_VIS_STOP_BIT) {
+            if (ctx->vis != (uint8_t) ctx->mode) {
+                /* not the transmission we are waiting for */
+                sstv_decoder_search(ctx);
+                return SSTV_OK;
+            }
+            ctx->state = SSTV_DECODER_STATE_IMAGE;
+            ctx->lines = 0;
+        }
+
+        /* end of image? */
+        if (timing->state == SSTV_ENCODER_STATE_END) {
+            ctx->lines = ctx->image.height;
+            sstv_decoder_search(ctx);
+            return SSTV_DECODE_END;
+        }
+
+        /* keep track of completed lines */
+        if (ctx->state == SSTV_DECODER_STATE_IMAGE
+            && timing->state != SSTV_ENCODER_STATE_VIS_STOP_BIT)
+        {
+            uint32_t line = timing->extra.scan.curr_line;
+            if (ctx->mode == SSTV_MODE_ROBOT_C12 || ctx->mode == SSTV_MODE_ROBOT_C36) {
+                /* even lines wait for the chroma of the following line */
+                line &= ~0x1u;
+            }
+            ctx->lines = line;
+        }
+
+        /* sync pulse starting? apply the pending phase correction and open
+           a tracking window around its end */
+        if (ctx->state == SSTV_DECODER_STATE_IMAGE
+            && (timing->state == SSTV_ENCODER_STATE_SYNC || timing->state == SSTV_ENCODER_STATE_SYNC_FIRST))
+        {
+            sstv_decoder_track_sync(ctx);
+        }
+
+        /* make sure we don't skip a state */
+        if (timing->fsk.remaining_usamp < usamp) {
+            /* this should not happen for a proper sample rate */
+            return SSTV_INTERNAL_ERROR;
+        }
+    }
+
+    /* accumulate */
+    ctx->segment.sum += freq;
+    ctx->segment.pixel_sum += pixel;
+    ctx->segment.count ++;
+
+    /* sync tracking window */
+    if (ctx->track.skip > 0) {
+        ctx->track.skip --;
+    } else if (ctx->track.window > 0) {
+        ctx->track.low += (freq < ctx->track.threshold);
+        if (-- ctx->track.window == 0) {
+            sstv_decoder_track_update(ctx);
+        }
+    }
+
+    timing->fsk.remaining_usamp -= usamp;
+    ctx->samples ++;
+    return SSTV_OK;
+}
+
+sstv_error_t
+sstv_decode(void *ctx, sstv_signal_t *signal)
+{
+    sstv_decoder_context_t *context = (sstv_decoder_context_t *)ctx;
+    sstv_error_t result = SSTV_DECODE_SUCCESSFUL;
+    uint32_t offset, i;
+
+    if (!context || !signal) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    switch (signal->type) {
+        case SSTV_SAMPLE_INT8:
+        case SSTV_SAMPLE_UINT8:
+        case SSTV_SAMPLE_INT16:
+            if (context->demod.iq) {
+                return SSTV_BAD_SAMPLE_TYPE;
+            }
+            break;
+
+        case SSTV_SAMPLE_CS16:
+#ifndef SSTV_DECODER_FIXED_POINT
+        case SSTV_SAMPLE_CF32:
+#endif
+            if (!context->demod.iq) {
+                return SSTV_BAD_SAMPLE_TYPE;
+            }
+            break;
+
+        default:
+            return SSTV_BAD_SAMPLE_TYPE;
+    }
+
+    /* process signal block by block */
+    for (offset = 0; offset < signal->count; offset += SSTV_DECODER_BLOCK_LENGTH) {
+        uint32_t count = signal->count - offset;
+        if (count > SSTV_DECODER_BLOCK_LENGTH) {
+            count = SSTV_DECODER_BLOCK_LENGTH;
+        }
+
+        sstv_demod_process(&context->demod, signal, offset, count, context->freq, context->pixel);
+
+        for (i = 0; i < count; i ++) {
+            sstv_error_t rc;
+            if (context->state == SSTV_DECODER_STATE_LEADER
+                || context->state == SSTV_DECODER_STATE_LEADER_LOW)
+            {
+                rc = sstv_decode_header_sample(context, context->freq[i]);
+            } else {
+                rc = sstv_decode_timed_sample(context, context->freq[i], context->pixel[i]);
+            }
+
+            if (rc == SSTV_DECODE_END) {
+                /* finish block while looking for the next transmission */
+                result = SSTV_DECODE_END;
+            } else if (rc != SSTV_OK) {
+                return rc;
+            }
+        }
+
+        /* stop at end of image, so the user gets to read it */
+        if (result == SSTV_DECODE_END) {
+            signal->count = offset + count;
+            return SSTV_DECODE_END;
+        }
+    }
+
+    return SSTV_DECODE_SUCCESSFUL;
+}
+
+sstv_error_t
+sstv_decoder_get_lines(void *ctx, uint32_t *lines)
+{
+    sstv_decoder_context_t *context = (sstv_decoder_context_t *)ctx;
+
+    if (!context || !lines) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    *lines = context->lines;
+    return SSTV_OK;
+}
+
+sstv_error_t
+sstv_decoder_get_drift(void *ctx, int32_t *ppm)
+{
+    sstv_decoder_context_t *context = (sstv_decoder_context_t *)ctx;
+
+    if (!context || !ppm) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    *ppm = (int32_t) ((context->track.drift + 32768) >> 16);
+    return SSTV_OK;
+}
+
+sstv_error_t
+sstv_decoder_set_iq_input(void *ctx, int32_t tone_offset)
+{
+    sstv_decoder_context_t *context = (sstv_decoder_context_t *)ctx;
+
+    if (!context) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    return sstv_demod_set_iq(&context->demod, context->sample_rate, tone_offset);
+}
+
+sstv_error_t
+sstv_decoder_skip_header(void *ctx)
+{
+    sstv_decoder_context_t *context = (sstv_decoder_context_t *)ctx;
+
+    if (!context) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* pretend we're in the VIS stop bit, for as long as the demodulator
+       delay, so that the first line lines up with its input samples */
+    context->timing.state = SSTV_ENCODER_STATE_VIS_STOP_BIT;
+    context->timing.fsk.remaining_usamp = sstv_demod_delay_usamp(&context->demod);
+
+    context->state = SSTV_DECODER_STATE_IMAGE;
+    context->vis = (uint8_t) context->mode;
+    sstv_decoder_track_reset(context);
+    context->lines = 0;
+    context->segment.sum = 0;
+    context->segment.pixel_sum = 0;
+    context->segment.count = 0;
+    return SSTV_OK;
+}
@@ -0,0 +1,438 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "libsstv.h"
+#include "sstv.h"
+#include "luts.h"
+#include "demod.h"
+
+/*
+ * Demodulator tuning
+ */
+#define SSTV_DEMOD_LO_HZ         1700 /* center of 1100-2300Hz band */
+#define SSTV_DEMOD_NULL1_HZ      3000 /* boxcar nulls over the 2800-4000Hz upper mixing product */
+#define SSTV_DEMOD_NULL2_HZ      3800
+#define SSTV_DEMOD_MIN_RATE      6000
+#define SSTV_DEMOD_BAND_LOW_HZ   1100 /* tones that must fit below Nyquist with I/Q input */
+#define SSTV_DEMOD_BAND_HIGH_HZ  2300
+
+/*
+ * CORDIC arctangent table, atan(2^-k) in 2^32 units per turn
+ */
+#define SSTV_CORDIC_ITERATIONS 16
+
+static const int32_t SSTV_CORDIC_ATAN[SSTV_CORDIC_ITERATIONS] = {
+    536870912, 316933406, 167458907, 85004756, 42667331, 21354465, 10679838, 5340245,
+    2670163, 1335087, 667544, 333772, 166886, 83443, 41722, 20861
+};
+
+/*
+ * CORDIC in vectoring mode: only shifts and adds on 32-bit integers, so it
+ * runs on cores without a multiplier worth the name. Arguments must stay
+ * within +/-2^30.
+ */
+int32_t
+sstv_atan2(int32_t y, int32_t x)
+{
+    uint32_t angle = 0;
+    uint32_t mag;
+    int32_t k;
+
+    if (x == 0 && y == 0) {
+        return 0;
+    }
+
+    /* rotate into the right half plane */
+    if (x < 0) {
+        x = -x;
+        y = -y;
+        angle = 0x80000000;
+    }
+
+    /* scale magnitude to [2^26, 2^28), leaving headroom for the CORDIC gain */
+    mag = (uint32_t)x | (uint32_t)(y < 0 ? -y : y);
+    while (mag >= (1U << 28)) {
+        x >>= 2;
+        y >>= 2;
+        mag >>= 2;
+    }
+    while (mag < (1U << 26)) {
+        x *= 4;
+        y *= 4;
+        mag <<= 2;
+    }
+
+    /* rotate towards the x axis, accumulating the angle; the direction is
+       applied as a conditional negate, since the branch would be a coin toss */
+    for (k = 0; k < SSTV_CORDIC_ITERATIONS; k ++) {
+        int32_t dir = y >> 31; /* 0 above the axis, -1 below */
+        int32_t dx = ((x >> k) ^ dir) - dir;
+        int32_t dy = ((y >> k) ^ dir) - dir;
+        x += dy;
+        y -= dx;
+        angle += (uint32_t) ((SSTV_CORDIC_ATAN[k] ^ dir) - dir);
+    }
+
+    return (int32_t) angle;
+}
+
+/*
+ * Only used at setup and once per block, so a plain Taylor series will do.
+ */
+void
+sstv_sincos(int32_t phase, int64_t *sin, int64_t *cos)
+{
+    /* 2pi in Q30 */
+    const int64_t two_pi = 6746518852LL;
+    int64_t ph = phase;
+    int64_t x, x2, ts, tc, k;
+    int flip = 0;
+
+    /* reduce to [-pi/2, pi/2] so the series stays within 64 bits */
+    if (ph > 0x40000000) {
+        ph = 0x80000000LL - ph;
+        flip = 1;
+    } else if (ph < -0x40000000) {
+        ph = -0x80000000LL - ph;
+        flip = 1;
+    }
+
+    x = ((ph >> 2) * two_pi) >> 30;
+    x2 = (x * x) >> 30;
+    ts = x;
+    tc = (1LL << 30);
+
+    *sin = ts;
+    *cos = tc;
+    for (k = 1; k <= 12; k ++) {
+        ts = -((ts * x2) >> 30) / ((2 * k) * (2 * k + 1));
+        tc = -((tc * x2) >> 30) / ((2 * k - 1) * (2 * k));
+        *sin += ts;
+        *cos += tc;
+    }
+
+    if (flip) {
+        *cos = -*cos;
+    }
+}
+
+static uint32_t
+sstv_demod_boxcar_length(uint32_t sample_rate, uint32_t null_hz)
+{
+    return (sample_rate + null_hz / 2) / null_hz;
+}
+
+uint64_t
+sstv_demod_delay_usamp(const sstv_demod_t *demod)
+{
+    /* half the FIR span, plus half a sample for the discriminator */
+#ifdef SSTV_DECODER_FIXED_POINT
+    return (uint64_t) (demod->lpf[0].length + demod->lpf[1].length - 1) * 500000;
+#else
+    return (uint64_t) demod->taps * 500000;
+#endif
+}
+
+/*
+ * Oscillator at hz (negative for complex input below 0Hz); the float build
+ * also needs the per-lane rotations.
+ */
+static void
+sstv_demod_set_lo(sstv_demod_t *demod, uint32_t sample_rate, int32_t hz)
+{
+    demod->lo_phase = 0;
+    demod->lo_phase_delta = (uint32_t) (((int64_t)hz * 4294967296LL) / sample_rate);
+
+#ifndef SSTV_DECODER_FIXED_POINT
+    {
+        int64_t s, c;
+        uint32_t i;
+
+        for (i = 0; i < 8; i ++) {
+            sstv_sincos((int32_t) (demod->lo_phase_delta * i), &s, &c);
+            demod->lo_cos[i] = (float) c / (float) (1 << 30);
+            demod->lo_sin[i] = (float) s / (float) (1 << 30);
+        }
+        sstv_sincos((int32_t) (demod->lo_phase_delta * 8), &s, &c);
+        demod->lo_step_cos = (float) c / (float) (1 << 30);
+        demod->lo_step_sin = (float) s / (float) (1 << 30);
+    }
+#endif
+}
+
+sstv_error_t
+sstv_demod_set_iq(sstv_demod_t *demod, uint32_t sample_rate, int32_t tone_offset)
+{
+    int64_t nyquist = sample_rate / 2;
+
+    if (!demod) {
+        return SSTV_INTERNAL_ERROR;
+    }
+
+    if ((int64_t)tone_offset + SSTV_DEMOD_BAND_HIGH_HZ >= nyquist
+        || (int64_t)tone_offset + SSTV_DEMOD_BAND_LOW_HZ <= -nyquist)
+    {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* move the oscillator onto the shifted band; after mixing, everything
+       (filters, discriminator base, pixel mapping) is as for real input */
+    demod->iq = 1;
+    sstv_demod_set_lo(demod, sample_rate, SSTV_DEMOD_LO_HZ + tone_offset);
+
+    return SSTV_OK;
+}
+
+#ifdef SSTV_DECODER_FIXED_POINT
+
+/*
+ * The fixed-point chain keeps every per-sample quantity within 32 bits:
+ * Q15 baseband, boxcars normalized by shifts rather than by a multiply, a
+ * 32-bit discriminator product and the CORDIC arctangent.
+ */
+sstv_error_t
+sstv_demod_init(sstv_demod_t *demod, uint32_t sample_rate, uint32_t pixel_low, uint32_t pixel_high)
+{
+    uint32_t i, s;
+
+    if (!demod) {
+        return SSTV_INTERNAL_ERROR;
+    }
+
+    if (sample_rate < SSTV_DEMOD_MIN_RATE || pixel_high <= pixel_low) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    demod->iq = 0;
+    sstv_demod_set_lo(demod, sample_rate, SSTV_DEMOD_LO_HZ);
+    demod->freq_base = (int32_t) demod->lo_phase_delta;
+
+    /* bandwidth is shifted down to 15 bits, so the scaled value fits in 32 */
+    demod->pixel_low = pixel_low;
+    demod->pixel_bandwidth = pixel_high - pixel_low;
+    demod->pixel_shift = 0;
+    while ((demod->pixel_bandwidth >> demod->pixel_shift) >= (1U << 15)) {
+        demod->pixel_shift ++;
+    }
+    demod->pixel_scale = (255U << 16) / (demod->pixel_bandwidth >> demod->pixel_shift);
+
+    demod->lpf[0].length = sstv_demod_boxcar_length(sample_rate, SSTV_DEMOD_NULL1_HZ);
+    demod->lpf[1].length = sstv_demod_boxcar_length(sample_rate, SSTV_DEMOD_NULL2_HZ);
+
+    for (s = 0; s < 2; s ++) {
+        if (demod->lpf[s].length > SSTV_DEMOD_MAX_FILTER_LENGTH) {
+            return SSTV_BAD_PARAMETER;
+        }
+        /* the gain of 2^shift / length (in (1/2, 1]) does not matter to the
+           discriminator */
+        demod->lpf[s].shift = 0;
+        while ((1U << demod->lpf[s].shift) < demod->lpf[s].length) {
+            demod->lpf[s].shift ++;
+        }
+        demod->lpf[s].pos = 0;
+        demod->lpf[s].sum_i = 0;
+        demod->lpf[s].sum_q = 0;
+        for (i = 0; i < demod->lpf[s].length; i ++) {
+            demod->lpf[s].hist_i[i] = 0;
+            demod->lpf[s].hist_q[i] = 0;
+        }
+    }
+
+    demod->prev_i = 0;
+    demod->prev_q = 0;
+
+    return SSTV_OK;
+}
+
+void
+sstv_demod_process(sstv_demod_t *demod, const sstv_signal_t *signal, uint32_t offset, uint32_t count,
+                   int32_t *freq, uint8_t *pixel)
+{
+    uint32_t n, s;
+    int32_t i, q;
+
+    for (n = 0; n < count; n ++) {
+        /* mix down to baseband, Q15 */
+        uint32_t idx = demod->lo_phase >> 22;
+        int32_t c = SSTV_SIN_INT10_INT16[(idx + 256) & 1023];
+        int32_t sn = SSTV_SIN_INT10_INT16[idx];
+        demod->lo_phase += demod->lo_phase_delta;
+
+        if (demod->iq) {
+            /* halved, so that the rotated sample stays within 16 bits */
+            const int16_t *z = (const int16_t *)signal->buffer + 2 * (offset + n);
+            int32_t x = z[0] >> 1, y = z[1] >> 1;
+            i = (x * c + y * sn + (1 << 14)) >> 15;
+            q = (y * c - x * sn + (1 << 14)) >> 15;
+        } else {
+            int32_t x = sstv_demod_get_sample(signal, offset + n);
+            i = (x * c + (1 << 14)) >> 15;
+            q = -((x * sn + (1 << 14)) >> 15);
+        }
+
+        /* low-pass */
+        for (s = 0; s < 2; s ++) {
+            uint32_t pos = demod->lpf[s].pos;
+            uint32_t shift = demod->lpf[s].shift;
+            demod->lpf[s].sum_i += i - demod->lpf[s].hist_i[pos];
+            demod->lpf[s].sum_q += q - demod->lpf[s].hist_q[pos];
+            demod->lpf[s].hist_i[pos] = (int16_t) i;
+            demod->lpf[s].hist_q[pos] = (int16_t) q;
+            demod->lpf[s].pos = (pos + 1 == demod->lpf[s].length ? 0 : pos + 1);
+
+            i = (demod->lpf[s].sum_i + ((1 << shift) >> 1)) >> shift;
+            q = (demod->lpf[s].sum_q + ((1 << shift) >> 1)) >> shift;
+        }
+
+        /* polar discriminator: arg(z[n] * conj(z[n-1])), both within Q15 */
+        int32_t re = i * demod->prev_i + q * demod->prev_q;
+        int32_t im = q * demod->prev_i - i * demod->prev_q;
+        demod->prev_i = i;
+        demod->prev_q = q;
+
+        freq[n] = demod->freq_base + sstv_atan2(im, re);
+
+        /* pixel value */
+        int32_t diff = freq[n] - (int32_t) demod->pixel_low;
+        if (diff <= 0) {
+            pixel[n] = 0;
+        } else if ((uint32_t) diff >= demod->pixel_bandwidth) {
+            pixel[n] = 255;
+        } else {
+            uint32_t val = (((uint32_t) diff >> demod->pixel_shift) * demod->pixel_scale + 0x8000) >> 16;
+            pixel[n] = (uint8_t) (val > 255 ? 255 : val);
+        }
+    }
+}
+
+#else
+
+sstv_error_t
+sstv_demod_init(sstv_demod_t *demod, uint32_t sample_rate, uint32_t pixel_low, uint32_t pixel_high)
+{
+    uint32_t len1, len2, i, j;
+
+    if (!demod) {
+        return SSTV_INTERNAL_ERROR;
+    }
+
+    if (sample_rate < SSTV_DEMOD_MIN_RATE || pixel_high <= pixel_low) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    demod->iq = 0;
+    sstv_demod_set_lo(demod, sample_rate, SSTV_DEMOD_LO_HZ);
+    demod->freq_base = (int32_t) demod->lo_phase_delta;
+
+    /* pixel mapping; the kernels work relative to the oscillator */
+    demod->pixel_low = pixel_low;
+    demod->pixel_bandwidth = pixel_high - pixel_low;
+    demod->pixel_offset = (float) ((int64_t)demod->freq_base - pixel_low);
+    demod->pixel_scale = 255.0f / (float) demod->pixel_bandwidth;
+
+    /* both boxcars as a single FIR */
+    len1 = sstv_demod_boxcar_length(sample_rate, SSTV_DEMOD_NULL1_HZ);
+    len2 = sstv_demod_boxcar_length(sample_rate, SSTV_DEMOD_NULL2_HZ);
+    if (len1 > SSTV_DEMOD_MAX_FILTER_LENGTH || len2 > SSTV_DEMOD_MAX_FILTER_LENGTH) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    demod->taps = len1 + len2 - 1;
+    for (i = 0; i < demod->taps; i ++) {
+        uint32_t overlap = 0;
+        for (j = 0; j < len1; j ++) {
+            if (i >= j && i - j < len2) {
+                overlap ++;
+            }
+        }
+        demod->fir[i] = (float) overlap / (float) (len1 * len2);
+    }
+
+    /* clear history */
+    for (i = 0; i < SSTV_DEMOD_MAX_TAPS - 1 + SSTV_DEMOD_BLOCK_LENGTH; i ++) {
+        demod->mix_i[i] = 0.0f;
+        demod->mix_q[i] = 0.0f;
+    }
+    for (i = 0; i < 1 + SSTV_DEMOD_BLOCK_LENGTH; i ++) {
+        demod->filt_i[i] = 0.0f;
+        demod->filt_q[i] = 0.0f;
+    }
+
+    /* pick kernel */
+    demod->kernel = sstv_demod_kernel_scalar;
+#ifdef SSTV_DEMOD_HAVE_AVX2
+    demod->kernel = sstv_demod_kernel_avx2;
+#endif
+#ifdef SSTV_DEMOD_HAVE_NEON
+    demod->kernel = sstv_demod_kernel_neon;
+#endif
+
+    return SSTV_OK;
+}
+
+void
+sstv_demod_process(sstv_demod_t *demod, const sstv_signal_t *signal, uint32_t offset, uint32_t count,
+                   int32_t *freq, uint8_t *pixel)
+{
+    uint32_t n;
+    int64_t s, c;
+
+    /* load block */
+    switch (signal->type) {
+        case SSTV_SAMPLE_CS16:
+            for (n = 0; n < count; n ++) {
+                demod->input[n] = (float) ((int16_t *)signal->buffer)[2 * (offset + n)];
+                demod->input_q[n] = (float) ((int16_t *)signal->buffer)[2 * (offset + n) + 1];
+            }
+            break;
+
+        case SSTV_SAMPLE_CF32:
+            for (n = 0; n < count; n ++) {
+                demod->input[n] = ((float *)signal->buffer)[2 * (offset + n)];
+                demod->input_q[n] = ((float *)signal->buffer)[2 * (offset + n) + 1];
+            }
+            break;
+
+        case SSTV_SAMPLE_INT8:
+            for (n = 0; n < count; n ++) {
+                demod->input[n] = (float) (((int8_t *)signal->buffer)[offset + n] * 256);
+            }
+            break;
+
+        case SSTV_SAMPLE_UINT8:
+            for (n = 0; n < count; n ++) {
+                demod->input[n] = (float) ((((uint8_t *)signal->buffer)[offset + n] - 128) * 256);
+            }
+            break;
+
+        case SSTV_SAMPLE_INT16:
+        default:
+            for (n = 0; n < count; n ++) {
+                demod->input[n] = (float) ((int16_t *)signal->buffer)[offset + n];
+            }
+            break;
+    }
+
+    /* oscillator phasor at block start, from the integer phase so rounding
+       errors of the rotation do not build up */
+    sstv_sincos((int32_t) demod->lo_phase, &s, &c);
+    demod->lo_base_cos = (float) c / (float) (1 << 30);
+    demod->lo_base_sin = (float) s / (float) (1 << 30);
+    demod->lo_phase += demod->lo_phase_delta * count;
+
+    demod->kernel(demod, count, freq, pixel);
+
+    /* keep history for the next block */
+    for (n = 0; n + 1 < demod->taps; n ++) {
+        demod->mix_i[n] = demod->mix_i[count + n];
+        demod->mix_q[n] = demod->mix_q[count + n];
+    }
+    demod->filt_i[0] = demod->filt_i[count];
+    demod->filt_q[0] = demod->filt_q[count];
+}
+
+#endif
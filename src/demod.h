@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _DEMOD_H_
+#define _DEMOD_H_
+
+#include "sstv.h"
+
+/*
+ * Limits
+ */
+#define SSTV_DEMOD_BLOCK_LENGTH      256 /* maximum samples per sstv_demod_process() call */
+#define SSTV_DEMOD_MAX_FILTER_LENGTH 128
+#define SSTV_DEMOD_MAX_TAPS          (2 * SSTV_DEMOD_MAX_FILTER_LENGTH - 1)
+
+/*
+ * Instantaneous frequency demodulator
+ *
+ * The input is mixed down with a complex oscillator at the center of the SSTV
+ * band, low-pass filtered by two cascaded boxcar stages (with nulls placed
+ * over the upper mixing product) and fed to a polar discriminator. The output
+ * is the per-sample phase delta, in the same units as sstv_freq_desc_t, and
+ * the pixel value that frequency encodes.
+ *
+ * The default build runs this in single precision, with AVX2 or NEON kernels
+ * where available; the two boxcars are applied as a single FIR so that the
+ * whole chain vectorizes. SSTV_DECODER_FIXED_POINT selects an integer-only
+ * implementation, for targets without an FPU, which keeps all
+ * per-sample arithmetic within 32 bits.
+ *
+ * Complex (I/Q) input is mixed with the oscillator moved by the tone offset,
+ * which leaves no upper mixing product, and then goes through the same chain.
+ */
+typedef struct sstv_demod_s sstv_demod_t;
+
+typedef void (*sstv_demod_kernel_t)(sstv_demod_t *demod, uint32_t count, int32_t *freq, uint8_t *pixel);
+
+struct sstv_demod_s {
+    /* local oscillator */
+    uint32_t lo_phase;
+    uint32_t lo_phase_delta;
+
+    /* complex input, and the phase delta added to the discriminator output
+       (the oscillator frequency, less the tone offset for complex input) */
+    uint32_t iq;
+    int32_t freq_base;
+
+    /* pixel value mapping, see sstv_mode_descriptor_t.pixel.val_phase_delta */
+    uint32_t pixel_low;
+    uint32_t pixel_bandwidth;
+
+#ifdef SSTV_DECODER_FIXED_POINT
+    /* pixel value = ((phase delta - low) >> shift) * scale, scale in Q16 */
+    uint32_t pixel_shift;
+    uint32_t pixel_scale;
+
+    /* boxcar low-pass stages, Q15 in and out */
+    struct {
+        uint32_t length;
+        uint32_t shift; /* log2(length), rounded up */
+        uint32_t pos;
+        int32_t sum_i;
+        int32_t sum_q;
+        int16_t hist_i[SSTV_DEMOD_MAX_FILTER_LENGTH];
+        int16_t hist_q[SSTV_DEMOD_MAX_FILTER_LENGTH];
+    } lpf[2];
+
+    /* previous filtered sample */
+    int32_t prev_i;
+    int32_t prev_q;
+#else
+    /* selected kernel */
+    sstv_demod_kernel_t kernel;
+
+    /* oscillator phasor at block start, rotation for each of 8 lanes and
+       rotation per 8 samples */
+    float lo_base_cos;
+    float lo_base_sin;
+    float lo_cos[8];
+    float lo_sin[8];
+    float lo_step_cos;
+    float lo_step_sin;
+
+    /* pixel value = (phase delta - low) * scale */
+    float pixel_offset;
+    float pixel_scale;
+
+    /* low-pass FIR (both boxcars convolved) */
+    uint32_t taps;
+    float fir[SSTV_DEMOD_MAX_TAPS];
+
+    /* input block (quadrature component only used for complex input) */
+    float input[SSTV_DEMOD_BLOCK_LENGTH];
+    float input_q[SSTV_DEMOD_BLOCK_LENGTH];
+
+    /* mixed input, after the last (taps - 1) samples of the previous block */
+    float mix_i[SSTV_DEMOD_MAX_TAPS - 1 + SSTV_DEMOD_BLOCK_LENGTH];
+    float mix_q[SSTV_DEMOD_MAX_TAPS - 1 + SSTV_DEMOD_BLOCK_LENGTH];
+
+    /* filtered block, after the last sample of the previous one */
+    float filt_i[1 + SSTV_DEMOD_BLOCK_LENGTH];
+    float filt_q[1 + SSTV_DEMOD_BLOCK_LENGTH];
+#endif
+};
+
+/*
+ * Read one input sample, scaled to 16 bits.
+ */
+static inline int16_t
+sstv_demod_get_sample(const sstv_signal_t *signal, uint32_t idx)
+{
+    switch (signal->type) {
+        case SSTV_SAMPLE_INT8:
+            return (int16_t) (((int8_t *)signal->buffer)[idx] * 256);
+
+        case SSTV_SAMPLE_UINT8:
+            return (int16_t) ((((uint8_t *)signal->buffer)[idx] - 128) * 256);
+
+        case SSTV_SAMPLE_INT16:
+        default:
+            return ((int16_t *)signal->buffer)[idx];
+    }
+}
+
+/*
+ * Initialize demodulator for a given sample rate and pixel value mapping.
+ */
+extern sstv_error_t
+sstv_demod_init(sstv_demod_t *demod, uint32_t sample_rate, uint32_t pixel_low, uint32_t pixel_high);
+
+/*
+ * Switch to complex input, whose tones lie tone_offset Hz above their audio
+ * frequencies.
+ */
+extern sstv_error_t
+sstv_demod_set_iq(sstv_demod_t *demod, uint32_t sample_rate, int32_t tone_offset);
+
+/*
+ * Demodulate count (at most SSTV_DEMOD_BLOCK_LENGTH) samples of signal,
+ * starting at offset, into freq and pixel. Signal must be complex after
+ * sstv_demod_set_iq(), and real before.
+ */
+extern void
+sstv_demod_process(sstv_demod_t *demod, const sstv_signal_t *signal, uint32_t offset, uint32_t count,
+                   int32_t *freq, uint8_t *pixel);
+
+/*
+ * Group delay of the demodulator, in microsamples.
+ */
+extern uint64_t
+sstv_demod_delay_usamp(const sstv_demod_t *demod);
+
+/*
+ * Four-quadrant arctangent, in 2^32 units per turn. Arguments within +/-2^30.
+ */
+extern int32_t
+sstv_atan2(int32_t y, int32_t x);
+
+/*
+ * Sine and cosine of a phase in 2^32 units per turn, in Q30.
+ */
+extern void
+sstv_sincos(int32_t phase, int64_t *sin, int64_t *cos);
+
+/*
+ * Float kernels (mixing, low-pass, discriminator and pixel mapping of the
+ * block in demod->input)
+ */
+#ifndef SSTV_DECODER_FIXED_POINT
+extern void
+sstv_demod_kernel_scalar(sstv_demod_t *demod, uint32_t count, int32_t *freq, uint8_t *pixel);
+
+/* chosen at compile time; runtime CPU detection would pull in libgcc */
+#if defined(__x86_64__) && defined(__AVX2__) && defined(__FMA__)
+#define SSTV_DEMOD_HAVE_AVX2
+extern void
+sstv_demod_kernel_avx2(sstv_demod_t *demod, uint32_t count, int32_t *freq, uint8_t *pixel);
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define SSTV_DEMOD_HAVE_NEON
+extern void
+sstv_demod_kernel_neon(sstv_demod_t *demod, uint32_t count, int32_t *freq, uint8_t *pixel);
+#endif
+#endif
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "libsstv.h"
+#include "sstv.h"
+#include "demod.h"
+
+#ifdef SSTV_DEMOD_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef SSTV_DEMOD_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * Arctangent polynomial coefficients (minimax, odd powers up to 9, in 2^32
+ * units per turn)
+ */
+#define SSTV_ATANF_C1  683473678.0f
+#define SSTV_ATANF_C3 -225781269.0f
+#define SSTV_ATANF_C5  123138132.0f
+#define SSTV_ATANF_C7  -58193963.0f
+#define SSTV_ATANF_C9   14242151.0f
+
+#define SSTV_TURN_QUARTER 1073741824.0f
+#define SSTV_TURN_HALF    2147483648.0f
+#define SSTV_TURN_MAX     2147483520.0f /* largest float below half a turn */
+
+/*
+ * Kernels write outputs in groups of 8 and may go past count, up to
+ * SSTV_DEMOD_BLOCK_LENGTH.
+ */
+
+void
+sstv_demod_kernel_scalar(sstv_demod_t *demod, uint32_t count, int32_t *freq, uint8_t *pixel)
+{
+    uint32_t hist = demod->taps - 1;
+    float *mix_i = demod->mix_i + hist;
+    float *mix_q = demod->mix_q + hist;
+    float bc = demod->lo_base_cos;
+    float bs = demod->lo_base_sin;
+    uint32_t n, k;
+
+    /* mix down to baseband */
+    for (n = 0; n < count; n += 8) {
+        for (k = 0; k < 8 && n + k < count; k ++) {
+            float c = bc * demod->lo_cos[k] - bs * demod->lo_sin[k];
+            float s = bs * demod->lo_cos[k] + bc * demod->lo_sin[k];
+            if (demod->iq) {
+                mix_i[n + k] = demod->input[n + k] * c + demod->input_q[n + k] * s;
+                mix_q[n + k] = demod->input_q[n + k] * c - demod->input[n + k] * s;
+            } else {
+                mix_i[n + k] = demod->input[n + k] * c;
+                mix_q[n + k] = -demod->input[n + k] * s;
+            }
+        }
+
+        float nc = bc * demod->lo_step_cos - bs * demod->lo_step_sin;
+        bs = bs * demod->lo_step_cos + bc * demod->lo_step_sin;
+        bc = nc;
+    }
+
+    /* low-pass, tap by tap so the compiler can vectorize over samples */
+    {
+        float *restrict filt_i = demod->filt_i + 1;
+        float *restrict filt_q = demod->filt_q + 1;
+
+        for (n = 0; n < count; n ++) {
+            filt_i[n] = 0.0f;
+            filt_q[n] = 0.0f;
+        }
+        for (k = 0; k < demod->taps; k ++) {
+            const float h = demod->fir[k];
+            const float *restrict src_i = mix_i - k;
+            const float *restrict src_q = mix_q - k;
+            for (n = 0; n < count; n ++) {
+                filt_i[n] += h * src_i[n];
+                filt_q[n] += h * src_q[n];
+            }
+        }
+    }
+
+    /* polar discriminator and pixel mapping */
+    for (n = 0; n < count; n ++) {
+        float pi = demod->filt_i[n], pq = demod->filt_q[n];
+        float i = demod->filt_i[n + 1], q = demod->filt_q[n + 1];
+        float re = i * pi + q * pq;
+        float im = q * pi - i * pq;
+
+        float ax = (re < 0.0f ? -re : re);
+        float ay = (im < 0.0f ? -im : im);
+        float mn = (ax < ay ? ax : ay);
+        float mx = (ax < ay ? ay : ax);
+        float t = (mx > 0.0f ? mn / mx : 0.0f);
+        float t2 = t * t;
+        float a = SSTV_ATANF_C9;
+        a = SSTV_ATANF_C7 + a * t2;
+        a = SSTV_ATANF_C5 + a * t2;
+        a = SSTV_ATANF_C3 + a * t2;
+        a = SSTV_ATANF_C1 + a * t2;
+        a = a * t;
+
+        if (ay > ax) {
+            a = SSTV_TURN_QUARTER - a;
+        }
+        if (re < 0.0f) {
+            a = SSTV_TURN_HALF - a;
+        }
+        if (im < 0.0f) {
+            a = -a;
+        }
+        a = (a > SSTV_TURN_MAX ? SSTV_TURN_MAX : (a < -SSTV_TURN_MAX ? -SSTV_TURN_MAX : a));
+
+        freq[n] = demod->freq_base + (int32_t) a;
+
+        float v = (a + demod->pixel_offset) * demod->pixel_scale;
+        v = (v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v));
+        pixel[n] = (uint8_t) (v + 0.5f);
+    }
+}
+
+#ifdef SSTV_DEMOD_HAVE_AVX2
+
+void
+sstv_demod_kernel_avx2(sstv_demod_t *demod, uint32_t count, int32_t *freq, uint8_t *pixel)
+{
+    uint32_t hist = demod->taps - 1;
+    float *mix_i = demod->mix_i + hist;
+    float *mix_q = demod->mix_q + hist;
+    float bc = demod->lo_base_cos;
+    float bs = demod->lo_base_sin;
+    uint32_t n, k;
+
+    const __m256 lane_c = _mm256_loadu_ps(demod->lo_cos);
+    const __m256 lane_s = _mm256_loadu_ps(demod->lo_sin);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+
+    /* mix down to baseband */
+    for (n = 0; n < count; n += 8) {
+        __m256 vbc = _mm256_set1_ps(bc), vbs = _mm256_set1_ps(bs);
+        __m256 c = _mm256_fmsub_ps(vbc, lane_c, _mm256_mul_ps(vbs, lane_s));
+        __m256 s = _mm256_fmadd_ps(vbs, lane_c, _mm256_mul_ps(vbc, lane_s));
+        __m256 x = _mm256_loadu_ps(demod->input + n);
+        if (demod->iq) {
+            __m256 y = _mm256_loadu_ps(demod->input_q + n);
+            _mm256_storeu_ps(mix_i + n, _mm256_fmadd_ps(x, c, _mm256_mul_ps(y, s)));
+            _mm256_storeu_ps(mix_q + n, _mm256_fmsub_ps(y, c, _mm256_mul_ps(x, s)));
+        } else {
+            _mm256_storeu_ps(mix_i + n, _mm256_mul_ps(x, c));
+            _mm256_storeu_ps(mix_q + n, _mm256_xor_ps(_mm256_mul_ps(x, s), sign));
+        }
+
+        float nc = bc * demod->lo_step_cos - bs * demod->lo_step_sin;
+        bs = bs * demod->lo_step_cos + bc * demod->lo_step_sin;
+        bc = nc;
+    }
+
+    /* low-pass */
+    for (n = 0; n < count; n += 8) {
+        __m256 acc_i = _mm256_setzero_ps(), acc_q = _mm256_setzero_ps();
+        for (k = 0; k < demod->taps; k ++) {
+            __m256 h = _mm256_broadcast_ss(demod->fir + k);
+            acc_i = _mm256_fmadd_ps(h, _mm256_loadu_ps(mix_i + n - k), acc_i);
+            acc_q = _mm256_fmadd_ps(h, _mm256_loadu_ps(mix_q + n - k), acc_q);
+        }
+        _mm256_storeu_ps(demod->filt_i + 1 + n, acc_i);
+        _mm256_storeu_ps(demod->filt_q + 1 + n, acc_q);
+    }
+
+    /* polar discriminator and pixel mapping */
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 tiny = _mm256_set1_ps(1e-30f);
+    const __m256 quarter = _mm256_set1_ps(SSTV_TURN_QUARTER);
+    const __m256 half = _mm256_set1_ps(SSTV_TURN_HALF);
+    const __m256 tmax = _mm256_set1_ps(SSTV_TURN_MAX);
+    const __m256 hi = _mm256_set1_ps(255.0f);
+    const __m256 offset = _mm256_set1_ps(demod->pixel_offset);
+    const __m256 scale = _mm256_set1_ps(demod->pixel_scale);
+    const __m256i delta = _mm256_set1_epi32(demod->freq_base);
+
+    for (n = 0; n < count; n += 8) {
+        __m256 pi = _mm256_loadu_ps(demod->filt_i + n), pq = _mm256_loadu_ps(demod->filt_q + n);
+        __m256 i = _mm256_loadu_ps(demod->filt_i + n + 1), q = _mm256_loadu_ps(demod->filt_q + n + 1);
+        __m256 re = _mm256_fmadd_ps(i, pi, _mm256_mul_ps(q, pq));
+        __m256 im = _mm256_fmsub_ps(q, pi, _mm256_mul_ps(i, pq));
+
+        __m256 ax = _mm256_andnot_ps(sign, re);
+        __m256 ay = _mm256_andnot_ps(sign, im);
+        __m256 mn = _mm256_min_ps(ax, ay);
+        __m256 mx = _mm256_max_ps(_mm256_max_ps(ax, ay), tiny);
+        __m256 t = _mm256_div_ps(mn, mx);
+        __m256 t2 = _mm256_mul_ps(t, t);
+        __m256 a = _mm256_set1_ps(SSTV_ATANF_C9);
+        a = _mm256_fmadd_ps(a, t2, _mm256_set1_ps(SSTV_ATANF_C7));
+        a = _mm256_fmadd_ps(a, t2, _mm256_set1_ps(SSTV_ATANF_C5));
+        a = _mm256_fmadd_ps(a, t2, _mm256_set1_ps(SSTV_ATANF_C3));
+        a = _mm256_fmadd_ps(a, t2, _mm256_set1_ps(SSTV_ATANF_C1));
+        a = _mm256_mul_ps(a, t);
+
+        a = _mm256_blendv_ps(a, _mm256_sub_ps(quarter, a), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+        a = _mm256_blendv_ps(a, _mm256_sub_ps(half, a), _mm256_cmp_ps(re, zero, _CMP_LT_OQ));
+        a = _mm256_xor_ps(a, _mm256_and_ps(im, sign));
+        a = _mm256_max_ps(_mm256_min_ps(a, tmax), _mm256_sub_ps(zero, tmax));
+
+        _mm256_storeu_si256((__m256i *)(freq + n), _mm256_add_epi32(delta, _mm256_cvttps_epi32(a)));
+
+        __m256 v = _mm256_mul_ps(_mm256_add_ps(a, offset), scale);
+        v = _mm256_max_ps(_mm256_min_ps(v, hi), zero);
+        __m256i pv = _mm256_cvtps_epi32(v);
+        __m128i p16 = _mm_packs_epi32(_mm256_castsi256_si128(pv), _mm256_extracti128_si256(pv, 1));
+        _mm_storel_epi64((__m128i *)(pixel + n), _mm_packus_epi16(p16, p16));
+    }
+}
+
+#endif
+
+#ifdef SSTV_DEMOD_HAVE_NEON
+
+void
+sstv_demod_kernel_neon(sstv_demod_t *demod, uint32_t count, int32_t *freq, uint8_t *pixel)
+{
+    uint32_t hist = demod->taps - 1;
+    float *mix_i = demod->mix_i + hist;
+    float *mix_q = demod->mix_q + hist;
+    float bc = demod->lo_base_cos;
+    float bs = demod->lo_base_sin;
+    uint32_t n, k, h;
+
+    /* mix down to baseband, as two groups of 4 lanes */
+    for (n = 0; n < count; n += 8) {
+        for (h = 0; h < 8; h += 4) {
+            float32x4_t lane_c = vld1q_f32(demod->lo_cos + h);
+            float32x4_t lane_s = vld1q_f32(demod->lo_sin + h);
+            float32x4_t c = vmlsq_n_f32(vmulq_n_f32(lane_c, bc), lane_s, bs);
+            float32x4_t s = vmlaq_n_f32(vmulq_n_f32(lane_c, bs), lane_s, bc);
+            float32x4_t x = vld1q_f32(demod->input + n + h);
+            if (demod->iq) {
+                float32x4_t y = vld1q_f32(demod->input_q + n + h);
+                vst1q_f32(mix_i + n + h, vfmaq_f32(vmulq_f32(y, s), x, c));
+                vst1q_f32(mix_q + n + h, vfmsq_f32(vmulq_f32(y, c), x, s));
+            } else {
+                vst1q_f32(mix_i + n + h, vmulq_f32(x, c));
+                vst1q_f32(mix_q + n + h, vnegq_f32(vmulq_f32(x, s)));
+            }
+        }
+
+        float nc = bc * demod->lo_step_cos - bs * demod->lo_step_sin;
+        bs = bs * demod->lo_step_cos + bc * demod->lo_step_sin;
+        bc = nc;
+    }
+
+    /* low-pass */
+    for (n = 0; n < count; n += 4) {
+        float32x4_t acc_i = vdupq_n_f32(0.0f), acc_q = vdupq_n_f32(0.0f);
+        for (k = 0; k < demod->taps; k ++) {
+            acc_i = vfmaq_n_f32(acc_i, vld1q_f32(mix_i + n - k), demod->fir[k]);
+            acc_q = vfmaq_n_f32(acc_q, vld1q_f32(mix_q + n - k), demod->fir[k]);
+        }
+        vst1q_f32(demod->filt_i + 1 + n, acc_i);
+        vst1q_f32(demod->filt_q + 1 + n, acc_q);
+    }
+
+    /* polar discriminator and pixel mapping */
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t tiny = vdupq_n_f32(1e-30f);
+    const float32x4_t quarter = vdupq_n_f32(SSTV_TURN_QUARTER);
+    const float32x4_t half = vdupq_n_f32(SSTV_TURN_HALF);
+    const float32x4_t tmax = vdupq_n_f32(SSTV_TURN_MAX);
+    const float32x4_t hi = vdupq_n_f32(255.0f);
+    const float32x4_t offset = vdupq_n_f32(demod->pixel_offset);
+    const float32x4_t scale = vdupq_n_f32(demod->pixel_scale);
+    const int32x4_t delta = vdupq_n_s32(demod->freq_base);
+
+    for (n = 0; n < count; n += 8) {
+        uint32x4_t pv[2];
+
+        for (h = 0; h < 8; h += 4) {
+            float32x4_t pi = vld1q_f32(demod->filt_i + n + h), pq = vld1q_f32(demod->filt_q + n + h);
+            float32x4_t i = vld1q_f32(demod->filt_i + n + h + 1), q = vld1q_f32(demod->filt_q + n + h + 1);
+            float32x4_t re = vfmaq_f32(vmulq_f32(q, pq), i, pi);
+            float32x4_t im = vfmsq_f32(vmulq_f32(q, pi), i, pq);
+
+            float32x4_t ax = vabsq_f32(re);
+            float32x4_t ay = vabsq_f32(im);
+            float32x4_t mn = vminq_f32(ax, ay);
+            float32x4_t mx = vmaxq_f32(vmaxq_f32(ax, ay), tiny);
+            float32x4_t t = vdivq_f32(mn, mx);
+            float32x4_t t2 = vmulq_f32(t, t);
+            float32x4_t a = vdupq_n_f32(SSTV_ATANF_C9);
+            a = vfmaq_f32(vdupq_n_f32(SSTV_ATANF_C7), a, t2);
+            a = vfmaq_f32(vdupq_n_f32(SSTV_ATANF_C5), a, t2);
+            a = vfmaq_f32(vdupq_n_f32(SSTV_ATANF_C3), a, t2);
+            a = vfmaq_f32(vdupq_n_f32(SSTV_ATANF_C1), a, t2);
+            a = vmulq_f32(a, t);
+
+            a = vbslq_f32(vcgtq_f32(ay, ax), vsubq_f32(quarter, a), a);
+            a = vbslq_f32(vcltq_f32(re, zero), vsubq_f32(half, a), a);
+            a = vbslq_f32(vcltq_f32(im, zero), vnegq_f32(a), a);
+            a = vmaxq_f32(vminq_f32(a, tmax), vnegq_f32(tmax));
+
+            vst1q_s32(freq + n + h, vaddq_s32(delta, vcvtq_s32_f32(a)));
+
+            float32x4_t v = vmulq_f32(vaddq_f32(a, offset), scale);
+            v = vmaxq_f32(vminq_f32(v, hi), zero);
+            pv[h / 4] = vcvtnq_u32_f32(v);
+        }
+
+        uint16x8_t p16 = vcombine_u16(vmovn_u32(pv[0]), vmovn_u32(pv[1]));
+        vst1_u8(pixel + n, vmovn_u16(p16));
+    }
+}
+
+#endif
@@ -8,6 +8,7 @@
 #include "sstv.h"
 #include "libsstv.h"
 #include "luts.h"
+#include "encoder.h"
 
 /*
  * FSK helpers
@@ -24,101 +25,149 @@
     }
 
 /*
- * Encoder state
+ * Default encoder contexts, for when no allocation/deallocation routines are provided
  */
-typedef enum {
-    /* start of coding */
-    SSTV_ENCODER_STATE_START,
-
-    /* transmission header */
-    SSTV_ENCODER_STATE_LEADER_TONE_1,
-    SSTV_ENCODER_STATE_BREAK,
-    SSTV_ENCODER_STATE_LEADER_TONE_2,
-
-    /* VIS */
-    SSTV_ENCODER_STATE_VIS_START_BIT,
-    SSTV_ENCODER_STATE_VIS_BIT,
-    SSTV_ENCODER_STATE_VIS_STOP_BIT,
-
-    /* sync and porch */
-    SSTV_ENCODER_STATE_SYNC,
-    SSTV_ENCODER_STATE_SYNC_FIRST,
-    SSTV_ENCODER_STATE_PORCH,
-    SSTV_ENCODER_STATE_PORCH2,
-    SSTV_ENCODER_STATE_PORCH_R,
-    SSTV_ENCODER_STATE_PORCH_G,
-    SSTV_ENCODER_STATE_PORCH_B,
-    SSTV_ENCODER_STATE_PORCH_BY,
-    SSTV_ENCODER_STATE_PORCH_RY,
-
-    /* separator */
-    SSTV_ENCODER_STATE_SEPARATOR,
-    SSTV_ENCODER_STATE_SEPARATOR2,
-    SSTV_ENCODER_STATE_SEPARATOR_BY,
-    SSTV_ENCODER_STATE_SEPARATOR_RY,
-
-    /* scan */
-    SSTV_ENCODER_STATE_Y_SCAN,
-    SSTV_ENCODER_STATE_Y_ODD_SCAN,
-    SSTV_ENCODER_STATE_Y_EVEN_SCAN,
-    SSTV_ENCODER_STATE_RY_SCAN,
-    SSTV_ENCODER_STATE_BY_SCAN,
-
-    SSTV_ENCODER_STATE_R_SCAN,
-    SSTV_ENCODER_STATE_G_SCAN,
-    SSTV_ENCODER_STATE_B_SCAN,
-
-    /* end of coding */
-    SSTV_ENCODER_STATE_END
-} sstv_encoder_state_t;
+static sstv_encoder_context_t default_encoder_context[SSTV_DEFAULT_ENCODER_CONTEXT_COUNT];
+static uint64_t default_encoder_context_usage = 0x0;
 
-/*
- * Encoder context
- */
-typedef struct {
-    /* input image */
-    sstv_image_t image;
-
-    /* output configuration */
-    sstv_mode_t mode;
-    uint32_t sample_rate;
-
-    /* current state */
-    sstv_encoder_state_t state;
-
-    /* current FSK value to be written */
-    struct {
-        uint32_t phase;
-        uint32_t phase_delta;
-        uint64_t remaining_usamp;
-    } fsk;
-
-    /* mode timings */
-    sstv_mode_descriptor_t descriptor;
-
-    /* state extra info */
-    union {
-        struct {
-            uint8_t visp;
-            uint8_t curr_bit;
-        } vis;
-
-        struct {
-            uint32_t curr_line;
-            uint32_t curr_col;
-        } scan;
-    } extra;
-} sstv_encoder_context_t;
 
 /*
- * Default encoder contexts, for when no allocation/deallocation routines are provided
+ * Segment class of each state, for statistics
  */
-static sstv_encoder_context_t default_encoder_context[SSTV_DEFAULT_ENCODER_CONTEXT_COUNT];
-static uint64_t default_encoder_context_usage = 0x0;
+static const uint8_t SSTV_ENCODER_STATE_CLASS[SSTV_ENCODER_STATE_END + 1] = {
+    [SSTV_ENCODER_STATE_START] = SSTV_SEGMENT_HEADER,
+    [SSTV_ENCODER_STATE_LEADER_TONE_1] = SSTV_SEGMENT_HEADER,
+    [SSTV_ENCODER_STATE_BREAK] = SSTV_SEGMENT_HEADER,
+    [SSTV_ENCODER_STATE_LEADER_TONE_2] = SSTV_SEGMENT_HEADER,
+    [SSTV_ENCODER_STATE_VIS_START_BIT] = SSTV_SEGMENT_VIS,
+    [SSTV_ENCODER_STATE_VIS_BIT] = SSTV_SEGMENT_VIS,
+    [SSTV_ENCODER_STATE_VIS_STOP_BIT] = SSTV_SEGMENT_VIS,
+    [SSTV_ENCODER_STATE_SYNC] = SSTV_SEGMENT_SYNC,
+    [SSTV_ENCODER_STATE_SYNC_FIRST] = SSTV_SEGMENT_SYNC,
+    [SSTV_ENCODER_STATE_PORCH] = SSTV_SEGMENT_PORCH,
+    [SSTV_ENCODER_STATE_PORCH2] = SSTV_SEGMENT_PORCH,
+    [SSTV_ENCODER_STATE_PORCH_R] = SSTV_SEGMENT_PORCH,
+    [SSTV_ENCODER_STATE_PORCH_G] = SSTV_SEGMENT_PORCH,
+    [SSTV_ENCODER_STATE_PORCH_B] = SSTV_SEGMENT_PORCH,
+    [SSTV_ENCODER_STATE_PORCH_BY] = SSTV_SEGMENT_PORCH,
+    [SSTV_ENCODER_STATE_PORCH_RY] = SSTV_SEGMENT_PORCH,
+    [SSTV_ENCODER_STATE_SEPARATOR] = SSTV_SEGMENT_SEPARATOR,
+    [SSTV_ENCODER_STATE_SEPARATOR2] = SSTV_SEGMENT_SEPARATOR,
+    [SSTV_ENCODER_STATE_SEPARATOR_BY] = SSTV_SEGMENT_SEPARATOR,
+    [SSTV_ENCODER_STATE_SEPARATOR_RY] = SSTV_SEGMENT_SEPARATOR,
+    [SSTV_ENCODER_STATE_Y_SCAN] = SSTV_SEGMENT_PIXEL,
+    [SSTV_ENCODER_STATE_Y_ODD_SCAN] = SSTV_SEGMENT_PIXEL,
+    [SSTV_ENCODER_STATE_Y_EVEN_SCAN] = SSTV_SEGMENT_PIXEL,
+    [SSTV_ENCODER_STATE_RY_SCAN] = SSTV_SEGMENT_PIXEL,
+    [SSTV_ENCODER_STATE_BY_SCAN] = SSTV_SEGMENT_PIXEL,
+    [SSTV_ENCODER_STATE_R_SCAN] = SSTV_SEGMENT_PIXEL,
+    [SSTV_ENCODER_STATE_G_SCAN] = SSTV_SEGMENT_PIXEL,
+    [SSTV_ENCODER_STATE_B_SCAN] = SSTV_SEGMENT_PIXEL,
+    [SSTV_ENCODER_STATE_END] = SSTV_SEGMENT_HEADER,
+};
 
 
-sstv_error_t
-sstv_create_encoder(void **out_ctx, sstv_image_t image, sstv_mode_t mode, uint32_t sample_rate)
+static sstv_error_t
+sstv_encoder_check_image(sstv_image_t image, sstv_mode_t mode)
+{
+    uint32_t w, h;
+    sstv_image_format_t fmt;
+    sstv_error_t rc;
+
+    rc = sstv_get_mode_image_props(mode, &w, &h, &fmt);
+    if (rc != SSTV_OK) {
+        return rc;
+    }
+    if (w != image.width || h != image.height) {
+        return SSTV_BAD_RESOLUTION;
+    }
+    if (fmt != image.format) {
+        return SSTV_BAD_FORMAT;
+    }
+
+    return SSTV_OK;
+}
+
+static void
+sstv_encoder_reset_state(sstv_encoder_context_t *ctx)
+{
+    ctx->state = SSTV_ENCODER_STATE_START;
+    ctx->fsk.remaining_usamp = 0; /* so we get initial state change */
+    ctx->isr.head = 0;
+    ctx->isr.tail = 0;
+    ctx->isr.end = 0;
+    ctx->isr.count = 0;
+#ifdef SSTV_TRACE_HOOKS
+    ctx->trace_line = 0xffffffff;
+#endif
+}
+
+static void
+sstv_encoder_reset_stats(sstv_encoder_context_t *ctx)
+{
+    uint32_t i;
+
+    ctx->stats.counters.samples = 0;
+    ctx->stats.counters.encode_calls = 0;
+    for (i = 0; i < SSTV_SEGMENT_CLASS_COUNT; i ++) {
+        ctx->stats.counters.transitions[i] = 0;
+    }
+    ctx->stats.counters.segments = 0;
+    ctx->stats.counters.segment_min_samples = 0xffffffff;
+    ctx->stats.counters.segment_max_samples = 0;
+    ctx->stats.counters.segment_avg_samples = 0;
+    ctx->stats.counters.state_cycles = 0;
+    ctx->stats.counters.synthesis_cycles = 0;
+    ctx->stats.segment_start = 0;
+    ctx->stats.segment_samples = 0;
+}
+
+static void
+sstv_encoder_count_transition(sstv_encoder_context_t *ctx)
+{
+    if (ctx->state != SSTV_ENCODER_STATE_END) {
+        ctx->stats.counters.transitions[SSTV_ENCODER_STATE_CLASS[ctx->state]] ++;
+    }
+}
+
+#ifdef SSTV_TRACE_HOOKS
+static void
+sstv_encoder_trace_line(sstv_encoder_context_t *ctx)
+{
+    /* lines change on their sync pulse, past the VIS */
+    if (ctx->state == SSTV_ENCODER_STATE_END) {
+        if (ctx->trace_line != 0xffffffff) {
+            SSTV_TRACE_END(SSTV_TRACE_LINE, ctx->trace_line);
+            ctx->trace_line = 0xffffffff;
+        }
+    } else if (ctx->state > SSTV_ENCODER_STATE_VIS_STOP_BIT
+               && ctx->extra.scan.curr_line != ctx->trace_line) {
+        if (ctx->trace_line != 0xffffffff) {
+            SSTV_TRACE_END(SSTV_TRACE_LINE, ctx->trace_line);
+        }
+        ctx->trace_line = ctx->extra.scan.curr_line;
+        SSTV_TRACE_BEGIN(SSTV_TRACE_LINE, ctx->trace_line);
+    }
+}
+#else
+#define sstv_encoder_trace_line(ctx)
+#endif
+
+static void
+sstv_encoder_count_segment(sstv_encoder_context_t *ctx, uint64_t samples)
+{
+    ctx->stats.counters.segments ++;
+    ctx->stats.segment_samples += samples;
+    if (samples < ctx->stats.counters.segment_min_samples) {
+        ctx->stats.counters.segment_min_samples = (uint32_t) samples;
+    }
+    if (samples > ctx->stats.counters.segment_max_samples) {
+        ctx->stats.counters.segment_max_samples = (uint32_t) samples;
+    }
+}
+
+static sstv_error_t
+sstv_create_encoder_context(void **out_ctx, sstv_image_t image, sstv_mode_t mode, uint32_t sample_rate)
 {
     sstv_encoder_context_t *ctx = NULL;
 
@@ -129,20 +178,10 @@ sstv_create_encoder(void **out_ctx, sstv_image_t image, sstv_mode_t mode, uint32
 
     /* check image properties */
     {
-        uint32_t w, h;
-        sstv_image_format_t fmt;
-        sstv_error_t rc;
-
-        rc = sstv_get_mode_image_props(mode, &w, &h, &fmt);
+        sstv_error_t rc = sstv_encoder_check_image(image, mode);
         if (rc != SSTV_OK) {
             return rc;
         }
-        if (w != image.width || h != image.height) {
-            return SSTV_BAD_RESOLUTION;
-        }
-        if (fmt != image.format) {
-            return SSTV_BAD_FORMAT;
-        }
     }
 
     /* create context */
@@ -171,17 +210,15 @@ sstv_create_encoder(void **out_ctx, sstv_image_t image, sstv_mode_t mode, uint32
     ctx->image = image;
     ctx->mode = mode;
     ctx->sample_rate = sample_rate;
-    ctx->state = SSTV_ENCODER_STATE_START;
     ctx->fsk.phase = 0; /* start nicely from zero */
-    ctx->fsk.remaining_usamp = 0; /* so we get initial state change */
+    sstv_encoder_reset_state(ctx);
+    sstv_encoder_reset_stats(ctx);
 
     /* initialize mode timings */
     {
         sstv_error_t rc = sstv_get_mode_descriptor(mode, sample_rate, &ctx->descriptor);
         if (rc != SSTV_OK) {
-            if (sstv_free_user) {
-                sstv_free_user(ctx);
-            }
+            sstv_delete_encoder(ctx);
             return rc;
         }
     }
@@ -193,6 +230,18 @@ sstv_create_encoder(void **out_ctx, sstv_image_t image, sstv_mode_t mode, uint32
     return SSTV_OK;
 }
 
+sstv_error_t
+sstv_create_encoder(void **out_ctx, sstv_image_t image, sstv_mode_t mode, uint32_t sample_rate)
+{
+    sstv_error_t rc;
+
+    SSTV_TRACE_BEGIN(SSTV_TRACE_CREATE_ENCODER, mode);
+    rc = sstv_create_encoder_context(out_ctx, image, mode, sample_rate);
+    SSTV_TRACE_END(SSTV_TRACE_CREATE_ENCODER, mode);
+
+    return rc;
+}
+
 sstv_error_t
 sstv_delete_encoder(void *ctx)
 {
@@ -223,6 +272,45 @@ sstv_delete_encoder(void *ctx)
     return SSTV_OK;
 }
 
+sstv_error_t
+sstv_encoder_reset(void *ctx, uint8_t keep_phase)
+{
+    sstv_encoder_context_t *context = (sstv_encoder_context_t *)ctx;
+
+    if (!context) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* descriptor is kept, only the position is reset */
+    if (!keep_phase) {
+        context->fsk.phase = 0;
+    }
+    sstv_encoder_reset_state(context);
+    sstv_encoder_reset_stats(context);
+
+    /* all ok */
+    return SSTV_OK;
+}
+
+sstv_error_t
+sstv_encoder_rebind(void *ctx, sstv_image_t image, uint8_t keep_phase)
+{
+    sstv_encoder_context_t *context = (sstv_encoder_context_t *)ctx;
+
+    if (!context) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* new image must fit the context's mode */
+    sstv_error_t rc = sstv_encoder_check_image(image, context->mode);
+    if (rc != SSTV_OK) {
+        return rc;
+    }
+
+    context->image = image;
+    return sstv_encoder_reset(context, keep_phase);
+}
+
 static sstv_error_t
 sstv_encode_bw_state_change(sstv_encoder_context_t *context)
 {
@@ -737,7 +825,7 @@ sstv_encode_pd_state_change(sstv_encoder_context_t *context)
     /* advance line (odd->sync) */
     if ((context->state == SSTV_ENCODER_STATE_Y_ODD_SCAN)
         && (context->extra.scan.curr_col >= context->image.width)
-        && (context->extra.scan.curr_line < context->image.height-1))
+        && (context->extra.scan.curr_line + 2 < context->image.height))
     {
         context->state = SSTV_ENCODER_STATE_SYNC;
         context->extra.scan.curr_line += 2;
@@ -839,7 +927,7 @@ sstv_encode_pd_state_change(sstv_encoder_context_t *context)
     return SSTV_OK;
 }
 
-static sstv_error_t
+sstv_error_t
 sstv_encode_state_change(sstv_encoder_context_t *context)
 {
     /* leader tone #1 */
@@ -967,30 +1055,263 @@ sstv_encode_state_change(sstv_encoder_context_t *context)
     }
 }
 
+/*
+ * Closes the segment just played and advances to the next one; position is
+ * the index of the next sample to be written
+ */
+static sstv_error_t
+sstv_encode_advance(sstv_encoder_context_t *context, uint64_t position)
+{
+    sstv_error_t rc;
+
+    /* close the segment just played */
+    if (context->state != SSTV_ENCODER_STATE_START && context->state != SSTV_ENCODER_STATE_END) {
+        sstv_encoder_count_segment(context, position - context->stats.segment_start);
+    }
+
+#ifdef SSTV_ENCODER_CYCLE_STATS
+    uint64_t start = sstv_cycles();
+    rc = sstv_encode_state_change(context);
+    context->stats.counters.state_cycles += sstv_cycles() - start;
+#else
+    rc = sstv_encode_state_change(context);
+#endif
+    if (rc != SSTV_OK) {
+        return rc;
+    }
+    context->stats.segment_start = position;
+    sstv_encoder_count_transition(context);
+    sstv_encoder_trace_line(context);
+
+    /* end of encoding? */
+    if (context->state == SSTV_ENCODER_STATE_END) {
+        return SSTV_ENCODE_END;
+    }
+
+    /* make sure we don't skip a state */
+    if (context->fsk.remaining_usamp < 1000000) {
+        /* this should not happen for a proper sample rate */
+        return SSTV_INTERNAL_ERROR;
+    }
+
+    return SSTV_OK;
+}
+
+/*
+ * Writes count samples of the current segment (count must not exceed the
+ * whole samples left in the segment, nor the free space in signal)
+ */
+static void
+sstv_encode_run(sstv_encoder_context_t *context, sstv_signal_t *signal, uint32_t count)
+{
+    uint32_t phase = context->fsk.phase;
+    uint32_t phase_delta = context->fsk.phase_delta;
+    uint32_t i;
+
+    context->fsk.remaining_usamp -= (uint64_t) count * 1000000;
+    switch(signal->type) {
+        case SSTV_SAMPLE_INT8:
+            {
+                int8_t *out = (int8_t *)signal->buffer + signal->count;
+                for (i = 0; i < count; i ++) {
+                    phase += phase_delta;
+                    out[i] = SSTV_SIN_INT10_INT8[phase >> 22];
+                }
+            }
+            break;
+
+        case SSTV_SAMPLE_UINT8:
+            {
+                uint8_t *out = (uint8_t *)signal->buffer + signal->count;
+                for (i = 0; i < count; i ++) {
+                    phase += phase_delta;
+                    out[i] = SSTV_SIN_INT10_UINT8[phase >> 22];
+                }
+            }
+            break;
+
+        case SSTV_SAMPLE_INT16:
+        default:
+            {
+                int16_t *out = (int16_t *)signal->buffer + signal->count;
+                for (i = 0; i < count; i ++) {
+                    phase += phase_delta;
+                    out[i] = SSTV_SIN_INT10_INT16[phase >> 22];
+                }
+            }
+            break;
+    }
+    context->fsk.phase = phase;
+    signal->count += count;
+}
+
+/*
+ * Whole samples left in the current segment that also fit in signal
+ */
+static uint32_t
+sstv_encode_run_length(sstv_encoder_context_t *context, sstv_signal_t *signal)
+{
+    uint64_t count = context->fsk.remaining_usamp / 1000000;
+    uint32_t space = signal->capacity - signal->count;
+
+    return (count < space ? (uint32_t) count : space);
+}
+
+static sstv_error_t
+sstv_encode_loop(sstv_encoder_context_t *context, sstv_signal_t *signal)
+{
+    sstv_error_t rc;
+
+    /* main encoding loop, one segment (or what fits of it) per iteration */
+    while (1) {
+        /* state change? */
+        if (context->fsk.remaining_usamp < 1000000) {
+            rc = sstv_encode_advance(context, context->stats.counters.samples + signal->count);
+            if (rc != SSTV_OK) {
+                return rc;
+            }
+            continue;
+        }
+
+        /* end of buffer? */
+        if (signal->count == signal->capacity) {
+            return SSTV_ENCODE_SUCCESSFUL;
+        }
+
+        sstv_encode_run(context, signal, sstv_encode_run_length(context, signal));
+    }
+}
+
+static sstv_error_t
+sstv_encode_loop_budget(sstv_encoder_context_t *context, sstv_signal_t *signal, uint32_t *budget)
+{
+    sstv_error_t rc;
+
+    /* same as sstv_encode_loop(), with every state change and sample paid for */
+    while (1) {
+        /* state change? */
+        if (context->fsk.remaining_usamp < 1000000) {
+            if (*budget == 0) {
+                return SSTV_ENCODE_BUDGET_EXHAUSTED;
+            }
+            (*budget) --;
+
+            rc = sstv_encode_advance(context, context->stats.counters.samples + signal->count);
+            if (rc != SSTV_OK) {
+                return rc;
+            }
+            continue;
+        }
+
+        /* end of buffer? */
+        if (signal->count == signal->capacity) {
+            return SSTV_ENCODE_SUCCESSFUL;
+        }
+
+        /* work budget spent? */
+        if (*budget == 0) {
+            return SSTV_ENCODE_BUDGET_EXHAUSTED;
+        }
+
+        uint32_t count = sstv_encode_run_length(context, signal);
+        if (count > *budget) {
+            count = *budget;
+        }
+        (*budget) -= count;
+        sstv_encode_run(context, signal, count);
+    }
+}
+
+static sstv_error_t
+sstv_encode_internal(sstv_encoder_context_t *context, sstv_signal_t *signal, uint32_t *budget)
+{
+#ifdef SSTV_ENCODER_CYCLE_STATS
+    uint64_t start = sstv_cycles();
+    uint64_t state_cycles = context->stats.counters.state_cycles;
+#endif
+
+    /* reset signal container */
+    signal->count = 0;
+    if (signal->type != SSTV_SAMPLE_INT8 && signal->type != SSTV_SAMPLE_UINT8 && signal->type != SSTV_SAMPLE_INT16) {
+        return SSTV_BAD_SAMPLE_TYPE;
+    }
+
+    SSTV_TRACE_BEGIN(SSTV_TRACE_ENCODE, signal->capacity);
+    sstv_error_t rc = (budget ? sstv_encode_loop_budget(context, signal, budget) : sstv_encode_loop(context, signal));
+    SSTV_TRACE_END(SSTV_TRACE_ENCODE, signal->count);
+
+    /* sample count is only updated once per call */
+    context->stats.counters.samples += signal->count;
+    context->stats.counters.encode_calls ++;
+
+#ifdef SSTV_ENCODER_CYCLE_STATS
+    context->stats.counters.synthesis_cycles +=
+        (sstv_cycles() - start) - (context->stats.counters.state_cycles - state_cycles);
+#endif
+
+    return rc;
+}
+
 sstv_error_t
 sstv_encode(void *ctx, sstv_signal_t *signal)
 {
-    sstv_error_t rc;
     sstv_encoder_context_t *context = (sstv_encoder_context_t *)ctx;
 
     if (!context || !signal) {
         return SSTV_BAD_PARAMETER;
     }
 
-    /* reset signal container */
-    signal->count = 0;
+    return sstv_encode_internal(context, signal, NULL);
+}
 
-    /* main encoding loop */
-    while (1) {
-        /* state change? */
+sstv_error_t
+sstv_encode_budget(void *ctx, sstv_signal_t *signal, uint32_t budget)
+{
+    sstv_encoder_context_t *context = (sstv_encoder_context_t *)ctx;
+
+    if (!context || !signal) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    return sstv_encode_internal(context, signal, &budget);
+}
+
+sstv_error_t
+sstv_encode_refill(void *ctx)
+{
+    sstv_error_t rc;
+    sstv_encoder_context_t *context = (sstv_encoder_context_t *)ctx;
+
+    if (!context) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* queue fill loop (head is only written here) */
+    uint32_t head = context->isr.head;
+    while (head - SSTV_ATOMIC_LOAD(&context->isr.tail) < SSTV_ENCODER_ISR_QUEUE_LENGTH) {
+        /* all segments already queued? */
+        if (context->isr.end) {
+            return SSTV_ENCODE_END;
+        }
+
+        /* advance to next segment, unless resuming in the middle of one */
         if (context->fsk.remaining_usamp < 1000000) {
+#ifdef SSTV_ENCODER_CYCLE_STATS
+            uint64_t start = sstv_cycles();
             rc = sstv_encode_state_change(context);
+            context->stats.counters.state_cycles += sstv_cycles() - start;
+#else
+            rc = sstv_encode_state_change(context);
+#endif
             if (rc != SSTV_OK) {
                 return rc;
             }
+            sstv_encoder_count_transition(context);
+            sstv_encoder_trace_line(context);
 
             /* end of encoding? */
             if (context->state == SSTV_ENCODER_STATE_END) {
+                SSTV_ATOMIC_STORE(&context->isr.end, 1);
                 return SSTV_ENCODE_END;
             }
 
@@ -999,34 +1320,400 @@ sstv_encode(void *ctx, sstv_signal_t *signal)
                 /* this should not happen for a proper sample rate */
                 return SSTV_INTERNAL_ERROR;
             }
-
-            continue;
         }
 
-        /* end of buffer? */
-        if (signal->count == signal->capacity) {
-            return SSTV_ENCODE_SUCCESSFUL;
+        /* whole samples go in the segment, the remainder carries over */
+        uint64_t count = context->fsk.remaining_usamp / 1000000;
+        context->fsk.remaining_usamp -= count * 1000000;
+
+        uint32_t idx = head & (SSTV_ENCODER_ISR_QUEUE_LENGTH - 1);
+        context->isr.segment[idx].phase_delta = context->fsk.phase_delta;
+        context->isr.segment[idx].count = (uint32_t) count;
+        sstv_encoder_count_segment(context, count);
+
+        head ++;
+        SSTV_ATOMIC_STORE(&context->isr.head, head);
+    }
+
+    return SSTV_ENCODE_SUCCESSFUL;
+}
+
+sstv_error_t
+sstv_encode_next_sample(void *ctx, sstv_sample_type_t type, void *sample)
+{
+    sstv_encoder_context_t *context = (sstv_encoder_context_t *)ctx;
+
+    if (!context || !sample) {
+        return SSTV_BAD_PARAMETER;
+    }
+    if (type != SSTV_SAMPLE_INT8 && type != SSTV_SAMPLE_UINT8 && type != SSTV_SAMPLE_INT16) {
+        return SSTV_BAD_SAMPLE_TYPE;
+    }
+
+    /* pop next segment (tail is only written here) */
+    if (context->isr.count == 0) {
+        /* read end flag before head, so we never miss the last segment */
+        uint32_t end = SSTV_ATOMIC_LOAD(&context->isr.end);
+        uint32_t tail = context->isr.tail;
+        if (tail == SSTV_ATOMIC_LOAD(&context->isr.head)) {
+            return end ? SSTV_ENCODE_END : SSTV_ENCODE_UNDERRUN;
         }
 
-        /* encode sample and continue */
-        context->fsk.remaining_usamp -= 1000000;
-        context->fsk.phase += context->fsk.phase_delta;
-        switch(signal->type) {
-            case SSTV_SAMPLE_INT8:
-                ((int8_t *)signal->buffer)[signal->count] = SSTV_SIN_INT10_INT8[context->fsk.phase >> 22];
-                break;
-            
-            case SSTV_SAMPLE_UINT8:
-                ((uint8_t *)signal->buffer)[signal->count] = SSTV_SIN_INT10_UINT8[context->fsk.phase >> 22];
-                break;
+        uint32_t idx = tail & (SSTV_ENCODER_ISR_QUEUE_LENGTH - 1);
+        context->isr.phase_delta = context->isr.segment[idx].phase_delta;
+        context->isr.count = context->isr.segment[idx].count;
+        SSTV_ATOMIC_STORE(&context->isr.tail, tail + 1);
 
-            case SSTV_SAMPLE_INT16:
-                ((int16_t *)signal->buffer)[signal->count] = SSTV_SIN_INT10_INT16[context->fsk.phase >> 22];
-                break;
-            
-            default:
-                return SSTV_BAD_SAMPLE_TYPE;
+        /* samples are counted per segment, not in the per-sample path;
+           sstv_encoder_get_stats() takes off those not played yet */
+        context->stats.counters.samples += context->isr.count;
+    }
+
+    /* encode sample */
+    context->isr.count --;
+    context->fsk.phase += context->isr.phase_delta;
+    switch(type) {
+        case SSTV_SAMPLE_INT8:
+            *(int8_t *)sample = SSTV_SIN_INT10_INT8[context->fsk.phase >> 22];
+            break;
+
+        case SSTV_SAMPLE_UINT8:
+            *(uint8_t *)sample = SSTV_SIN_INT10_UINT8[context->fsk.phase >> 22];
+            break;
+
+        case SSTV_SAMPLE_INT16:
+        default:
+            *(int16_t *)sample = SSTV_SIN_INT10_INT16[context->fsk.phase >> 22];
+            break;
+    }
+
+    return SSTV_ENCODE_SUCCESSFUL;
+}
+
+sstv_error_t
+sstv_encoder_get_stats(void *ctx, sstv_encoder_stats_t *stats)
+{
+    sstv_encoder_context_t *context = (sstv_encoder_context_t *)ctx;
+    uint32_t i;
+
+    if (!context || !stats) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* field by field, so no memcpy() is needed */
+    stats->samples = context->stats.counters.samples - context->isr.count;
+    stats->encode_calls = context->stats.counters.encode_calls;
+    for (i = 0; i < SSTV_SEGMENT_CLASS_COUNT; i ++) {
+        stats->transitions[i] = context->stats.counters.transitions[i];
+    }
+    stats->segments = context->stats.counters.segments;
+    if (stats->segments > 0) {
+        stats->segment_min_samples = context->stats.counters.segment_min_samples;
+        stats->segment_max_samples = context->stats.counters.segment_max_samples;
+        stats->segment_avg_samples = (uint32_t) (context->stats.segment_samples / stats->segments);
+    } else {
+        stats->segment_min_samples = 0;
+        stats->segment_max_samples = 0;
+        stats->segment_avg_samples = 0;
+    }
+    stats->state_cycles = context->stats.counters.state_cycles;
+    stats->synthesis_cycles = context->stats.counters.synthesis_cycles;
+
+    return SSTV_OK;
+}
+
+sstv_error_t
+sstv_encoder_get_sample_count(void *ctx, uint64_t *count)
+{
+    sstv_encoder_context_t *context = (sstv_encoder_context_t *)ctx;
+    sstv_encoder_context_t timing;
+    sstv_error_t rc;
+    uint8_t *p = (uint8_t *)&timing;
+    uint32_t i;
+
+    if (!context || !count) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* walk a separate timing generator over the same image, from a clean
+       context (no memset in a -nostdlib build) */
+    for (i = 0; i < sizeof(timing); i ++) {
+        p[i] = 0;
+    }
+    timing.image = context->image;
+    timing.mode = context->mode;
+    timing.sample_rate = context->sample_rate;
+    rc = sstv_get_mode_descriptor(context->mode, context->sample_rate, &timing.descriptor);
+    if (rc != SSTV_OK) {
+        return rc;
+    }
+    timing.state = SSTV_ENCODER_STATE_START;
+    timing.fsk.remaining_usamp = 0;
+
+    /* segments carry their fractional samples over to the next one, and
+       sstv_encode() stops with less than a sample left, so the total is the
+       whole part of the summed segment lengths */
+    while (timing.state != SSTV_ENCODER_STATE_END) {
+        rc = sstv_encode_state_change(&timing);
+        if (rc != SSTV_OK) {
+            return rc;
         }
-        signal->count ++;
     }
+    *count = timing.fsk.remaining_usamp / 1000000;
+
+    return SSTV_OK;
+}
+
+/*
+ * Serialization helpers (little endian)
+ */
+#define SSTV_STATE_MAGIC_0 'S'
+#define SSTV_STATE_MAGIC_1 'E'
+#define SSTV_STATE_VERSION 1
+
+static void
+sstv_put_u32(uint8_t *buf, uint32_t val)
+{
+    buf[0] = (uint8_t) val;
+    buf[1] = (uint8_t) (val >> 8);
+    buf[2] = (uint8_t) (val >> 16);
+    buf[3] = (uint8_t) (val >> 24);
+}
+
+static uint32_t
+sstv_get_u32(const uint8_t *buf)
+{
+    return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+sstv_error_t
+sstv_encoder_save_state(void *ctx, uint8_t *buf, uint32_t len)
+{
+    sstv_encoder_context_t *context = (sstv_encoder_context_t *)ctx;
+
+    if (!context || !buf || len < SSTV_ENCODER_STATE_SIZE) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* position is only meaningful for sstv_encode() streams */
+    if (context->isr.head != 0) {
+        return SSTV_BAD_STATE;
+    }
+
+    /* header */
+    buf[0] = SSTV_STATE_MAGIC_0;
+    buf[1] = SSTV_STATE_MAGIC_1;
+    buf[2] = SSTV_STATE_VERSION;
+    buf[3] = (uint8_t) context->mode;
+    sstv_put_u32(buf + 4, context->sample_rate);
+
+    /* state and state extra info */
+    buf[8] = (uint8_t) context->state;
+    buf[9] = 0;
+    buf[10] = 0;
+    buf[11] = 0;
+    sstv_put_u32(buf + 12, 0);
+    sstv_put_u32(buf + 16, 0);
+    if (context->state >= SSTV_ENCODER_STATE_VIS_START_BIT
+        && context->state <= SSTV_ENCODER_STATE_VIS_STOP_BIT)
+    {
+        buf[9] = context->extra.vis.visp;
+        buf[10] = context->extra.vis.curr_bit;
+    } else if (context->state > SSTV_ENCODER_STATE_VIS_STOP_BIT) {
+        sstv_put_u32(buf + 12, context->extra.scan.curr_line);
+        sstv_put_u32(buf + 16, context->extra.scan.curr_col);
+    }
+
+    /* FSK generator */
+    sstv_put_u32(buf + 20, context->fsk.phase);
+    sstv_put_u32(buf + 24, context->fsk.phase_delta);
+    sstv_put_u32(buf + 28, (uint32_t) context->fsk.remaining_usamp);
+    sstv_put_u32(buf + 32, (uint32_t) (context->fsk.remaining_usamp >> 32));
+
+    /* all ok */
+    return SSTV_OK;
+}
+
+#define SSTV_STATE_BIT(state) ((uint32_t) 1 << (state))
+
+/*
+ * Image scan states
+ */
+#define SSTV_SCAN_STATES \
+    (SSTV_STATE_BIT(SSTV_ENCODER_STATE_Y_SCAN) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_Y_ODD_SCAN) \
+     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_Y_EVEN_SCAN) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_RY_SCAN) \
+     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_BY_SCAN) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_R_SCAN) \
+     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_G_SCAN) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_B_SCAN))
+
+/*
+ * Checks that a position past the VIS is one the encoder of the context's
+ * mode can be in, and that resuming from it stays within the image
+ */
+static sstv_error_t
+sstv_encoder_check_position(sstv_encoder_context_t *context, sstv_encoder_state_t state,
+                            uint32_t curr_line, uint32_t curr_col)
+{
+    uint32_t width = context->image.width;
+    uint32_t height = context->image.height;
+    uint32_t states;
+
+    if (state == SSTV_ENCODER_STATE_END) {
+        return SSTV_OK;
+    }
+    if (curr_line >= height || curr_col > width) {
+        return SSTV_BAD_STATE;
+    }
+
+    /* pixels are read at curr_col, which scan states have already advanced past */
+    if ((SSTV_SCAN_STATES & SSTV_STATE_BIT(state)) && curr_col == 0) {
+        return SSTV_BAD_STATE;
+    }
+
+    switch (context->mode) {
+        case SSTV_MODE_FAX480:
+        case SSTV_MODE_ROBOT_BW8_R:
+        case SSTV_MODE_ROBOT_BW8_G:
+        case SSTV_MODE_ROBOT_BW8_B:
+        case SSTV_MODE_ROBOT_BW12_R:
+        case SSTV_MODE_ROBOT_BW12_G:
+        case SSTV_MODE_ROBOT_BW12_B:
+        case SSTV_MODE_ROBOT_BW24_R:
+        case SSTV_MODE_ROBOT_BW24_G:
+        case SSTV_MODE_ROBOT_BW24_B:
+        case SSTV_MODE_ROBOT_BW36_R:
+        case SSTV_MODE_ROBOT_BW36_G:
+        case SSTV_MODE_ROBOT_BW36_B:
+            states = SSTV_STATE_BIT(SSTV_ENCODER_STATE_SYNC) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_Y_SCAN);
+            break;
+
+        case SSTV_MODE_ROBOT_C12:
+        case SSTV_MODE_ROBOT_C36:
+            /* even lines carry R-Y averaged with the next line, odd lines B-Y
+               averaged with the previous one */
+            states = SSTV_STATE_BIT(SSTV_ENCODER_STATE_SYNC) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_PORCH)
+                     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_Y_SCAN) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_PORCH2);
+            if (curr_line % 2 == 0) {
+                if (curr_line + 1 >= height) {
+                    return SSTV_BAD_STATE;
+                }
+                states |= SSTV_STATE_BIT(SSTV_ENCODER_STATE_SEPARATOR) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_RY_SCAN);
+            } else {
+                states |= SSTV_STATE_BIT(SSTV_ENCODER_STATE_SEPARATOR2) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_BY_SCAN);
+            }
+            break;
+
+        case SSTV_MODE_ROBOT_C24:
+        case SSTV_MODE_ROBOT_C72:
+            states = SSTV_STATE_BIT(SSTV_ENCODER_STATE_SYNC) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_PORCH)
+                     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_Y_SCAN) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_SEPARATOR_RY)
+                     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_PORCH_RY) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_RY_SCAN)
+                     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_SEPARATOR_BY) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_PORCH_BY)
+                     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_BY_SCAN);
+            break;
+
+        case SSTV_MODE_SCOTTIE_S1:
+        case SSTV_MODE_SCOTTIE_S2:
+        case SSTV_MODE_SCOTTIE_S3:
+        case SSTV_MODE_SCOTTIE_S4:
+        case SSTV_MODE_SCOTTIE_DX:
+            /* the first sync only precedes line 0 */
+            states = SSTV_STATE_BIT(SSTV_ENCODER_STATE_PORCH_G) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_G_SCAN)
+                     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_PORCH_B) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_B_SCAN)
+                     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_SYNC) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_PORCH_R)
+                     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_R_SCAN);
+            if (curr_line == 0) {
+                states |= SSTV_STATE_BIT(SSTV_ENCODER_STATE_SYNC_FIRST);
+            }
+            break;
+
+        case SSTV_MODE_MARTIN_M1:
+        case SSTV_MODE_MARTIN_M2:
+        case SSTV_MODE_MARTIN_M3:
+        case SSTV_MODE_MARTIN_M4:
+            states = SSTV_STATE_BIT(SSTV_ENCODER_STATE_SYNC) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_PORCH_G)
+                     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_G_SCAN) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_PORCH_B)
+                     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_B_SCAN) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_PORCH_R)
+                     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_R_SCAN) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_PORCH);
+            break;
+
+        case SSTV_MODE_PD50:
+        case SSTV_MODE_PD90:
+        case SSTV_MODE_PD120:
+        case SSTV_MODE_PD160:
+        case SSTV_MODE_PD180:
+        case SSTV_MODE_PD240:
+        case SSTV_MODE_PD290:
+            /* every state belongs to the pair of lines starting at curr_line */
+            if (curr_line % 2 != 0 || curr_line + 1 >= height) {
+                return SSTV_BAD_STATE;
+            }
+            states = SSTV_STATE_BIT(SSTV_ENCODER_STATE_SYNC) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_PORCH)
+                     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_Y_EVEN_SCAN) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_RY_SCAN)
+                     | SSTV_STATE_BIT(SSTV_ENCODER_STATE_BY_SCAN) | SSTV_STATE_BIT(SSTV_ENCODER_STATE_Y_ODD_SCAN);
+            break;
+
+        default:
+            return SSTV_BAD_MODE;
+    }
+
+    return ((states & SSTV_STATE_BIT(state)) ? SSTV_OK : SSTV_BAD_STATE);
+}
+
+sstv_error_t
+sstv_encoder_restore_state(void *ctx, const uint8_t *buf, uint32_t len)
+{
+    sstv_encoder_context_t *context = (sstv_encoder_context_t *)ctx;
+
+    if (!context || !buf || len < SSTV_ENCODER_STATE_SIZE) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* check header against context; descriptor is reused as-is */
+    if (buf[0] != SSTV_STATE_MAGIC_0 || buf[1] != SSTV_STATE_MAGIC_1 || buf[2] != SSTV_STATE_VERSION) {
+        return SSTV_BAD_STATE;
+    }
+    if (buf[3] != (uint8_t) context->mode || sstv_get_u32(buf + 4) != context->sample_rate) {
+        return SSTV_BAD_STATE;
+    }
+
+    /* validate position, so we never read outside of the image */
+    sstv_encoder_state_t state = (sstv_encoder_state_t) buf[8];
+    uint32_t curr_line = sstv_get_u32(buf + 12);
+    uint32_t curr_col = sstv_get_u32(buf + 16);
+    if (state > SSTV_ENCODER_STATE_END) {
+        return SSTV_BAD_STATE;
+    }
+    if (state > SSTV_ENCODER_STATE_VIS_STOP_BIT
+        && sstv_encoder_check_position(context, state, curr_line, curr_col) != SSTV_OK)
+    {
+        return SSTV_BAD_STATE;
+    }
+    if (state >= SSTV_ENCODER_STATE_VIS_START_BIT && state <= SSTV_ENCODER_STATE_VIS_STOP_BIT
+        && buf[10] > 8)
+    {
+        return SSTV_BAD_STATE;
+    }
+
+    /* restore */
+    context->state = state;
+    if (state > SSTV_ENCODER_STATE_VIS_STOP_BIT) {
+        context->extra.scan.curr_line = curr_line;
+        context->extra.scan.curr_col = curr_col;
+    } else {
+        context->extra.vis.visp = buf[9];
+        context->extra.vis.curr_bit = buf[10];
+    }
+    context->fsk.phase = sstv_get_u32(buf + 20);
+    context->fsk.phase_delta = sstv_get_u32(buf + 24);
+    context->fsk.remaining_usamp = (uint64_t)sstv_get_u32(buf + 28) | ((uint64_t)sstv_get_u32(buf + 32) << 32);
+
+    /* sample-by-sample queue restarts from the restored position */
+    context->isr.head = 0;
+    context->isr.tail = 0;
+    context->isr.end = 0;
+    context->stats.counters.samples -= context->isr.count; /* never played */
+    context->isr.count = 0;
+
+    /* all ok */
+    return SSTV_OK;
 }
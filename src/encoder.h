@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _ENCODER_H_
+#define _ENCODER_H_
+
+#include "sstv.h"
+
+/*
+ * Encoder state
+ */
+typedef enum {
+    /* start of coding */
+    SSTV_ENCODER_STATE_START,
+
+    /* transmission header */
+    SSTV_ENCODER_STATE_LEADER_TONE_1,
+    SSTV_ENCODER_STATE_BREAK,
+    SSTV_ENCODER_STATE_LEADER_TONE_2,
+
+    /* VIS */
+    SSTV_ENCODER_STATE_VIS_START_BIT,
+    SSTV_ENCODER_STATE_VIS_BIT,
+    SSTV_ENCODER_STATE_VIS_STOP_BIT,
+
+    /* sync and porch */
+    SSTV_ENCODER_STATE_SYNC,
+    SSTV_ENCODER_STATE_SYNC_FIRST,
+    SSTV_ENCODER_STATE_PORCH,
+    SSTV_ENCODER_STATE_PORCH2,
+    SSTV_ENCODER_STATE_PORCH_R,
+    SSTV_ENCODER_STATE_PORCH_G,
+    SSTV_ENCODER_STATE_PORCH_B,
+    SSTV_ENCODER_STATE_PORCH_BY,
+    SSTV_ENCODER_STATE_PORCH_RY,
+
+    /* separator */
+    SSTV_ENCODER_STATE_SEPARATOR,
+    SSTV_ENCODER_STATE_SEPARATOR2,
+    SSTV_ENCODER_STATE_SEPARATOR_BY,
+    SSTV_ENCODER_STATE_SEPARATOR_RY,
+
+    /* scan */
+    SSTV_ENCODER_STATE_Y_SCAN,
+    SSTV_ENCODER_STATE_Y_ODD_SCAN,
+    SSTV_ENCODER_STATE_Y_EVEN_SCAN,
+    SSTV_ENCODER_STATE_RY_SCAN,
+    SSTV_ENCODER_STATE_BY_SCAN,
+
+    SSTV_ENCODER_STATE_R_SCAN,
+    SSTV_ENCODER_STATE_G_SCAN,
+    SSTV_ENCODER_STATE_B_SCAN,
+
+    /* end of coding */
+    SSTV_ENCODER_STATE_END
+} sstv_encoder_state_t;
+
+/*
+ * Encoder context
+ */
+typedef struct {
+    /* input image */
+    sstv_image_t image;
+
+    /* output configuration */
+    sstv_mode_t mode;
+    uint32_t sample_rate;
+
+    /* current state */
+    sstv_encoder_state_t state;
+
+    /* current FSK value to be written */
+    struct {
+        uint32_t phase;
+        uint32_t phase_delta;
+        uint64_t remaining_usamp;
+    } fsk;
+
+    /* mode timings */
+    sstv_mode_descriptor_t descriptor;
+
+    /* state extra info */
+    union {
+        struct {
+            uint8_t visp;
+            uint8_t curr_bit;
+        } vis;
+
+        struct {
+            uint32_t curr_line;
+            uint32_t curr_col;
+        } scan;
+    } extra;
+
+    /* precomputed FSK segments for sstv_encode_next_sample() */
+    struct {
+        struct {
+            uint32_t phase_delta;
+            uint32_t count;
+        } segment[SSTV_ENCODER_ISR_QUEUE_LENGTH];
+
+        /* queue indices (head written by producer, tail by consumer) */
+        uint32_t head;
+        uint32_t tail;
+        uint32_t end;
+
+        /* segment being played back */
+        uint32_t phase_delta;
+        uint32_t count;
+    } isr;
+
+    /* statistics (see sstv_encoder_get_stats()) */
+    struct {
+        sstv_encoder_stats_t counters;
+
+        /* sample index at which the current segment started */
+        uint64_t segment_start;
+
+        /* total length of completed segments */
+        uint64_t segment_samples;
+    } stats;
+
+#ifdef SSTV_TRACE_HOOKS
+    /* line being traced, or ~0 if none */
+    uint32_t trace_line;
+#endif
+} sstv_encoder_context_t;
+
+/*
+ * Advance the encoder to its next FSK segment (also used by the decoder to
+ * follow the transmission timing)
+ */
+extern sstv_error_t
+sstv_encode_state_change(sstv_encoder_context_t *context);
+
+#endif
@@ -27,6 +27,11 @@ extern "C" {
  * Limits
  */
 #define SSTV_DEFAULT_ENCODER_CONTEXT_COUNT @DEFAULT_ENCODER_CONTEXT_COUNT@
+#define SSTV_ENCODER_STATE_SIZE 36 /* bytes, see sstv_encoder_save_state() */
+#define SSTV_ENCODER_ISR_QUEUE_LENGTH @ENCODER_ISR_QUEUE_LENGTH@ /* power of two */
+#define SSTV_DEFAULT_DECODER_CONTEXT_COUNT @DEFAULT_DECODER_CONTEXT_COUNT@
+#define SSTV_DEFAULT_VIS_DETECTOR_CONTEXT_COUNT @DEFAULT_VIS_DETECTOR_CONTEXT_COUNT@
+#define SSTV_DEFAULT_MODE_IDENTIFIER_CONTEXT_COUNT @DEFAULT_MODE_IDENTIFIER_CONTEXT_COUNT@
 
 /*
  * Error codes
@@ -48,14 +53,31 @@ typedef enum {
     SSTV_BAD_RESOLUTION         = 106,
     SSTV_BAD_SAMPLE_TYPE        = 107,
     SSTV_UNSUPPORTED_CONVERSION = 108,
+    SSTV_BAD_STATE              = 109,
+    SSTV_UNSUPPORTED_FEATURE    = 110,
 
     SSTV_ALLOC_FAIL             = 200,
 
     /* Encoder return codes */
     SSTV_ENCODE_SUCCESSFUL      = 1000,
     SSTV_ENCODE_END             = 1001,
+    SSTV_ENCODE_UNDERRUN        = 1002,
+    SSTV_ENCODE_BUDGET_EXHAUSTED = 1003,
 
     SSTV_NO_DEFAULT_ENCODERS    = 1100,
+
+    /* Decoder return codes */
+    SSTV_DECODE_SUCCESSFUL      = 2000,
+    SSTV_DECODE_END             = 2001,
+
+    SSTV_NO_DEFAULT_DECODERS    = 2100,
+
+    /* VIS detector return codes */
+    SSTV_DETECT_SUCCESSFUL      = 3000,
+    SSTV_DETECT_FOUND           = 3001,
+
+    SSTV_NO_DEFAULT_DETECTORS   = 3100,
+    SSTV_NO_DEFAULT_IDENTIFIERS = 3101,
 } sstv_error_t;
 
 /*
@@ -149,7 +171,12 @@ typedef struct {
 typedef enum {
     SSTV_SAMPLE_UINT8,
     SSTV_SAMPLE_INT8,
-    SSTV_SAMPLE_INT16
+    SSTV_SAMPLE_INT16,
+
+    /* complex, interleaved I/Q pairs counting as one sample (decoder input
+       only, see sstv_decoder_set_iq_input()) */
+    SSTV_SAMPLE_CS16,
+    SSTV_SAMPLE_CF32
 } sstv_sample_type_t;
 
 /*
@@ -172,6 +199,121 @@ typedef struct {
     uint32_t count;
 } sstv_signal_t;
 
+/*
+ * Single-producer/single-consumer signal ring buffer
+ */
+typedef struct {
+    /* buffer pointer */
+    void *buffer;
+
+    /* sample type */
+    sstv_sample_type_t type;
+
+    /* number of total samples (power of two) */
+    uint32_t capacity;
+
+    /* free-running write (producer) and read (consumer) positions */
+    uint32_t head;
+    uint32_t tail;
+
+    /* set by producer once the whole image has been written */
+    uint32_t end;
+
+    /* number of reads that found fewer samples than requested */
+    uint32_t underruns;
+
+    /* number of producer calls that found the ring full */
+    uint32_t overruns;
+
+    /* minimum number of samples found in the ring by a read, while the
+       producer was still running (capacity until the first read) */
+    uint32_t low_water;
+} sstv_ringbuf_t;
+
+/*
+ * Mode identification result
+ */
+typedef struct {
+    /* candidate mode */
+    sstv_mode_t mode;
+
+    /* match of sync period and width, 0 to 1000 */
+    uint32_t confidence;
+
+    /* index of the first sample of a line, counted from the first sample ever
+       passed to the identifier (see sstv_detect_vis()) */
+    uint64_t sync_offset;
+} sstv_mode_candidate_t;
+
+/*
+ * Encoder FSK segment classes
+ */
+typedef enum {
+    /* leader tones and break */
+    SSTV_SEGMENT_HEADER,
+
+    /* VIS start, data and stop bits */
+    SSTV_SEGMENT_VIS,
+
+    /* line sync pulses */
+    SSTV_SEGMENT_SYNC,
+
+    /* porches and channel separators */
+    SSTV_SEGMENT_PORCH,
+    SSTV_SEGMENT_SEPARATOR,
+
+    /* pixels */
+    SSTV_SEGMENT_PIXEL,
+
+    SSTV_SEGMENT_CLASS_COUNT
+} sstv_segment_class_t;
+
+/*
+ * Encoder statistics
+ */
+typedef struct {
+    /* samples written, by any of the encoding functions */
+    uint64_t samples;
+
+    /* sstv_encode() and sstv_encode_budget() calls (including those made by
+       sstv_encode_ringbuf()) */
+    uint64_t encode_calls;
+
+    /* state machine transitions, by class of the FSK segment entered */
+    uint64_t transitions[SSTV_SEGMENT_CLASS_COUNT];
+
+    /* completed FSK segments, and their length in samples */
+    uint64_t segments;
+    uint32_t segment_min_samples;
+    uint32_t segment_max_samples;
+    uint32_t segment_avg_samples;
+
+    /* cycles spent in the state machine and in sample synthesis (only
+       counted when built with ENCODER_CYCLE_STATS, zero otherwise) */
+    uint64_t state_cycles;
+    uint64_t synthesis_cycles;
+} sstv_encoder_stats_t;
+
+/*
+ * Trace events (see sstv_set_trace_hooks())
+ */
+typedef enum {
+    /* sstv_create_encoder(), arg is the mode */
+    SSTV_TRACE_CREATE_ENCODER,
+
+    /* sstv_encode() or sstv_encode_budget() call, arg is the signal capacity
+       on begin and the number of samples written on end */
+    SSTV_TRACE_ENCODE,
+
+    /* image line, from its sync pulse to the next one, arg is the line index
+       (first line of the pair for PD modes) */
+    SSTV_TRACE_LINE,
+
+    /* sstv_convert_image(), arg is the target format */
+    SSTV_TRACE_CONVERT_IMAGE
+} sstv_trace_event_t;
+
+typedef void (*sstv_trace_func_t)(sstv_trace_event_t event, uint32_t arg, void *user);
 
 /*
  * Initialize the library.
@@ -184,6 +326,24 @@ typedef struct {
  */
 extern sstv_error_t sstv_init(sstv_malloc_t alloc_func, sstv_free_t dealloc_func);
 
+/*
+ * Install trace hooks.
+ *   begin(in): called when a traced operation begins
+ *   end(in): called when it ends
+ *   user(in): opaque pointer passed to the hooks
+ *   returns: error code (SSTV_UNSUPPORTED_FEATURE if the library was built
+ *            without TRACE_HOOKS)
+ *
+ * NOTE: Either both or none of the hooks must be provided; passing none
+ * removes them. Hooks are global and called synchronously, from whichever
+ * thread runs the traced operation.
+ * NOTE: Lines are traced from sstv_encode(), sstv_encode_budget() and
+ * sstv_encode_refill(), as the encoder's state machine reaches them, so they
+ * may span several calls. sstv_encode_next_sample() is never traced.
+ * NOTE: Without TRACE_HOOKS the trace points are compiled out entirely.
+ */
+extern sstv_error_t sstv_set_trace_hooks(sstv_trace_func_t begin, sstv_trace_func_t end, void *user);
+
 /*
  * Retrieve the image properties for a supported SSTV mode.
  *   mode(in): desired SSTV mode
@@ -270,12 +430,24 @@ extern sstv_error_t sstv_pack_image(sstv_image_t *out_img, uint32_t width, uint3
  */
 extern sstv_error_t sstv_pack_signal(sstv_signal_t *sig, sstv_sample_type_t type, uint32_t capacity, void *buffer);
 
+/*
+ * Pack a sample buffer into a ring buffer structure.
+ *   rb(in): ring buffer structure to initialize
+ *   type(in): sample type
+ *   capacity(in): buffer capacity in samples, must be a power of two
+ *   buffer(in): buffer pointer
+ *   returns: error code
+ *
+ * NOTE: Buffer is managed by user.
+ */
+extern sstv_error_t sstv_pack_ringbuf(sstv_ringbuf_t *rb, sstv_sample_type_t type, uint32_t capacity, void *buffer);
+
 /*
  * Create an SSTV encoder.
  *   out_ctx(out): output context structure pointer
  *   image(in): image buffer
  *   mode(in): SSTV mode
- *   sample_rate(in): output signal sample rate
+ *   sample_rate(in): output signal sample rate (non-zero)
  *   returns: error code
  *
  * NOTE: Context shall never be modified by the user.
@@ -297,6 +469,60 @@ extern sstv_error_t sstv_create_encoder(void **out_ctx, sstv_image_t image, sstv
  */
 extern sstv_error_t sstv_delete_encoder(void *ctx);
 
+/*
+ * Restart an SSTV encoder from the beginning of its image.
+ *   ctx(in): encoder context structure pointer
+ *   keep_phase(in): if non-zero, the FSK phase carries on from the last
+ *                   sample, for click-free back-to-back transmissions
+ *   returns: error code
+ *
+ * NOTE: The mode descriptor is kept, so this is much cheaper than deleting
+ * and re-creating the encoder.
+ */
+extern sstv_error_t sstv_encoder_reset(void *ctx, uint8_t keep_phase);
+
+/*
+ * Bind a new image to an SSTV encoder and restart it.
+ *   ctx(in): encoder context structure pointer
+ *   image(in): image buffer, with the properties required by the encoder's
+ *              mode
+ *   keep_phase(in): see sstv_encoder_reset()
+ *   returns: error code
+ */
+extern sstv_error_t sstv_encoder_rebind(void *ctx, sstv_image_t image, uint8_t keep_phase);
+
+/*
+ * Save the position of an SSTV encoder.
+ *   ctx(in): encoder context structure pointer
+ *   buf(out): output buffer
+ *   len(in): output buffer length, at least SSTV_ENCODER_STATE_SIZE bytes
+ *   returns: error code
+ *
+ * NOTE: Only the encoding position is saved (state, line/column, VIS bit and
+ * FSK generator), in a portable format. Mode and sample rate are recorded so
+ * that the state is only restored into a matching encoder.
+ * NOTE: Returns SSTV_BAD_STATE for contexts driven by sstv_encode_refill(),
+ * since their state runs ahead of the samples actually played.
+ */
+extern sstv_error_t sstv_encoder_save_state(void *ctx, uint8_t *buf, uint32_t len);
+
+/*
+ * Restore the position of an SSTV encoder.
+ *   ctx(in): encoder context structure pointer
+ *   buf(in): buffer written by sstv_encoder_save_state()
+ *   len(in): buffer length
+ *   returns: error code (SSTV_BAD_STATE if the state does not match the
+ *            encoder's mode, sample rate or image, or is not a position the
+ *            encoder of that mode can be in)
+ *
+ * NOTE: The context must have been created with the same mode, sample rate
+ * and image. Its mode descriptor is reused, so restoring is cheap. Encoding
+ * resumes with the sample following the last one produced before saving.
+ * NOTE: The record is validated against the mode's state machine, so records
+ * from untrusted storage never make the encoder read outside of the image.
+ */
+extern sstv_error_t sstv_encoder_restore_state(void *ctx, const uint8_t *buf, uint32_t len);
+
 /*
  * Encode image into SSTV signal.
  *   ctx(in): encoder context structure pointer
@@ -307,6 +533,301 @@ extern sstv_error_t sstv_delete_encoder(void *ctx);
  */
 extern sstv_error_t sstv_encode(void *ctx, sstv_signal_t *signal);
 
+/*
+ * Encode image into SSTV signal, doing at most a bounded amount of work.
+ *   ctx(in): encoder context structure pointer
+ *   signal(in): output signal container
+ *   budget(in): maximum number of work units (one per state change and one
+ *               per written sample)
+ *   returns: SSTV_ENCODE_SUCCESSFUL on successful fill of signal buffer
+ *            SSTV_ENCODE_BUDGET_EXHAUSTED if budget was spent before the
+ *            signal buffer was filled
+ *            SSTV_ENCODE_END on successful encoding of whole image
+ *            error code otherwise
+ *
+ * NOTE: SSTV_ENCODE_BUDGET_EXHAUSTED is resumable in the same way as
+ * SSTV_ENCODE_SUCCESSFUL: signal->count holds the samples produced so far and
+ * the next call continues where this one stopped.
+ */
+extern sstv_error_t sstv_encode_budget(void *ctx, sstv_signal_t *signal, uint32_t budget);
+
+/*
+ * Encode image into the free space of a ring buffer (producer side).
+ *   ctx(in): encoder context structure pointer
+ *   rb(in): ring buffer
+ *   returns: SSTV_ENCODE_SUCCESSFUL when the ring buffer has been filled
+ *            SSTV_ENCODE_END once the whole image has been written
+ *            error code otherwise
+ *
+ * NOTE: Meant to be called in a loop from a producer thread, sleeping or
+ * waiting between calls. Never blocks and takes no locks.
+ */
+extern sstv_error_t sstv_encode_ringbuf(void *ctx, sstv_ringbuf_t *rb);
+
+/*
+ * Read samples from a ring buffer (consumer side).
+ *   rb(in): ring buffer
+ *   out(out): output buffer of rb->type samples
+ *   count(in): number of samples to read
+ *   returns: SSTV_OK if all samples were read
+ *            SSTV_ENCODE_UNDERRUN if fewer samples were available
+ *            SSTV_ENCODE_END if the producer has finished and the ring is
+ *            drained
+ *            error code otherwise
+ *
+ * NOTE: Wait-free, suitable for audio callbacks. Missing samples are padded
+ * with silence.
+ */
+extern sstv_error_t sstv_ringbuf_read(sstv_ringbuf_t *rb, void *out, uint32_t count);
+
+/*
+ * Run the encoder state machine ahead of sstv_encode_next_sample().
+ *   ctx(in): encoder context structure pointer
+ *   returns: SSTV_ENCODE_SUCCESSFUL when the segment queue is full
+ *            SSTV_ENCODE_END once the whole image has been queued
+ *            error code otherwise
+ *
+ * NOTE: Call this from a non-interrupt context (e.g. the main loop) often
+ * enough to keep the queue of SSTV_ENCODER_ISR_QUEUE_LENGTH FSK segments from
+ * running dry.
+ */
+extern sstv_error_t sstv_encode_refill(void *ctx);
+
+/*
+ * Encode exactly one sample, in constant time.
+ *   ctx(in): encoder context structure pointer
+ *   type(in): sample type
+ *   sample(out): pointer to a single sample of the given type
+ *   returns: SSTV_ENCODE_SUCCESSFUL if a sample was written
+ *            SSTV_ENCODE_END on successful encoding of whole image
+ *            SSTV_ENCODE_UNDERRUN if sstv_encode_refill() fell behind
+ *            error code otherwise
+ *
+ * NOTE: Safe to call from an interrupt handler, with sstv_encode_refill()
+ * called concurrently from a single other context. No sample is written when
+ * SSTV_ENCODE_END or SSTV_ENCODE_UNDERRUN is returned.
+ * NOTE: Do not mix with sstv_encode() on the same context.
+ */
+extern sstv_error_t sstv_encode_next_sample(void *ctx, sstv_sample_type_t type, void *sample);
+
+/*
+ * Retrieve encoder statistics.
+ *   ctx(in): encoder context structure pointer
+ *   stats(out): statistics since the encoder was created, reset or rebound
+ *   returns: error code
+ *
+ * NOTE: Counters are cheap enough to be always on: samples and calls are
+ * counted once per sstv_encode() call (samples from sstv_encode_next_sample()
+ * once per queued segment), segments once per state transition; nothing is
+ * counted per sample.
+ * NOTE: With ENCODER_CYCLE_STATS, the cycle counter (TSC on x86, virtual
+ * counter on AArch64) is read around every state transition and every
+ * sstv_encode() call; synthesis_cycles is the remainder of the latter. Samples
+ * produced by sstv_encode_next_sample() are counted, but not timed.
+ */
+extern sstv_error_t sstv_encoder_get_stats(void *ctx, sstv_encoder_stats_t *stats);
+
+/*
+ * Compute the number of samples the encoder produces for a whole image.
+ *   ctx(in): encoder context structure pointer
+ *   count(out): total number of samples, from the leader tone to the last line
+ *   returns: error code
+ *
+ * NOTE: Walks the timing of the mode without synthesizing samples, so it is
+ * cheap enough to size an output file before encoding into it. The result
+ * depends on the mode and sample rate only, and the encoder position is left
+ * untouched.
+ */
+extern sstv_error_t sstv_encoder_get_sample_count(void *ctx, uint64_t *count);
+
+/*
+ * Create an SSTV decoder.
+ *   out_ctx(out): output context structure pointer
+ *   image(in): output image buffer
+ *   mode(in): SSTV mode to wait for
+ *   sample_rate(in): input signal sample rate (6000Hz to 384kHz)
+ *   returns: error code
+ *
+ * NOTE: Context shall never be modified by the user.
+ * NOTE: If an allocator/deallocator is provided via sstv_init(), then the
+ * context structure will be dynamically allocated. Otherwise, one of the
+ * default (static) structures, built into the library, will be used. There are
+ * SSTV_DEFAULT_DECODER_CONTEXT_COUNT default structures, and once these are
+ * used up, a SSTV_NO_DEFAULT_DECODERS error is returned.
+ * NOTE: No memory is allocated after creation, and the decoder uses constant
+ * memory regardless of the length of the input.
+ */
+extern sstv_error_t sstv_create_decoder(void **out_ctx, sstv_image_t image, sstv_mode_t mode, uint32_t sample_rate);
+
+/*
+ * Deletes an SSTV decoder.
+ *   ctx(in): decoder context structure pointer
+ *   returns: error code
+ *
+ * NOTE: If context is one of the default decoders, then it will be marked as
+ * reusable and can be claimed again by sstv_create_decoder().
+ */
+extern sstv_error_t sstv_delete_decoder(void *ctx);
+
+/*
+ * Decode SSTV signal into image.
+ *   ctx(in): decoder context structure pointer
+ *   signal(in/out): input signal container, with signal->count valid samples
+ *   returns: SSTV_DECODE_SUCCESSFUL if the whole signal was consumed
+ *            SSTV_DECODE_END if an image was completely decoded
+ *            error code otherwise
+ *
+ * NOTE: The decoder waits for the leader tone and the VIS code of its mode,
+ * then writes lines into the image as they are received.
+ * NOTE: On SSTV_DECODE_END, signal->count is set to the number of samples
+ * consumed. The remaining samples should be passed in the next call, once the
+ * image has been read; the decoder is then looking for the next transmission.
+ */
+extern sstv_error_t sstv_decode(void *ctx, sstv_signal_t *signal);
+
+/*
+ * Retrieve decoding progress.
+ *   ctx(in): decoder context structure pointer
+ *   lines(out): number of image lines completely decoded so far
+ *   returns: error code
+ */
+extern sstv_error_t sstv_decoder_get_lines(void *ctx, uint32_t *lines);
+
+/*
+ * Retrieve the estimated sample clock error.
+ *   ctx(in): decoder context structure pointer
+ *   ppm(out): parts per million by which the input runs faster than its
+ *             nominal sample rate (negative if slower)
+ *   returns: error code
+ *
+ * NOTE: The decoder locks onto the sync pulses of every line and corrects
+ * both timing and clock drift as it goes (up to 1000ppm). The estimate is
+ * kept across images, it is only reset when the decoder is created.
+ */
+extern sstv_error_t sstv_decoder_get_drift(void *ctx, int32_t *ppm);
+
+/*
+ * Switch the decoder to complex baseband input, e.g. from an SDR.
+ *   ctx(in): decoder context structure pointer
+ *   tone_offset(in): frequency, in Hz, at which audio 0Hz lies in the
+ *                    baseband (a tone of f Hz is received at f + tone_offset;
+ *                    0 for upper sideband tuned to the suppressed carrier)
+ *   returns: error code
+ *
+ * NOTE: Afterwards, sstv_decode() takes SSTV_SAMPLE_CS16 or SSTV_SAMPLE_CF32
+ * signals only. They are mixed down by an oscillator moved by tone_offset,
+ * which leaves no mirrored product, and then go through the same low-pass
+ * filter and discriminator as real input; no filtering is needed beforehand.
+ * NOTE: The whole band must lie within the sample rate, i.e. within
+ * +/- sample_rate / 2.
+ * NOTE: In builds with DECODER_FIXED_POINT, only SSTV_SAMPLE_CS16 is accepted.
+ * NOTE: Call before sstv_decoder_skip_header(), if using it.
+ */
+extern sstv_error_t sstv_decoder_set_iq_input(void *ctx, int32_t tone_offset);
+
+/*
+ * Start decoding the image right away, without waiting for leader and VIS.
+ *   ctx(in): decoder context structure pointer
+ *   returns: error code
+ *
+ * NOTE: The next sample passed to sstv_decode() must be the first sample of
+ * the first line, e.g. the one at the sync_offset reported by
+ * sstv_detect_vis().
+ */
+extern sstv_error_t sstv_decoder_skip_header(void *ctx);
+
+/*
+ * Create a VIS detector.
+ *   out_ctx(out): output context structure pointer
+ *   sample_rate(in): input signal sample rate (6000Hz to 384kHz)
+ *   returns: error code
+ *
+ * NOTE: Context shall never be modified by the user.
+ * NOTE: If an allocator/deallocator is provided via sstv_init(), then the
+ * context structure will be dynamically allocated. Otherwise, one of the
+ * default (static) structures, built into the library, will be used. There are
+ * SSTV_DEFAULT_VIS_DETECTOR_CONTEXT_COUNT default structures, and once these
+ * are used up, a SSTV_NO_DEFAULT_DETECTORS error is returned.
+ */
+extern sstv_error_t sstv_create_vis_detector(void **out_ctx, uint32_t sample_rate);
+
+/*
+ * Deletes a VIS detector.
+ *   ctx(in): detector context structure pointer
+ *   returns: error code
+ */
+extern sstv_error_t sstv_delete_vis_detector(void *ctx);
+
+/*
+ * Look for leader tone and VIS code of any supported mode.
+ *   ctx(in): detector context structure pointer
+ *   signal(in/out): input signal container, with signal->count valid samples
+ *   mode(out): detected mode
+ *   sync_offset(out): index of the first sample of the first line, counted
+ *                     from the first sample ever passed to the detector
+ *   returns: SSTV_DETECT_SUCCESSFUL if the whole signal was consumed
+ *            SSTV_DETECT_FOUND if a transmission was detected
+ *            error code otherwise
+ *
+ * NOTE: Uses a fixed-point Goertzel filter bank over short blocks, so it is
+ * cheap enough to run continuously on many channels, with a full decoder
+ * only created on detection.
+ * NOTE: On SSTV_DETECT_FOUND, signal->count is set to the number of samples
+ * consumed, which end right before sync_offset. The remaining samples can be
+ * passed to a decoder on which sstv_decoder_skip_header() was called.
+ */
+extern sstv_error_t sstv_detect_vis(void *ctx, sstv_signal_t *signal, sstv_mode_t *mode, uint64_t *sync_offset);
+
+/*
+ * Create a mode identifier, for transmissions whose VIS header was lost.
+ *   out_ctx(out): output context structure pointer
+ *   sample_rate(in): input signal sample rate (6000Hz to 384kHz)
+ *   returns: error code
+ *
+ * NOTE: Context shall never be modified by the user.
+ * NOTE: If an allocator/deallocator is provided via sstv_init(), then the
+ * context structure will be dynamically allocated. Otherwise, one of the
+ * default (static) structures, built into the library, will be used. There are
+ * SSTV_DEFAULT_MODE_IDENTIFIER_CONTEXT_COUNT default structures, and once
+ * these are used up, a SSTV_NO_DEFAULT_IDENTIFIERS error is returned.
+ */
+extern sstv_error_t sstv_create_mode_identifier(void **out_ctx, uint32_t sample_rate);
+
+/*
+ * Deletes a mode identifier.
+ *   ctx(in): identifier context structure pointer
+ *   returns: error code
+ */
+extern sstv_error_t sstv_delete_mode_identifier(void *ctx);
+
+/*
+ * Feed samples to the mode identifier.
+ *   ctx(in): identifier context structure pointer
+ *   signal(in): input signal container, with signal->count valid samples
+ *   returns: SSTV_DETECT_SUCCESSFUL if the whole signal was consumed
+ *            error code otherwise
+ *
+ * NOTE: Only the sync pulses are looked at: their spacing and width are
+ * matched against the timing of every supported mode, as generated by the
+ * encoder. A few lines of image are usually enough for a clear result.
+ */
+extern sstv_error_t sstv_identify_mode(void *ctx, sstv_signal_t *signal);
+
+/*
+ * Retrieve the most likely modes of the signal fed so far.
+ *   ctx(in): identifier context structure pointer
+ *   candidates(out): candidates, highest confidence first
+ *   count(in/out): in, capacity of candidates; out, number of candidates set
+ *   returns: error code
+ *
+ * NOTE: Modes that only differ in their VIS code (e.g. the Robot B/W
+ * variants) have identical timing, and come out with the same confidence.
+ * NOTE: A decoder on which sstv_decoder_skip_header() was called can be fed
+ * the signal starting at the sync_offset of a candidate; image lines then
+ * start with the first line received.
+ */
+extern sstv_error_t sstv_get_mode_candidates(void *ctx, sstv_mode_candidate_t *candidates, uint32_t *count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,633 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "libsstv.h"
+#include "sstv.h"
+#include "demod.h"
+#include "encoder.h"
+
+/*
+ * Identifier tuning
+ */
+#define SSTV_MODEID_MIN_PULSE_MS    3   /* shortest sync is Martin M3/M4, 4.862ms */
+#define SSTV_MODEID_MAX_PULSE_MS    26  /* longest sync is PD, 20ms */
+#define SSTV_MODEID_BRIDGE_MS       1   /* tolerated noise inside a sync pulse */
+#define SSTV_MODEID_DEVIATION_HZ    150 /* mean distance of a sync pulse from the sync tone */
+#define SSTV_MODEID_TOLERANCE_MS    1   /* sync period match, plus sample clock drift */
+#define SSTV_MODEID_MAX_DRIFT_PPM   1000
+#define SSTV_MODEID_WIDTH_SHIFT     3   /* sync width average, 1/8 */
+#define SSTV_MODEID_HISTORY         16  /* sync onsets looked back at */
+
+#define SSTV_MODEID_MIN_RATE        6000
+#define SSTV_MODEID_MAX_RATE        384000
+
+/* widest image line, as read by the timing walk */
+#define SSTV_MODEID_MAX_WIDTH       800
+#define SSTV_MODEID_WALK_LINES      6
+#define SSTV_MODEID_WALK_TONES      16
+
+/*
+ * Candidate modes, one entry per VIS code
+ */
+static const sstv_mode_t sstv_modeid_modes[] = {
+    SSTV_MODE_FAX480,
+
+    SSTV_MODE_ROBOT_BW8_R, SSTV_MODE_ROBOT_BW8_G, SSTV_MODE_ROBOT_BW8_B,
+    SSTV_MODE_ROBOT_BW12_R, SSTV_MODE_ROBOT_BW12_G, SSTV_MODE_ROBOT_BW12_B,
+    SSTV_MODE_ROBOT_BW24_R, SSTV_MODE_ROBOT_BW24_G, SSTV_MODE_ROBOT_BW24_B,
+    SSTV_MODE_ROBOT_BW36_R, SSTV_MODE_ROBOT_BW36_G, SSTV_MODE_ROBOT_BW36_B,
+    SSTV_MODE_ROBOT_C12, SSTV_MODE_ROBOT_C24, SSTV_MODE_ROBOT_C36, SSTV_MODE_ROBOT_C72,
+
+    SSTV_MODE_SCOTTIE_S1, SSTV_MODE_SCOTTIE_S2, SSTV_MODE_SCOTTIE_S3, SSTV_MODE_SCOTTIE_S4,
+    SSTV_MODE_SCOTTIE_DX,
+
+    SSTV_MODE_MARTIN_M1, SSTV_MODE_MARTIN_M2, SSTV_MODE_MARTIN_M3, SSTV_MODE_MARTIN_M4,
+
+    SSTV_MODE_PD50, SSTV_MODE_PD90, SSTV_MODE_PD120, SSTV_MODE_PD160,
+    SSTV_MODE_PD180, SSTV_MODE_PD240, SSTV_MODE_PD290
+};
+
+#define SSTV_MODEID_MODE_COUNT (sizeof(sstv_modeid_modes) / sizeof(sstv_modeid_modes[0]))
+
+/*
+ * Sync structure of a mode, as generated by the encoder
+ */
+typedef struct {
+    uint64_t period; /* usamp between sync onsets */
+    uint64_t lead;   /* usamp from line start to the next sync onset */
+
+    /* fixed tone that tells apart consecutive sync periods, if they differ */
+    uint32_t probe;
+    uint64_t probe_offset; /* usamp after sync onset */
+    uint64_t probe_length; /* usamp */
+    uint32_t probe_first;  /* phase delta in the period a line starts with */
+    uint32_t probe_second; /* phase delta in the period after that */
+} sstv_modeid_structure_t;
+
+/*
+ * Identifier context
+ */
+typedef struct {
+    /* input configuration */
+    uint32_t sample_rate;
+
+    /* frequency demodulator */
+    sstv_demod_t demod;
+
+    /* index of next demodulated sample */
+    uint64_t position;
+
+    /* sync pulse detector, on the demodulated frequency */
+    struct {
+        int32_t threshold;
+        int32_t sync;
+        int64_t max_deviation;
+        uint32_t min_width;
+        uint32_t max_width;
+        uint32_t bridge;
+        uint32_t active;
+        uint64_t start;
+        uint64_t last_low;
+        uint32_t lows;
+        int64_t deviation;
+        uint32_t width; /* samples, Q8 average */
+    } pulse;
+
+    /* onsets of the most recent sync pulses */
+    struct {
+        uint64_t onset[SSTV_MODEID_HISTORY];
+        uint32_t count;
+        uint32_t scored;
+    } history;
+
+    /* per-mode sync structure and match statistics */
+    struct {
+        sstv_mode_t mode;
+        sstv_modeid_structure_t st;
+        uint32_t width;        /* sync pulse, samples */
+        uint32_t score;
+        uint32_t chained;
+        uint64_t start;        /* first onset of a matched sync chain */
+
+        /* probe of the tone following a matched sync, with votes on whether
+           lines start at the chain start or one period later */
+        struct {
+            uint64_t onset;
+            uint64_t from;
+            uint64_t to;
+            int64_t sum;
+            int32_t votes;
+        } parity;
+    } model[SSTV_MODEID_MODE_COUNT];
+
+    /* modes with alternating lines */
+    uint32_t probed[SSTV_MODEID_MODE_COUNT];
+    uint32_t probes;
+
+    /* demodulated block */
+    int32_t freq[SSTV_DEMOD_BLOCK_LENGTH];
+    uint8_t pixel[SSTV_DEMOD_BLOCK_LENGTH];
+} sstv_modeid_context_t;
+
+/*
+ * Default identifier contexts, for when no allocation/deallocation routines are provided
+ */
+static sstv_modeid_context_t default_modeid_context[SSTV_DEFAULT_MODE_IDENTIFIER_CONTEXT_COUNT];
+static uint64_t default_modeid_context_usage = 0x0;
+
+/* image walked over by the timing generator; only the first lines are read,
+   and pixel values do not affect timing, so it can stay in read-only memory */
+static const uint8_t sstv_modeid_walk_buffer[SSTV_MODEID_MAX_WIDTH * SSTV_MODEID_WALK_LINES * 3];
+
+static sstv_error_t
+sstv_modeid_walk(sstv_encoder_context_t *timing, sstv_mode_t mode, uint32_t sample_rate,
+                 sstv_modeid_structure_t *st)
+{
+    struct {
+        uint64_t offset;
+        uint64_t length;
+        uint32_t phase_delta;
+        uint32_t period;
+    } tone[SSTV_MODEID_WALK_TONES];
+    uint64_t elapsed = 0, image_start = 0;
+    uint64_t sync[4];
+    uint32_t syncs = 0, tones = 0, first, i, j;
+    sstv_error_t rc;
+
+    /* only some fields are set below; clear the rest (stats, ISR queue) so
+       the state machine never sees stack garbage. A plain loop, the library
+       has no memset */
+    {
+        uint8_t *p = (uint8_t *)timing;
+        for (i = 0; i < sizeof(*timing); i ++) {
+            p[i] = 0;
+        }
+    }
+
+    rc = sstv_get_mode_image_props(mode, &timing->image.width, &timing->image.height, &timing->image.format);
+    if (rc != SSTV_OK) {
+        return rc;
+    }
+    if (timing->image.width > SSTV_MODEID_MAX_WIDTH) {
+        return SSTV_INTERNAL_ERROR;
+    }
+    rc = sstv_get_mode_descriptor(mode, sample_rate, &timing->descriptor);
+    if (rc != SSTV_OK) {
+        return rc;
+    }
+
+    timing->image.buffer = (uint8_t *)sstv_modeid_walk_buffer;
+    timing->mode = mode;
+    timing->sample_rate = sample_rate;
+    timing->state = SSTV_ENCODER_STATE_START;
+
+    /* run the state machine up to the fourth sync; the first one may be
+       special (Scottie), the distance between the next two is the period,
+       and the fixed tones after them show whether lines alternate (Robot
+       4:2:0 chroma) */
+    while (syncs < 4) {
+        sstv_encoder_state_t prev = timing->state;
+
+        timing->fsk.remaining_usamp = 0;
+        rc = sstv_encode_state_change(timing);
+        if (rc != SSTV_OK) {
+            return rc;
+        }
+        if (timing->state == SSTV_ENCODER_STATE_END) {
+            return SSTV_INTERNAL_ERROR;
+        }
+
+        if (prev == SSTV_ENCODER_STATE_VIS_STOP_BIT) {
+            image_start = elapsed;
+        }
+        if (timing->state == SSTV_ENCODER_STATE_SYNC || timing->state == SSTV_ENCODER_STATE_SYNC_FIRST) {
+            sync[syncs ++] = elapsed;
+        } else if (syncs >= 2 && tones < SSTV_MODEID_WALK_TONES
+                   && (timing->state < SSTV_ENCODER_STATE_Y_SCAN || timing->state > SSTV_ENCODER_STATE_B_SCAN)) {
+            tone[tones].offset = elapsed - sync[syncs - 1];
+            tone[tones].length = timing->fsk.remaining_usamp;
+            tone[tones].phase_delta = timing->fsk.phase_delta;
+            tone[tones].period = syncs - 2;
+            tones ++;
+        }
+
+        elapsed += timing->fsk.remaining_usamp;
+    }
+
+    st->period = sync[2] - sync[1];
+    st->lead = (sync[1] - image_start) % st->period;
+
+    /* period that lines start with (0 for sync[1], 1 for sync[2]) */
+    first = (uint32_t) (((sync[1] - image_start) / st->period) & 0x1);
+
+    st->probe = 0;
+    for (i = 0; i < tones && !st->probe; i ++) {
+        for (j = i + 1; j < tones; j ++) {
+            if (tone[i].period == 0 && tone[j].period == 1
+                && tone[i].offset == tone[j].offset && tone[i].length == tone[j].length
+                && tone[i].phase_delta != tone[j].phase_delta) {
+                st->probe = 1;
+                st->probe_offset = tone[i].offset;
+                st->probe_length = tone[i].length;
+                st->probe_first = (first == 0 ? tone[i].phase_delta : tone[j].phase_delta);
+                st->probe_second = (first == 0 ? tone[j].phase_delta : tone[i].phase_delta);
+                break;
+            }
+        }
+    }
+
+    return SSTV_OK;
+}
+
+sstv_error_t
+sstv_create_mode_identifier(void **out_ctx, uint32_t sample_rate)
+{
+    sstv_modeid_context_t *ctx = NULL;
+    sstv_encoder_context_t timing;
+    sstv_error_t rc;
+    uint32_t i;
+
+    /* check input */
+    if (!out_ctx) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    if (sample_rate < SSTV_MODEID_MIN_RATE || sample_rate > SSTV_MODEID_MAX_RATE) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* create context */
+    if (sstv_malloc_user) {
+        /* user allocator */
+        ctx = (sstv_modeid_context_t *) sstv_malloc_user(sizeof(sstv_modeid_context_t));
+        if (!ctx) {
+            return SSTV_ALLOC_FAIL;
+        }
+    } else {
+        /* use default contexts */
+        for (i = 0; i < SSTV_DEFAULT_MODE_IDENTIFIER_CONTEXT_COUNT; i++) {
+            if ((default_modeid_context_usage & (0x1 << i)) == 0) {
+                default_modeid_context_usage |= (0x1 << i);
+                ctx = &default_modeid_context[i];
+                break;
+            }
+        }
+        if (!ctx) {
+            return SSTV_NO_DEFAULT_IDENTIFIERS;
+        }
+    }
+
+    /* initialize context */
+    ctx->sample_rate = sample_rate;
+    ctx->position = 0;
+    ctx->history.count = 0;
+    ctx->history.scored = 0;
+    ctx->probes = 0;
+
+    /* sync structure of every mode */
+    for (i = 0; i < SSTV_MODEID_MODE_COUNT; i ++) {
+        rc = sstv_modeid_walk(&timing, sstv_modeid_modes[i], sample_rate, &ctx->model[i].st);
+        if (rc != SSTV_OK) {
+            sstv_delete_mode_identifier(ctx);
+            return rc;
+        }
+        ctx->model[i].mode = sstv_modeid_modes[i];
+        ctx->model[i].width = (uint32_t) (timing.descriptor.sync.time.usamp / 1000000);
+        ctx->model[i].score = 0;
+        ctx->model[i].chained = 0;
+        ctx->model[i].start = 0;
+        ctx->model[i].parity.to = 0;
+        ctx->model[i].parity.votes = 0;
+        if (ctx->model[i].st.probe) {
+            ctx->probed[ctx->probes ++] = i;
+        }
+    }
+
+    /* all modes share sync and porch tones, and the pixel range only matters
+       for the (unused) pixel output of the demodulator */
+    rc = sstv_demod_init(&ctx->demod, sample_rate,
+                         timing.descriptor.pixel.val_phase_delta[0],
+                         timing.descriptor.pixel.val_phase_delta[255]);
+    if (rc != SSTV_OK) {
+        sstv_delete_mode_identifier(ctx);
+        return rc;
+    }
+
+    ctx->pulse.threshold =
+        (int32_t) ((timing.descriptor.sync.freq.phase_delta + timing.descriptor.porch.freq.phase_delta) / 2);
+    ctx->pulse.sync = (int32_t) timing.descriptor.sync.freq.phase_delta;
+    ctx->pulse.max_deviation = (int64_t) ((((uint64_t)SSTV_MODEID_DEVIATION_HZ) << 32) / sample_rate);
+    ctx->pulse.min_width = sample_rate / 1000 * SSTV_MODEID_MIN_PULSE_MS;
+    ctx->pulse.max_width = sample_rate / 1000 * SSTV_MODEID_MAX_PULSE_MS;
+    ctx->pulse.bridge = sample_rate / 1000 * SSTV_MODEID_BRIDGE_MS;
+    ctx->pulse.active = 0;
+    ctx->pulse.width = 0;
+
+    /* set output */
+    *out_ctx = ctx;
+
+    /* all ok */
+    return SSTV_OK;
+}
+
+sstv_error_t
+sstv_delete_mode_identifier(void *ctx)
+{
+    uint32_t i;
+
+    if (!ctx) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* check default contexts */
+    for (i = 0; i < SSTV_DEFAULT_MODE_IDENTIFIER_CONTEXT_COUNT; i++) {
+        if (ctx == default_modeid_context+i) {
+            default_modeid_context_usage &= ~(0x1 << i);
+            ctx = NULL;
+            break;
+        }
+    }
+
+    /* deallocate context */
+    if (ctx) {
+        if (!sstv_free_user) {
+            return SSTV_BAD_USER_DEALLOC;
+        }
+        sstv_free_user(ctx);
+    }
+
+    /* all ok */
+    return SSTV_OK;
+}
+
+static inline uint64_t
+sstv_modeid_distance(uint64_t a, uint64_t b)
+{
+    return (a > b ? a - b : b - a);
+}
+
+/*
+ * Lines that alternate in structure (Robot 4:2:0) can only be decoded from
+ * the right one of every two syncs; the middle half of the tone that differs
+ * between them is averaged after matched syncs to find out which.
+ */
+static void
+sstv_modeid_parity_start(sstv_modeid_context_t *ctx, uint32_t i, uint64_t onset)
+{
+    sstv_modeid_structure_t *st = &ctx->model[i].st;
+    uint64_t from = st->probe_offset + st->probe_length / 4;
+
+    if (st->probe_length / 2 < 1000000) {
+        return;
+    }
+
+    ctx->model[i].parity.onset = onset;
+    ctx->model[i].parity.from = onset + from / 1000000;
+    ctx->model[i].parity.to = onset + (from + st->probe_length / 2) / 1000000;
+    ctx->model[i].parity.sum = 0;
+}
+
+static void
+sstv_modeid_parity_end(sstv_modeid_context_t *ctx, uint32_t i)
+{
+    sstv_modeid_structure_t *st = &ctx->model[i].st;
+    int64_t count = (int64_t) (ctx->model[i].parity.to - ctx->model[i].parity.from);
+    int64_t first, second, avg;
+    uint64_t periods;
+    uint32_t is_first;
+
+    ctx->model[i].parity.to = 0;
+    avg = ctx->model[i].parity.sum / count;
+    first = (int64_t)st->probe_first - avg;
+    second = (int64_t)st->probe_second - avg;
+    is_first = ((first < 0 ? -first : first) < (second < 0 ? -second : second));
+
+    /* parity of the chain start, from that of the probed sync */
+    periods = ((ctx->model[i].parity.onset - ctx->model[i].start) * 1000000 + st->period / 2) / st->period;
+    if (is_first ^ (uint32_t)(periods & 0x1)) {
+        ctx->model[i].parity.votes ++;
+    } else {
+        ctx->model[i].parity.votes --;
+    }
+}
+
+/*
+ * Score a sync pulse onset against every mode. This is the autocorrelation of
+ * the sync pulse train, evaluated only at the lags the modes can produce: a
+ * mode scores fully when the previous pulse sits one period back, and half
+ * when it sits two periods back (one missed pulse) or when one period back is
+ * another, earlier pulse (a spurious one in between). Pulse trains at half
+ * or twice the period of a mode therefore only ever score half for it.
+ */
+static void
+sstv_modeid_onset(sstv_modeid_context_t *ctx, uint64_t onset)
+{
+    uint32_t i, j, n = ctx->history.count;
+
+    if (n > 0) {
+        uint64_t latest = (onset - ctx->history.onset[(n - 1) % SSTV_MODEID_HISTORY]) * 1000000;
+        uint32_t depth = (n < SSTV_MODEID_HISTORY ? n : SSTV_MODEID_HISTORY);
+
+        for (i = 0; i < SSTV_MODEID_MODE_COUNT; i ++) {
+            uint64_t period = ctx->model[i].st.period;
+            uint64_t tolerance;
+
+            /* match tolerance grows with the lag, for sample clock drift */
+            tolerance = (uint64_t)ctx->sample_rate * 1000 * SSTV_MODEID_TOLERANCE_MS
+                + latest / 1000000 * SSTV_MODEID_MAX_DRIFT_PPM;
+
+            if (sstv_modeid_distance(latest, period) <= tolerance) {
+                ctx->model[i].score += 2;
+                if (!ctx->model[i].chained) {
+                    ctx->model[i].chained = 1;
+                    ctx->model[i].start = onset - latest / 1000000;
+                }
+                if (ctx->model[i].st.probe && !ctx->model[i].parity.to) {
+                    sstv_modeid_parity_start(ctx, i, onset);
+                }
+                continue;
+            }
+
+            if (sstv_modeid_distance(latest, 2 * period) <= 2 * tolerance) {
+                ctx->model[i].score ++;
+                continue;
+            }
+
+            for (j = 1; j < depth; j ++) {
+                uint64_t lag = (onset - ctx->history.onset[(n - 1 - j) % SSTV_MODEID_HISTORY]) * 1000000;
+                if (sstv_modeid_distance(lag, period) <= tolerance) {
+                    ctx->model[i].score ++;
+                    break;
+                }
+            }
+        }
+
+        ctx->history.scored ++;
+    }
+
+    ctx->history.onset[n % SSTV_MODEID_HISTORY] = onset;
+    ctx->history.count ++;
+}
+
+static void
+sstv_modeid_pulse_end(sstv_modeid_context_t *ctx)
+{
+    uint64_t width = ctx->pulse.last_low - ctx->pulse.start + 1;
+
+    ctx->pulse.active = 0;
+    if (width < ctx->pulse.min_width || width > ctx->pulse.max_width) {
+        return;
+    }
+
+    /* noise also dips below the threshold, but not steadily at the sync tone */
+    if (ctx->pulse.deviation > ctx->pulse.max_deviation * ctx->pulse.lows) {
+        return;
+    }
+
+    /* running average of the sync width, in Q8 */
+    if (ctx->history.count == 0) {
+        ctx->pulse.width = (uint32_t) (width << 8);
+    } else {
+        int64_t delta = (int64_t)(width << 8) - ctx->pulse.width;
+        ctx->pulse.width = (uint32_t) (ctx->pulse.width + (delta >> SSTV_MODEID_WIDTH_SHIFT));
+    }
+
+    sstv_modeid_onset(ctx, ctx->pulse.start);
+}
+
+sstv_error_t
+sstv_identify_mode(void *ctx, sstv_signal_t *signal)
+{
+    sstv_modeid_context_t *context = (sstv_modeid_context_t *)ctx;
+    uint32_t offset = 0;
+
+    if (!context || !signal) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    switch (signal->type) {
+        case SSTV_SAMPLE_INT8:
+        case SSTV_SAMPLE_UINT8:
+        case SSTV_SAMPLE_INT16:
+            break;
+
+        default:
+            return SSTV_BAD_SAMPLE_TYPE;
+    }
+
+    while (offset < signal->count) {
+        uint32_t count = signal->count - offset;
+        uint32_t i;
+
+        if (count > SSTV_DEMOD_BLOCK_LENGTH) {
+            count = SSTV_DEMOD_BLOCK_LENGTH;
+        }
+        sstv_demod_process(&context->demod, signal, offset, count, context->freq, context->pixel);
+
+        for (i = 0; i < count; i ++, context->position ++) {
+            uint32_t p;
+
+            for (p = 0; p < context->probes; p ++) {
+                uint32_t m = context->probed[p];
+                if (context->model[m].parity.to && context->position >= context->model[m].parity.from) {
+                    context->model[m].parity.sum += context->freq[i];
+                    if (context->position + 1 == context->model[m].parity.to) {
+                        sstv_modeid_parity_end(context, m);
+                    }
+                }
+            }
+
+            if (context->freq[i] < context->pulse.threshold) {
+                int32_t deviation = context->freq[i] - context->pulse.sync;
+
+                if (!context->pulse.active) {
+                    context->pulse.active = 1;
+                    context->pulse.start = context->position;
+                    context->pulse.lows = 0;
+                    context->pulse.deviation = 0;
+                }
+                context->pulse.last_low = context->position;
+                context->pulse.lows ++;
+                context->pulse.deviation += (deviation < 0 ? -deviation : deviation);
+            } else if (context->pulse.active
+                       && context->position - context->pulse.last_low > context->pulse.bridge) {
+                sstv_modeid_pulse_end(context);
+            }
+        }
+
+        offset += count;
+    }
+
+    return SSTV_DETECT_SUCCESSFUL;
+}
+
+sstv_error_t
+sstv_get_mode_candidates(void *ctx, sstv_mode_candidate_t *candidates, uint32_t *count)
+{
+    sstv_modeid_context_t *context = (sstv_modeid_context_t *)ctx;
+    sstv_mode_candidate_t found[SSTV_MODEID_MODE_COUNT];
+    uint32_t i, j, n = 0;
+    uint64_t delay;
+
+    if (!context || !count || (*count > 0 && !candidates)) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    delay = sstv_demod_delay_usamp(&context->demod);
+
+    for (i = 0; i < SSTV_MODEID_MODE_COUNT; i ++) {
+        uint64_t expected, error, offset;
+        uint32_t confidence, shape;
+
+        if (!context->history.scored || !context->model[i].chained) {
+            continue;
+        }
+
+        /* period match, scaled by how well the average sync width fits */
+        confidence = context->model[i].score * 500 / context->history.scored;
+
+        expected = (uint64_t)context->model[i].width << 8;
+        error = sstv_modeid_distance(context->pulse.width, expected);
+        shape = (error >= expected ? 0 : (uint32_t) (1000 - error * 1000 / expected));
+        confidence = confidence * shape / 1000;
+        if (confidence == 0) {
+            continue;
+        }
+
+        /* line start, in input samples; a whole period is added where the
+           chain starts on the wrong one of alternating lines, or too early
+           for its line to be complete */
+        offset = context->model[i].start * 1000000;
+        if (context->model[i].parity.votes < 0) {
+            offset += context->model[i].st.period;
+        }
+        while (offset < delay + context->model[i].st.lead) {
+            offset += context->model[i].st.period * (context->model[i].st.probe ? 2 : 1);
+        }
+        offset -= delay + context->model[i].st.lead;
+
+        /* insert, highest confidence first */
+        for (j = n; j > 0 && found[j - 1].confidence < confidence; j --) {
+            found[j] = found[j - 1];
+        }
+        found[j].mode = context->model[i].mode;
+        found[j].confidence = confidence;
+        found[j].sync_offset = (offset + 500000) / 1000000;
+        n ++;
+    }
+
+    /* set output */
+    if (n < *count) {
+        *count = n;
+    }
+    for (i = 0; i < *count; i ++) {
+        candidates[i] = found[i];
+    }
+
+    /* all ok */
+    return SSTV_OK;
+}
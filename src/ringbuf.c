@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "libsstv.h"
+#include "sstv.h"
+
+/*
+ * Sample size helper
+ */
+static uint32_t
+sstv_sample_size(sstv_sample_type_t type)
+{
+    return (type == SSTV_SAMPLE_INT16 ? 2 : 1);
+}
+
+sstv_error_t
+sstv_pack_ringbuf(sstv_ringbuf_t *rb, sstv_sample_type_t type, uint32_t capacity, void *buffer)
+{
+    if (!rb || !buffer) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* capacity must be a power of two, so that indices may wrap freely */
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    switch (type) {
+        case SSTV_SAMPLE_INT8:
+        case SSTV_SAMPLE_UINT8:
+        case SSTV_SAMPLE_INT16:
+            break;
+
+        default:
+            return SSTV_BAD_SAMPLE_TYPE;
+    }
+
+    rb->buffer = buffer;
+    rb->type = type;
+    rb->capacity = capacity;
+    rb->head = 0;
+    rb->tail = 0;
+    rb->end = 0;
+    rb->underruns = 0;
+    rb->overruns = 0;
+    rb->low_water = capacity;
+
+    /* done */
+    return SSTV_OK;
+}
+
+sstv_error_t
+sstv_encode_ringbuf(void *ctx, sstv_ringbuf_t *rb)
+{
+    if (!ctx || !rb) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    if (rb->end) {
+        return SSTV_ENCODE_END;
+    }
+
+    /* head is only written here */
+    uint32_t head = rb->head;
+    uint32_t space = rb->capacity - (head - SSTV_ATOMIC_LOAD(&rb->tail));
+    if (space == 0) {
+        rb->overruns ++;
+        return SSTV_ENCODE_SUCCESSFUL;
+    }
+
+    /* fill free space, in at most two contiguous chunks */
+    while (space > 0) {
+        uint32_t offset = head & (rb->capacity - 1);
+        uint32_t chunk = rb->capacity - offset;
+        if (chunk > space) {
+            chunk = space;
+        }
+
+        sstv_signal_t signal;
+        sstv_error_t rc = sstv_pack_signal(&signal, rb->type, chunk,
+            (uint8_t *)rb->buffer + offset * sstv_sample_size(rb->type));
+        if (rc != SSTV_OK) {
+            return rc;
+        }
+
+        rc = sstv_encode(ctx, &signal);
+        if (rc != SSTV_ENCODE_SUCCESSFUL && rc != SSTV_ENCODE_END) {
+            return rc;
+        }
+
+        /* publish samples */
+        head += signal.count;
+        space -= signal.count;
+        SSTV_ATOMIC_STORE(&rb->head, head);
+
+        if (rc == SSTV_ENCODE_END) {
+            SSTV_ATOMIC_STORE(&rb->end, 1);
+            break;
+        }
+    }
+
+    return (rb->end ? SSTV_ENCODE_END : SSTV_ENCODE_SUCCESSFUL);
+}
+
+sstv_error_t
+sstv_ringbuf_read(sstv_ringbuf_t *rb, void *out, uint32_t count)
+{
+    if (!rb || !out) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* read end flag before head, so we never miss the last samples */
+    uint32_t end = SSTV_ATOMIC_LOAD(&rb->end);
+    uint32_t tail = rb->tail;
+    uint32_t avail = SSTV_ATOMIC_LOAD(&rb->head) - tail;
+    uint32_t n = (avail < count ? avail : count);
+    uint32_t mask = rb->capacity - 1;
+    uint32_t i;
+
+    /* headroom left to the producer, until it is done */
+    if (!end && avail < rb->low_water) {
+        rb->low_water = avail;
+    }
+
+    /* copy available samples and pad the rest with silence */
+    switch (rb->type) {
+        case SSTV_SAMPLE_INT8:
+            for (i = 0; i < n; i ++) {
+                ((int8_t *)out)[i] = ((int8_t *)rb->buffer)[(tail + i) & mask];
+            }
+            for (; i < count; i ++) {
+                ((int8_t *)out)[i] = 0;
+            }
+            break;
+
+        case SSTV_SAMPLE_UINT8:
+            for (i = 0; i < n; i ++) {
+                ((uint8_t *)out)[i] = ((uint8_t *)rb->buffer)[(tail + i) & mask];
+            }
+            for (; i < count; i ++) {
+                ((uint8_t *)out)[i] = 128;
+            }
+            break;
+
+        case SSTV_SAMPLE_INT16:
+            for (i = 0; i < n; i ++) {
+                ((int16_t *)out)[i] = ((int16_t *)rb->buffer)[(tail + i) & mask];
+            }
+            for (; i < count; i ++) {
+                ((int16_t *)out)[i] = 0;
+            }
+            break;
+
+        default:
+            return SSTV_BAD_SAMPLE_TYPE;
+    }
+
+    /* release consumed space to producer (tail is only written here) */
+    SSTV_ATOMIC_STORE(&rb->tail, tail + n);
+
+    if (n < count) {
+        if (end) {
+            return SSTV_ENCODE_END;
+        }
+        rb->underruns ++;
+        return SSTV_ENCODE_UNDERRUN;
+    }
+
+    return SSTV_OK;
+}
@@ -33,6 +33,15 @@
 sstv_malloc_t sstv_malloc_user = NULL;
 sstv_free_t sstv_free_user = NULL;
 
+/*
+ * User-defined trace hooks
+ */
+#ifdef SSTV_TRACE_HOOKS
+sstv_trace_func_t sstv_trace_begin_user = NULL;
+sstv_trace_func_t sstv_trace_end_user = NULL;
+void *sstv_trace_user = NULL;
+#endif
+
 
 sstv_error_t
 sstv_init(sstv_malloc_t alloc_func, sstv_free_t dealloc_func)
@@ -49,7 +58,28 @@ sstv_init(sstv_malloc_t alloc_func, sstv_free_t dealloc_func)
 }
 
 sstv_error_t
-sstv_convert_image(sstv_image_t *img, sstv_image_format_t format)
+sstv_set_trace_hooks(sstv_trace_func_t begin, sstv_trace_func_t end, void *user)
+{
+#ifdef SSTV_TRACE_HOOKS
+    /* Check that either both or none of the hooks are provided */
+    if ((!begin && end) || (begin && !end)) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    sstv_trace_begin_user = begin;
+    sstv_trace_end_user = end;
+    sstv_trace_user = user;
+    return SSTV_OK;
+#else
+    (void) begin;
+    (void) end;
+    (void) user;
+    return SSTV_UNSUPPORTED_FEATURE;
+#endif
+}
+
+static sstv_error_t
+sstv_convert_image_pixels(sstv_image_t *img, sstv_image_format_t format)
 {
     if (!img) {
         return SSTV_BAD_PARAMETER;
@@ -156,6 +186,18 @@ sstv_convert_image(sstv_image_t *img, sstv_image_format_t format)
     return SSTV_OK;
 }
 
+sstv_error_t
+sstv_convert_image(sstv_image_t *img, sstv_image_format_t format)
+{
+    sstv_error_t rc;
+
+    SSTV_TRACE_BEGIN(SSTV_TRACE_CONVERT_IMAGE, format);
+    rc = sstv_convert_image_pixels(img, format);
+    SSTV_TRACE_END(SSTV_TRACE_CONVERT_IMAGE, format);
+
+    return rc;
+}
+
 sstv_error_t
 sstv_get_mode_image_props(sstv_mode_t mode, uint32_t *width, uint32_t *height, sstv_image_format_t *format)
 {
@@ -448,6 +490,14 @@ sstv_pack_signal(sstv_signal_t *sig, sstv_sample_type_t type, uint32_t capacity,
             sig->size = 2 * capacity;
             break;
 
+        case SSTV_SAMPLE_CS16:
+            sig->size = 4 * capacity;
+            break;
+
+        case SSTV_SAMPLE_CF32:
+            sig->size = 8 * capacity;
+            break;
+
         default:
             return SSTV_BAD_SAMPLE_TYPE;
     }
@@ -467,6 +517,9 @@ sstv_get_mode_descriptor(sstv_mode_t mode, uint32_t sample_rate, sstv_mode_descr
     if (!desc) {
         return SSTV_INTERNAL_ERROR;
     }
+    if (sample_rate == 0) {
+        return SSTV_BAD_PARAMETER;
+    }
 
     /* Common desc and frequencies */
     desc->leader_tone.time = TIME_DESC_INIT(300000000, sample_rate); // 300ms
@@ -20,7 +20,7 @@ typedef struct {
 
 typedef struct {
     uint32_t nsec;
-    uint32_t usamp;
+    uint64_t usamp;
 } sstv_timing_desc_t;
 
 typedef struct {
@@ -79,12 +79,62 @@ typedef struct {
     } pixel;
 } sstv_mode_descriptor_t;
 
+/*
+ * Single-producer/single-consumer index access (GCC/Clang builtins, no libc)
+ */
+#define SSTV_ATOMIC_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define SSTV_ATOMIC_STORE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+
+/*
+ * Cycle counter, for ENCODER_CYCLE_STATS (zero where none is available)
+ */
+static inline uint64_t
+sstv_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ volatile ("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return 0;
+#endif
+}
+
 /*
  * Memory management
  */
 extern sstv_malloc_t sstv_malloc_user;
 extern sstv_free_t sstv_free_user;
 
+/*
+ * Trace hooks (compiled out without TRACE_HOOKS)
+ */
+#ifdef SSTV_TRACE_HOOKS
+extern sstv_trace_func_t sstv_trace_begin_user;
+extern sstv_trace_func_t sstv_trace_end_user;
+extern void *sstv_trace_user;
+
+#define SSTV_TRACE_BEGIN(event, arg) \
+    { \
+        if (sstv_trace_begin_user) { \
+            sstv_trace_begin_user((event), (arg), sstv_trace_user); \
+        } \
+    }
+#define SSTV_TRACE_END(event, arg) \
+    { \
+        if (sstv_trace_end_user) { \
+            sstv_trace_end_user((event), (arg), sstv_trace_user); \
+        } \
+    }
+#else
+#define SSTV_TRACE_BEGIN(event, arg)
+#define SSTV_TRACE_END(event, arg)
+#endif
+
 /*
  * Utility functions
  */
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _SSTV_TOOLS_DAEMON_HPP_
+#define _SSTV_TOOLS_DAEMON_HPP_
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <libsstv.h>
+
+/*
+ * sstv-encoded protocol, over a Unix stream socket. A connection carries any
+ * number of requests, one after the other, each a line of tab-separated fields:
+ *
+ *   mode \t sample_rate \t format \t input \t output \n
+ *
+ * sample_rate is 6000 to 384000 Hz. format is wav, s16, u8 or s8 (the last
+ * three for headerless PCM). input is an image path, or "-" with the RGB
+ * pixels of an image at the mode's resolution following the line. output is
+ * a path, or "-" for headerless samples sent back on the connection. Paths
+ * are taken on the daemon's side.
+ *
+ * The reply is "OK <samples>\n", followed for "-" outputs by exactly that many
+ * samples, or "ERR <message>\n". A connection that breaks off while samples
+ * are sent back means encoding failed half way.
+ */
+static constexpr uint32_t DAEMON_MIN_RATE = 6000;
+static constexpr uint32_t DAEMON_MAX_RATE = 384000;
+
+struct DaemonRequest {
+    std::string mode;
+    uint32_t sample_rate;
+    std::string format;
+    std::string input;
+    std::string output;
+};
+
+inline std::string format_request(const DaemonRequest& req)
+{
+    return req.mode + "\t" + std::to_string(req.sample_rate) + "\t" + req.format + "\t" + req.input + "\t"
+           + req.output + "\n";
+}
+
+inline bool parse_request(const std::string& line, DaemonRequest& req)
+{
+    std::vector<std::string> fields;
+    std::istringstream in(line);
+    std::string field;
+    while (std::getline(in, field, '\t')) {
+        fields.push_back(field);
+    }
+    if (fields.size() != 5 || fields[1].empty() || fields[1].find_first_not_of("0123456789") != std::string::npos
+        || fields[1].size() > 9) {
+        return false;
+    }
+
+    req.mode = fields[0];
+    req.sample_rate = (uint32_t)std::stoul(fields[1]);
+    req.format = fields[2];
+    req.input = fields[3];
+    req.output = fields[4];
+    return !req.mode.empty() && !req.input.empty() && !req.output.empty();
+}
+
+/* sample type of a headerless PCM format; false for wav and unknown formats */
+inline bool parse_sample_format(const std::string& format, sstv_sample_type_t& type)
+{
+    if (format == "s16") {
+        type = SSTV_SAMPLE_INT16;
+    } else if (format == "u8") {
+        type = SSTV_SAMPLE_UINT8;
+    } else if (format == "s8") {
+        type = SSTV_SAMPLE_INT8;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline const char *sample_format_name(sstv_sample_type_t type)
+{
+    return (type == SSTV_SAMPLE_UINT8 ? "u8" : type == SSTV_SAMPLE_INT8 ? "s8" : "s16");
+}
+
+/*
+ * Socket helpers; all throw std::runtime_error on failure
+ */
+inline int connect_unix(const std::string& path)
+{
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("socket path too long: " + path);
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("socket() failed: ") + std::strerror(errno));
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        int err = errno;
+        close(fd);
+        throw std::runtime_error("cannot connect to " + path + ": " + std::strerror(err));
+    }
+    return fd;
+}
+
+inline void write_all(int fd, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("write failed: ") + std::strerror(errno));
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+}
+
+/* false on end of stream before the first byte */
+inline bool read_exact(int fd, void *data, size_t size)
+{
+    uint8_t *p = (uint8_t *)data;
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = read(fd, p + got, size - got);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("read failed: ") + std::strerror(errno));
+        }
+        if (n == 0) {
+            if (got == 0) {
+                return false;
+            }
+            throw std::runtime_error("connection closed mid-message");
+        }
+        got += (size_t)n;
+    }
+    return true;
+}
+
+/*
+ * Reads lines and the data following them through a buffer, so a request or
+ * reply line does not cost one read() per byte
+ */
+class SocketReader {
+public:
+    explicit SocketReader(int fd = -1) : fd_(fd) {}
+
+    /* one line, without its newline; false on end of stream before it */
+    bool read_line(std::string& line, size_t max = 64 * 1024)
+    {
+        line.clear();
+        while (true) {
+            if (head_ == tail_ && !fill()) {
+                if (!line.empty()) {
+                    throw std::runtime_error("connection closed mid-line");
+                }
+                return false;
+            }
+
+            const char *begin = buffer_ + head_;
+            const char *newline = (const char *)std::memchr(begin, '\n', tail_ - head_);
+            size_t n = (newline ? (size_t)(newline - begin) : tail_ - head_);
+            if (line.size() + n > max) {
+                throw std::runtime_error("line too long");
+            }
+            line.append(begin, n);
+            head_ += n;
+            if (newline) {
+                head_ ++;
+                return true;
+            }
+        }
+    }
+
+    /* buffered bytes first, the rest straight from the socket; false on end
+       of stream before the first byte */
+    bool read_exact(void *data, size_t size)
+    {
+        size_t n = std::min(size, tail_ - head_);
+        std::memcpy(data, buffer_ + head_, n);
+        head_ += n;
+        if (n == size) {
+            return true;
+        }
+        if (!::read_exact(fd_, (uint8_t *)data + n, size - n)) {
+            if (n == 0) {
+                return false;
+            }
+            throw std::runtime_error("connection closed mid-message");
+        }
+        return true;
+    }
+
+private:
+    bool fill()
+    {
+        while (true) {
+            ssize_t n = read(fd_, buffer_, sizeof(buffer_));
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("read failed: ") + std::strerror(errno));
+            }
+            head_ = 0;
+            tail_ = (size_t)n;
+            return n > 0;
+        }
+    }
+
+    int fd_;
+    char buffer_[4096];
+    size_t head_ = 0;
+    size_t tail_ = 0;
+};
+
+#endif
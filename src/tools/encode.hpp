@@ -0,0 +1,600 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _SSTV_TOOLS_ENCODE_HPP_
+#define _SSTV_TOOLS_ENCODE_HPP_
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef SSTV_HAVE_MAGICK
+#include <Magick++.h>
+#endif
+#ifdef SSTV_HAVE_SNDFILE
+#include <sndfile.h>
+#endif
+
+#include <libsstv.h>
+
+#include "image.hpp"
+#include "trace.hpp"
+
+/*
+ * One image to encode
+ */
+struct EncodeJob {
+    sstv_mode_t mode;
+    std::string input;
+    std::string output;
+    uint32_t sample_rate;
+};
+
+/*
+ * How jobs are written out
+ */
+struct EncodeOptions {
+    bool raw = false;                                /* headerless PCM instead of WAV */
+    sstv_sample_type_t raw_type = SSTV_SAMPLE_INT16; /* sample type of headerless PCM */
+    size_t chunk = 128 * 1024;                       /* samples per sstv_encode() call */
+    bool mmap = false;                               /* encode straight into mapped output files */
+    bool verbose = false;                            /* per-block progress */
+    std::ostream *log = &std::cout;                  /* progress and summaries */
+};
+
+inline size_t sample_size(sstv_sample_type_t type)
+{
+    return type == SSTV_SAMPLE_INT16 ? 2 : 1;
+}
+
+/*
+ * Destination of the encoded samples
+ */
+class SampleSink {
+public:
+    virtual ~SampleSink() = default;
+
+    /* append count samples */
+    virtual void write(const void *samples, uint32_t count) = 0;
+
+    /* flush and close, reporting errors that only show up now */
+    virtual void close() = 0;
+};
+
+#ifdef SSTV_HAVE_SNDFILE
+/*
+ * 16-bit PCM WAV file, through libsndfile
+ */
+class WavSink : public SampleSink {
+public:
+    WavSink(const std::string& path, uint32_t sample_rate) : path_(path)
+    {
+        SF_INFO wavinfo;
+        wavinfo.samplerate = sample_rate;
+        wavinfo.channels = 1;
+        wavinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+        file_ = sf_open(path.c_str(), SFM_WRITE, &wavinfo);
+        if (!file_) {
+            throw std::runtime_error(std::string("sf_open() failed: ") + sf_strerror(NULL));
+        }
+    }
+
+    ~WavSink() override
+    {
+        if (file_) {
+            sf_close(file_);
+        }
+    }
+
+    void write(const void *samples, uint32_t count) override
+    {
+        if (sf_write_short(file_, (const int16_t *)samples, count) != count) {
+            throw std::runtime_error("cannot write " + path_ + ": " + sf_strerror(file_));
+        }
+    }
+
+    void close() override
+    {
+        int rc = sf_close(file_);
+        file_ = nullptr;
+        if (rc != 0) {
+            throw std::runtime_error("cannot write " + path_);
+        }
+    }
+
+private:
+    std::string path_;
+    SNDFILE *file_ = nullptr;
+};
+#endif
+
+/*
+ * Headerless PCM on a file, or on standard output for "-"; every chunk goes
+ * straight to write(2), without stdio buffering in between
+ */
+class RawSink : public SampleSink {
+public:
+    /* on an open descriptor, e.g. a socket, left open */
+    RawSink(int fd, const std::string& name, sstv_sample_type_t type)
+        : path_(name), sample_size_(sample_size(type)), fd_(fd)
+    {
+    }
+
+    RawSink(const std::string& path, sstv_sample_type_t type) : path_(path), sample_size_(sample_size(type))
+    {
+        if (path == "-") {
+            fd_ = STDOUT_FILENO;
+            path_ = "standard output";
+        } else {
+            fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd_ < 0) {
+                throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+            }
+            owned_ = true;
+        }
+    }
+
+    ~RawSink() override
+    {
+        if (owned_) {
+            ::close(fd_);
+        }
+    }
+
+    void write(const void *samples, uint32_t count) override
+    {
+        const uint8_t *data = (const uint8_t *)samples;
+        size_t left = (size_t)count * sample_size_;
+        while (left > 0) {
+            ssize_t n = ::write(fd_, data, left);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("cannot write " + path_ + ": " + std::strerror(errno));
+            }
+            data += n;
+            left -= (size_t)n;
+        }
+    }
+
+    void close() override
+    {
+        if (owned_) {
+            owned_ = false;
+            if (::close(fd_) != 0) {
+                throw std::runtime_error("cannot write " + path_ + ": " + std::strerror(errno));
+            }
+        }
+    }
+
+private:
+    std::string path_;
+    size_t sample_size_;
+    int fd_ = -1;
+    bool owned_ = false;
+};
+
+/*
+ * Output file of a known length, mapped into memory so that sstv_encode()
+ * writes samples straight into it
+ */
+class MappedOutput {
+public:
+    MappedOutput(const std::string& path, size_t size) : path_(path), size_(size)
+    {
+        fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+        }
+        if (ftruncate(fd_, (off_t)size) != 0) {
+            fail("ftruncate");
+        }
+        void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (base == MAP_FAILED) {
+            fail("mmap");
+        }
+        base_ = (uint8_t *)base;
+    }
+
+    ~MappedOutput()
+    {
+        if (base_) {
+            munmap(base_, size_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    MappedOutput(const MappedOutput&) = delete;
+    MappedOutput& operator=(const MappedOutput&) = delete;
+
+    uint8_t *data() { return base_; }
+
+    void close()
+    {
+        int rc = munmap(base_, size_);
+        base_ = nullptr;
+        if (rc != 0) {
+            fail("munmap");
+        }
+        rc = ::close(fd_);
+        fd_ = -1;
+        if (rc != 0) {
+            fail("close");
+        }
+    }
+
+private:
+    [[noreturn]] void fail(const char *call)
+    {
+        throw std::runtime_error(std::string(call) + "() failed on " + path_ + ": " + std::strerror(errno));
+    }
+
+    std::string path_;
+    size_t size_;
+    int fd_ = -1;
+    uint8_t *base_ = nullptr;
+};
+
+/*
+ * Canonical 44-byte header of a mono PCM WAV file
+ */
+inline const size_t WAV_HEADER_SIZE = 44;
+
+inline void put_le(uint8_t *p, uint32_t v, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i ++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+inline void write_wav_header(uint8_t *p, uint32_t sample_rate, uint16_t bits, uint32_t data_size)
+{
+    uint16_t block = bits / 8;
+    std::memcpy(p, "RIFF", 4);
+    put_le(p + 4, 36 + data_size, 4);
+    std::memcpy(p + 8, "WAVEfmt ", 8);
+    put_le(p + 16, 16, 4);                      /* fmt chunk size */
+    put_le(p + 20, 1, 2);                       /* PCM */
+    put_le(p + 22, 1, 2);                       /* channels */
+    put_le(p + 24, sample_rate, 4);
+    put_le(p + 28, sample_rate * block, 4);     /* byte rate */
+    put_le(p + 32, block, 2);                   /* block align */
+    put_le(p + 34, bits, 2);
+    std::memcpy(p + 36, "data", 4);
+    put_le(p + 40, data_size, 4);
+}
+
+#ifdef SSTV_HAVE_MAGICK
+/*
+ * Image file in any format ImageMagick reads, as RGB pixels scaled to the given resolution
+ */
+inline void load_image(const std::string& path, uint32_t width, uint32_t height, std::vector<uint8_t>& pixels,
+                       ChromeTrace *trace)
+{
+    Magick::Image image;
+    {
+        TraceScope scope(trace, "load");
+        image.read(path);
+    }
+    {
+        TraceScope scope(trace, "scale");
+        Magick::Geometry nsize(width, height);
+        nsize.aspect(true);
+        image.scale(nsize);
+    }
+
+    TraceScope scope(trace, "export");
+    image.colorSpace(Magick::sRGBColorspace);
+    Magick::PixelData blob(image, "RGB", Magick::CharPixel);
+    const uint8_t *data = (const uint8_t *)blob.data();
+    pixels.assign(data, data + (size_t)width * height * 3);
+}
+#endif
+
+/*
+ * Encodes jobs one after the other, keeping warm encoder contexts (one per
+ * mode and sample rate, rebound to every new image, up to MAX_CONTEXTS of
+ * them, least recently used dropped first), pixel and signal buffers
+ */
+class EncodeWorker {
+public:
+    static constexpr size_t MAX_CONTEXTS = 16;
+
+    EncodeWorker() = default;
+
+    ~EncodeWorker()
+    {
+        for (auto& c : contexts_) {
+            sstv_delete_encoder(c.second.ctx);
+        }
+    }
+
+    EncodeWorker(const EncodeWorker&) = delete;
+    EncodeWorker& operator=(const EncodeWorker&) = delete;
+
+    /* encodes job.input into job.output; returns the number of samples written */
+    uint64_t run(const EncodeJob& job, const EncodeOptions& opts, ChromeTrace *trace)
+    {
+        bind(job, opts, trace);
+        return encode(job, opts, trace);
+    }
+
+    /* buffer for RGB pixels of the given size, to bind with bind_pixels() */
+    uint8_t *pixel_buffer(size_t size)
+    {
+        file_.reset();
+        pixels_.resize(size);
+        return pixels_.data();
+    }
+
+    /* loads job.input and binds the encoder for job to it */
+    void bind(const EncodeJob& job, const EncodeOptions& opts, ChromeTrace *trace)
+    {
+        /* get image properties for chosen mode */
+        uint32_t width, height;
+        sstv_image_format_t format;
+        if (sstv_get_mode_image_props(job.mode, &width, &height, &format) != SSTV_OK) {
+            throw std::runtime_error("sstv_get_mode_image_props() failed");
+        }
+
+        /* load image from file */
+        if (opts.verbose) {
+            *opts.log << "Loading image from " << job.input << ", resizing to " << width << "x" << height << "\n";
+        }
+        sstv_image_t image;
+        {
+            TraceScope scope(trace, "load");
+            file_ = ImageFile::open(job.input, width, height);
+        }
+        if (file_) {
+            bool scaled = (file_->width() != width || file_->height() != height);
+            TraceScope scope(trace, (scaled ? "scale" : "export"));
+            image = file_->image(width, height, format, pixels_);
+        } else {
+#ifdef SSTV_HAVE_MAGICK
+            load_image(job.input, width, height, pixels_, trace);
+            if (sstv_pack_image(&image, width, height, SSTV_FORMAT_RGB, pixels_.data()) != SSTV_OK) {
+                throw std::runtime_error("sstv_pack_image() failed");
+            }
+#else
+            throw std::runtime_error("not a PPM, PGM, BMP or raw RGB image, and built without ImageMagick");
+#endif
+        }
+
+        bind_image(job, image, format, trace);
+    }
+
+    /* binds the encoder for job to the RGB pixels in pixel_buffer(), at the mode's resolution */
+    void bind_pixels(const EncodeJob& job, ChromeTrace *trace)
+    {
+        uint32_t width, height;
+        sstv_image_format_t format;
+        if (sstv_get_mode_image_props(job.mode, &width, &height, &format) != SSTV_OK) {
+            throw std::runtime_error("sstv_get_mode_image_props() failed");
+        }
+        if (pixels_.size() != (size_t)width * height * 3) {
+            throw std::runtime_error("pixel buffer does not hold a " + std::to_string(width) + "x"
+                                     + std::to_string(height) + " image");
+        }
+
+        sstv_image_t image;
+        if (sstv_pack_image(&image, width, height, SSTV_FORMAT_RGB, pixels_.data()) != SSTV_OK) {
+            throw std::runtime_error("sstv_pack_image() failed");
+        }
+        bind_image(job, image, format, trace);
+    }
+
+    /* exact length of the bound transmission */
+    uint64_t sample_count() const
+    {
+        uint64_t count;
+        if (sstv_encoder_get_sample_count(ctx_, &count) != SSTV_OK) {
+            throw std::runtime_error("sstv_encoder_get_sample_count() failed");
+        }
+        return count;
+    }
+
+    /* encodes the bound image into job.output; returns the number of samples written */
+    uint64_t encode(const EncodeJob& job, const EncodeOptions& opts, ChromeTrace *trace)
+    {
+        sstv_sample_type_t type = (opts.raw ? opts.raw_type : SSTV_SAMPLE_INT16);
+
+        /* files of known length are encoded into in place */
+#ifdef SSTV_HAVE_SNDFILE
+        bool mapped = opts.mmap;
+#else
+        bool mapped = opts.mmap || !opts.raw; /* the only WAV writer */
+#endif
+        if (mapped && job.output != "-") {
+            return encode_mapped(job, opts, type, trace);
+        }
+
+        /* open output */
+        std::unique_ptr<SampleSink> sink;
+        if (opts.raw) {
+            sink = std::make_unique<RawSink>(job.output, type);
+        } else {
+#ifdef SSTV_HAVE_SNDFILE
+            sink = std::make_unique<WavSink>(job.output, job.sample_rate);
+#else
+            throw std::runtime_error("built without libsndfile");
+#endif
+        }
+
+        uint64_t total = encode(*sink, type, opts, trace);
+
+        /* close output */
+        TraceScope scope(trace, "close");
+        sink->close();
+
+        return total;
+    }
+
+    /* encodes the bound image into sink; returns the number of samples written */
+    uint64_t encode(SampleSink& sink, sstv_sample_type_t type, const EncodeOptions& opts, ChromeTrace *trace)
+    {
+        samples_.resize(opts.chunk * sample_size(type));
+
+        uint64_t total = 0;
+        TraceScope encode_scope(trace, "encode");
+        while (true) {
+            /* encode block */
+            sstv_signal_t signal;
+            sstv_pack_signal(&signal, type, (uint32_t)opts.chunk, samples_.data());
+            sstv_error_t rc = sstv_encode(ctx_, &signal);
+            if (rc != SSTV_ENCODE_SUCCESSFUL && rc != SSTV_ENCODE_END) {
+                throw std::runtime_error("sstv_encode() failed with rc " + std::to_string(rc));
+            }
+
+            /* write out */
+            {
+                TraceScope scope(trace, "write");
+                sink.write(samples_.data(), signal.count);
+            }
+            total += signal.count;
+            if (opts.verbose) {
+                *opts.log << "Written " << signal.count << " samples\n";
+            }
+
+            /* exit case */
+            if (rc == SSTV_ENCODE_END) {
+                return total;
+            }
+        }
+    }
+
+private:
+    /* converts image to the mode's colorspace and binds an encoder to it */
+    void bind_image(const EncodeJob& job, sstv_image_t image, sstv_image_format_t format, ChromeTrace *trace)
+    {
+        /* convert to mode's colorspace */
+        {
+            TraceScope scope(trace, "convert");
+            if (sstv_convert_image(&image, format) != SSTV_OK) {
+                throw std::runtime_error("sstv_convert_image() failed");
+            }
+        }
+
+        /* rebind a warm encoder context, or create one */
+        TraceScope scope(trace, "create encoder");
+        auto key = std::make_pair(job.mode, job.sample_rate);
+        auto it = contexts_.find(key);
+        if (it != contexts_.end()) {
+            it->second.used = ++ uses_;
+            ctx_ = it->second.ctx;
+            if (sstv_encoder_rebind(ctx_, image, 0) != SSTV_OK) {
+                throw std::runtime_error("sstv_encoder_rebind() failed");
+            }
+            return;
+        }
+
+        if (contexts_.size() >= MAX_CONTEXTS) {
+            auto lru = std::min_element(contexts_.begin(), contexts_.end(), [](const auto& a, const auto& b) {
+                return a.second.used < b.second.used;
+            });
+            if (lru->second.ctx == ctx_) {
+                ctx_ = nullptr;
+            }
+            sstv_delete_encoder(lru->second.ctx);
+            contexts_.erase(lru);
+        }
+
+        void *ctx = nullptr;
+        if (sstv_create_encoder(&ctx, image, job.mode, job.sample_rate) != SSTV_OK || !ctx) {
+            throw std::runtime_error("Failed to create SSTV encoder");
+        }
+        contexts_[key] = { ctx, ++ uses_ };
+        ctx_ = ctx;
+    }
+
+    /* sizes the output from the mode timing, then encodes straight into it */
+    uint64_t encode_mapped(const EncodeJob& job, const EncodeOptions& opts, sstv_sample_type_t type, ChromeTrace *trace)
+    {
+        uint64_t count = sample_count();
+        size_t header = (opts.raw ? 0 : WAV_HEADER_SIZE);
+        uint64_t data_size = count * sample_size(type);
+        if (!opts.raw && data_size > UINT32_MAX - 36) {
+            throw std::runtime_error("signal too long for a WAV file");
+        }
+
+        std::unique_ptr<MappedOutput> file;
+        {
+            TraceScope scope(trace, "map");
+            file = std::make_unique<MappedOutput>(job.output, header + data_size);
+            if (!opts.raw) {
+                write_wav_header(file->data(), job.sample_rate, 16, (uint32_t)data_size);
+            }
+        }
+
+        /* encode */
+        uint8_t *data = file->data() + header;
+        uint64_t total = 0;
+        {
+            TraceScope encode_scope(trace, "encode");
+            while (true) {
+                /* encode block, in place */
+                sstv_signal_t signal;
+                uint32_t capacity = (uint32_t)std::min<uint64_t>(opts.chunk, count - total);
+                sstv_pack_signal(&signal, type, capacity, data + total * sample_size(type));
+                sstv_error_t rc = sstv_encode(ctx_, &signal);
+                if (rc != SSTV_ENCODE_SUCCESSFUL && rc != SSTV_ENCODE_END) {
+                    throw std::runtime_error("sstv_encode() failed with rc " + std::to_string(rc));
+                }
+                if (rc == SSTV_ENCODE_SUCCESSFUL && signal.count == 0) {
+                    throw std::runtime_error("signal longer than the predicted " + std::to_string(count) + " samples");
+                }
+                total += signal.count;
+                if (opts.verbose) {
+                    *opts.log << "Written " << signal.count << " samples\n";
+                }
+
+                /* exit case */
+                if (rc == SSTV_ENCODE_END) {
+                    break;
+                }
+            }
+        }
+        if (total != count) {
+            throw std::runtime_error("signal shorter than the predicted " + std::to_string(count) + " samples");
+        }
+
+        /* unmap and close */
+        TraceScope scope(trace, "close");
+        file->close();
+
+        return total;
+    }
+
+    struct WarmContext {
+        void *ctx;
+        uint64_t used; /* value of uses_ when last bound */
+    };
+
+    std::map<std::pair<sstv_mode_t, uint32_t>, WarmContext> contexts_;
+    uint64_t uses_ = 0;
+    void *ctx_ = nullptr;
+    std::unique_ptr<ImageFile> file_;
+    std::vector<uint8_t> pixels_;
+    std::vector<uint8_t> samples_;
+};
+
+#endif
@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _SSTV_TOOLS_FARM_HPP_
+#define _SSTV_TOOLS_FARM_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libsstv.h>
+
+/*
+ * Decodes many independent channels on a fixed pool of worker threads.
+ *
+ * Each channel owns a decoder and an output image, created up front by
+ * add_channel(). Input is copied into chunks drawn from a preallocated pool,
+ * so pushing and decoding do not allocate. A channel with pending input is
+ * queued on one worker (its home worker); idle workers steal queued channels
+ * from the others. A channel is only ever decoded by one worker at a time.
+ *
+ * An exception thrown while decoding a channel is caught on the worker and
+ * rethrown by the next drain() or stop(); the failed channel's remaining input
+ * is discarded, the other channels carry on.
+ */
+class DecoderFarm {
+public:
+    using clock = std::chrono::steady_clock;
+
+    /* called from a worker thread whenever a channel completes an image */
+    using ImageCallback = std::function<void(size_t channel, const sstv_image_t& image)>;
+
+    struct ChannelStats {
+        uint64_t samples = 0;
+        uint64_t chunks = 0;
+        uint64_t images = 0;
+        double busy_seconds = 0.0;
+        double latency_sum = 0.0;
+        double latency_max = 0.0;
+
+        /* decoded samples per second of worker time */
+        double throughput() const { return busy_seconds > 0.0 ? samples / busy_seconds : 0.0; }
+
+        /* push to decode completion, per chunk */
+        double latency_mean() const { return chunks ? latency_sum / chunks : 0.0; }
+    };
+
+    DecoderFarm(size_t workers, size_t chunk_samples = 4096, size_t chunk_count = 1024)
+        : workers_(std::max<size_t>(workers, 1)),
+          chunk_samples_(chunk_samples),
+          slab_(chunk_samples * chunk_count),
+          chunks_(chunk_count)
+    {
+        for (size_t i = 0; i < chunk_count; i ++) {
+            chunks_[i].data = slab_.data() + i * chunk_samples;
+            free_.push_back(&chunks_[i]);
+        }
+        for (auto& w : workers_) {
+            w = std::make_unique<Worker>();
+        }
+    }
+
+    ~DecoderFarm()
+    {
+        join();
+        for (auto& ch : channels_) {
+            sstv_delete_decoder(ch->decoder);
+            sstv_delete_image(&ch->image);
+        }
+    }
+
+    DecoderFarm(const DecoderFarm&) = delete;
+    DecoderFarm& operator=(const DecoderFarm&) = delete;
+
+    /* must be called before start() */
+    size_t add_channel(sstv_mode_t mode, uint32_t sample_rate)
+    {
+        if (!threads_.empty()) {
+            throw std::logic_error("channels must be added before start()");
+        }
+
+        auto ch = std::make_unique<Channel>();
+        if (sstv_create_image_from_mode(&ch->image, mode) != SSTV_OK) {
+            throw std::runtime_error("sstv_create_image_from_mode() failed");
+        }
+        if (sstv_create_decoder(&ch->decoder, ch->image, mode, sample_rate) != SSTV_OK) {
+            sstv_delete_image(&ch->image);
+            throw std::runtime_error("sstv_create_decoder() failed");
+        }
+
+        channels_.push_back(std::move(ch));
+        return channels_.size() - 1;
+    }
+
+    void on_image(ImageCallback cb)
+    {
+        callback_ = std::move(cb);
+    }
+
+    void start()
+    {
+        for (auto& w : workers_) {
+            w->queue.assign(channels_.size(), 0);
+        }
+        for (size_t i = 0; i < workers_.size(); i ++) {
+            threads_.emplace_back([this, i] { run(i); });
+        }
+    }
+
+    /* rethrows the first exception raised on a worker, if any */
+    void stop()
+    {
+        join();
+        rethrow();
+    }
+
+    /* copies input; blocks while the chunk pool is exhausted */
+    void push(size_t channel, const int16_t *samples, size_t count)
+    {
+        Channel& ch = *channels_.at(channel);
+
+        while (count > 0) {
+            Chunk *chunk = acquire_chunk();
+            chunk->count = (uint32_t) std::min(count, chunk_samples_);
+            std::memcpy(chunk->data, samples, chunk->count * sizeof(int16_t));
+            chunk->pushed = clock::now();
+            chunk->next = nullptr;
+            samples += chunk->count;
+            count -= chunk->count;
+
+            outstanding_ ++;
+
+            bool schedule;
+            {
+                std::lock_guard<std::mutex> lock(ch.mutex);
+                if (ch.tail) {
+                    ch.tail->next = chunk;
+                } else {
+                    ch.head = chunk;
+                }
+                ch.tail = chunk;
+                schedule = !ch.scheduled;
+                ch.scheduled = true;
+            }
+
+            if (schedule) {
+                enqueue(channel % workers_.size(), channel);
+            }
+        }
+    }
+
+    /* waits until all pushed input has been decoded; rethrows the first
+       exception raised on a worker, if any */
+    void drain()
+    {
+        {
+            std::unique_lock<std::mutex> lock(done_mutex_);
+            done_cv_.wait(lock, [this] { return outstanding_.load() == 0; });
+        }
+        rethrow();
+    }
+
+    size_t channel_count() const { return channels_.size(); }
+
+    /* only consistent after drain() */
+    const ChannelStats& stats(size_t channel) const { return channels_.at(channel)->stats; }
+
+private:
+    struct Chunk {
+        int16_t *data = nullptr;
+        uint32_t count = 0;
+        clock::time_point pushed;
+        Chunk *next = nullptr;
+    };
+
+    struct Channel {
+        void *decoder = nullptr;
+        sstv_image_t image;
+
+        /* pending input, guarded by mutex */
+        std::mutex mutex;
+        Chunk *head = nullptr;
+        Chunk *tail = nullptr;
+        bool scheduled = false;
+
+        /* only touched by the worker currently holding the channel */
+        ChannelStats stats;
+        bool failed = false;
+    };
+
+    /* fixed-capacity queue of channels; each channel is queued at most once */
+    struct Worker {
+        std::mutex mutex;
+        std::vector<size_t> queue;
+        size_t head = 0;
+        size_t tail = 0;
+    };
+
+    void join()
+    {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            stopping_ = true;
+        }
+        idle_cv_.notify_all();
+        for (auto& t : threads_) {
+            t.join();
+        }
+        threads_.clear();
+    }
+
+    /* keeps the first error only */
+    void fail(std::exception_ptr error)
+    {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+        if (!error_) {
+            error_ = error;
+        }
+    }
+
+    void rethrow()
+    {
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(error_mutex_);
+            std::swap(error, error_);
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    Chunk *acquire_chunk()
+    {
+        std::unique_lock<std::mutex> lock(free_mutex_);
+        free_cv_.wait(lock, [this] { return !free_.empty(); });
+        Chunk *chunk = free_.back();
+        free_.pop_back();
+        return chunk;
+    }
+
+    void release_chunk(Chunk *chunk)
+    {
+        {
+            std::lock_guard<std::mutex> lock(free_mutex_);
+            free_.push_back(chunk);
+        }
+        free_cv_.notify_one();
+    }
+
+    void enqueue(size_t worker, size_t channel)
+    {
+        Worker& w = *workers_[worker];
+        {
+            std::lock_guard<std::mutex> lock(w.mutex);
+            w.queue[w.tail % w.queue.size()] = channel;
+            w.tail ++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            queued_ ++;
+        }
+        idle_cv_.notify_one();
+    }
+
+    /* own queue from the front, other queues from the back */
+    bool dequeue(size_t worker, size_t& channel)
+    {
+        for (size_t i = 0; i < workers_.size(); i ++) {
+            Worker& w = *workers_[(worker + i) % workers_.size()];
+            std::lock_guard<std::mutex> lock(w.mutex);
+            if (w.head == w.tail) {
+                continue;
+            }
+            if (i == 0) {
+                channel = w.queue[w.head % w.queue.size()];
+                w.head ++;
+            } else {
+                w.tail --;
+                channel = w.queue[w.tail % w.queue.size()];
+            }
+
+            std::lock_guard<std::mutex> idle_lock(idle_mutex_);
+            queued_ --;
+            return true;
+        }
+        return false;
+    }
+
+    void run(size_t worker)
+    {
+        try {
+            work(worker);
+        } catch (...) {
+            fail(std::current_exception());
+        }
+    }
+
+    void work(size_t worker)
+    {
+        while (true) {
+            size_t channel;
+            if (!dequeue(worker, channel)) {
+                std::unique_lock<std::mutex> lock(idle_mutex_);
+                idle_cv_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+                if (stopping_ && queued_ == 0) {
+                    return;
+                }
+                continue;
+            }
+
+            process(worker, channel);
+        }
+    }
+
+    void process(size_t worker, size_t channel)
+    {
+        Channel& ch = *channels_[channel];
+
+        /* take everything pending so far */
+        Chunk *chunk;
+        {
+            std::lock_guard<std::mutex> lock(ch.mutex);
+            chunk = ch.head;
+            ch.head = ch.tail = nullptr;
+        }
+
+        size_t done = 0;
+        auto t0 = clock::now();
+        while (chunk) {
+            /* a failed channel still releases its chunks, so drain() returns */
+            if (!ch.failed) {
+                try {
+                    decode(channel, ch, *chunk);
+                } catch (...) {
+                    ch.failed = true;
+                    fail(std::current_exception());
+                }
+            }
+
+            auto now = clock::now();
+            double latency = std::chrono::duration<double>(now - chunk->pushed).count();
+            ch.stats.samples += chunk->count;
+            ch.stats.chunks ++;
+            ch.stats.latency_sum += latency;
+            ch.stats.latency_max = std::max(ch.stats.latency_max, latency);
+
+            Chunk *next = chunk->next;
+            release_chunk(chunk);
+            chunk = next;
+            done ++;
+        }
+        ch.stats.busy_seconds += std::chrono::duration<double>(clock::now() - t0).count();
+
+        /* more input arrived meanwhile? go to the back of our own queue, so
+           other channels get their turn */
+        bool requeue;
+        {
+            std::lock_guard<std::mutex> lock(ch.mutex);
+            requeue = (ch.head != nullptr);
+            ch.scheduled = requeue;
+        }
+        if (requeue) {
+            enqueue(worker, channel);
+        }
+
+        if ((outstanding_ -= done) == 0) {
+            std::lock_guard<std::mutex> lock(done_mutex_);
+            done_cv_.notify_all();
+        }
+    }
+
+    void decode(size_t channel, Channel& ch, const Chunk& chunk)
+    {
+        uint32_t offset = 0;
+        while (offset < chunk.count) {
+            sstv_signal_t signal;
+            sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, chunk.count - offset, chunk.data + offset);
+            signal.count = chunk.count - offset;
+
+            sstv_error_t rc = sstv_decode(ch.decoder, &signal);
+            if (rc == SSTV_DECODE_END) {
+                ch.stats.images ++;
+                if (callback_) {
+                    callback_(channel, ch.image);
+                }
+            } else if (rc != SSTV_DECODE_SUCCESSFUL) {
+                throw std::runtime_error("sstv_decode() failed with rc " + std::to_string(rc));
+            }
+            offset += signal.count;
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::vector<std::unique_ptr<Channel>> channels_;
+    ImageCallback callback_;
+
+    /* chunk pool */
+    size_t chunk_samples_;
+    std::vector<int16_t> slab_;
+    std::vector<Chunk> chunks_;
+    std::vector<Chunk *> free_;
+    std::mutex free_mutex_;
+    std::condition_variable free_cv_;
+
+    /* idle workers */
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+    size_t queued_ = 0;
+    bool stopping_ = false;
+
+    /* drain() */
+    std::atomic<size_t> outstanding_ { 0 };
+    std::mutex done_mutex_;
+    std::condition_variable done_cv_;
+
+    /* first exception raised on a worker */
+    std::mutex error_mutex_;
+    std::exception_ptr error_;
+};
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _SSTV_TOOLS_IMAGE_HPP_
+#define _SSTV_TOOLS_IMAGE_HPP_
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libsstv.h>
+
+/*
+ * Built-in image loaders: binary PPM (P6) and PGM (P5) with 8-bit samples,
+ * uncompressed 24 and 32-bit BMP, and headerless RGB (.rgb or .raw files,
+ * which must hold exactly one image of the mode's resolution).
+ *
+ * Files are mapped privately into memory. When the pixels are already laid
+ * out the way libsstv takes them (PPM and raw RGB, or PGM for black and white
+ * modes) at the mode's resolution, the image points straight into the mapping;
+ * it is copy-on-write, so converting the image in place leaves the file alone.
+ * Anything else is converted, and if needed bilinearly scaled, into a buffer.
+ */
+class ImageFile {
+public:
+    /* maps path; nullptr if it is in none of the built-in formats */
+    static std::unique_ptr<ImageFile> open(const std::string& path, uint32_t raw_width, uint32_t raw_height)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot read " + path);
+        }
+
+        void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            throw std::runtime_error("cannot map " + path + ": " + std::strerror(errno));
+        }
+
+        std::unique_ptr<ImageFile> file(new ImageFile((uint8_t *)map, (size_t)st.st_size));
+        if (!file->parse_pnm() && !file->parse_bmp() && !file->parse_raw(path, raw_width, raw_height)) {
+            return nullptr;
+        }
+        return file;
+    }
+
+    ~ImageFile()
+    {
+        munmap(map_, size_);
+    }
+
+    ImageFile(const ImageFile&) = delete;
+    ImageFile& operator=(const ImageFile&) = delete;
+
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+
+    /* true if image() needs no copy for this resolution and target format */
+    bool direct(uint32_t width, uint32_t height, sstv_image_format_t format) const
+    {
+        return width == width_ && height == height_ && !bgr_ && stride_ == (ptrdiff_t)(width_ * channels_)
+               && (channels_ == 3 || (channels_ == 1 && format == SSTV_FORMAT_Y));
+    }
+
+    /*
+     * Image of the given resolution, ready for sstv_convert_image() to format;
+     * pixels holds it unless it could be taken from the mapping directly
+     */
+    sstv_image_t image(uint32_t width, uint32_t height, sstv_image_format_t format, std::vector<uint8_t>& pixels)
+    {
+        sstv_image_t image;
+
+        if (direct(width, height, format)) {
+            sstv_pack_image(&image, width, height, (channels_ == 1 ? SSTV_FORMAT_Y : SSTV_FORMAT_RGB), data_);
+            return image;
+        }
+
+        pixels.resize((size_t)width * height * 3);
+        uint8_t *out = pixels.data();
+        if (width == width_ && height == height_) {
+            for (uint32_t y = 0; y < height; y ++) {
+                for (uint32_t x = 0; x < width; x ++) {
+                    pixel(x, y, out);
+                    out += 3;
+                }
+            }
+        } else {
+            /* bilinear, with pixel centers lined up */
+            double sx = (double)width_ / width, sy = (double)height_ / height;
+            for (uint32_t y = 0; y < height; y ++) {
+                double fy = std::min(std::max((y + 0.5) * sy - 0.5, 0.0), (double)(height_ - 1));
+                uint32_t y0 = (uint32_t)fy, y1 = std::min(y0 + 1, height_ - 1);
+                double wy = fy - y0;
+                for (uint32_t x = 0; x < width; x ++) {
+                    double fx = std::min(std::max((x + 0.5) * sx - 0.5, 0.0), (double)(width_ - 1));
+                    uint32_t x0 = (uint32_t)fx, x1 = std::min(x0 + 1, width_ - 1);
+                    double wx = fx - x0;
+
+                    uint8_t p00[3], p01[3], p10[3], p11[3];
+                    pixel(x0, y0, p00);
+                    pixel(x1, y0, p01);
+                    pixel(x0, y1, p10);
+                    pixel(x1, y1, p11);
+                    for (int c = 0; c < 3; c ++) {
+                        double top = p00[c] + (p01[c] - p00[c]) * wx;
+                        double bottom = p10[c] + (p11[c] - p10[c]) * wx;
+                        out[c] = (uint8_t)(top + (bottom - top) * wy + 0.5);
+                    }
+                    out += 3;
+                }
+            }
+        }
+
+        sstv_pack_image(&image, width, height, SSTV_FORMAT_RGB, pixels.data());
+        return image;
+    }
+
+private:
+    ImageFile(uint8_t *map, size_t size) : map_(map), size_(size) {}
+
+    /* RGB value of a stored pixel */
+    void pixel(uint32_t x, uint32_t y, uint8_t *rgb) const
+    {
+        const uint8_t *p = data_ + (ptrdiff_t)y * stride_ + (size_t)x * channels_;
+        if (channels_ == 1) {
+            rgb[0] = rgb[1] = rgb[2] = p[0];
+        } else if (bgr_) {
+            rgb[0] = p[2];
+            rgb[1] = p[1];
+            rgb[2] = p[0];
+        } else {
+            rgb[0] = p[0];
+            rgb[1] = p[1];
+            rgb[2] = p[2];
+        }
+    }
+
+    bool set_layout(uint8_t *data, uint32_t width, uint32_t height, uint32_t channels, ptrdiff_t stride, bool bgr)
+    {
+        if (width == 0 || height == 0) {
+            return false;
+        }
+        if (width > 65536 || height > 65536) {
+            throw std::runtime_error("image too large");
+        }
+
+        /* rows must lie within the file */
+        uint8_t *first = data, *last = data + (ptrdiff_t)(height - 1) * stride;
+        uint8_t *low = std::min(first, last), *high = std::max(first, last) + (size_t)width * channels;
+        if (low < map_ || high > map_ + size_) {
+            throw std::runtime_error("truncated image file");
+        }
+
+        data_ = data;
+        width_ = width;
+        height_ = height;
+        channels_ = channels;
+        stride_ = stride;
+        bgr_ = bgr;
+        return true;
+    }
+
+    /* P5/P6, maxval 255 */
+    bool parse_pnm()
+    {
+        if (size_ < 2 || map_[0] != 'P' || (map_[1] != '5' && map_[1] != '6')) {
+            return false;
+        }
+        uint32_t channels = (map_[1] == '6' ? 3 : 1);
+
+        size_t pos = 2;
+        uint32_t fields[3];
+        for (uint32_t &field : fields) {
+            /* whitespace and comments */
+            while (pos < size_ && (std::isspace(map_[pos]) || map_[pos] == '#')) {
+                if (map_[pos] == '#') {
+                    while (pos < size_ && map_[pos] != '\n') {
+                        pos ++;
+                    }
+                } else {
+                    pos ++;
+                }
+            }
+            if (pos >= size_ || !std::isdigit(map_[pos])) {
+                return false;
+            }
+            uint64_t value = 0;
+            while (pos < size_ && std::isdigit(map_[pos]) && value <= UINT32_MAX) {
+                value = value * 10 + (map_[pos ++] - '0');
+            }
+            if (value > UINT32_MAX) {
+                return false;
+            }
+            field = (uint32_t)value;
+        }
+
+        /* a single whitespace character ends the header */
+        if (fields[2] != 255 || pos >= size_ || !std::isspace(map_[pos])) {
+            return false;
+        }
+        pos ++;
+
+        return set_layout(map_ + pos, fields[0], fields[1], channels, (ptrdiff_t)fields[0] * channels, false);
+    }
+
+    /* BITMAPINFOHEADER or later, uncompressed, 24 or 32 bits per pixel */
+    bool parse_bmp()
+    {
+        if (size_ < 54 || map_[0] != 'B' || map_[1] != 'M') {
+            return false;
+        }
+        uint32_t offset = le32(10);
+        uint32_t header = le32(14);
+        int32_t width = (int32_t)le32(18);
+        int32_t height = (int32_t)le32(22);
+        uint32_t bpp = le16(28);
+        uint32_t compression = le32(30);
+        if (header < 40 || compression != 0 || (bpp != 24 && bpp != 32) || width <= 0 || height == 0
+            || height == INT32_MIN || offset >= size_) {
+            return false;
+        }
+
+        /* rows are padded to 4 bytes, and stored bottom-up unless height is negative */
+        uint32_t h = (uint32_t)(height < 0 ? -height : height);
+        ptrdiff_t stride = (((ptrdiff_t)width * bpp + 31) / 32) * 4;
+        uint8_t *data = map_ + offset;
+        if (height > 0) {
+            data += (ptrdiff_t)(h - 1) * stride;
+            stride = -stride;
+        }
+        return set_layout(data, (uint32_t)width, h, bpp / 8, stride, true);
+    }
+
+    /* headerless RGB, by extension */
+    bool parse_raw(const std::string& path, uint32_t width, uint32_t height)
+    {
+        std::string ext = path.substr(std::min(path.size(), path.rfind('.')));
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (ext != ".rgb" && ext != ".raw") {
+            return false;
+        }
+        if (size_ != (size_t)width * height * 3) {
+            throw std::runtime_error("raw RGB file is not " + std::to_string(width) + "x" + std::to_string(height)
+                                     + " pixels");
+        }
+        return set_layout(map_, width, height, 3, (ptrdiff_t)width * 3, false);
+    }
+
+    uint32_t le16(size_t pos) const { return map_[pos] | (map_[pos + 1] << 8); }
+    uint32_t le32(size_t pos) const { return le16(pos) | (le16(pos + 2) << 16); }
+
+    uint8_t *map_;
+    size_t size_;
+    uint8_t *data_ = nullptr;
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+    uint32_t channels_ = 0;
+    ptrdiff_t stride_ = 0;
+    bool bgr_ = false;
+};
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _SSTV_TOOLS_MODES_HPP_
+#define _SSTV_TOOLS_MODES_HPP_
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <cstdlib>
+
+#include <libsstv.h>
+
+inline std::map<std::string, sstv_mode_t> stringToModeMap = {
+    { "FAX480", SSTV_MODE_FAX480 },
+    { "ROBOT_BW8_R", SSTV_MODE_ROBOT_BW8_R },
+    { "ROBOT_BW8_G", SSTV_MODE_ROBOT_BW8_G },
+    { "ROBOT_BW8_B", SSTV_MODE_ROBOT_BW8_B },
+    { "ROBOT_BW12_R", SSTV_MODE_ROBOT_BW12_R },
+    { "ROBOT_BW12_G", SSTV_MODE_ROBOT_BW12_G },
+    { "ROBOT_BW12_B", SSTV_MODE_ROBOT_BW12_B },
+    { "ROBOT_BW24_R", SSTV_MODE_ROBOT_BW24_R },
+    { "ROBOT_BW24_G", SSTV_MODE_ROBOT_BW24_G },
+    { "ROBOT_BW24_B", SSTV_MODE_ROBOT_BW24_B },
+    { "ROBOT_BW36_R", SSTV_MODE_ROBOT_BW36_R },
+    { "ROBOT_BW36_G", SSTV_MODE_ROBOT_BW36_G },
+    { "ROBOT_BW36_B", SSTV_MODE_ROBOT_BW36_B },
+    { "ROBOT_C12", SSTV_MODE_ROBOT_C12 },
+    { "ROBOT_C24", SSTV_MODE_ROBOT_C24 },
+    { "ROBOT_C36", SSTV_MODE_ROBOT_C36 },
+    { "ROBOT_C72", SSTV_MODE_ROBOT_C72 },
+    { "SCOTTIE_S1", SSTV_MODE_SCOTTIE_S1 },
+    { "SCOTTIE_S2", SSTV_MODE_SCOTTIE_S2 },
+    { "SCOTTIE_S3", SSTV_MODE_SCOTTIE_S3 },
+    { "SCOTTIE_S4", SSTV_MODE_SCOTTIE_S4 },
+    { "SCOTTIE_DX", SSTV_MODE_SCOTTIE_DX },
+    { "MARTIN_M1", SSTV_MODE_MARTIN_M1 },
+    { "MARTIN_M2", SSTV_MODE_MARTIN_M2 },
+    { "MARTIN_M3", SSTV_MODE_MARTIN_M3 },
+    { "MARTIN_M4", SSTV_MODE_MARTIN_M4 },
+    { "PD50", SSTV_MODE_PD50 },
+    { "PD90", SSTV_MODE_PD90 },
+    { "PD120", SSTV_MODE_PD120 },
+    { "PD160", SSTV_MODE_PD160 },
+    { "PD180", SSTV_MODE_PD180 },
+    { "PD240", SSTV_MODE_PD240 },
+    { "PD290", SSTV_MODE_PD290 },
+};
+
+inline sstv_mode_t mode_from_string(std::string mode)
+{
+    std::transform(mode.begin(), mode.end(), mode.begin(), ::toupper);
+
+    if (auto it = stringToModeMap.find(mode); it != stringToModeMap.end()) {
+        return (*it).second;
+    } else {
+        std::cerr << "Unknown mode '" << mode << "'" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _SSTV_TOOLS_PCM_HPP_
+#define _SSTV_TOOLS_PCM_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libsstv.h>
+
+/*
+ * Memory-mapped PCM recording (WAV or headerless raw).
+ *
+ * Mono recordings are handed to the library straight from the mapping;
+ * for multi-channel ones the first channel is copied out, one block at a
+ * time, into a caller-provided scratch buffer.
+ */
+class PcmFile {
+public:
+    /* WAV file, 8-bit unsigned or 16-bit signed PCM */
+    explicit PcmFile(const std::string& path)
+    {
+        map(path);
+        parse_wav();
+    }
+
+    /* raw PCM, mono */
+    PcmFile(const std::string& path, sstv_sample_type_t type, uint32_t sample_rate)
+        : type_(type), sample_rate_(sample_rate), channels_(1)
+    {
+        map(path);
+        data_ = base_;
+        count_ = size_ / sample_size(type_);
+    }
+
+    ~PcmFile()
+    {
+        if (base_) {
+            munmap((void *)base_, size_);
+        }
+    }
+
+    PcmFile(const PcmFile&) = delete;
+    PcmFile& operator=(const PcmFile&) = delete;
+
+    sstv_sample_type_t type() const { return type_; }
+    uint32_t sample_rate() const { return sample_rate_; }
+    uint32_t channels() const { return channels_; }
+
+    /* samples per channel */
+    uint64_t count() const { return count_; }
+
+    double duration() const { return (double) count_ / sample_rate_; }
+
+    /* signal covering [offset, offset + count), count fitting in a uint32_t */
+    void signal(sstv_signal_t *signal, uint64_t offset, uint32_t count, std::vector<uint8_t>& scratch) const
+    {
+        size_t ssize = sample_size(type_);
+        const uint8_t *src = data_ + offset * ssize * channels_;
+        void *buffer = (void *)src;
+
+        if (channels_ > 1) {
+            scratch.resize((size_t)count * ssize);
+            for (uint32_t i = 0; i < count; i ++) {
+                std::memcpy(scratch.data() + i * ssize, src + (size_t)i * ssize * channels_, ssize);
+            }
+            buffer = scratch.data();
+        }
+
+        sstv_pack_signal(signal, type_, count, buffer);
+        signal->count = count;
+    }
+
+    static size_t sample_size(sstv_sample_type_t type)
+    {
+        return (type == SSTV_SAMPLE_INT16 ? 2 : 1);
+    }
+
+private:
+    void map(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + path);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            throw std::runtime_error("cannot read " + path);
+        }
+        size_ = (size_t) st.st_size;
+
+        void *p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            throw std::runtime_error("cannot map " + path);
+        }
+        madvise(p, size_, MADV_SEQUENTIAL);
+        base_ = (const uint8_t *)p;
+    }
+
+    static uint32_t le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+    static uint16_t le16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+    void parse_wav()
+    {
+        if (size_ < 12 || std::memcmp(base_, "RIFF", 4) != 0 || std::memcmp(base_ + 8, "WAVE", 4) != 0) {
+            throw std::runtime_error("not a WAV file");
+        }
+
+        bool have_fmt = false;
+        size_t pos = 12;
+        while (pos + 8 <= size_) {
+            const uint8_t *chunk = base_ + pos;
+            size_t length = le32(chunk + 4);
+            size_t body = pos + 8;
+
+            if (std::memcmp(chunk, "fmt ", 4) == 0 && length >= 16 && body + 16 <= size_) {
+                uint16_t tag = le16(base_ + body);
+                uint16_t bits = le16(base_ + body + 14);
+                channels_ = le16(base_ + body + 2);
+                sample_rate_ = le32(base_ + body + 4);
+
+                /* WAVE_FORMAT_PCM or WAVE_FORMAT_EXTENSIBLE */
+                if ((tag != 1 && tag != 0xfffe) || channels_ == 0) {
+                    throw std::runtime_error("unsupported WAV encoding (PCM only)");
+                }
+                if (bits == 8) {
+                    type_ = SSTV_SAMPLE_UINT8;
+                } else if (bits == 16) {
+                    type_ = SSTV_SAMPLE_INT16;
+                } else {
+                    throw std::runtime_error("unsupported WAV sample size " + std::to_string(bits));
+                }
+                have_fmt = true;
+            } else if (std::memcmp(chunk, "data", 4) == 0) {
+                if (!have_fmt) {
+                    throw std::runtime_error("WAV data before format");
+                }
+                /* streamed WAVs may leave the length unset; trust the file */
+                length = std::min(length, size_ - body);
+                data_ = base_ + body;
+                count_ = length / (sample_size(type_) * channels_);
+                return;
+            }
+
+            pos = body + length + (length & 1);
+        }
+
+        throw std::runtime_error("WAV file has no data");
+    }
+
+    const uint8_t *base_ = nullptr;
+    size_t size_ = 0;
+
+    const uint8_t *data_ = nullptr;
+    uint64_t count_ = 0;
+    sstv_sample_type_t type_ = SSTV_SAMPLE_INT16;
+    uint32_t sample_rate_ = 0;
+    uint32_t channels_ = 1;
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _SSTV_TOOLS_PERF_HPP_
+#define _SSTV_TOOLS_PERF_HPP_
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Hardware performance counters of the calling thread (Linux perf_event_open,
+ * user space only).
+ *
+ * Each counter is opened on its own, so that one the PMU lacks does not take
+ * the others down, and is scaled by its enabled/running time in case the
+ * kernel had to multiplex them. Where no counter can be opened (other
+ * systems, containers, perf_event_paranoid, virtual machines without a PMU)
+ * available() is false and error() says why; callers fall back to wall-clock.
+ */
+class PerfCounters {
+public:
+    enum Counter { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, COUNT };
+
+    struct Reading {
+        bool valid[COUNT] = {};
+        double value[COUNT] = {};
+
+        double per(Counter c, double n) const { return valid[c] && n > 0 ? value[c] / n : 0.0; }
+        double ipc() const { return valid[CYCLES] && valid[INSTRUCTIONS] && value[CYCLES] > 0 ? value[INSTRUCTIONS] / value[CYCLES] : 0.0; }
+    };
+
+    PerfCounters()
+    {
+        for (int c = 0; c < COUNT; c ++) {
+            fd_[c] = -1;
+        }
+
+#if defined(__linux__)
+        static const struct { uint32_t type; uint64_t config; } events[COUNT] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                  | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        };
+
+        for (int c = 0; c < COUNT; c ++) {
+            struct perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[c].type;
+            attr.config = events[c].config;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            fd_[c] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+            if (fd_[c] < 0 && error_.empty()) {
+                error_ = std::string("perf_event_open: ") + std::strerror(errno);
+            }
+        }
+#else
+        error_ = "hardware counters are only read on Linux";
+#endif
+    }
+
+    ~PerfCounters()
+    {
+#if defined(__linux__)
+        for (int c = 0; c < COUNT; c ++) {
+            if (fd_[c] >= 0) {
+                close(fd_[c]);
+            }
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    /* true if at least one counter could be opened */
+    bool available() const
+    {
+        for (int c = 0; c < COUNT; c ++) {
+            if (fd_[c] >= 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* reason the first unavailable counter could not be opened */
+    const std::string& error() const { return error_; }
+
+    void start()
+    {
+#if defined(__linux__)
+        for (int c = 0; c < COUNT; c ++) {
+            if (fd_[c] >= 0) {
+                ioctl(fd_[c], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd_[c], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    Reading stop()
+    {
+        Reading r;
+#if defined(__linux__)
+        for (int c = 0; c < COUNT; c ++) {
+            if (fd_[c] >= 0) {
+                ioctl(fd_[c], PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
+        for (int c = 0; c < COUNT; c ++) {
+            /* value, time enabled, time running */
+            uint64_t v[3];
+            if (fd_[c] < 0 || read(fd_[c], v, sizeof(v)) != (ssize_t) sizeof(v) || v[2] == 0) {
+                continue;
+            }
+            r.valid[c] = true;
+            r.value[c] = (double) v[0] * ((double) v[1] / (double) v[2]);
+        }
+#endif
+        return r;
+    }
+
+    static const char *name(Counter c)
+    {
+        static const char *names[COUNT] = { "cycles", "instructions", "L1D misses", "LLC misses", "branch misses" };
+        return names[c];
+    }
+
+private:
+    int fd_[COUNT];
+    std::string error_;
+};
+
+#endif
@@ -0,0 +1,933 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <libsstv.h>
+
+#include "args.hxx"
+#include "farm.hpp"
+#include "modes.hpp"
+#include "perf.hpp"
+
+/*
+ * Cycle counter (falls back to nanoseconds where no counter is available)
+ */
+static inline uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/*
+ * Per-call cycle statistics, with a histogram for percentiles
+ */
+class CycleStats {
+public:
+    CycleStats() : histogram_(4096, 0) {}
+
+    void add(uint64_t c)
+    {
+        count_ ++;
+        sum_ += c;
+        min_ = std::min(min_, c);
+        max_ = std::max(max_, c);
+        histogram_[std::min<uint64_t>(c, histogram_.size() - 1)] ++;
+    }
+
+    uint64_t percentile(double p) const
+    {
+        uint64_t target = (uint64_t)(p * count_);
+        uint64_t acc = 0;
+        for (size_t i = 0; i < histogram_.size(); i ++) {
+            acc += histogram_[i];
+            if (acc > target) {
+                return i;
+            }
+        }
+        return max_;
+    }
+
+    void print(const std::string& name) const
+    {
+        std::cout << std::left << std::setw(24) << name << std::right
+                  << std::setw(12) << count_
+                  << std::setw(8) << (count_ ? min_ : 0)
+                  << std::setw(10) << std::fixed << std::setprecision(1) << (count_ ? (double)sum_ / count_ : 0.0)
+                  << std::setw(10) << percentile(0.999)
+                  << std::setw(10) << max_ << std::endl;
+    }
+
+private:
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+    std::vector<uint64_t> histogram_;
+};
+
+static uint64_t timer_overhead()
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 10000; i ++) {
+        uint64_t t0 = cycles();
+        uint64_t t1 = cycles();
+        best = std::min(best, t1 - t0);
+    }
+    return best;
+}
+
+static void fill_image(sstv_image_t& image)
+{
+    /* deterministic noise, so every pixel changes frequency */
+    uint32_t bpp = (image.format == SSTV_FORMAT_Y ? 1 : 3);
+    uint32_t lcg = 0x12345678;
+    for (uint32_t i = 0; i < image.width * image.height * bpp; i ++) {
+        lcg = lcg * 1664525 + 1013904223;
+        image.buffer[i] = lcg >> 24;
+    }
+}
+
+static void *create_encoder(sstv_image_t& image, sstv_mode_t mode, uint32_t rate)
+{
+    void *ctx = nullptr;
+    if (sstv_create_encoder(&ctx, image, mode, rate) != SSTV_OK || !ctx) {
+        std::cerr << "Failed to create SSTV encoder" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return ctx;
+}
+
+static std::vector<int16_t> encode_transmission(sstv_image_t& image, sstv_mode_t mode, uint32_t rate)
+{
+    /* half a second of silence on each side */
+    std::vector<int16_t> samples(rate / 2, 0);
+    std::vector<int16_t> buffer(4096);
+    void *ctx = create_encoder(image, mode, rate);
+    sstv_signal_t signal;
+    sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, buffer.size(), buffer.data());
+
+    sstv_error_t rc;
+    do {
+        rc = sstv_encode(ctx, &signal);
+        if (rc != SSTV_ENCODE_SUCCESSFUL && rc != SSTV_ENCODE_END) {
+            std::cerr << "sstv_encode() failed with rc " << rc << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        samples.insert(samples.end(), buffer.begin(), buffer.begin() + signal.count);
+    } while (rc != SSTV_ENCODE_END);
+
+    sstv_delete_encoder(ctx);
+    samples.insert(samples.end(), rate / 2, 0);
+    return samples;
+}
+
+/*
+ * Complex baseband version of a transmission, as an SDR tuned to the
+ * suppressed carrier would deliver it: the input, delayed, as I and its
+ * Hilbert transform (windowed FIR) as Q.
+ */
+static std::vector<int16_t> to_iq(const std::vector<int16_t>& samples)
+{
+    const int half = 31;
+    std::vector<double> h(2 * half + 1, 0.0);
+    for (int k = 1; k <= half; k += 2) {
+        double w = 0.54 + 0.46 * std::cos(M_PI * k / (half + 1));
+        h[half + k] = 2.0 / (M_PI * k) * w;
+        h[half - k] = -h[half + k];
+    }
+
+    std::vector<int16_t> iq(2 * samples.size());
+    for (size_t n = 0; n < samples.size(); n ++) {
+        double q = 0.0;
+        for (int k = -half; k <= half; k ++) {
+            if (n >= (size_t)(half + k) && n - half - k < samples.size()) {
+                q += h[half + k] * samples[n - half - k];
+            }
+        }
+        iq[2 * n] = (n >= (size_t)half ? samples[n - half] : 0);
+        iq[2 * n + 1] = (int16_t) std::max(-32768.0, std::min(32767.0, q));
+    }
+    return iq;
+}
+
+/*
+ * Decode a transmission (INT16, or CS16 pairs) in blocks, timing each block;
+ * stats are per sample
+ */
+static void decode_transmission(const std::vector<int16_t>& samples, sstv_sample_type_t type, sstv_image_t& out,
+                                sstv_mode_t mode, uint32_t rate, uint64_t overhead, CycleStats& stats)
+{
+    const uint32_t block = 256;
+    const size_t width = (type == SSTV_SAMPLE_CS16 ? 2 : 1);
+    void *ctx = nullptr;
+    if (sstv_create_decoder(&ctx, out, mode, rate) != SSTV_OK) {
+        std::cerr << "Failed to create SSTV decoder" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (type == SSTV_SAMPLE_CS16 && sstv_decoder_set_iq_input(ctx, 0) != SSTV_OK) {
+        std::cerr << "sstv_decoder_set_iq_input() failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    size_t total = samples.size() / width;
+    size_t pos = 0;
+    while (pos < total) {
+        sstv_signal_t signal;
+        uint32_t count = (uint32_t) std::min<size_t>(block, total - pos);
+        sstv_pack_signal(&signal, type, count, (void *)(samples.data() + pos * width));
+        signal.count = count;
+
+        uint64_t t0 = cycles();
+        sstv_error_t rc = sstv_decode(ctx, &signal);
+        uint64_t t1 = cycles();
+        if (rc == SSTV_DECODE_END) {
+            break;
+        }
+        if (rc != SSTV_DECODE_SUCCESSFUL) {
+            std::cerr << "sstv_decode() failed with rc " << rc << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        stats.add((t1 - t0 > overhead ? t1 - t0 - overhead : 0) / signal.count);
+        pos += signal.count;
+    }
+
+    sstv_delete_decoder(ctx);
+}
+
+/*
+ * Encoder statistics, as returned by sstv_encoder_get_stats()
+ */
+static void print_encoder_stats(const sstv_encoder_stats_t& stats)
+{
+    static const char *classes[SSTV_SEGMENT_CLASS_COUNT] = {
+        "header", "vis", "sync", "porch", "separator", "pixel"
+    };
+
+    std::cout << "sstv_encode(4096): " << stats.samples << " samples in " << stats.encode_calls << " calls, "
+              << stats.segments << " segments of " << stats.segment_min_samples << "/" << stats.segment_avg_samples
+              << "/" << stats.segment_max_samples << " (min/avg/max) samples" << std::endl;
+    std::cout << "transitions:";
+    for (int i = 0; i < SSTV_SEGMENT_CLASS_COUNT; i ++) {
+        std::cout << " " << classes[i] << " " << stats.transitions[i];
+    }
+    std::cout << std::endl;
+
+    uint64_t total = stats.state_cycles + stats.synthesis_cycles;
+    if (total > 0 && stats.samples > 0) {
+        std::cout << "cycles per sample: state machine " << std::fixed << std::setprecision(2)
+                  << (double)stats.state_cycles / stats.samples << ", synthesis "
+                  << (double)stats.synthesis_cycles / stats.samples << " ("
+                  << std::setprecision(1) << 100.0 * stats.state_cycles / total << "% in state machine)" << std::endl;
+    } else {
+        std::cout << "cycles per sample: not counted (build with ENCODER_CYCLE_STATS)" << std::endl;
+    }
+}
+
+/*
+ * Pixel differences between two images of the same size
+ */
+static void compare_images(const std::string& name, const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t same = 0;
+    uint64_t sum = 0;
+    int max = 0;
+    for (size_t i = 0; i < size; i ++) {
+        int d = std::abs((int)a[i] - (int)b[i]);
+        same += (d == 0);
+        sum += d;
+        max = std::max(max, d);
+    }
+    std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(2)
+              << 100.0 * same / size << "% identical, mean difference " << std::setprecision(3)
+              << (double)sum / size << ", max " << max << std::endl;
+}
+
+/*
+ * Decode the same transmission on many channels at once, fed in interleaved
+ * chunks like the output of a channelizer
+ */
+static void run_farm(sstv_image_t& image, sstv_mode_t mode, uint32_t rate, size_t channels, size_t workers)
+{
+    const size_t chunk = 4096;
+    std::vector<int16_t> samples = encode_transmission(image, mode, rate);
+
+    DecoderFarm farm(workers, chunk);
+    for (size_t i = 0; i < channels; i ++) {
+        farm.add_channel(mode, rate);
+    }
+    farm.start();
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t offset = 0; offset < samples.size(); offset += chunk) {
+        size_t count = std::min(chunk, samples.size() - offset);
+        for (size_t i = 0; i < channels; i ++) {
+            farm.push(i, samples.data() + offset, count);
+        }
+    }
+    farm.drain();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    /* report */
+    std::cout << channels << " channels on " << workers << " workers, "
+              << samples.size() << " samples per channel" << std::endl;
+    std::cout << std::setw(8) << "channel"
+              << std::setw(10) << "images"
+              << std::setw(12) << "Msamp/s"
+              << std::setw(12) << "realtime"
+              << std::setw(14) << "lat mean ms"
+              << std::setw(14) << "lat max ms" << std::endl;
+
+    uint64_t images = 0;
+    for (size_t i = 0; i < channels; i ++) {
+        const DecoderFarm::ChannelStats& st = farm.stats(i);
+        images += st.images;
+        std::cout << std::setw(8) << i
+                  << std::setw(10) << st.images
+                  << std::setw(12) << std::fixed << std::setprecision(2) << st.throughput() / 1e6
+                  << std::setw(11) << std::setprecision(0) << st.throughput() / rate << "x"
+                  << std::setw(14) << std::setprecision(3) << st.latency_mean() * 1e3
+                  << std::setw(14) << std::setprecision(3) << st.latency_max * 1e3 << std::endl;
+    }
+
+    double total = (double)samples.size() * channels;
+    std::cout << "total: " << images << "/" << channels << " images, "
+              << std::setprecision(2) << total / wall / 1e6 << " Msamp/s in "
+              << wall << " s, enough for " << std::setprecision(0) << total / wall / rate
+              << " real-time channels" << std::endl;
+}
+
+/*
+ * Throughput matrix over modes, sample types, rates and signal capacities,
+ * plus encoder creation and image conversion, as CSV or JSON records
+ */
+struct MatrixOptions {
+    std::vector<sstv_mode_t> modes;
+    std::vector<uint32_t> rates;
+    std::vector<uint32_t> chunks; /* 0 for the whole image */
+    double seconds;               /* per cell, 0 for the whole image */
+    bool json;
+};
+
+class MatrixWriter {
+public:
+    MatrixWriter(std::ostream& out, bool json) : out_(out), json_(json)
+    {
+        if (json_) {
+            out_ << "[";
+        } else {
+            out_ << "benchmark,mode,sample_type,rate,chunk,conversion,metric,value" << std::endl;
+        }
+    }
+
+    ~MatrixWriter()
+    {
+        if (json_) {
+            out_ << std::endl << "]" << std::endl;
+        }
+    }
+
+    /* params: mode, sample_type, rate, chunk, conversion (empty if unused) */
+    void record(const std::string& benchmark, const std::vector<std::string>& params,
+                const std::vector<std::pair<std::string, double>>& metrics)
+    {
+        static const char *names[] = { "mode", "sample_type", "rate", "chunk", "conversion" };
+
+        if (!json_) {
+            for (const auto& m : metrics) {
+                out_ << benchmark;
+                for (const auto& p : params) {
+                    out_ << "," << p;
+                }
+                out_ << "," << m.first << "," << std::setprecision(10) << std::defaultfloat << m.second << std::endl;
+            }
+            return;
+        }
+
+        out_ << (first_ ? "" : ",") << std::endl << "  { \"benchmark\": \"" << benchmark << "\"";
+        for (size_t i = 0; i < params.size(); i ++) {
+            if (params[i].empty()) {
+                continue;
+            }
+            bool numeric = (i == 2 || (i == 3 && params[i] != "image"));
+            out_ << ", \"" << names[i] << "\": " << (numeric ? "" : "\"") << params[i] << (numeric ? "" : "\"");
+        }
+        for (const auto& m : metrics) {
+            out_ << ", \"" << m.first << "\": " << std::setprecision(10) << std::defaultfloat << m.second;
+        }
+        out_ << " }";
+        first_ = false;
+    }
+
+private:
+    std::ostream& out_;
+    bool json_;
+    bool first_ = true;
+};
+
+static std::string mode_name(sstv_mode_t mode)
+{
+    for (const auto& m : stringToModeMap) {
+        if (m.second == mode) {
+            return m.first;
+        }
+    }
+    return std::to_string((int)mode);
+}
+
+static std::vector<std::string> split_list(const std::string& list)
+{
+    std::vector<std::string> items;
+    size_t pos = 0;
+    while (pos <= list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        if (end > pos) {
+            items.push_back(list.substr(pos, end - pos));
+        }
+        pos = end + 1;
+    }
+    return items;
+}
+
+/* hardware counter metrics, per sample or per thousand samples, for those
+   that could be read */
+static void append_counter_metrics(std::vector<std::pair<std::string, double>>& metrics,
+                                   const PerfCounters::Reading& hw, uint64_t samples)
+{
+    if (hw.valid[PerfCounters::CYCLES]) {
+        metrics.push_back({ "hw_cycles_per_sample", hw.per(PerfCounters::CYCLES, samples) });
+    }
+    if (hw.valid[PerfCounters::INSTRUCTIONS]) {
+        metrics.push_back({ "instructions_per_sample", hw.per(PerfCounters::INSTRUCTIONS, samples) });
+    }
+    if (hw.valid[PerfCounters::CYCLES] && hw.valid[PerfCounters::INSTRUCTIONS]) {
+        metrics.push_back({ "ipc", hw.ipc() });
+    }
+    if (hw.valid[PerfCounters::L1D_MISSES]) {
+        metrics.push_back({ "l1d_misses_per_ksample", hw.per(PerfCounters::L1D_MISSES, samples / 1000.0) });
+    }
+    if (hw.valid[PerfCounters::LLC_MISSES]) {
+        metrics.push_back({ "llc_misses_per_ksample", hw.per(PerfCounters::LLC_MISSES, samples / 1000.0) });
+    }
+    if (hw.valid[PerfCounters::BRANCH_MISSES]) {
+        metrics.push_back({ "branch_misses_per_ksample", hw.per(PerfCounters::BRANCH_MISSES, samples / 1000.0) });
+    }
+}
+
+/* sstv_encode() with a signal of the given capacity, until the image ends or
+   the sample budget is spent */
+static void matrix_encode(MatrixWriter& writer, PerfCounters& perf, sstv_image_t& image, sstv_mode_t mode,
+                          sstv_sample_type_t type, const char *type_name, uint32_t rate, uint32_t chunk, double seconds)
+{
+    size_t ssize = (type == SSTV_SAMPLE_INT16 ? 2 : 1);
+    uint64_t budget = (seconds > 0.0 ? (uint64_t)(seconds * rate) : UINT64_MAX);
+    void *ctx = create_encoder(image, mode, rate);
+
+    /* a whole image: size the signal from a first, untimed pass */
+    uint32_t capacity = chunk;
+    if (capacity == 0) {
+        std::vector<int16_t> scratch(65536);
+        uint64_t total = 0;
+        sstv_error_t rc;
+        do {
+            sstv_signal_t signal;
+            sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, (uint32_t) scratch.size(), scratch.data());
+            rc = sstv_encode(ctx, &signal);
+            total += signal.count;
+        } while (rc == SSTV_ENCODE_SUCCESSFUL);
+        sstv_delete_encoder(ctx);
+        ctx = create_encoder(image, mode, rate);
+        capacity = (uint32_t) total;
+    }
+    std::vector<uint8_t> buffer((size_t)capacity * ssize);
+
+    uint64_t samples = 0;
+    perf.start();
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t c0 = cycles();
+    while (samples < budget) {
+        sstv_signal_t signal;
+        sstv_pack_signal(&signal, type, capacity, buffer.data());
+        sstv_error_t rc = sstv_encode(ctx, &signal);
+        samples += signal.count;
+        if (rc == SSTV_ENCODE_END) {
+            break;
+        }
+        if (rc != SSTV_ENCODE_SUCCESSFUL) {
+            std::cerr << "sstv_encode() failed with rc " << rc << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    uint64_t c1 = cycles();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    PerfCounters::Reading hw = perf.stop();
+    sstv_delete_encoder(ctx);
+
+    std::vector<std::pair<std::string, double>> metrics = {
+        { "samples", (double)samples },
+        { "msamples_per_s", samples / wall / 1e6 },
+        { "realtime", samples / wall / rate },
+        { "cycles_per_sample", (double)(c1 - c0) / samples }
+    };
+    append_counter_metrics(metrics, hw, samples);
+    writer.record("encode",
+                  { mode_name(mode), type_name, std::to_string(rate), chunk ? std::to_string(chunk) : "image", "" },
+                  metrics);
+}
+
+/* sstv_create_encoder() and sstv_delete_encoder() pairs */
+static void matrix_create(MatrixWriter& writer, sstv_image_t& image, sstv_mode_t mode, uint32_t rate)
+{
+    const int iterations = 200;
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i ++) {
+        sstv_delete_encoder(create_encoder(image, mode, rate));
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    writer.record("create_encoder", { mode_name(mode), "", std::to_string(rate), "", "" },
+                  { { "us_per_call", wall / iterations * 1e6 } });
+}
+
+/* sstv_convert_image() between all supported format pairs, at the mode's
+   resolution; the source image is restored (untimed) before each call */
+static void matrix_convert(MatrixWriter& writer, sstv_mode_t mode)
+{
+    static const std::pair<sstv_image_format_t, const char *> formats[] = {
+        { SSTV_FORMAT_RGB, "rgb" }, { SSTV_FORMAT_YCBCR, "ycbcr" }, { SSTV_FORMAT_Y, "y" }
+    };
+    const int iterations = 20;
+    uint32_t width, height;
+    sstv_get_mode_image_props(mode, &width, &height, nullptr);
+
+    for (const auto& from : formats) {
+        for (const auto& to : formats) {
+            if (from.first == to.first || from.first == SSTV_FORMAT_Y) {
+                continue;
+            }
+
+            sstv_image_t image;
+            if (sstv_create_image_from_props(&image, width, height, from.first) != SSTV_OK) {
+                std::cerr << "sstv_create_image_from_props() failed" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            fill_image(image);
+            std::vector<uint8_t> source(image.buffer, image.buffer + (size_t)width * height * 3);
+
+            double wall = 0.0;
+            for (int i = 0; i < iterations; i ++) {
+                std::copy(source.begin(), source.end(), image.buffer);
+                image.format = from.first;
+
+                auto t0 = std::chrono::steady_clock::now();
+                sstv_error_t rc = sstv_convert_image(&image, to.first);
+                wall += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+                if (rc != SSTV_OK) {
+                    std::cerr << "sstv_convert_image() failed with rc " << rc << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            }
+            image.format = from.first;
+            sstv_delete_image(&image);
+
+            writer.record("convert_image",
+                          { mode_name(mode), "", "", "", std::string(from.second) + ">" + to.second },
+                          { { "us_per_call", wall / iterations * 1e6 },
+                            { "mpixels_per_s", (double)width * height * iterations / wall / 1e6 } });
+        }
+    }
+}
+
+/*
+ * A whole transmission through sstv_encode() in blocks of 4096 samples, with
+ * hardware counters (if available) and wall-clock time around it
+ */
+struct CountedEncode {
+    sstv_encoder_stats_t stats;
+    PerfCounters::Reading hw;
+    double wall;
+};
+
+static CountedEncode encode_counted(sstv_image_t& image, sstv_mode_t mode, uint32_t rate, PerfCounters& perf)
+{
+    CountedEncode result;
+    void *ctx = nullptr;
+    if (sstv_create_encoder(&ctx, image, mode, rate) != SSTV_OK) {
+        std::cerr << "Failed to create SSTV encoder" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::vector<int16_t> buffer(4096);
+    sstv_signal_t signal;
+    sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, (uint32_t)buffer.size(), buffer.data());
+
+    sstv_error_t rc;
+    perf.start();
+    auto t0 = std::chrono::steady_clock::now();
+    while ((rc = sstv_encode(ctx, &signal)) == SSTV_ENCODE_SUCCESSFUL) {
+    }
+    result.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    result.hw = perf.stop();
+    if (rc != SSTV_ENCODE_END) {
+        std::cerr << "sstv_encode() failed with rc " << rc << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    sstv_encoder_get_stats(ctx, &result.stats);
+    sstv_delete_encoder(ctx);
+    return result;
+}
+
+/*
+ * Hardware counters of a counted encode, per sample
+ */
+static void print_counters(const std::string& name, const CountedEncode& run)
+{
+    double n = (double)run.stats.samples;
+    std::cout << std::left << std::setw(14) << name << std::right << std::fixed
+              << std::setw(10) << std::setprecision(1) << n / run.wall / 1e6
+              << std::setw(10) << std::setprecision(2) << run.wall / n * 1e9;
+
+    const PerfCounters::Reading& hw = run.hw;
+    auto column = [&](PerfCounters::Counter c, double scale, int precision) {
+        if (hw.valid[c]) {
+            std::cout << std::setw(10) << std::setprecision(precision) << hw.per(c, n / scale);
+        } else {
+            std::cout << std::setw(10) << "-";
+        }
+    };
+    column(PerfCounters::CYCLES, 1.0, 2);
+    column(PerfCounters::INSTRUCTIONS, 1.0, 2);
+    if (hw.valid[PerfCounters::CYCLES] && hw.valid[PerfCounters::INSTRUCTIONS]) {
+        std::cout << std::setw(8) << std::setprecision(2) << hw.ipc();
+    } else {
+        std::cout << std::setw(8) << "-";
+    }
+    column(PerfCounters::L1D_MISSES, 1000.0, 3);
+    column(PerfCounters::LLC_MISSES, 1000.0, 3);
+    column(PerfCounters::BRANCH_MISSES, 1000.0, 3);
+    std::cout << std::endl;
+}
+
+static void print_counters_header(const PerfCounters& perf)
+{
+    if (!perf.available()) {
+        std::cout << "hardware counters unavailable (" << perf.error() << "), wall-clock only" << std::endl;
+    }
+    std::cout << std::left << std::setw(14) << "sstv_encode" << std::right
+              << std::setw(10) << "Msmp/s"
+              << std::setw(10) << "ns/smp"
+              << std::setw(10) << "cyc/smp"
+              << std::setw(10) << "ins/smp"
+              << std::setw(8) << "IPC"
+              << std::setw(10) << "L1D/k"
+              << std::setw(10) << "LLC/k"
+              << std::setw(10) << "brmis/k" << std::endl;
+}
+
+/*
+ * Hardware counters of sstv_encode(), one row per mode
+ */
+static void run_counters(const std::vector<sstv_mode_t>& modes, uint32_t rate)
+{
+    PerfCounters perf;
+    std::cout << "whole transmissions @ " << rate << " Hz, int16, blocks of 4096 samples "
+              << "(misses and mispredicts per 1000 samples)" << std::endl;
+    print_counters_header(perf);
+
+    for (sstv_mode_t mode : modes) {
+        sstv_image_t image;
+        if (sstv_create_image_from_mode(&image, mode) != SSTV_OK) {
+            std::cerr << "sstv_create_image_from_mode() failed" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        fill_image(image);
+        print_counters(mode_name(mode), encode_counted(image, mode, rate, perf));
+        sstv_delete_image(&image);
+    }
+}
+
+static void run_matrix(const MatrixOptions& opts, std::ostream& out)
+{
+    static const std::pair<sstv_sample_type_t, const char *> types[] = {
+        { SSTV_SAMPLE_UINT8, "uint8" }, { SSTV_SAMPLE_INT8, "int8" }, { SSTV_SAMPLE_INT16, "int16" }
+    };
+    MatrixWriter writer(out, opts.json);
+    PerfCounters perf;
+    if (!perf.available()) {
+        std::cerr << "hardware counters unavailable (" << perf.error() << "), wall-clock only" << std::endl;
+    }
+
+    for (sstv_mode_t mode : opts.modes) {
+        sstv_image_t image;
+        if (sstv_create_image_from_mode(&image, mode) != SSTV_OK) {
+            std::cerr << "sstv_create_image_from_mode() failed" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        fill_image(image);
+
+        for (uint32_t rate : opts.rates) {
+            matrix_create(writer, image, mode, rate);
+            for (const auto& type : types) {
+                for (uint32_t chunk : opts.chunks) {
+                    matrix_encode(writer, perf, image, mode, type.first, type.second, rate, chunk,
+                                  chunk ? opts.seconds : 0.0);
+                }
+            }
+        }
+        matrix_convert(writer, mode);
+
+        sstv_delete_image(&image);
+        std::cerr << mode_name(mode) << " done" << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse command line flags */
+    args::ArgumentParser parser("Measures per-sample encoding and decoding cost, in cycles, or encoder throughput over a matrix of configurations.");
+    args::HelpFlag help(parser, "help", "Display this help menu", { 'h', "help" });
+    args::ValueFlag<std::string> modeString(parser, "mode", "SSTV mode (default PD120)", { 'm', "mode" }, "PD120");
+    args::ValueFlag<uint32_t> sample_rate(parser, "rate", "sample rate (default 48000)", { 'r', "rate" }, 48000);
+    args::ValueFlag<std::string> dump(parser, "file", "write the decoded image to file (raw bytes)", { "dump" });
+    args::ValueFlag<std::string> reference(parser, "file", "compare the decoded image with one written by --dump (e.g. by a fixed-point build)", { "reference" });
+    args::ValueFlag<size_t> farm_channels(parser, "channels", "decode this many channels at once instead", { "farm" });
+    args::ValueFlag<size_t> farm_workers(parser, "workers", "worker threads for --farm (default: all cores)", { "workers" },
+                                         std::max(1u, std::thread::hardware_concurrency()));
+    args::Flag counters(parser, "counters", "report hardware counters of sstv_encode() for every mode (or --modes) at --rate instead", { "counters" });
+    args::Group matrixGroup(parser, "Matrix (--matrix):", args::Group::Validators::DontCare);
+    args::Flag matrix(matrixGroup, "matrix", "measure encoder throughput over modes, sample types, rates and chunk sizes instead", { "matrix" });
+    args::ValueFlag<std::string> matrixModes(matrixGroup, "modes", "comma separated modes, also for --counters (default: all)", { "modes" });
+    args::ValueFlag<std::string> matrixRates(matrixGroup, "rates", "comma separated sample rates (default: 8000,11025,16000,22050,32000,44100,48000,96000,192000)",
+                                             { "rates" }, "8000,11025,16000,22050,32000,44100,48000,96000,192000");
+    args::ValueFlag<std::string> matrixChunks(matrixGroup, "chunks", "comma separated signal capacities, \"image\" for the whole image in one call (default: 64,256,1024,4096,16384,65536,image)",
+                                              { "chunks" }, "64,256,1024,4096,16384,65536,image");
+    args::ValueFlag<double> matrixSeconds(matrixGroup, "seconds", "signal encoded per chunked cell, 0 for the whole image (default: 10)", { "seconds" }, 10.0);
+    args::ValueFlag<std::string> matrixFormat(matrixGroup, "format", "csv or json (default: csv)", { "format" }, "csv");
+    args::ValueFlag<std::string> matrixOutput(matrixGroup, "file", "output file (default: standard output)", { 'o', "output" });
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help&) {
+        std::cout << parser;
+        return 0;
+    } catch (const args::ParseError& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (sstv_init(malloc, free) != SSTV_OK) {
+        std::cerr << "Failed to initialize libsstv" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    /* modes for --matrix and --counters */
+    std::vector<sstv_mode_t> modes;
+    if (matrixModes) {
+        for (const auto& m : split_list(args::get(matrixModes))) {
+            modes.push_back(mode_from_string(m));
+        }
+    } else {
+        for (const auto& m : stringToModeMap) {
+            modes.push_back(m.second);
+        }
+    }
+
+    if (counters) {
+        run_counters(modes, args::get(sample_rate));
+        return 0;
+    }
+
+    if (matrix) {
+        MatrixOptions opts;
+        opts.modes = modes;
+        for (const auto& r : split_list(args::get(matrixRates))) {
+            opts.rates.push_back((uint32_t) std::stoul(r));
+        }
+        for (const auto& c : split_list(args::get(matrixChunks))) {
+            opts.chunks.push_back(c == "image" ? 0 : (uint32_t) std::stoul(c));
+        }
+        opts.seconds = args::get(matrixSeconds);
+        opts.json = (args::get(matrixFormat) == "json");
+        if (!opts.json && args::get(matrixFormat) != "csv") {
+            std::cerr << "Unknown format '" << args::get(matrixFormat) << "'" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        if (matrixOutput) {
+            std::ofstream out(args::get(matrixOutput));
+            if (!out) {
+                std::cerr << "cannot write " << args::get(matrixOutput) << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            run_matrix(opts, out);
+        } else {
+            run_matrix(opts, std::cout);
+        }
+        return 0;
+    }
+
+    sstv_mode_t mode = mode_from_string(args::get(modeString));
+    uint32_t rate = args::get(sample_rate);
+
+    sstv_image_t image;
+    if (sstv_create_image_from_mode(&image, mode) != SSTV_OK) {
+        std::cerr << "sstv_create_image_from_mode() failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    fill_image(image);
+
+    if (farm_channels) {
+        try {
+            run_farm(image, mode, rate, args::get(farm_channels), args::get(farm_workers));
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            sstv_delete_image(&image);
+            exit(EXIT_FAILURE);
+        }
+        sstv_delete_image(&image);
+        return 0;
+    }
+
+    uint64_t overhead = timer_overhead();
+
+    /* sstv_encode() one sample at a time: includes state changes */
+    CycleStats encode_stats;
+    {
+        void *ctx = create_encoder(image, mode, rate);
+        int16_t sample;
+        sstv_signal_t signal;
+        sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, 1, &sample);
+
+        while (true) {
+            uint64_t t0 = cycles();
+            sstv_error_t rc = sstv_encode(ctx, &signal);
+            uint64_t t1 = cycles();
+            if (rc == SSTV_ENCODE_END) {
+                break;
+            }
+            if (rc != SSTV_ENCODE_SUCCESSFUL) {
+                std::cerr << "sstv_encode() failed with rc " << rc << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            encode_stats.add(t1 - t0 > overhead ? t1 - t0 - overhead : 0);
+        }
+        sstv_delete_encoder(ctx);
+    }
+
+    /* sstv_encode() in blocks of 4096 samples, for the encoder's own statistics
+       and the hardware counters */
+    PerfCounters perf;
+    CountedEncode counted = encode_counted(image, mode, rate, perf);
+
+    /* sstv_encode_next_sample(), with untimed refills in between */
+    CycleStats isr_stats;
+    {
+        void *ctx = create_encoder(image, mode, rate);
+        int16_t sample;
+
+        while (true) {
+            sstv_error_t rc = sstv_encode_refill(ctx);
+            if (rc != SSTV_ENCODE_SUCCESSFUL && rc != SSTV_ENCODE_END) {
+                std::cerr << "sstv_encode_refill() failed with rc " << rc << std::endl;
+                exit(EXIT_FAILURE);
+            }
+
+            uint64_t t0 = cycles();
+            rc = sstv_encode_next_sample(ctx, SSTV_SAMPLE_INT16, &sample);
+            uint64_t t1 = cycles();
+            if (rc == SSTV_ENCODE_END) {
+                break;
+            }
+            if (rc != SSTV_ENCODE_SUCCESSFUL) {
+                std::cerr << "sstv_encode_next_sample() failed with rc " << rc << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            isr_stats.add(t1 - t0 > overhead ? t1 - t0 - overhead : 0);
+        }
+        sstv_delete_encoder(ctx);
+    }
+
+    /* sstv_decode() in blocks of 256 samples */
+    CycleStats decode_stats;
+    sstv_image_t decoded;
+    if (sstv_create_image_from_mode(&decoded, mode) != SSTV_OK) {
+        std::cerr << "sstv_create_image_from_mode() failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    size_t image_size = (size_t)image.width * image.height * (image.format == SSTV_FORMAT_Y ? 1 : 3);
+    std::vector<int16_t> transmission = encode_transmission(image, mode, rate);
+
+    /* and of its complex baseband; the real input decode is kept for --dump */
+    CycleStats decode_iq_stats;
+    decode_transmission(to_iq(transmission), SSTV_SAMPLE_CS16, decoded, mode, rate, overhead, decode_iq_stats);
+
+    std::fill(decoded.buffer, decoded.buffer + image_size, 0);
+    decode_transmission(transmission, SSTV_SAMPLE_INT16, decoded, mode, rate, overhead, decode_stats);
+
+    /* report */
+    std::cout << args::get(modeString) << " @ " << rate << " Hz, timer overhead "
+              << overhead << " cycles subtracted" << std::endl;
+    std::cout << std::left << std::setw(24) << "path" << std::right
+              << std::setw(12) << "samples"
+              << std::setw(8) << "min"
+              << std::setw(10) << "mean"
+              << std::setw(10) << "p99.9"
+              << std::setw(10) << "max" << std::endl;
+    encode_stats.print("sstv_encode(1)");
+    isr_stats.print("sstv_encode_next_sample");
+    decode_stats.print("sstv_decode(256)");
+    decode_iq_stats.print("sstv_decode(256), CS16");
+    print_encoder_stats(counted.stats);
+    print_counters_header(perf);
+    print_counters("4096", counted);
+
+    if (reference) {
+        std::vector<uint8_t> ref(image_size);
+        std::ifstream in(args::get(reference), std::ios::binary);
+        if (!in.read((char *)ref.data(), (std::streamsize)image_size)) {
+            std::cerr << "cannot read " << args::get(reference) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        compare_images("decoded vs reference", decoded.buffer, ref.data(), image_size);
+    }
+    if (dump) {
+        std::ofstream out(args::get(dump), std::ios::binary);
+        out.write((const char *)decoded.buffer, (std::streamsize)image_size);
+        if (!out) {
+            std::cerr << "cannot write " << args::get(dump) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sstv_delete_image(&decoded);
+    sstv_delete_image(&image);
+    return 0;
+}
@@ -0,0 +1,639 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+
+#include <libsstv.h>
+
+#include "args.hxx"
+#include "modes.hpp"
+#include "pcm.hpp"
+
+namespace fs = std::filesystem;
+using clock_type = std::chrono::steady_clock;
+
+/* samples handed to the library per call */
+static constexpr uint32_t BLOCK_SAMPLES = 64 * 1024;
+
+/* mode identification of recordings without a VIS header */
+static constexpr double IDENTIFY_SECONDS = 60.0;
+static constexpr uint32_t IDENTIFY_MIN_CONFIDENCE = 500;
+
+struct Options {
+    fs::path output;
+    sstv_sample_type_t raw_type = SSTV_SAMPLE_INT16;
+    uint32_t raw_rate = 48000;
+    size_t jobs = 1;
+    double segment_seconds = 300.0;
+    bool identify = true;
+};
+
+struct Transmission {
+    sstv_mode_t mode;
+    uint64_t start = 0;     /* first sample of the first line */
+    uint64_t end = 0;       /* one past the last sample decoded */
+    uint32_t lines = 0;
+    uint32_t height = 0;
+    bool complete = false;
+    int32_t drift = 0;
+    uint32_t confidence = 0; /* of the mode identification, 0 if the VIS was received */
+    std::string image;
+};
+
+struct FileResult {
+    std::string path;
+    std::string error;
+    uint32_t sample_rate = 0;
+    double duration = 0.0;
+    double seconds = 0.0;
+    std::vector<Transmission> transmissions;
+};
+
+static std::string mode_name(sstv_mode_t mode)
+{
+    for (const auto& m : stringToModeMap) {
+        if (m.second == mode) {
+            return m.first;
+        }
+    }
+    return std::to_string((int) mode);
+}
+
+static std::string json_string(const std::string& s)
+{
+    std::ostringstream out;
+    out << '"';
+    for (unsigned char c : s) {
+        switch (c) {
+            case '"': out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int) c << std::dec;
+                } else {
+                    out << c;
+                }
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+/*
+ * Binary PGM (luma-only modes) or PPM
+ */
+static void write_image(const fs::path& path, sstv_image_t& image)
+{
+    if (image.format != SSTV_FORMAT_Y && image.format != SSTV_FORMAT_RGB) {
+        if (sstv_convert_image(&image, SSTV_FORMAT_RGB) != SSTV_OK) {
+            throw std::runtime_error("sstv_convert_image() failed");
+        }
+    }
+
+    bool gray = (image.format == SSTV_FORMAT_Y);
+    std::ofstream out(path, std::ios::binary);
+    out << (gray ? "P5" : "P6") << "\n" << image.width << " " << image.height << "\n255\n";
+    out.write((const char *)image.buffer, (std::streamsize)image.width * image.height * (gray ? 1 : 3));
+    if (!out) {
+        throw std::runtime_error("cannot write " + path.string());
+    }
+}
+
+/*
+ * Decode one transmission whose first line starts at tx.start
+ */
+static void decode_transmission(const PcmFile& pcm, Transmission& tx, std::vector<uint8_t>& scratch)
+{
+    sstv_image_t image;
+    if (sstv_create_image_from_mode(&image, tx.mode) != SSTV_OK) {
+        throw std::runtime_error("sstv_create_image_from_mode() failed");
+    }
+    tx.height = image.height;
+
+    void *decoder = nullptr;
+    if (sstv_create_decoder(&decoder, image, tx.mode, pcm.sample_rate()) != SSTV_OK) {
+        sstv_delete_image(&image);
+        throw std::runtime_error("sstv_create_decoder() failed");
+    }
+    sstv_decoder_skip_header(decoder);
+
+    uint64_t pos = tx.start;
+    while (pos < pcm.count()) {
+        sstv_signal_t signal;
+        pcm.signal(&signal, pos, (uint32_t) std::min<uint64_t>(BLOCK_SAMPLES, pcm.count() - pos), scratch);
+
+        sstv_error_t rc = sstv_decode(decoder, &signal);
+        pos += signal.count;
+        if (rc == SSTV_DECODE_END) {
+            tx.complete = true;
+            break;
+        } else if (rc != SSTV_DECODE_SUCCESSFUL) {
+            sstv_delete_decoder(decoder);
+            sstv_delete_image(&image);
+            throw std::runtime_error("sstv_decode() failed with rc " + std::to_string(rc));
+        }
+    }
+
+    tx.end = pos;
+    sstv_decoder_get_lines(decoder, &tx.lines);
+    sstv_decoder_get_drift(decoder, &tx.drift);
+    sstv_delete_decoder(decoder);
+
+    /* keep the image if any line made it */
+    if (tx.lines > 0 && !tx.image.empty()) {
+        write_image(tx.image, image);
+    } else {
+        tx.image.clear();
+    }
+    sstv_delete_image(&image);
+}
+
+/*
+ * Find all transmissions whose header lies within [from, to)
+ */
+static void scan_segment(const PcmFile& pcm, uint64_t from, uint64_t to, std::vector<Transmission>& found,
+                         std::vector<uint8_t>& scratch)
+{
+    void *detector = nullptr;
+    if (sstv_create_vis_detector(&detector, pcm.sample_rate()) != SSTV_OK) {
+        throw std::runtime_error("sstv_create_vis_detector() failed");
+    }
+
+    uint64_t pos = from;
+    while (pos < to) {
+        sstv_signal_t signal;
+        pcm.signal(&signal, pos, (uint32_t) std::min<uint64_t>(BLOCK_SAMPLES, to - pos), scratch);
+
+        Transmission tx;
+        uint64_t sync = 0;
+        sstv_error_t rc = sstv_detect_vis(detector, &signal, &tx.mode, &sync);
+        pos += signal.count;
+        if (rc == SSTV_DETECT_FOUND) {
+            tx.start = from + sync;
+            found.push_back(tx);
+        } else if (rc != SSTV_DETECT_SUCCESSFUL) {
+            sstv_delete_vis_detector(detector);
+            throw std::runtime_error("sstv_detect_vis() failed with rc " + std::to_string(rc));
+        }
+    }
+
+    sstv_delete_vis_detector(detector);
+}
+
+/*
+ * Guess the mode of a recording without VIS header from its sync pulses, over
+ * its first IDENTIFY_SECONDS
+ */
+static bool identify_recording(const PcmFile& pcm, Transmission& tx, std::vector<uint8_t>& scratch)
+{
+    void *identifier = nullptr;
+    if (sstv_create_mode_identifier(&identifier, pcm.sample_rate()) != SSTV_OK) {
+        throw std::runtime_error("sstv_create_mode_identifier() failed");
+    }
+
+    uint64_t to = std::min<uint64_t>(pcm.count(), (uint64_t) (IDENTIFY_SECONDS * pcm.sample_rate()));
+    uint64_t pos = 0;
+    while (pos < to) {
+        sstv_signal_t signal;
+        pcm.signal(&signal, pos, (uint32_t) std::min<uint64_t>(BLOCK_SAMPLES, to - pos), scratch);
+
+        sstv_error_t rc = sstv_identify_mode(identifier, &signal);
+        pos += signal.count;
+        if (rc != SSTV_DETECT_SUCCESSFUL) {
+            sstv_delete_mode_identifier(identifier);
+            throw std::runtime_error("sstv_identify_mode() failed with rc " + std::to_string(rc));
+        }
+    }
+
+    sstv_mode_candidate_t best;
+    uint32_t count = 1;
+    sstv_get_mode_candidates(identifier, &best, &count);
+    sstv_delete_mode_identifier(identifier);
+
+    if (count == 0 || best.confidence < IDENTIFY_MIN_CONFIDENCE) {
+        return false;
+    }
+    tx.mode = best.mode;
+    tx.start = best.sync_offset;
+    tx.confidence = best.confidence;
+    return true;
+}
+
+/*
+ * Run fn(0) ... fn(count - 1) on a pool of threads; the first exception thrown
+ * by fn stops its worker and is rethrown once all workers have joined
+ */
+template<typename F>
+static void parallel_for(size_t count, size_t jobs, F fn)
+{
+    std::atomic<size_t> next { 0 };
+    std::vector<std::thread> workers;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    for (size_t w = 0; w < std::max<size_t>(1, std::min(jobs, count)); w ++) {
+        workers.emplace_back([&] {
+            try {
+                size_t i;
+                while ((i = next ++) < count) {
+                    fn(i);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        });
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+struct Recording {
+    FileResult result;
+    std::unique_ptr<PcmFile> pcm;
+    std::mutex mutex; /* guards result.error and result.seconds */
+
+    void fail(const std::string& error)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (result.error.empty()) {
+            result.error = error;
+        }
+    }
+
+    void spent(double seconds)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        result.seconds += seconds;
+    }
+};
+
+static std::string image_name(const fs::path& path, const std::string& tag, sstv_mode_t mode)
+{
+    uint32_t width, height;
+    sstv_image_format_t format;
+    sstv_get_mode_image_props(mode, &width, &height, &format);
+
+    return path.stem().string() + "_" + tag + "_" + mode_name(mode) + (format == SSTV_FORMAT_Y ? ".pgm" : ".ppm");
+}
+
+/*
+ * Decode a set of recordings in two phases, both spread over all threads:
+ * first every recording is scanned for VIS headers, in overlapping segments,
+ * then every detected transmission is decoded on its own. Transmissions
+ * starting inside the previous image of the same recording (duplicates from
+ * overlapping segments, or false detections within image content) are
+ * dropped afterwards, so the outcome matches a sequential walk. Recordings
+ * with no VIS header at all get their mode identified from the sync pulses,
+ * so that a single decoder runs on them instead of one per mode.
+ */
+static void decode_recordings(const Options& opts, std::vector<std::unique_ptr<Recording>>& recordings)
+{
+    struct ScanJob {
+        Recording *rec;
+        uint64_t from;
+        uint64_t to;
+        std::vector<Transmission> found;
+    };
+
+    struct DecodeJob {
+        Recording *rec = nullptr;
+        Transmission tx;
+    };
+
+    /* open */
+    for (auto& rec : recordings) {
+        fs::path path(rec->result.path);
+        std::string ext = path.extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+        try {
+            rec->pcm = (ext == ".raw"
+                ? std::make_unique<PcmFile>(rec->result.path, opts.raw_type, opts.raw_rate)
+                : std::make_unique<PcmFile>(rec->result.path));
+            rec->result.sample_rate = rec->pcm->sample_rate();
+            rec->result.duration = rec->pcm->duration();
+        } catch (const std::exception& e) {
+            rec->result.error = e.what();
+        }
+    }
+
+    /* scan; segments overlap by more than a header, so that none is cut */
+    std::vector<ScanJob> scans;
+    for (auto& rec : recordings) {
+        if (!rec->pcm) {
+            continue;
+        }
+        uint64_t length = (uint64_t) (opts.segment_seconds * rec->pcm->sample_rate());
+        uint64_t overlap = 2 * (uint64_t) rec->pcm->sample_rate();
+        for (uint64_t from = 0; from < rec->pcm->count(); from += length) {
+            scans.push_back({ rec.get(), (from > overlap ? from - overlap : 0),
+                              std::min(from + length, rec->pcm->count()), {} });
+        }
+    }
+
+    parallel_for(scans.size(), opts.jobs, [&](size_t i) {
+        ScanJob& job = scans[i];
+        std::vector<uint8_t> scratch;
+        auto t0 = clock_type::now();
+        try {
+            scan_segment(*job.rec->pcm, job.from, job.to, job.found, scratch);
+        } catch (const std::exception& e) {
+            job.rec->fail(e.what());
+        }
+        job.rec->spent(std::chrono::duration<double>(clock_type::now() - t0).count());
+    });
+
+    /* merge detections per recording, in order */
+    std::vector<DecodeJob> decodes;
+    std::vector<Recording *> unidentified;
+    for (auto& rec : recordings) {
+        if (!rec->pcm) {
+            continue;
+        }
+
+        std::vector<Transmission> found;
+        for (auto& job : scans) {
+            if (job.rec == rec.get()) {
+                found.insert(found.end(), job.found.begin(), job.found.end());
+            }
+        }
+        std::sort(found.begin(), found.end(), [](const Transmission& a, const Transmission& b) {
+            return a.start < b.start;
+        });
+
+        for (size_t i = 0; i < found.size(); i ++) {
+            /* the same header, seen by two overlapping segments */
+            if (i > 0 && found[i].mode == found[i - 1].mode
+                && found[i].start - found[i - 1].start < rec->pcm->sample_rate() / 10) {
+                continue;
+            }
+            decodes.push_back({ rec.get(), found[i] });
+        }
+
+        if (found.empty() && opts.identify) {
+            unidentified.push_back(rec.get());
+        }
+    }
+
+    /* identify */
+    std::vector<DecodeJob> identified(unidentified.size());
+    parallel_for(unidentified.size(), opts.jobs, [&](size_t i) {
+        Recording *rec = unidentified[i];
+        std::vector<uint8_t> scratch;
+        auto t0 = clock_type::now();
+        try {
+            if (identify_recording(*rec->pcm, identified[i].tx, scratch)) {
+                identified[i].rec = rec;
+            }
+        } catch (const std::exception& e) {
+            rec->fail(e.what());
+        }
+        rec->spent(std::chrono::duration<double>(clock_type::now() - t0).count());
+    });
+    for (auto& job : identified) {
+        if (job.rec) {
+            decodes.push_back(job);
+        }
+    }
+
+    /* decode */
+    parallel_for(decodes.size(), opts.jobs, [&](size_t i) {
+        DecodeJob& job = decodes[i];
+        std::vector<uint8_t> scratch;
+        auto t0 = clock_type::now();
+        job.tx.image = (opts.output / image_name(job.rec->result.path, std::to_string(job.tx.start), job.tx.mode)).string();
+        try {
+            decode_transmission(*job.rec->pcm, job.tx, scratch);
+        } catch (const std::exception& e) {
+            job.rec->fail(e.what());
+        }
+        job.rec->spent(std::chrono::duration<double>(clock_type::now() - t0).count());
+    });
+
+    /* keep transmissions in order, dropping those inside the previous one */
+    for (auto& job : decodes) {
+        FileResult& result = job.rec->result;
+        Transmission& tx = job.tx;
+        std::error_code ec;
+
+        if (!result.transmissions.empty() && tx.start < result.transmissions.back().end) {
+            if (!tx.image.empty()) {
+                fs::remove(tx.image, ec);
+            }
+            continue;
+        }
+
+        if (!tx.image.empty()) {
+            std::string name = (opts.output / image_name(result.path, std::to_string(result.transmissions.size()), tx.mode)).string();
+            fs::rename(tx.image, name, ec);
+            tx.image = name;
+        }
+        result.transmissions.push_back(tx);
+    }
+
+    for (auto& rec : recordings) {
+        rec->pcm.reset();
+    }
+}
+
+static void write_summary(const fs::path& path, const std::vector<FileResult>& results, double wall)
+{
+    std::ofstream out(path);
+    double audio = 0.0;
+    size_t count = 0;
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\n  \"files\": [";
+    for (size_t i = 0; i < results.size(); i ++) {
+        const FileResult& r = results[i];
+        audio += r.duration;
+        count += r.transmissions.size();
+
+        out << (i ? "," : "") << "\n    {\n"
+            << "      \"path\": " << json_string(r.path) << ",\n"
+            << "      \"error\": " << (r.error.empty() ? "null" : json_string(r.error)) << ",\n"
+            << "      \"sample_rate\": " << r.sample_rate << ",\n"
+            << "      \"duration\": " << r.duration << ",\n"
+            << "      \"decode_seconds\": " << r.seconds << ",\n"
+            << "      \"realtime\": " << (r.seconds > 0.0 ? r.duration / r.seconds : 0.0) << ",\n"
+            << "      \"transmissions\": [";
+        for (size_t j = 0; j < r.transmissions.size(); j ++) {
+            const Transmission& t = r.transmissions[j];
+            out << (j ? "," : "") << "\n        { "
+                << "\"mode\": " << json_string(mode_name(t.mode)) << ", "
+                << "\"start\": " << (double) t.start / r.sample_rate << ", "
+                << "\"lines\": " << t.lines << ", "
+                << "\"height\": " << t.height << ", "
+                << "\"complete\": " << (t.complete ? "true" : "false") << ", "
+                << "\"drift_ppm\": " << t.drift << ", "
+                << "\"confidence\": " << (t.confidence ? std::to_string(t.confidence) : "null") << ", "
+                << "\"image\": " << (t.image.empty() ? "null" : json_string(t.image)) << " }";
+        }
+        out << (r.transmissions.empty() ? "" : "\n      ") << "]\n    }";
+    }
+    out << (results.empty() ? "" : "\n  ") << "],\n"
+        << "  \"total\": {\n"
+        << "    \"files\": " << results.size() << ",\n"
+        << "    \"transmissions\": " << count << ",\n"
+        << "    \"audio_seconds\": " << audio << ",\n"
+        << "    \"wall_seconds\": " << wall << ",\n"
+        << "    \"realtime\": " << (wall > 0.0 ? audio / wall : 0.0) << "\n"
+        << "  }\n}\n";
+
+    if (!out) {
+        throw std::runtime_error("cannot write " + path.string());
+    }
+}
+
+static bool is_recording(const fs::path& path)
+{
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".wav" || ext == ".raw";
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse command line flags */
+    args::ArgumentParser parser("Decodes SSTV transmissions from WAV or raw PCM recordings.");
+    args::HelpFlag help(parser, "help", "Display this help menu", { 'h', "help" });
+    args::ValueFlag<std::string> outputDir(parser, "dir", "output directory for images and summary (default: current)", { 'o', "output" }, ".");
+    args::ValueFlag<std::string> summaryPath(parser, "file", "JSON summary (default: <output>/summary.json)", { 's', "summary" });
+    args::ValueFlag<size_t> jobs(parser, "jobs", "worker threads (default: hardware threads)", { 'j', "jobs" }, std::max(1u, std::thread::hardware_concurrency()));
+    args::ValueFlag<double> segment(parser, "seconds", "length of the segments recordings are scanned in, in parallel (default: 300)", { "segment" }, 300.0);
+    args::Flag noIdentify(parser, "no-identify", "do not guess the mode of recordings without a VIS header", { "no-identify" });
+    args::ValueFlag<size_t> rawRate(parser, "rate", "sample rate of .raw inputs (default: 48000)", { "raw-rate" }, 48000);
+    args::ValueFlag<std::string> rawFormat(parser, "format", "sample format of .raw inputs: s16, u8 or s8 (default: s16)", { "raw-format" }, "s16");
+    args::PositionalList<std::string> inputs(parser, "inputs", "WAV/raw files, or directories containing them", args::Options::Required);
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help&) {
+        std::cout << parser;
+        return 0;
+    } catch (const args::ParseError& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser << std::endl;
+        exit(EXIT_FAILURE);
+    } catch (const args::ValidationError& e) {
+        std::cerr << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    Options opts;
+    opts.output = args::get(outputDir);
+    opts.raw_rate = (uint32_t) args::get(rawRate);
+    opts.jobs = args::get(jobs);
+    opts.segment_seconds = args::get(segment);
+    opts.identify = !noIdentify;
+    if (opts.segment_seconds < 10.0) {
+        std::cerr << "Segments must be at least 10 seconds long" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (args::get(rawFormat) == "s16") {
+        opts.raw_type = SSTV_SAMPLE_INT16;
+    } else if (args::get(rawFormat) == "u8") {
+        opts.raw_type = SSTV_SAMPLE_UINT8;
+    } else if (args::get(rawFormat) == "s8") {
+        opts.raw_type = SSTV_SAMPLE_INT8;
+    } else {
+        std::cerr << "Unknown raw format '" << args::get(rawFormat) << "'" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    /* collect recordings, directories in name order */
+    std::vector<std::unique_ptr<Recording>> recordings;
+    auto add = [&](const std::string& path) {
+        recordings.push_back(std::make_unique<Recording>());
+        recordings.back()->result.path = path;
+    };
+    for (const auto& input : args::get(inputs)) {
+        if (fs::is_directory(input)) {
+            std::vector<std::string> found;
+            for (const auto& entry : fs::recursive_directory_iterator(input)) {
+                if (entry.is_regular_file() && is_recording(entry.path())) {
+                    found.push_back(entry.path().string());
+                }
+            }
+            std::sort(found.begin(), found.end());
+            for (const auto& f : found) {
+                add(f);
+            }
+        } else {
+            add(input);
+        }
+    }
+
+    std::error_code ec;
+    fs::create_directories(opts.output, ec);
+
+    /* initialize library */
+    if (sstv_init(malloc, free) != SSTV_OK) {
+        std::cerr << "Failed to initialize libsstv" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    /* decode */
+    auto t0 = clock_type::now();
+    try {
+        decode_recordings(opts, recordings);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    double wall = std::chrono::duration<double>(clock_type::now() - t0).count();
+
+    /* report, in input order */
+    std::vector<FileResult> results;
+    for (auto& rec : recordings) {
+        const FileResult& r = rec->result;
+        if (!r.error.empty()) {
+            std::cerr << r.path << ": " << r.error << std::endl;
+        } else {
+            std::cout << r.path << ": " << r.transmissions.size() << " transmission(s), "
+                      << std::fixed << std::setprecision(1) << r.duration << "s in "
+                      << std::setprecision(2) << r.seconds << "s of worker time ("
+                      << std::setprecision(0) << (r.seconds > 0.0 ? r.duration / r.seconds : 0.0)
+                      << "x realtime per thread)" << std::endl;
+        }
+        results.push_back(r);
+    }
+
+    /* summary */
+    fs::path summary = (summaryPath ? fs::path(args::get(summaryPath)) : opts.output / "summary.json");
+    try {
+        write_summary(summary, results, wall);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    bool failed = std::any_of(results.begin(), results.end(), [](const FileResult& r) { return !r.error.empty(); });
+    return failed ? EXIT_FAILURE : 0;
+}
@@ -5,63 +5,219 @@
  * it under the terms of the MIT license. See LICENSE for details.
  */
 
+#include <algorithm>
 #include <iostream>
-#include <map>
+#include <iomanip>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 #include <cstdlib>
 
-#include <Magick++.h> 
-#include <sndfile.h>
-
 #include <libsstv.h>
 
 #include "args.hxx"
+#include "daemon.hpp"
+#include "encode.hpp"
+#include "modes.hpp"
+#include "trace.hpp"
+
+/*
+ * Batch file: one job per line, as "mode input output [sample_rate]";
+ * empty lines and lines starting with '#' are ignored
+ */
+static std::vector<EncodeJob> read_batch(std::istream& in, uint32_t default_rate)
+{
+    std::vector<EncodeJob> jobs;
+    std::string line;
+    size_t number = 0;
+
+    while (std::getline(in, line)) {
+        number ++;
+        std::istringstream fields(line);
+        std::string mode, extra;
+        EncodeJob job;
+        job.sample_rate = default_rate;
+
+        if (!(fields >> mode) || mode[0] == '#') {
+            continue;
+        }
+        if (!(fields >> job.input >> job.output)) {
+            throw std::runtime_error("line " + std::to_string(number) + ": expected mode, input and output");
+        }
+        if (fields >> extra) {
+            job.sample_rate = (uint32_t) std::stoul(extra);
+        }
+
+        std::transform(mode.begin(), mode.end(), mode.begin(), ::toupper);
+        auto it = stringToModeMap.find(mode);
+        if (it == stringToModeMap.end()) {
+            throw std::runtime_error("line " + std::to_string(number) + ": unknown mode '" + mode + "'");
+        }
+        job.mode = it->second;
+        jobs.push_back(job);
+    }
+
+    return jobs;
+}
+
+/*
+ * Hands jobs to a running sstv-encoded instead of encoding them; connects on
+ * first use, and copies the samples of "-" outputs to standard output
+ */
+class DaemonClient {
+public:
+    explicit DaemonClient(const std::string& socket) : socket_(socket) {}
+
+    ~DaemonClient()
+    {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    DaemonClient(const DaemonClient&) = delete;
+    DaemonClient& operator=(const DaemonClient&) = delete;
+
+    uint64_t run(const EncodeJob& job, const EncodeOptions& opts, ChromeTrace *trace)
+    {
+        if (fd_ < 0) {
+            fd_ = connect_unix(socket_);
+            reader_ = SocketReader(fd_);
+        }
+
+        /* paths are resolved by the daemon, from its own working directory */
+        DaemonRequest req;
+        req.mode = mode_name(job.mode);
+        req.sample_rate = job.sample_rate;
+        req.format = (opts.raw ? sample_format_name(opts.raw_type) : "wav");
+        req.input = std::filesystem::absolute(job.input).string();
+        req.output = (job.output == "-" ? job.output : std::filesystem::absolute(job.output).string());
+
+        std::string line;
+        {
+            TraceScope scope(trace, "request");
+            std::string request = format_request(req);
+            write_all(fd_, request.data(), request.size());
+            if (!reader_.read_line(line)) {
+                throw std::runtime_error("daemon closed the connection");
+            }
+        }
+        if (line.compare(0, 4, "ERR ") == 0) {
+            throw std::runtime_error(line.substr(4));
+        }
+        if (line.compare(0, 3, "OK ") != 0) {
+            throw std::runtime_error("unexpected reply from daemon: " + line);
+        }
+        uint64_t count = std::stoull(line.substr(3));
 
-std::map<std::string, sstv_mode_t> stringToModeMap = {
-    { "FAX480", SSTV_MODE_FAX480 },
-    { "ROBOT_BW8_R", SSTV_MODE_ROBOT_BW8_R },
-    { "ROBOT_BW8_G", SSTV_MODE_ROBOT_BW8_G },
-    { "ROBOT_BW8_B", SSTV_MODE_ROBOT_BW8_B },
-    { "ROBOT_BW12_R", SSTV_MODE_ROBOT_BW12_R },
-    { "ROBOT_BW12_G", SSTV_MODE_ROBOT_BW12_G },
-    { "ROBOT_BW12_B", SSTV_MODE_ROBOT_BW12_B },
-    { "ROBOT_BW24_R", SSTV_MODE_ROBOT_BW24_R },
-    { "ROBOT_BW24_G", SSTV_MODE_ROBOT_BW24_G },
-    { "ROBOT_BW24_B", SSTV_MODE_ROBOT_BW24_B },
-    { "ROBOT_BW36_R", SSTV_MODE_ROBOT_BW36_R },
-    { "ROBOT_BW36_G", SSTV_MODE_ROBOT_BW36_G },
-    { "ROBOT_BW36_B", SSTV_MODE_ROBOT_BW36_B },
-    { "ROBOT_C12", SSTV_MODE_ROBOT_C12 },
-    { "ROBOT_C24", SSTV_MODE_ROBOT_C24 },
-    { "ROBOT_C36", SSTV_MODE_ROBOT_C36 },
-    { "ROBOT_C72", SSTV_MODE_ROBOT_C72 },
-    { "SCOTTIE_S1", SSTV_MODE_SCOTTIE_S1 },
-    { "SCOTTIE_S2", SSTV_MODE_SCOTTIE_S2 },
-    { "SCOTTIE_S3", SSTV_MODE_SCOTTIE_S3 },
-    { "SCOTTIE_S4", SSTV_MODE_SCOTTIE_S4 },
-    { "SCOTTIE_DX", SSTV_MODE_SCOTTIE_DX },
-    { "MARTIN_M1", SSTV_MODE_MARTIN_M1 },
-    { "MARTIN_M2", SSTV_MODE_MARTIN_M2 },
-    { "MARTIN_M3", SSTV_MODE_MARTIN_M3 },
-    { "MARTIN_M4", SSTV_MODE_MARTIN_M4 },
-    { "PD50", SSTV_MODE_PD50 },
-    { "PD90", SSTV_MODE_PD90 },
-    { "PD120", SSTV_MODE_PD120 },
-    { "PD160", SSTV_MODE_PD160 },
-    { "PD180", SSTV_MODE_PD180 },
-    { "PD240", SSTV_MODE_PD240 },
-    { "PD290", SSTV_MODE_PD290 },
+        /* samples sent back */
+        if (job.output == "-") {
+            TraceScope scope(trace, "receive");
+            size_t size = sample_size(opts.raw_type);
+            RawSink sink("-", opts.raw_type);
+            buffer_.resize(opts.chunk * size);
+            for (uint64_t done = 0; done < count;) {
+                uint32_t n = (uint32_t)std::min<uint64_t>(opts.chunk, count - done);
+                if (!reader_.read_exact(buffer_.data(), n * size)) {
+                    throw std::runtime_error("daemon closed the connection");
+                }
+                sink.write(buffer_.data(), n);
+                done += n;
+            }
+        }
+
+        return count;
+    }
+
+private:
+    static std::string mode_name(sstv_mode_t mode)
+    {
+        for (const auto& m : stringToModeMap) {
+            if (m.second == mode) {
+                return m.first;
+            }
+        }
+        return "";
+    }
+
+    std::string socket_;
+    int fd_ = -1;
+    SocketReader reader_;
+    std::vector<uint8_t> buffer_;
 };
 
-sstv_mode_t mode_from_string(std::string mode)
+/*
+ * Runs jobs on a number of worker threads, reporting failures as they happen
+ * and total throughput at the end; returns the number of failed jobs. An
+ * exception escaping a worker (e.g. failing to set it up) is rethrown once all
+ * workers have joined.
+ */
+template <typename Worker, typename... Args>
+static size_t run_batch(const std::vector<EncodeJob>& jobs, size_t threads, const EncodeOptions& opts, ChromeTrace *trace,
+                        const Args&... args)
 {
-    std::transform(mode.begin(), mode.end(), mode.begin(), ::toupper);
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> failed(0);
+    std::atomic<uint64_t> samples(0);
+    std::atomic<double> seconds(0.0);
+    std::mutex console;
+    std::exception_ptr error;
 
-    if (auto it = stringToModeMap.find(mode); it != stringToModeMap.end()) {
-        return (*it).second;
-    } else {
-        std::cerr << "Unknown mode '" << mode << "'" << std::endl;
-        exit(EXIT_FAILURE);
+    auto start = std::chrono::steady_clock::now();
+    auto work = [&]() {
+        try {
+            Worker worker(args...);
+            size_t i;
+            while ((i = next.fetch_add(1)) < jobs.size()) {
+                try {
+                    uint64_t n = worker.run(jobs[i], opts, trace);
+                    samples += n;
+                    double s = seconds.load();
+                    while (!seconds.compare_exchange_weak(s, s + (double) n / jobs[i].sample_rate)) {
+                    }
+                } catch (const std::exception& e) {
+                    failed ++;
+                    std::lock_guard<std::mutex> lock(console);
+                    std::cerr << jobs[i].input << " -> " << jobs[i].output << ": " << e.what() << std::endl;
+                }
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(console);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; t ++) {
+        pool.emplace_back(work);
+    }
+    work();
+    for (auto& t : pool) {
+        t.join();
     }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t done = jobs.size() - failed;
+    *opts.log << "Encoded " << done << "/" << jobs.size() << " images on " << threads << " threads in "
+              << std::fixed << std::setprecision(2) << wall << " s: "
+              << std::setprecision(1) << done / wall << " images/s, "
+              << samples / wall / 1e6 << " Msamples/s, "
+              << seconds / wall << "x real time" << std::endl;
+
+    return failed;
 }
 
 int main(int argc, char **argv)
@@ -71,9 +227,19 @@ int main(int argc, char **argv)
     args::HelpFlag help(parser, "help", "Display this help menu", { 'h', "help" });
     args::Flag list(parser, "list", "list supported SSTV modes", { 'l', "list" });
     args::Positional<std::string> modeString(parser, "mode", "the desired SSTV mode", args::Options::Required);
-    args::Positional<std::string> input(parser, "input", "input image file", args::Options::Required);
-    args::Positional<std::string> output(parser, "output", "output WAV file", args::Options::Required);
+    args::Positional<std::string> input(parser, "input", "input image file (PPM, PGM, BMP or raw RGB; other formats through ImageMagick)", args::Options::Required);
+    args::Positional<std::string> output(parser, "output", "output WAV file, or - for raw samples on standard output", args::Options::Required);
     args::Positional<size_t> sample_rate(parser, "sample_rate", "output WAV file", 48000);
+    args::ValueFlag<std::string> tracePath(parser, "file", "write Chrome/Perfetto trace events to file", { "trace" });
+    args::ValueFlag<std::string> batch(parser, "file", "encode the jobs listed in file (\"mode input output [sample_rate]\" per line, - for standard input) instead", { "batch" });
+    args::ValueFlag<size_t> threads(parser, "threads", "worker threads for --batch (default: hardware threads)", { 'j', "jobs" },
+                                    std::max(1u, std::thread::hardware_concurrency()));
+    args::Flag raw(parser, "raw", "write headerless PCM instead of WAV", { "raw" });
+    args::ValueFlag<std::string> rawFormat(parser, "format", "sample format of headerless PCM: s16, u8 or s8 (default: s16)", { "raw-format" }, "s16");
+    args::ValueFlag<size_t> chunk(parser, "samples", "samples encoded and written at once (default: 131072)", { "chunk" }, 128 * 1024);
+    args::Flag mappedOutput(parser, "mmap", "size output files up front and encode into them in place, without libsndfile", { "mmap" });
+    args::Flag verbose(parser, "verbose", "report progress of every block", { 'v', "verbose" });
+    args::ValueFlag<std::string> daemon(parser, "socket", "have the sstv-encoded daemon listening on socket encode the image(s)", { "connect" });
 
     try {
         parser.ParseCLI(argc, argv);
@@ -81,7 +247,7 @@ int main(int argc, char **argv)
         std::cout << parser;
         return 0;
     } catch (const args::RequiredError& e) {
-        if (!list) {
+        if (!list && !batch) {
             std::cerr << e.what() << std::endl;
             exit(EXIT_FAILURE);
         }
@@ -100,122 +266,121 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    /* parse SSTV mode */
-    sstv_mode_t mode = mode_from_string(args::get(modeString));
-
-    /* get image properties for chosen mode */
-    uint32_t width, height;
-    sstv_image_format_t format;
-    if (sstv_get_mode_image_props(mode, &width, &height, &format) != SSTV_OK) {
-        std::cerr << "sstv_get_mode_image_props() failed" << std::endl;
-        exit(EXIT_FAILURE);
+    /* output options; with samples on standard output, messages go to standard error */
+    EncodeOptions opts;
+    opts.raw = raw || (!batch && args::get(output) == "-");
+    opts.verbose = verbose;
+    opts.mmap = mappedOutput;
+    if (!batch && args::get(output) == "-") {
+        opts.log = &std::cerr;
     }
-
-    /* load image from file */
-    std::cout << "Loading image from " << args::get(input) << std::endl;
-
-    Magick::Image image;
-    uint8_t *image_buffer = NULL;
-
-    try {
-        /* load from file */
-        image.read(args::get(input));
-
-        /* resize */
-        std::cout << "Resizing to " << width << "x" << height << std::endl;
-        Magick::Geometry nsize(width, height);
-        nsize.aspect(true);
-        image.scale(nsize);
-    } catch (int e) {
-        std::cerr << "Magick++ failed" << std::endl;
+    if (!parse_sample_format(args::get(rawFormat), opts.raw_type)) {
+        std::cerr << "Unknown raw format '" << args::get(rawFormat) << "'" << std::endl;
         exit(EXIT_FAILURE);
     }
-
-    /* get raw RGB (and convert it if necessary) */
-    image.colorSpace(Magick::sRGBColorspace);
-    Magick::PixelData blob(image, "RGB", Magick::CharPixel);
-    image_buffer = (uint8_t *)blob.data();
-
-    sstv_image_t sstv_image;
-    if (sstv_pack_image(&sstv_image, width, height, SSTV_FORMAT_RGB, image_buffer) != SSTV_OK) {
-        std::cerr << "sstv_pack_image() failed" << std::endl;
+    if (args::get(chunk) == 0 || args::get(chunk) > UINT32_MAX) {
+        std::cerr << "Chunks must hold between 1 and " << UINT32_MAX << " samples" << std::endl;
         exit(EXIT_FAILURE);
     }
+    opts.chunk = args::get(chunk);
 
-    /* convert to mode's colorspace */
-    if (sstv_convert_image(&sstv_image, format) != SSTV_OK) {
-        std::cerr << "sstv_convert_image() failed" << std::endl;
-        exit(EXIT_FAILURE);
+    /* initialize libraries */
+#ifdef SSTV_HAVE_MAGICK
+    if (!daemon) {
+        Magick::InitializeMagick(*argv);
     }
-
-    /* create a sample buffer for output */
-    int16_t samp_buffer[128 * 1024];
-    sstv_signal_t signal;
-    if (sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, 128 * 1024, samp_buffer) != SSTV_OK) {
-        std::cerr << "sstv_pack_signal() failed" << std::endl;
-        exit(EXIT_FAILURE);
-    }
-
-    /* initialize library */
-    std::cout << "Initializing libsstv" << std::endl;
+#endif
     if (sstv_init(malloc, free) != SSTV_OK) {
         std::cerr << "Failed to initialize libsstv" << std::endl;
         exit(EXIT_FAILURE);
     }
 
-    /* create encoder context */
-    std::cout << "Creating encoding context" << std::endl;
-    void *ctx = nullptr;
-    if (sstv_create_encoder(&ctx, sstv_image, mode, args::get(sample_rate)) != SSTV_OK) {
-        std::cerr << "Failed to create SSTV encoder" << std::endl;
-        exit(EXIT_FAILURE);
-    }
-    if (!ctx) {
-        std::cerr << "NULL encoder received" << std::endl;
-        exit(EXIT_FAILURE);
-    }
-
-    /* open WAV file */
-    SF_INFO wavinfo;
-    wavinfo.samplerate = args::get(sample_rate);
-    wavinfo.channels = 1;
-    wavinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
-    SNDFILE *wavfile = sf_open(args::get(output).c_str(), SFM_WRITE, &wavinfo);
-    if (!wavfile) {
-        std::cerr << "sf_open() failed: " << sf_strerror(NULL) << std::endl;
-        exit(EXIT_FAILURE);
+    /* trace tool phases, and library calls if it was built with TRACE_HOOKS */
+    std::unique_ptr<ChromeTrace> trace;
+    if (tracePath) {
+        trace = std::make_unique<ChromeTrace>();
+        if (!trace->hook_library()) {
+            std::cerr << "libsstv built without TRACE_HOOKS, tracing tool phases only" << std::endl;
+        }
     }
 
-    /* encode */
-    while (true) {
-        /* encode block */
-        sstv_error_t rc = sstv_encode(ctx, &signal);
-        if (rc != SSTV_ENCODE_SUCCESSFUL && rc != SSTV_ENCODE_END) {
-            std::cerr << "sstv_encode() failed with rc " << rc << std::endl;
+    size_t failed = 0;
+    if (batch) {
+        /* many images, on a pool of workers */
+        std::vector<EncodeJob> jobs;
+        try {
+            if (args::get(batch) == "-") {
+                jobs = read_batch(std::cin, (uint32_t) args::get(sample_rate));
+            } else {
+                std::ifstream in(args::get(batch));
+                if (!in) {
+                    throw std::runtime_error("cannot read " + args::get(batch));
+                }
+                jobs = read_batch(in, (uint32_t) args::get(sample_rate));
+            }
+        } catch (const std::exception& e) {
+            std::cerr << args::get(batch) << ": " << e.what() << std::endl;
             exit(EXIT_FAILURE);
         }
 
-        /* write to sound file */
-        sf_write_short(wavfile, (int16_t *)signal.buffer, signal.count);
-        std::cout << "Written " << signal.count << " samples" << std::endl;
+        for (const auto& job : jobs) {
+            if (job.output == "-" && jobs.size() > 1) {
+                std::cerr << args::get(batch) << ": only a single job can write to standard output" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            if (job.output == "-") {
+                opts.raw = true;
+                opts.log = &std::cerr;
+            }
+        }
 
-        /* exit case */
-        if (rc == SSTV_ENCODE_END) {
-            break;
+        size_t count = std::max<size_t>(1, std::min(args::get(threads), jobs.size()));
+        try {
+            if (daemon) {
+                failed = run_batch<DaemonClient>(jobs, count, opts, trace.get(), args::get(daemon));
+            } else {
+                failed = run_batch<EncodeWorker>(jobs, count, opts, trace.get());
+            }
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            failed = jobs.size();
+        }
+    } else {
+        /* single image */
+        EncodeJob job = { mode_from_string(args::get(modeString)), args::get(input), args::get(output),
+                          (uint32_t) args::get(sample_rate) };
+        try {
+            uint64_t n;
+            if (daemon) {
+                n = DaemonClient(args::get(daemon)).run(job, opts, trace.get());
+            } else {
+                n = EncodeWorker().run(job, opts, trace.get());
+            }
+            *opts.log << "Written " << n << " samples (" << std::fixed << std::setprecision(2)
+                      << (double) n / job.sample_rate << " s) to " << job.output << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            failed = 1;
         }
     }
 
-    /* close wav file */
-    sf_close(wavfile);
+    /* write trace */
+    if (trace) {
+        ChromeTrace::unhook_library();
+        try {
+            trace->write(args::get(tracePath));
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        *opts.log << "Trace written to " << args::get(tracePath) << std::endl;
+    }
 
-    /* cleanup */
-    std::cout << "Cleaning up" << std::endl;
-    if (sstv_delete_encoder(ctx) != SSTV_OK) {
-        std::cerr << "Failed to delete SSTV encoder" << std::endl;
+    if (failed) {
         exit(EXIT_FAILURE);
     }
 
     /* all ok */
-    std::cout << "Successfuly exited" << std::endl;
+    *opts.log << "Successfuly exited" << std::endl;
     return 0;
 }
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <cstdlib>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <libsstv.h>
+
+#include "args.hxx"
+#include "daemon.hpp"
+#include "encode.hpp"
+#include "modes.hpp"
+
+/*
+ * Socket path, removed on SIGINT/SIGTERM
+ */
+static char socket_path[sizeof(((struct sockaddr_un *)nullptr)->sun_path)];
+
+static void on_signal(int)
+{
+    unlink(socket_path);
+    _exit(EXIT_SUCCESS);
+}
+
+/*
+ * Accepted connections, waiting for a free worker
+ */
+class ConnectionQueue {
+public:
+    void push(int fd)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            fds_.push_back(fd);
+        }
+        ready_.notify_one();
+    }
+
+    int pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this]() { return !fds_.empty(); });
+        int fd = fds_.front();
+        fds_.pop_front();
+        return fd;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<int> fds_;
+};
+
+/*
+ * Serves the requests of one connection until the client closes it, with
+ * the worker's warm encoder contexts
+ */
+static void serve(int fd, EncodeWorker& worker, const EncodeOptions& defaults, bool verbose, std::mutex& console)
+{
+    SocketReader reader(fd);
+    std::string line;
+    try {
+        while (reader.read_line(line)) {
+            DaemonRequest req;
+            EncodeOptions opts = defaults;
+            bool pending = false;
+            bool streaming = false;
+            std::string error;
+
+            try {
+                if (!parse_request(line, req)) {
+                    /* pixels may follow, so the connection cannot be trusted any longer */
+                    pending = true;
+                    throw std::runtime_error("malformed request");
+                }
+                pending = (req.input == "-");
+
+                std::string mode = req.mode;
+                std::transform(mode.begin(), mode.end(), mode.begin(), ::toupper);
+                auto it = stringToModeMap.find(mode);
+                if (it == stringToModeMap.end()) {
+                    throw std::runtime_error("unknown mode '" + req.mode + "'");
+                }
+                if (req.sample_rate < DAEMON_MIN_RATE || req.sample_rate > DAEMON_MAX_RATE) {
+                    throw std::runtime_error("sample rate must be between " + std::to_string(DAEMON_MIN_RATE)
+                                             + " and " + std::to_string(DAEMON_MAX_RATE) + " Hz");
+                }
+                EncodeJob job = { it->second, req.input, req.output, req.sample_rate };
+
+                opts.raw = (req.format != "wav");
+                if (opts.raw && !parse_sample_format(req.format, opts.raw_type)) {
+                    throw std::runtime_error("unknown format '" + req.format + "'");
+                }
+                if (job.output == "-" && !opts.raw) {
+                    throw std::runtime_error("samples sent back must be headerless PCM");
+                }
+
+                /* image, from the connection or from a file */
+                if (job.input == "-") {
+                    uint32_t width, height;
+                    sstv_image_format_t format;
+                    if (sstv_get_mode_image_props(job.mode, &width, &height, &format) != SSTV_OK) {
+                        throw std::runtime_error("sstv_get_mode_image_props() failed");
+                    }
+                    size_t size = (size_t)width * height * 3;
+                    if (!reader.read_exact(worker.pixel_buffer(size), size)) {
+                        throw std::runtime_error("connection closed before the pixels");
+                    }
+                    pending = false;
+                    worker.bind_pixels(job, nullptr);
+                } else {
+                    worker.bind(job, opts, nullptr);
+                }
+
+                /* samples, to the connection or to a file */
+                uint64_t count;
+                if (job.output == "-") {
+                    count = worker.sample_count();
+                    std::string reply = "OK " + std::to_string(count) + "\n";
+                    write_all(fd, reply.data(), reply.size());
+                    streaming = true;
+
+                    RawSink sink(fd, "client", opts.raw_type);
+                    worker.encode(sink, opts.raw_type, opts, nullptr);
+                } else {
+                    count = worker.encode(job, opts, nullptr);
+                    std::string reply = "OK " + std::to_string(count) + "\n";
+                    write_all(fd, reply.data(), reply.size());
+                }
+
+                if (verbose) {
+                    std::lock_guard<std::mutex> lock(console);
+                    std::cout << req.mode << " " << req.sample_rate << " " << req.format << " " << req.input
+                              << " -> " << req.output << ": " << count << " samples" << std::endl;
+                }
+            } catch (const std::exception& e) {
+                error = e.what();
+            }
+
+            if (!error.empty()) {
+                {
+                    std::lock_guard<std::mutex> lock(console);
+                    std::cerr << (req.input.empty() ? line : req.input + " -> " + req.output) << ": " << error
+                              << std::endl;
+                }
+
+                /* half-sent samples cannot be taken back; unread pixels cannot be
+                   skipped, so the connection is closed after the reply */
+                if (streaming) {
+                    break;
+                }
+                std::string reply = "ERR " + error + "\n";
+                write_all(fd, reply.data(), reply.size());
+                if (pending) {
+                    break;
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        /* client went away */
+        std::lock_guard<std::mutex> lock(console);
+        std::cerr << "connection: " << e.what() << std::endl;
+    }
+
+    close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse command line flags */
+    args::ArgumentParser parser("Encodes images into SSTV audio signals for clients of a Unix socket.");
+    args::HelpFlag help(parser, "help", "Display this help menu", { 'h', "help" });
+    args::Positional<std::string> socketPath(parser, "socket", "path of the Unix socket to listen on", args::Options::Required);
+    args::ValueFlag<size_t> threads(parser, "threads", "worker threads, each serving one connection at a time (default: hardware threads)",
+                                    { 'j', "jobs" }, std::max(1u, std::thread::hardware_concurrency()));
+    args::ValueFlag<size_t> chunk(parser, "samples", "samples encoded and written at once (default: 131072)", { "chunk" }, 128 * 1024);
+    args::Flag mappedOutput(parser, "mmap", "size output files up front and encode into them in place, without libsndfile", { "mmap" });
+    args::Flag verbose(parser, "verbose", "report every request served", { 'v', "verbose" });
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch (args::Help&) {
+        std::cout << parser;
+        return 0;
+    } catch (const args::ParseError& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << parser << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    EncodeOptions opts;
+    opts.mmap = mappedOutput;
+    opts.log = &std::cerr;
+    if (args::get(chunk) == 0 || args::get(chunk) > UINT32_MAX) {
+        std::cerr << "Chunks must hold between 1 and " << UINT32_MAX << " samples" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    opts.chunk = args::get(chunk);
+    size_t workers = std::max<size_t>(1, args::get(threads));
+
+    /* initialize libraries */
+#ifdef SSTV_HAVE_MAGICK
+    Magick::InitializeMagick(*argv);
+#endif
+    if (sstv_init(malloc, free) != SSTV_OK) {
+        std::cerr << "Failed to initialize libsstv" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    /* listen, replacing the socket left behind by a previous instance */
+    const std::string& path = args::get(socketPath);
+    if (path.size() >= sizeof(socket_path)) {
+        std::cerr << "Socket path too long: " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::memcpy(socket_path, path.c_str(), path.size() + 1);
+
+    struct stat st;
+    if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        /* a socket still accepting connections belongs to a running instance */
+        bool live = false;
+        try {
+            close(connect_unix(path));
+            live = true;
+        } catch (const std::runtime_error&) {
+        }
+        if (live) {
+            std::cerr << "Socket " << path << " is in use by a running instance" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        unlink(socket_path);
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, socket_path, sizeof(socket_path));
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0) {
+        std::cerr << "Cannot listen on " << path << ": " << std::strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    /* clients hanging up are reported as write errors */
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    /* workers keep their encoder contexts for as long as the daemon runs */
+    ConnectionQueue queue;
+    std::mutex console;
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < workers; t ++) {
+        pool.emplace_back([&]() {
+            EncodeWorker worker;
+            while (true) {
+                serve(queue.pop(), worker, opts, verbose, console);
+            }
+        });
+    }
+
+    std::cout << "Listening on " << path << " with " << workers << " workers" << std::endl;
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            std::cerr << "accept() failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        queue.push(fd);
+    }
+
+    unlink(socket_path);
+    exit(EXIT_FAILURE);
+}
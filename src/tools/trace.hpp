@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _SSTV_TOOLS_TRACE_HPP_
+#define _SSTV_TOOLS_TRACE_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libsstv.h>
+
+/*
+ * Chrome trace event recorder (JSON object format, loads in chrome://tracing
+ * and Perfetto).
+ *
+ * Events are kept in memory and written out by write(), so recording costs a
+ * clock read and a vector append. Synchronous spans ("B"/"E") must nest per
+ * thread; async spans ("b"/"e") may overlap them, and are used for image lines,
+ * which begin and end inside different sstv_encode() calls.
+ */
+class ChromeTrace {
+public:
+    using clock = std::chrono::steady_clock;
+
+    ChromeTrace() : start_(clock::now()) {}
+
+    void begin(const std::string& name, const std::string& category, const std::string& args = "")
+    {
+        record(name, category, 'B', 0, args);
+    }
+
+    void end(const std::string& name, const std::string& category, const std::string& args = "")
+    {
+        record(name, category, 'E', 0, args);
+    }
+
+    void async_begin(const std::string& name, const std::string& category, uint64_t id, const std::string& args = "")
+    {
+        record(name, category, 'b', id, args);
+    }
+
+    void async_end(const std::string& name, const std::string& category, uint64_t id, const std::string& args = "")
+    {
+        record(name, category, 'e', id, args);
+    }
+
+    /* route the library's trace hooks into this recorder */
+    bool hook_library()
+    {
+        return sstv_set_trace_hooks(library_begin, library_end, this) == SSTV_OK;
+    }
+
+    static void unhook_library()
+    {
+        sstv_set_trace_hooks(nullptr, nullptr, nullptr);
+    }
+
+    void write(const std::string& path) const
+    {
+        std::ofstream out(path);
+        if (!out) {
+            throw std::runtime_error("cannot write " + path);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        out << "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        for (size_t i = 0; i < events_.size(); i ++) {
+            const Event& e = events_[i];
+            out << (i ? "," : "") << std::endl << "  { \"name\": \"" << e.name << "\", \"cat\": \"" << e.category
+                << "\", \"ph\": \"" << e.phase << "\", \"ts\": " << std::fixed << std::setprecision(3) << e.ts
+                << ", \"pid\": 1, \"tid\": " << e.tid;
+            if (e.phase == 'b' || e.phase == 'e') {
+                out << ", \"id\": " << e.id;
+            }
+            if (!e.args.empty()) {
+                out << ", \"args\": { " << e.args << " }";
+            }
+            out << " }";
+        }
+        out << std::endl << "] }" << std::endl;
+
+        if (!out) {
+            throw std::runtime_error("cannot write " + path);
+        }
+    }
+
+private:
+    struct Event {
+        std::string name;
+        std::string category;
+        char phase;
+        double ts;
+        uint32_t tid;
+        uint64_t id;
+        std::string args;
+    };
+
+    void record(const std::string& name, const std::string& category, char phase, uint64_t id, const std::string& args)
+    {
+        double ts = std::chrono::duration<double, std::micro>(clock::now() - start_).count();
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint32_t tid = thread_id();
+
+        /* async ids are per thread, so that concurrent encoders do not pair up each other's lines */
+        if (phase == 'b' || phase == 'e') {
+            id |= (uint64_t)tid << 32;
+        }
+        events_.push_back({ name, category, phase, ts, tid, id, args });
+    }
+
+    /* small, stable thread ids, in order of first event */
+    uint32_t thread_id()
+    {
+        auto self = std::this_thread::get_id();
+        for (size_t i = 0; i < threads_.size(); i ++) {
+            if (threads_[i] == self) {
+                return (uint32_t)i + 1;
+            }
+        }
+        threads_.push_back(self);
+        return (uint32_t)threads_.size();
+    }
+
+    static void library_begin(sstv_trace_event_t event, uint32_t arg, void *user)
+    {
+        ChromeTrace *trace = (ChromeTrace *)user;
+        switch (event) {
+            case SSTV_TRACE_CREATE_ENCODER:
+                trace->begin("sstv_create_encoder", "libsstv", "\"mode\": " + std::to_string(arg));
+                break;
+            case SSTV_TRACE_ENCODE:
+                trace->begin("sstv_encode", "libsstv", "\"capacity\": " + std::to_string(arg));
+                break;
+            case SSTV_TRACE_LINE:
+                trace->async_begin("line " + std::to_string(arg), "line", arg);
+                break;
+            case SSTV_TRACE_CONVERT_IMAGE:
+                trace->begin("sstv_convert_image", "libsstv", "\"format\": " + std::to_string(arg));
+                break;
+        }
+    }
+
+    static void library_end(sstv_trace_event_t event, uint32_t arg, void *user)
+    {
+        ChromeTrace *trace = (ChromeTrace *)user;
+        switch (event) {
+            case SSTV_TRACE_CREATE_ENCODER:
+                trace->end("sstv_create_encoder", "libsstv");
+                break;
+            case SSTV_TRACE_ENCODE:
+                trace->end("sstv_encode", "libsstv", "\"samples\": " + std::to_string(arg));
+                break;
+            case SSTV_TRACE_LINE:
+                trace->async_end("line " + std::to_string(arg), "line", arg);
+                break;
+            case SSTV_TRACE_CONVERT_IMAGE:
+                trace->end("sstv_convert_image", "libsstv");
+                break;
+        }
+    }
+
+    clock::time_point start_;
+    mutable std::mutex mutex_;
+    std::vector<Event> events_;
+    std::vector<std::thread::id> threads_;
+};
+
+/*
+ * Synchronous span for the lifetime of a scope; a no-op without a recorder
+ */
+class TraceScope {
+public:
+    TraceScope(ChromeTrace *trace, const std::string& name, const std::string& category = "tool")
+        : trace_(trace), name_(name), category_(category)
+    {
+        if (trace_) {
+            trace_->begin(name_, category_);
+        }
+    }
+
+    ~TraceScope()
+    {
+        if (trace_) {
+            trace_->end(name_, category_);
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    ChromeTrace *trace_;
+    std::string name_;
+    std::string category_;
+};
+
+#endif
@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "libsstv.h"
+#include "sstv.h"
+#include "demod.h"
+
+/*
+ * Detector tuning
+ */
+#define SSTV_VIS_LEADER_HZ          1900
+#define SSTV_VIS_LOW_HZ             1200 /* break, start/stop bits and sync */
+#define SSTV_VIS_ONE_HZ             1100
+#define SSTV_VIS_ZERO_HZ            1300
+#define SSTV_VIS_BIT_NS             30000000
+
+#define SSTV_VIS_SEARCH_BLOCK_MS    1
+#define SSTV_VIS_LEADER_MIN_BLOCKS  100 /* 100ms of leader before VIS */
+#define SSTV_VIS_START_MIN_BLOCKS   20  /* longer than the 10ms break */
+#define SSTV_VIS_MAX_MISSES         3   /* tolerated noisy blocks in a tone */
+#define SSTV_VIS_MIN_LEVEL          16  /* minimum mean square input level */
+#define SSTV_VIS_INPUT_SHIFT        2   /* input headroom for the resonators */
+
+#define SSTV_VIS_MIN_RATE           6000
+#define SSTV_VIS_MAX_RATE           384000
+
+/*
+ * Goertzel resonator, for power at a single frequency over a block
+ */
+typedef struct {
+    int64_t coeff; /* 2cos(w), Q29 */
+    int64_t cos;   /* cos(w), Q30 */
+    int64_t sin;   /* sin(w), Q30 */
+    int64_t s1;
+    int64_t s2;
+} sstv_goertzel_t;
+
+/*
+ * Detector state
+ */
+typedef enum {
+    /* looking for the leader tone */
+    SSTV_VIS_STATE_LEADER,
+
+    /* leader tone interrupted, either by break or by VIS start bit */
+    SSTV_VIS_STATE_LOW,
+
+    /* VIS code bits */
+    SSTV_VIS_STATE_BITS,
+
+    /* VIS code valid, waiting for the stop bit to end */
+    SSTV_VIS_STATE_STOP
+} sstv_vis_state_t;
+
+typedef enum {
+    SSTV_VIS_TONE_NONE,
+    SSTV_VIS_TONE_LEADER,
+    SSTV_VIS_TONE_LOW
+} sstv_vis_tone_t;
+
+/*
+ * Detector context
+ */
+typedef struct {
+    /* input configuration */
+    uint32_t sample_rate;
+
+    /* current state */
+    sstv_vis_state_t state;
+
+    /* index of next input sample */
+    uint64_t position;
+
+    /* leader/start bit search, in fixed length blocks */
+    struct {
+        sstv_goertzel_t leader;
+        sstv_goertzel_t low;
+        int64_t energy;
+        uint32_t length;
+        uint32_t pos;
+        uint32_t run;
+        uint32_t misses;
+        uint64_t low_start;
+    } search;
+
+    /* VIS code, one block centered in each bit */
+    struct {
+        sstv_goertzel_t one;
+        sstv_goertzel_t zero;
+        uint64_t start_usamp; /* start bit onset, in microsamples */
+        uint64_t bit_usamp;
+        uint64_t block_start;
+        uint64_t block_end;
+        uint32_t bit;
+        uint8_t code;
+    } vis;
+
+    /* detection result */
+    sstv_mode_t mode;
+    uint64_t sync;
+} sstv_vis_context_t;
+
+/*
+ * Default detector contexts, for when no allocation/deallocation routines are provided
+ */
+static sstv_vis_context_t default_vis_context[SSTV_DEFAULT_VIS_DETECTOR_CONTEXT_COUNT];
+static uint64_t default_vis_context_usage = 0x0;
+
+
+static void
+sstv_goertzel_init(sstv_goertzel_t *g, uint32_t freq, uint32_t sample_rate)
+{
+    sstv_sincos((int32_t) ((((uint64_t)freq) << 32) / sample_rate), &g->sin, &g->cos);
+    g->coeff = g->cos;
+    g->s1 = 0;
+    g->s2 = 0;
+}
+
+static inline void
+sstv_goertzel_step(sstv_goertzel_t *g, int32_t x)
+{
+    int64_t s = x + ((g->coeff * g->s1) >> 29) - g->s2;
+    g->s2 = g->s1;
+    g->s1 = s;
+}
+
+static int64_t
+sstv_goertzel_power(sstv_goertzel_t *g)
+{
+    int64_t re = g->s1 - ((g->cos * g->s2) >> 30);
+    int64_t im = (g->sin * g->s2) >> 30;
+
+    g->s1 = 0;
+    g->s2 = 0;
+    return re * re + im * im;
+}
+
+static void
+sstv_vis_search(sstv_vis_context_t *ctx)
+{
+    ctx->state = SSTV_VIS_STATE_LEADER;
+    ctx->search.run = 0;
+    ctx->search.misses = 0;
+}
+
+sstv_error_t
+sstv_create_vis_detector(void **out_ctx, uint32_t sample_rate)
+{
+    sstv_vis_context_t *ctx = NULL;
+
+    /* check input */
+    if (!out_ctx) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    if (sample_rate < SSTV_VIS_MIN_RATE || sample_rate > SSTV_VIS_MAX_RATE) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* create context */
+    if (sstv_malloc_user) {
+        /* user allocator */
+        ctx = (sstv_vis_context_t *) sstv_malloc_user(sizeof(sstv_vis_context_t));
+        if (!ctx) {
+            return SSTV_ALLOC_FAIL;
+        }
+    } else {
+        uint32_t i;
+        /* use default contexts */
+        for (i = 0; i < SSTV_DEFAULT_VIS_DETECTOR_CONTEXT_COUNT; i++) {
+            if ((default_vis_context_usage & (0x1 << i)) == 0) {
+                default_vis_context_usage |= (0x1 << i);
+                ctx = &default_vis_context[i];
+                break;
+            }
+        }
+        if (!ctx) {
+            return SSTV_NO_DEFAULT_DETECTORS;
+        }
+    }
+
+    /* initialize context */
+    ctx->sample_rate = sample_rate;
+    ctx->position = 0;
+
+    sstv_goertzel_init(&ctx->search.leader, SSTV_VIS_LEADER_HZ, sample_rate);
+    sstv_goertzel_init(&ctx->search.low, SSTV_VIS_LOW_HZ, sample_rate);
+    ctx->search.energy = 0;
+    ctx->search.length = sample_rate / 1000 * SSTV_VIS_SEARCH_BLOCK_MS;
+    ctx->search.pos = 0;
+
+    sstv_goertzel_init(&ctx->vis.one, SSTV_VIS_ONE_HZ, sample_rate);
+    sstv_goertzel_init(&ctx->vis.zero, SSTV_VIS_ZERO_HZ, sample_rate);
+    ctx->vis.bit_usamp = (uint64_t)SSTV_VIS_BIT_NS * sample_rate / 1000;
+
+    sstv_vis_search(ctx);
+
+    /* set output */
+    *out_ctx = ctx;
+
+    /* all ok */
+    return SSTV_OK;
+}
+
+sstv_error_t
+sstv_delete_vis_detector(void *ctx)
+{
+    uint32_t i;
+
+    if (!ctx) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    /* check default contexts */
+    for (i = 0; i < SSTV_DEFAULT_VIS_DETECTOR_CONTEXT_COUNT; i++) {
+        if (ctx == default_vis_context+i) {
+            default_vis_context_usage &= ~(0x1 << i);
+            ctx = NULL;
+            break;
+        }
+    }
+
+    /* deallocate context */
+    if (ctx) {
+        if (!sstv_free_user) {
+            return SSTV_BAD_USER_DEALLOC;
+        }
+        sstv_free_user(ctx);
+    }
+
+    /* all ok */
+    return SSTV_OK;
+}
+
+static void
+sstv_vis_next_bit_block(sstv_vis_context_t *ctx)
+{
+    /* skip the first and last sixth of the bit, to allow for onset error */
+    uint64_t start = ctx->vis.start_usamp + (ctx->vis.bit + 1) * ctx->vis.bit_usamp;
+    ctx->vis.block_start = (start + ctx->vis.bit_usamp / 6) / 1000000;
+    ctx->vis.block_end = (start + ctx->vis.bit_usamp * 5 / 6) / 1000000;
+}
+
+static sstv_vis_tone_t
+sstv_vis_classify_block(sstv_vis_context_t *ctx)
+{
+    /* for a pure tone, power = length * energy / 2 */
+    int64_t total = ctx->search.energy * ctx->search.length;
+    int64_t leader = sstv_goertzel_power(&ctx->search.leader);
+    int64_t low = sstv_goertzel_power(&ctx->search.low);
+
+    ctx->search.energy = 0;
+
+    if (total < (int64_t)ctx->search.length * ctx->search.length * SSTV_VIS_MIN_LEVEL) {
+        return SSTV_VIS_TONE_NONE;
+    }
+
+    /* at least half of the block's energy, and clearly above the other tone */
+    if (4 * leader >= total && leader > 2 * low) {
+        return SSTV_VIS_TONE_LEADER;
+    }
+    if (4 * low >= total && low > 2 * leader) {
+        return SSTV_VIS_TONE_LOW;
+    }
+    return SSTV_VIS_TONE_NONE;
+}
+
+static void
+sstv_vis_search_block(sstv_vis_context_t *ctx)
+{
+    sstv_vis_tone_t tone = sstv_vis_classify_block(ctx);
+    uint64_t block_start = ctx->position + 1 - ctx->search.length;
+
+    if (ctx->state == SSTV_VIS_STATE_LEADER) {
+        if (tone == SSTV_VIS_TONE_LEADER) {
+            ctx->search.run ++;
+            ctx->search.misses = 0;
+        } else if (tone == SSTV_VIS_TONE_LOW && ctx->search.run >= SSTV_VIS_LEADER_MIN_BLOCKS) {
+            /* break or VIS start bit */
+            ctx->state = SSTV_VIS_STATE_LOW;
+            ctx->search.run = 1;
+            ctx->search.misses = 0;
+            ctx->search.low_start = block_start;
+        } else if (++ ctx->search.misses > SSTV_VIS_MAX_MISSES) {
+            ctx->search.run = 0;
+        }
+        return;
+    }
+
+    /* SSTV_VIS_STATE_LOW */
+    if (tone == SSTV_VIS_TONE_LEADER) {
+        /* short low tone was the break, count the second leader */
+        ctx->state = SSTV_VIS_STATE_LEADER;
+        ctx->search.run = 1;
+        ctx->search.misses = 0;
+        return;
+    }
+
+    if (tone != SSTV_VIS_TONE_LOW) {
+        if (++ ctx->search.misses > SSTV_VIS_MAX_MISSES) {
+            sstv_vis_search(ctx);
+        }
+        return;
+    }
+
+    ctx->search.misses = 0;
+    ctx->search.run ++;
+    if (ctx->search.run < SSTV_VIS_START_MIN_BLOCKS) {
+        return;
+    }
+
+    /* start bit confirmed; the first low block is at least half low tone,
+       so its start is within half a block of the onset */
+    ctx->state = SSTV_VIS_STATE_BITS;
+    ctx->vis.start_usamp = ctx->search.low_start * 1000000;
+    ctx->vis.bit = 0;
+    ctx->vis.code = 0;
+    sstv_vis_next_bit_block(ctx);
+}
+
+static void
+sstv_vis_bit_block(sstv_vis_context_t *ctx)
+{
+    int64_t one = sstv_goertzel_power(&ctx->vis.one);
+    int64_t zero = sstv_goertzel_power(&ctx->vis.zero);
+    uint32_t ones = 0;
+    uint32_t w, h;
+    sstv_image_format_t fmt;
+    uint8_t i;
+
+    /* VIS bits are sent LSB first */
+    if (one > zero) {
+        ctx->vis.code |= (uint8_t) (1 << ctx->vis.bit);
+    }
+
+    ctx->vis.bit ++;
+    if (ctx->vis.bit < 8) {
+        sstv_vis_next_bit_block(ctx);
+        return;
+    }
+
+    /* code includes an even parity bit */
+    for (i = 0; i < 8; i ++) {
+        ones += (ctx->vis.code >> i) & 0x1;
+    }
+
+    if ((ones & 0x1) != 0
+        || sstv_get_mode_image_props((sstv_mode_t) ctx->vis.code, &w, &h, &fmt) != SSTV_OK)
+    {
+        /* not a known mode */
+        sstv_vis_search(ctx);
+        return;
+    }
+
+    /* first line starts after start bit, 8 code bits and stop bit */
+    ctx->state = SSTV_VIS_STATE_STOP;
+    ctx->mode = (sstv_mode_t) ctx->vis.code;
+    ctx->sync = (ctx->vis.start_usamp + 10 * ctx->vis.bit_usamp + 500000) / 1000000;
+}
+
+sstv_error_t
+sstv_detect_vis(void *ctx, sstv_signal_t *signal, sstv_mode_t *mode, uint64_t *sync_offset)
+{
+    sstv_vis_context_t *context = (sstv_vis_context_t *)ctx;
+    uint32_t i;
+
+    if (!context || !signal || !mode || !sync_offset) {
+        return SSTV_BAD_PARAMETER;
+    }
+
+    switch (signal->type) {
+        case SSTV_SAMPLE_INT8:
+        case SSTV_SAMPLE_UINT8:
+        case SSTV_SAMPLE_INT16:
+            break;
+
+        default:
+            return SSTV_BAD_SAMPLE_TYPE;
+    }
+
+    for (i = 0; i < signal->count; i ++) {
+        int32_t x = sstv_demod_get_sample(signal, i) >> SSTV_VIS_INPUT_SHIFT;
+
+        switch (context->state) {
+            case SSTV_VIS_STATE_LEADER:
+            case SSTV_VIS_STATE_LOW:
+                sstv_goertzel_step(&context->search.leader, x);
+                sstv_goertzel_step(&context->search.low, x);
+                context->search.energy += x * x;
+
+                if (++ context->search.pos == context->search.length) {
+                    sstv_vis_search_block(context);
+                    context->search.pos = 0;
+                }
+                break;
+
+            case SSTV_VIS_STATE_BITS:
+                if (context->position >= context->vis.block_start) {
+                    sstv_goertzel_step(&context->vis.one, x);
+                    sstv_goertzel_step(&context->vis.zero, x);
+                }
+                if (context->position + 1 == context->vis.block_end) {
+                    sstv_vis_bit_block(context);
+                }
+                break;
+
+            case SSTV_VIS_STATE_STOP:
+                break;
+        }
+
+        context->position ++;
+
+        /* hand over once the next sample is the first of the image */
+        if (context->state == SSTV_VIS_STATE_STOP && context->position >= context->sync) {
+            *mode = context->mode;
+            *sync_offset = context->sync;
+            signal->count = i + 1;
+            sstv_vis_search(context);
+            return SSTV_DETECT_FOUND;
+        }
+    }
+
+    return SSTV_DETECT_SUCCESSFUL;
+}
@@ -0,0 +1,2497 @@
+/*
+ * Copyright (c) 2018-2023 Vasile Vilvoiu (YO7JBP) <vasi@vilvoiu.ro>
+ *
+ * libsstv is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <libsstv.h>
+
+#include "daemon.hpp"
+#include "farm.hpp"
+#include "image.hpp"
+#include "modes.hpp"
+
+/*
+ * Regression tests, registered with CTest:
+ *   sstv-test golden <file>        encoder output hashes vs. committed values, and
+ *                                  sstv_encoder_get_sample_count() vs. output length
+ *   sstv-test golden <file> update  rewrite <file> from the current encoder
+ *   sstv-test paths                 sstv_encode() vs. the other encoder APIs
+ *   sstv-test roundtrip             encode, decode and compare images
+ *   sstv-test iq                    complex baseband decoder input vs. real input
+ *   sstv-test drift                 decoder sync tracking of a sample clock offset
+ *   sstv-test identify              mode identification, and the line it starts on
+ *   sstv-test vis                   VIS detection, and decoding from the line it reports
+ *   sstv-test farm                  multi-channel decoder farm vs. single-threaded decodes
+ *   sstv-test trace                 trace hook spans (TRACE_HOOKS builds only)
+ *   sstv-test timing                leader tone length and PD line pairs
+ *   sstv-test stats                 sstv_encoder_get_stats() after known encodes
+ *   sstv-test rebind <file>         sstv_encoder_reset() and rebind() vs. committed values
+ *   sstv-test state                 sstv_encoder_save_state() and restore_state()
+ *   sstv-test images                built-in image loaders of the tools
+ *   sstv-test daemon <sstv-encoded> samples served by the encode daemon
+ *   sstv-test scan <sstv-encode> <sstv-decode>
+ *                                   recordings of several transmissions, whole and
+ *                                   in segments
+ */
+
+static const uint32_t GOLDEN_RATES[] = { 8000, 11025, 44100, 48000 };
+
+static const std::pair<sstv_sample_type_t, const char *> GOLDEN_TYPES[] = {
+    { SSTV_SAMPLE_UINT8, "uint8" },
+    { SSTV_SAMPLE_INT8, "int8" },
+    { SSTV_SAMPLE_INT16, "int16" },
+};
+
+/*
+ * Deterministic test image: colour bars over the top half, a gradient over
+ * the third quarter and pseudo-random noise (full 0..255 range) at the bottom
+ */
+static sstv_image_t test_image(sstv_mode_t mode)
+{
+    sstv_image_t image;
+    if (sstv_create_image_from_mode(&image, mode) != SSTV_OK) {
+        std::cerr << "sstv_create_image_from_mode() failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t bpp = (image.format == SSTV_FORMAT_Y ? 1 : 3);
+    uint32_t lcg = 12345;
+    for (uint32_t y = 0; y < image.height; y ++) {
+        for (uint32_t x = 0; x < image.width; x ++) {
+            for (uint32_t c = 0; c < bpp; c ++) {
+                uint8_t v;
+                if (y < image.height / 2) {
+                    v = (((x * 8 / image.width) >> c) & 1) ? 255 : 0;
+                } else if (y < image.height * 3 / 4) {
+                    v = (uint8_t)((x * 255 / (image.width - 1) + c * 85) & 0xff);
+                } else {
+                    lcg = lcg * 1664525 + 1013904223;
+                    v = (uint8_t)(lcg >> 24);
+                }
+                image.buffer[(y * image.width + x) * bpp + c] = v;
+            }
+        }
+    }
+
+    return image;
+}
+
+static size_t sample_size(sstv_sample_type_t type)
+{
+    switch (type) {
+        case SSTV_SAMPLE_INT16:
+            return 2;
+        case SSTV_SAMPLE_CS16:
+            return 4;
+        case SSTV_SAMPLE_CF32:
+            return 8;
+        default:
+            return 1;
+    }
+}
+
+/*
+ * FNV-1a (64-bit), over little-endian samples so hashes are portable
+ */
+class Hash {
+public:
+    void add(const void *samples, size_t count, sstv_sample_type_t type)
+    {
+        const uint8_t *p = (const uint8_t *)samples;
+        for (size_t i = 0; i < count; i ++) {
+            if (type == SSTV_SAMPLE_INT16) {
+                uint16_t s;
+                std::memcpy(&s, p + 2 * i, 2);
+                byte(s & 0xff);
+                byte(s >> 8);
+            } else {
+                byte(p[i]);
+            }
+        }
+        count_ += count;
+    }
+
+    uint64_t value() const { return hash_; }
+    uint64_t count() const { return count_; }
+
+    bool operator==(const Hash& other) const { return hash_ == other.hash_ && count_ == other.count_; }
+    bool operator!=(const Hash& other) const { return !(*this == other); }
+
+private:
+    void byte(uint8_t b)
+    {
+        hash_ ^= b;
+        hash_ *= 0x100000001b3ull;
+    }
+
+    uint64_t hash_ = 0xcbf29ce484222325ull;
+    uint64_t count_ = 0;
+};
+
+static void *create_encoder(sstv_image_t image, sstv_mode_t mode, uint32_t rate)
+{
+    void *ctx = nullptr;
+    if (sstv_create_encoder(&ctx, image, mode, rate) != SSTV_OK) {
+        std::cerr << "sstv_create_encoder() failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return ctx;
+}
+
+static void check(sstv_error_t rc, const char *func)
+{
+    if (rc != SSTV_OK) {
+        std::cerr << func << " failed with rc " << rc << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Hash of a whole transmission, encoded with sstv_encode() in chunks
+ */
+static Hash encode_chunked(sstv_image_t image, sstv_mode_t mode, uint32_t rate, sstv_sample_type_t type, uint32_t chunk)
+{
+    void *ctx = create_encoder(image, mode, rate);
+    std::vector<uint8_t> buffer(chunk * sample_size(type));
+    Hash hash;
+
+    while (true) {
+        sstv_signal_t signal;
+        check(sstv_pack_signal(&signal, type, chunk, buffer.data()), "sstv_pack_signal()");
+
+        sstv_error_t rc = sstv_encode(ctx, &signal);
+        if (rc != SSTV_ENCODE_SUCCESSFUL && rc != SSTV_ENCODE_END) {
+            std::cerr << "sstv_encode() failed with rc " << rc << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        hash.add(buffer.data(), signal.count, type);
+        if (rc == SSTV_ENCODE_END) {
+            break;
+        }
+    }
+
+    sstv_delete_encoder(ctx);
+    return hash;
+}
+
+/*
+ * Same, with sstv_encode_budget() and a fixed work budget per call
+ */
+static Hash encode_budget(sstv_image_t image, sstv_mode_t mode, uint32_t rate, sstv_sample_type_t type,
+                          uint32_t chunk, uint32_t budget)
+{
+    void *ctx = create_encoder(image, mode, rate);
+    std::vector<uint8_t> buffer(chunk * sample_size(type));
+    Hash hash;
+    sstv_signal_t signal;
+    check(sstv_pack_signal(&signal, type, chunk, buffer.data()), "sstv_pack_signal()");
+
+    /* every call, exhausted or not, hands over signal.count new samples */
+    while (true) {
+        sstv_error_t rc = sstv_encode_budget(ctx, &signal, budget);
+        if (rc != SSTV_ENCODE_SUCCESSFUL && rc != SSTV_ENCODE_END && rc != SSTV_ENCODE_BUDGET_EXHAUSTED) {
+            std::cerr << "sstv_encode_budget() failed with rc " << rc << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        hash.add(buffer.data(), signal.count, type);
+        if (rc == SSTV_ENCODE_END) {
+            break;
+        }
+    }
+
+    sstv_delete_encoder(ctx);
+    return hash;
+}
+
+/*
+ * Same, one sample at a time with sstv_encode_next_sample(), refilling the
+ * segment queue only when it runs dry
+ */
+static Hash encode_isr(sstv_image_t image, sstv_mode_t mode, uint32_t rate, sstv_sample_type_t type)
+{
+    void *ctx = create_encoder(image, mode, rate);
+    Hash hash;
+    uint8_t sample[2];
+
+    while (true) {
+        sstv_error_t rc = sstv_encode_next_sample(ctx, type, sample);
+        if (rc == SSTV_ENCODE_END) {
+            break;
+        }
+        if (rc == SSTV_ENCODE_UNDERRUN) {
+            rc = sstv_encode_refill(ctx);
+            if (rc != SSTV_ENCODE_SUCCESSFUL && rc != SSTV_ENCODE_END) {
+                std::cerr << "sstv_encode_refill() failed with rc " << rc << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        if (rc != SSTV_ENCODE_SUCCESSFUL) {
+            std::cerr << "sstv_encode_next_sample() failed with rc " << rc << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        hash.add(sample, 1, type);
+    }
+
+    sstv_delete_encoder(ctx);
+    return hash;
+}
+
+/*
+ * Same, through a small ring buffer with a producer thread
+ */
+static Hash encode_ringbuf(sstv_image_t image, sstv_mode_t mode, uint32_t rate, sstv_sample_type_t type)
+{
+    void *ctx = create_encoder(image, mode, rate);
+    std::vector<uint8_t> storage(1024 * sample_size(type));
+    sstv_ringbuf_t rb;
+    check(sstv_pack_ringbuf(&rb, type, 1024, storage.data()), "sstv_pack_ringbuf()");
+
+    sstv_error_t producer_rc = SSTV_OK;
+    std::thread producer([&]() {
+        while (true) {
+            sstv_error_t rc = sstv_encode_ringbuf(ctx, &rb);
+            if (rc != SSTV_ENCODE_SUCCESSFUL) {
+                producer_rc = rc;
+                return;
+            }
+            std::this_thread::yield();
+        }
+    });
+
+    /* the consumer owns rb.tail, so it advancing tells how much was real */
+    Hash hash;
+    std::vector<uint8_t> buffer(256 * sample_size(type));
+    while (true) {
+        uint32_t tail = rb.tail;
+        sstv_error_t rc = sstv_ringbuf_read(&rb, buffer.data(), 256);
+        hash.add(buffer.data(), rb.tail - tail, type);
+        if (rc == SSTV_ENCODE_END) {
+            break;
+        }
+        if (rc == SSTV_ENCODE_UNDERRUN) {
+            std::this_thread::yield();
+        } else if (rc != SSTV_OK) {
+            std::cerr << "sstv_ringbuf_read() failed with rc " << rc << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    producer.join();
+    if (producer_rc != SSTV_ENCODE_END) {
+        std::cerr << "sstv_encode_ringbuf() failed with rc " << producer_rc << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    sstv_delete_encoder(ctx);
+    return hash;
+}
+
+/*
+ * Same, with producer and consumer driven from one thread on a simulated
+ * clock: every tick the consumer reads 256 samples, and every producer_period
+ * ticks the producer is called producer_calls times before it; the ring's
+ * counters are left in rb_out
+ */
+static Hash encode_ringbuf_ticks(sstv_image_t image, sstv_mode_t mode, uint32_t rate, sstv_sample_type_t type,
+                                 uint32_t producer_period, uint32_t producer_calls, sstv_ringbuf_t& rb_out)
+{
+    void *ctx = create_encoder(image, mode, rate);
+    std::vector<uint8_t> storage(1024 * sample_size(type));
+    sstv_ringbuf_t rb;
+    check(sstv_pack_ringbuf(&rb, type, 1024, storage.data()), "sstv_pack_ringbuf()");
+
+    Hash hash;
+    std::vector<uint8_t> buffer(256 * sample_size(type));
+    for (uint32_t tick = 0; ; tick ++) {
+        if (tick % producer_period == 0) {
+            for (uint32_t i = 0; i < producer_calls; i ++) {
+                sstv_error_t rc = sstv_encode_ringbuf(ctx, &rb);
+                if (rc != SSTV_ENCODE_SUCCESSFUL && rc != SSTV_ENCODE_END) {
+                    std::cerr << "sstv_encode_ringbuf() failed with rc " << rc << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+
+        uint32_t tail = rb.tail;
+        sstv_error_t rc = sstv_ringbuf_read(&rb, buffer.data(), 256);
+        hash.add(buffer.data(), rb.tail - tail, type);
+        if (rc == SSTV_ENCODE_END) {
+            break;
+        }
+        if (rc != SSTV_OK && rc != SSTV_ENCODE_UNDERRUN) {
+            std::cerr << "sstv_ringbuf_read() failed with rc " << rc << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    rb_out = rb;
+    sstv_delete_encoder(ctx);
+    return hash;
+}
+
+/*
+ * Length sstv_encoder_get_sample_count() predicts for an image
+ */
+static uint64_t predicted_count(sstv_image_t image, sstv_mode_t mode, uint32_t rate)
+{
+    void *ctx = create_encoder(image, mode, rate);
+    uint64_t count = 0;
+    check(sstv_encoder_get_sample_count(ctx, &count), "sstv_encoder_get_sample_count()");
+    sstv_delete_encoder(ctx);
+    return count;
+}
+
+static std::string hex(uint64_t v)
+{
+    std::ostringstream s;
+    s << std::hex << std::setw(16) << std::setfill('0') << v;
+    return s.str();
+}
+
+/*
+ * Hashes of every mode, at every rate and sample type
+ */
+/*
+ * Golden values by "mode rate type", as "samples hash"
+ */
+static bool read_golden(const std::string& path, std::map<std::string, std::string>& golden)
+{
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "cannot read " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream s(line);
+        std::string mode, rate, type, count, hash;
+        s >> mode >> rate >> type >> count >> hash;
+        golden[mode + " " + rate + " " + type] = count + " " + hash;
+    }
+    return true;
+}
+
+static int run_golden(const std::string& path, bool update)
+{
+    std::map<std::string, std::string> golden;
+    if (!update && !read_golden(path, golden)) {
+        return EXIT_FAILURE;
+    }
+
+    std::ostringstream out;
+    out << "# mode rate type samples fnv1a64" << std::endl;
+
+    size_t failures = 0, checked = 0;
+    for (const auto& m : stringToModeMap) {
+        sstv_image_t image = test_image(m.second);
+        for (uint32_t rate : GOLDEN_RATES) {
+            for (const auto& t : GOLDEN_TYPES) {
+                Hash hash = encode_chunked(image, m.second, rate, t.first, 4096);
+                std::string key = m.first + " " + std::to_string(rate) + " " + t.second;
+                std::string value = std::to_string(hash.count()) + " " + hex(hash.value());
+                out << key << " " << value << std::endl;
+
+                if (update) {
+                    continue;
+                }
+                checked ++;
+                auto it = golden.find(key);
+                if (it == golden.end()) {
+                    std::cerr << key << ": no golden value" << std::endl;
+                    failures ++;
+                } else if (it->second != value) {
+                    std::cerr << key << ": got " << value << ", expected " << it->second << std::endl;
+                    failures ++;
+                }
+                if (predicted_count(image, m.second, rate) != hash.count()) {
+                    std::cerr << key << ": sstv_encoder_get_sample_count() predicted "
+                              << predicted_count(image, m.second, rate) << " samples" << std::endl;
+                    failures ++;
+                }
+            }
+        }
+        sstv_delete_image(&image);
+    }
+
+    if (update) {
+        std::ofstream file(path);
+        file << out.str();
+        if (!file) {
+            std::cerr << "cannot write " << path << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "wrote " << path << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    std::cout << checked - failures << "/" << checked << " golden hashes match" << std::endl;
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Every encoder API must produce exactly the sstv_encode() output
+ */
+static int run_paths()
+{
+    const sstv_mode_t modes[] = { SSTV_MODE_ROBOT_BW8_R, SSTV_MODE_ROBOT_C36, SSTV_MODE_SCOTTIE_S1,
+                                  SSTV_MODE_MARTIN_M1, SSTV_MODE_PD120 };
+    const uint32_t rate = 11025;
+    size_t failures = 0;
+
+    for (sstv_mode_t mode : modes) {
+        sstv_image_t image = test_image(mode);
+        for (const auto& t : GOLDEN_TYPES) {
+            Hash reference = encode_chunked(image, mode, rate, t.first, 4096);
+            const std::pair<std::string, Hash> paths[] = {
+                { "sstv_encode(1)", encode_chunked(image, mode, rate, t.first, 1) },
+                { "sstv_encode(97)", encode_chunked(image, mode, rate, t.first, 97) },
+                { "sstv_encode_budget(1)", encode_budget(image, mode, rate, t.first, 4096, 1) },
+                { "sstv_encode_budget(37)", encode_budget(image, mode, rate, t.first, 4096, 37) },
+                { "sstv_encode_next_sample", encode_isr(image, mode, rate, t.first) },
+                { "sstv_encode_ringbuf", encode_ringbuf(image, mode, rate, t.first) },
+            };
+
+            for (const auto& p : paths) {
+                if (p.second != reference) {
+                    std::cerr << mode << " " << t.second << ": " << p.first << " differs from sstv_encode(4096) ("
+                              << p.second.count() << " vs " << reference.count() << " samples)" << std::endl;
+                    failures ++;
+                }
+            }
+        }
+        sstv_delete_image(&image);
+    }
+
+    /* fixed-period consumer against producers of various speeds; the low
+       water mark is what the consumer found before reading, while the
+       producer was running */
+    {
+        const sstv_mode_t mode = SSTV_MODE_ROBOT_BW8_R;
+        sstv_image_t image = test_image(mode);
+        Hash reference = encode_chunked(image, mode, 8000, SSTV_SAMPLE_INT16, 4096);
+
+        struct {
+            const char *name;
+            uint32_t period, calls;
+            bool underruns, overruns;
+            uint32_t low_water;
+        } cases[] = {
+            { "producer ahead", 1, 2, false, true, 1024 },
+            { "producer every 3 reads", 3, 1, false, false, 512 },
+            { "producer every 5 reads", 5, 1, true, false, 0 },
+        };
+
+        for (const auto& c : cases) {
+            sstv_ringbuf_t rb;
+            Hash played = encode_ringbuf_ticks(image, mode, 8000, SSTV_SAMPLE_INT16, c.period, c.calls, rb);
+            bool ok = (played == reference && (rb.underruns > 0) == c.underruns && (rb.overruns > 0) == c.overruns
+                       && rb.low_water == c.low_water);
+            if (!ok) {
+                std::cerr << "ring buffer, " << c.name << ": " << (played == reference ? "" : "samples differ, ")
+                          << rb.underruns << " underruns, " << rb.overruns << " overruns, low water "
+                          << rb.low_water << std::endl;
+                failures ++;
+            }
+        }
+        sstv_delete_image(&image);
+    }
+
+    std::cout << (failures ? "encoder paths differ" : "all encoder paths match") << std::endl;
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Whole int16 transmission at the given rate, with a bit of silence on either
+ * side
+ */
+static std::vector<int16_t> encode_padded(sstv_image_t image, sstv_mode_t mode, uint32_t rate)
+{
+    std::vector<int16_t> samples(rate / 4, 0);
+    void *ctx = create_encoder(image, mode, rate);
+    std::vector<int16_t> buffer(4096);
+    while (true) {
+        sstv_signal_t signal;
+        check(sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, 4096, buffer.data()), "sstv_pack_signal()");
+        sstv_error_t rc = sstv_encode(ctx, &signal);
+        samples.insert(samples.end(), buffer.begin(), buffer.begin() + signal.count);
+        if (rc == SSTV_ENCODE_END) {
+            break;
+        }
+    }
+    sstv_delete_encoder(ctx);
+    samples.resize(samples.size() + rate / 4, 0);
+    return samples;
+}
+
+/*
+ * Feed count samples of any type to a decoder until the image ends; returns
+ * SSTV_DECODE_END, SSTV_DECODE_SUCCESSFUL if the image never ended, or the
+ * error code of sstv_decode()
+ */
+static sstv_error_t decode_signal(void *ctx, sstv_sample_type_t type, const void *samples, size_t count)
+{
+    const uint8_t *data = (const uint8_t *) samples;
+    for (size_t pos = 0; pos < count; ) {
+        sstv_signal_t signal;
+        uint32_t n = (uint32_t) std::min<size_t>(1000, count - pos);
+        sstv_pack_signal(&signal, type, n, (void *) (data + pos * sample_size(type)));
+        signal.count = n;
+        sstv_error_t rc = sstv_decode(ctx, &signal);
+        if (rc != SSTV_DECODE_SUCCESSFUL) {
+            return rc;
+        }
+        pos += signal.count;
+    }
+    return SSTV_DECODE_SUCCESSFUL;
+}
+
+/*
+ * Feed int16 samples to a decoder until the image ends; returns false if it
+ * never does
+ */
+static bool decode_samples(void *ctx, const std::vector<int16_t>& samples)
+{
+    sstv_error_t rc = decode_signal(ctx, SSTV_SAMPLE_INT16, samples.data(), samples.size());
+    if (rc != SSTV_DECODE_END && rc != SSTV_DECODE_SUCCESSFUL) {
+        std::cerr << "sstv_decode() failed with rc " << rc << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return (rc == SSTV_DECODE_END);
+}
+
+/*
+ * Mean pixel difference over the smooth gradient band only; bars and noise
+ * are smeared by the demodulator filters by design
+ */
+static double gradient_error(sstv_image_t image, sstv_image_t decoded)
+{
+    size_t size = (size_t)image.width * image.height * (image.format == SSTV_FORMAT_Y ? 1 : 3);
+    size_t row = size / image.height;
+    size_t begin = row * (image.height / 2), end = row * (image.height * 3 / 4);
+    uint64_t sum = 0;
+    for (size_t i = begin; i < end; i ++) {
+        sum += std::abs((int)image.buffer[i] - (int)decoded.buffer[i]);
+    }
+    return (double)sum / (end - begin);
+}
+
+/*
+ * Encoded images must decode back within a small mean pixel error; sample
+ * rates the decoder cannot work at, and a zero encoder rate, are refused
+ */
+static int run_roundtrip()
+{
+    const sstv_mode_t modes[] = { SSTV_MODE_ROBOT_BW8_R, SSTV_MODE_ROBOT_C36, SSTV_MODE_SCOTTIE_S1,
+                                  SSTV_MODE_MARTIN_M1, SSTV_MODE_PD120 };
+    const uint32_t rate = 48000;
+    const double max_error = 4.0;
+    size_t failures = 0;
+
+    for (sstv_mode_t mode : modes) {
+        sstv_image_t image = test_image(mode);
+        sstv_image_t decoded;
+        check(sstv_create_image_from_mode(&decoded, mode), "sstv_create_image_from_mode()");
+        size_t size = (size_t)image.width * image.height * (image.format == SSTV_FORMAT_Y ? 1 : 3);
+        std::memset(decoded.buffer, 0, size);
+
+        std::vector<int16_t> samples = encode_padded(image, mode, rate);
+
+        void *ctx = nullptr;
+        check(sstv_create_decoder(&ctx, decoded, mode, rate), "sstv_create_decoder()");
+        bool ended = decode_samples(ctx, samples);
+        sstv_delete_decoder(ctx);
+
+        double error = gradient_error(image, decoded);
+        std::cout << std::setw(4) << mode << ": " << (ended ? "decoded" : "not decoded")
+                  << ", mean difference " << std::fixed << std::setprecision(3) << error << std::endl;
+        if (!ended || error > max_error) {
+            failures ++;
+        }
+
+        sstv_delete_image(&decoded);
+        sstv_delete_image(&image);
+    }
+
+    {
+        sstv_image_t image = test_image(SSTV_MODE_ROBOT_BW8_R);
+        bool refused = true;
+        for (uint32_t bad : { 0u, 5999u, 384001u }) {
+            void *ctx = nullptr;
+            sstv_error_t rc = sstv_create_decoder(&ctx, image, SSTV_MODE_ROBOT_BW8_R, bad);
+            refused = refused && (rc == SSTV_BAD_PARAMETER && !ctx);
+        }
+        void *ctx = nullptr;
+        sstv_error_t rc = sstv_create_encoder(&ctx, image, SSTV_MODE_ROBOT_BW8_R, 0);
+        refused = refused && (rc == SSTV_BAD_PARAMETER && !ctx);
+        std::cout << "bad sample rates: " << (refused ? "refused" : "accepted") << std::endl;
+        failures += !refused;
+        sstv_delete_image(&image);
+    }
+
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Complex baseband of a real signal, as an SDR tuned to the upper sideband
+ * would deliver it: a tone of f Hz comes out at f + offset Hz. Q is the
+ * Hilbert transform of the input (windowed FIR, 255 taps), I the input
+ * delayed to match; interleaved I, Q pairs.
+ */
+static std::vector<float> to_baseband(const std::vector<int16_t>& samples, uint32_t rate, int32_t offset)
+{
+    const int taps = 255, mid = taps / 2;
+    const double pi = 3.14159265358979323846;
+    std::vector<double> h(taps, 0.0);
+    for (int k = 1; k <= mid; k += 2) {
+        double w = 0.42 + 0.5 * std::cos(pi * k / (mid + 1)) + 0.08 * std::cos(2 * pi * k / (mid + 1));
+        h[mid + k] = 2.0 / (pi * k) * w;
+        h[mid - k] = -h[mid + k];
+    }
+
+    std::vector<float> iq(2 * samples.size());
+    for (size_t n = 0; n < samples.size(); n ++) {
+        double i = (n >= (size_t) mid ? samples[n - mid] : 0.0), q = 0.0;
+        for (int k = 0; k < taps; k ++) {
+            if (n >= (size_t) k) {
+                q += h[k] * samples[n - k];
+            }
+        }
+        double phase = 2 * pi * offset * (double) n / rate;
+        double c = std::cos(phase), s = std::sin(phase);
+        iq[2 * n] = (float) (i * c - q * s);
+        iq[2 * n + 1] = (float) (i * s + q * c);
+    }
+    return iq;
+}
+
+/*
+ * Complex input: transmissions converted to CS16 and CF32 baseband, at a
+ * couple of tone offsets, must decode at least about as well as the real
+ * signal they came from (better, usually: there is no mirrored product to
+ * filter out). CF32 is skipped where the build refuses it
+ * (DECODER_FIXED_POINT).
+ */
+static int run_iq()
+{
+    const sstv_mode_t modes[] = { SSTV_MODE_ROBOT_C36, SSTV_MODE_MARTIN_M1 };
+    const int32_t offsets[] = { 0, -1700 };
+    const uint32_t rate = 11025;
+    const double max_extra_error = 0.5; /* mean pixel difference, over real input */
+    size_t failures = 0;
+
+    for (sstv_mode_t mode : modes) {
+        sstv_image_t image = test_image(mode);
+        size_t size = (size_t)image.width * image.height * (image.format == SSTV_FORMAT_Y ? 1 : 3);
+        std::vector<int16_t> samples = encode_padded(image, mode, rate);
+
+        sstv_image_t reference;
+        check(sstv_create_image_from_mode(&reference, mode), "sstv_create_image_from_mode()");
+        std::memset(reference.buffer, 0, size);
+        void *ctx = nullptr;
+        check(sstv_create_decoder(&ctx, reference, mode, rate), "sstv_create_decoder()");
+        if (!decode_samples(ctx, samples)) {
+            std::cerr << mode << ": real input not decoded" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        sstv_delete_decoder(ctx);
+        double real_error = gradient_error(image, reference);
+
+        for (int32_t offset : offsets) {
+            std::vector<float> cf32 = to_baseband(samples, rate, offset);
+            std::vector<int16_t> cs16(cf32.size());
+            for (size_t i = 0; i < cf32.size(); i ++) {
+                cs16[i] = (int16_t) std::lround(std::max(-32768.0f, std::min(32767.0f, cf32[i])));
+            }
+
+            for (sstv_sample_type_t type : { SSTV_SAMPLE_CS16, SSTV_SAMPLE_CF32 }) {
+                sstv_image_t decoded;
+                check(sstv_create_image_from_mode(&decoded, mode), "sstv_create_image_from_mode()");
+                std::memset(decoded.buffer, 0, size);
+                check(sstv_create_decoder(&ctx, decoded, mode, rate), "sstv_create_decoder()");
+                check(sstv_decoder_set_iq_input(ctx, offset), "sstv_decoder_set_iq_input()");
+
+                /* the real input is refused from now on */
+                sstv_signal_t signal;
+                sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, 1, samples.data());
+                signal.count = 1;
+                bool refused = (sstv_decode(ctx, &signal) == SSTV_BAD_SAMPLE_TYPE);
+
+                const void *data = (type == SSTV_SAMPLE_CS16 ? (const void *) cs16.data() : (const void *) cf32.data());
+                sstv_error_t rc = decode_signal(ctx, type, data, samples.size());
+                sstv_delete_decoder(ctx);
+
+                const char *name = (type == SSTV_SAMPLE_CS16 ? "cs16" : "cf32");
+                if (type == SSTV_SAMPLE_CF32 && rc == SSTV_BAD_SAMPLE_TYPE) {
+                    std::cout << std::setw(4) << mode << " " << name << " " << std::setw(5) << offset
+                              << "Hz: not supported by this build"
+                              << std::endl;
+                    sstv_delete_image(&decoded);
+                    continue;
+                }
+
+                double error = gradient_error(image, decoded);
+                std::cout << std::setw(4) << mode << " " << name << " " << std::setw(5) << offset << "Hz: "
+                          << (rc == SSTV_DECODE_END ? "decoded" : "not decoded") << ", mean difference "
+                          << std::fixed << std::setprecision(3) << error << " (real input " << real_error << ")"
+                          << std::endl;
+                if (!refused || rc != SSTV_DECODE_END || error > real_error + max_extra_error) {
+                    failures ++;
+                }
+                sstv_delete_image(&decoded);
+            }
+        }
+
+        sstv_delete_image(&reference);
+        sstv_delete_image(&image);
+    }
+
+    std::cout << (failures ? "complex input differs" : "complex input decodes as well as real input") << std::endl;
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Column of the first rising bar edge (left of the second bar, channel 0) on
+ * the given line, to subpixel precision
+ */
+static double bar_edge(sstv_image_t image, uint32_t line)
+{
+    uint32_t bpp = (image.format == SSTV_FORMAT_Y ? 1 : 3);
+    const uint8_t *row = image.buffer + (size_t)line * image.width * bpp;
+    for (uint32_t x = 1; x < image.width / 4; x ++) {
+        int a = row[(x - 1) * bpp], b = row[x * bpp];
+        if (a < 128 && b >= 128) {
+            return x - 1 + (128.0 - a) / (b - a);
+        }
+    }
+    return -1.0;
+}
+
+/*
+ * Sample clock drift: transmissions encoded at a rate a few hundred ppm off
+ * the nominal 44100Hz are decoded at 44100Hz. The decoder must report the
+ * offset, decode every line, and keep the lines aligned: the bar edges stay in
+ * the same column from the first lines to the last, and the image is about as
+ * good as without an offset.
+ */
+static int run_drift()
+{
+    const sstv_mode_t modes[] = { SSTV_MODE_ROBOT_C36, SSTV_MODE_SCOTTIE_S1, SSTV_MODE_MARTIN_M1, SSTV_MODE_PD120 };
+    const int32_t offsets[] = { 0, -500, 300, 800 };
+    const uint32_t rate = 44100;
+    const double max_drift_error = 40.0;    /* ppm */
+    const double max_shift = 0.005;         /* of the image width */
+    const double max_extra_error = 0.5;     /* mean pixel difference, over no offset */
+    size_t failures = 0;
+
+    for (sstv_mode_t mode : modes) {
+        sstv_image_t image = test_image(mode);
+        double base_error = 0.0;
+        for (int32_t ppm : offsets) {
+            uint32_t tx_rate = (uint32_t) std::lround(rate * (1.0 + ppm * 1e-6));
+            double expected = ((double) tx_rate / rate - 1.0) * 1e6;
+            std::vector<int16_t> samples = encode_padded(image, mode, tx_rate);
+
+            sstv_image_t decoded;
+            check(sstv_create_image_from_mode(&decoded, mode), "sstv_create_image_from_mode()");
+            void *ctx = nullptr;
+            check(sstv_create_decoder(&ctx, decoded, mode, rate), "sstv_create_decoder()");
+            bool ended = decode_samples(ctx, samples);
+            int32_t drift = 0;
+            uint32_t lines = 0;
+            check(sstv_decoder_get_drift(ctx, &drift), "sstv_decoder_get_drift()");
+            check(sstv_decoder_get_lines(ctx, &lines), "sstv_decoder_get_lines()");
+            sstv_delete_decoder(ctx);
+
+            /* mean edge position of the last bar lines against the first
+               ones; a line of PD and Robot colour carries a pair */
+            double first = 0.0, last = 0.0;
+            for (uint32_t y = 0; y < 16; y ++) {
+                first += bar_edge(decoded, y) / 16;
+                last += bar_edge(decoded, image.height / 2 - 16 + y) / 16;
+            }
+            double shift = std::abs(last - first);
+            double error = gradient_error(image, decoded);
+            if (ppm == 0) {
+                base_error = error;
+            }
+
+            std::cout << std::setw(4) << mode << " " << std::showpos << std::setw(5) << ppm << std::noshowpos
+                      << "ppm: " << (ended ? "decoded" : "not decoded") << ", " << lines << "/" << image.height
+                      << " lines, drift " << drift << " (expected " << std::fixed << std::setprecision(1) << expected
+                      << "), edge shift " << std::setprecision(2) << shift << "px, mean difference " << std::setprecision(3)
+                      << error << std::endl;
+            if (!ended || lines != image.height || std::abs(drift - expected) > max_drift_error
+                || shift > max_shift * image.width || error > base_error + max_extra_error)
+            {
+                failures ++;
+            }
+            sstv_delete_image(&decoded);
+        }
+        sstv_delete_image(&image);
+    }
+
+    std::cout << (failures ? "drift not tracked" : "drift tracked") << std::endl;
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Sync pulses the encoder starts within its first count samples
+ */
+static uint64_t syncs_before(sstv_image_t image, sstv_mode_t mode, uint32_t rate, size_t count)
+{
+    std::vector<int16_t> buffer(count);
+    void *ctx = create_encoder(image, mode, rate);
+    sstv_signal_t signal;
+    check(sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, (uint32_t) count, buffer.data()), "sstv_pack_signal()");
+    sstv_encode(ctx, &signal);
+    sstv_encoder_stats_t stats;
+    check(sstv_encoder_get_stats(ctx, &stats), "sstv_encoder_get_stats()");
+    sstv_delete_encoder(ctx);
+    return stats.transitions[SSTV_SEGMENT_SYNC];
+}
+
+/*
+ * Mode identification without VIS: a few seconds taken from the middle of a
+ * transmission must come out as its mode (or one with identical timing).
+ * Robot 4:2:0 modes, whose lines start with their sync, must also report the
+ * start of an even line: exactly one sync starts around sync_offset, and an
+ * even number before it. Every window is taken at a few start points, a
+ * fraction of a line apart, so both line parities are hit.
+ */
+static int run_identify()
+{
+    const sstv_mode_t modes[] = { SSTV_MODE_FAX480, SSTV_MODE_ROBOT_BW24_R, SSTV_MODE_ROBOT_C12, SSTV_MODE_ROBOT_C36,
+                                  SSTV_MODE_ROBOT_C72, SSTV_MODE_SCOTTIE_S1, SSTV_MODE_SCOTTIE_DX, SSTV_MODE_MARTIN_M1,
+                                  SSTV_MODE_MARTIN_M4, SSTV_MODE_PD50, SSTV_MODE_PD120, SSTV_MODE_PD290 };
+    const uint32_t rate = 11025;
+    const double skip = 4.0, window = 8.0, step = 0.04; /* seconds */
+    const uint32_t starts = 5;
+    const size_t slack = rate / 500;    /* 2ms around the line start */
+    size_t failures = 0;
+
+    for (sstv_mode_t mode : modes) {
+        sstv_image_t image = test_image(mode);
+        bool robot_color = (mode == SSTV_MODE_ROBOT_C12 || mode == SSTV_MODE_ROBOT_C36);
+
+        /* the first seconds only, enough for every window */
+        std::vector<int16_t> samples((size_t) ((skip + window + 1.0) * rate));
+        {
+            void *ctx = create_encoder(image, mode, rate);
+            sstv_signal_t signal;
+            check(sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, (uint32_t) samples.size(), samples.data()),
+                  "sstv_pack_signal()");
+            sstv_encode(ctx, &signal);
+            samples.resize(signal.count);
+            sstv_delete_encoder(ctx);
+        }
+
+        for (uint32_t n = 0; n < starts; n ++) {
+            size_t start = (size_t) ((skip + n * step) * rate);
+            size_t end = std::min(samples.size(), start + (size_t) (window * rate));
+
+            void *id = nullptr;
+            check(sstv_create_mode_identifier(&id, rate), "sstv_create_mode_identifier()");
+            for (size_t pos = start; pos < end; ) {
+                sstv_signal_t signal;
+                uint32_t count = (uint32_t) std::min<size_t>(1000, end - pos);
+                sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, count, samples.data() + pos);
+                signal.count = count;
+                check(sstv_identify_mode(id, &signal) == SSTV_DETECT_SUCCESSFUL ? SSTV_OK : SSTV_INTERNAL_ERROR,
+                      "sstv_identify_mode()");
+                pos += count;
+            }
+            sstv_mode_candidate_t candidates[4];
+            uint32_t count = 4;
+            check(sstv_get_mode_candidates(id, candidates, &count), "sstv_get_mode_candidates()");
+            sstv_delete_mode_identifier(id);
+
+            /* modes that only differ in VIS code tie */
+            bool identified = false;
+            for (uint32_t c = 0; c < count && candidates[c].confidence == candidates[0].confidence; c ++) {
+                identified |= (candidates[c].mode == mode);
+            }
+
+            /* line start and parity, against the encoder's own count */
+            bool aligned = true;
+            if (identified && robot_color) {
+                size_t line_start = start + candidates[0].sync_offset;
+                uint64_t before = syncs_before(image, mode, rate, line_start - slack);
+                uint64_t after = syncs_before(image, mode, rate, line_start + slack);
+                aligned = (after == before + 1 && (before & 0x1) == 0);
+            }
+
+            std::cout << std::setw(4) << mode << " +" << std::fixed << std::setprecision(2) << (skip + n * step)
+                      << "s: " << candidates[0].mode << " (" << candidates[0].confidence << ") at "
+                      << candidates[0].sync_offset << (identified ? "" : ", WRONG MODE")
+                      << (aligned ? "" : ", WRONG LINE") << std::endl;
+            if (!identified || !aligned) {
+                failures ++;
+            }
+        }
+        sstv_delete_image(&image);
+    }
+
+    std::cout << (failures ? "modes not identified" : "all modes identified") << std::endl;
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Phase-continuous tones, as (Hz, ms) pairs, appended to samples
+ */
+static void append_tones(std::vector<int16_t>& samples, uint32_t rate,
+                         const std::vector<std::pair<uint32_t, uint32_t>>& tones)
+{
+    double phase = 0.0;
+    for (const auto& tone : tones) {
+        size_t count = (size_t) tone.second * rate / 1000;
+        for (size_t i = 0; i < count; i ++) {
+            samples.push_back((int16_t) std::lround(16000.0 * std::sin(phase)));
+            phase += 2.0 * M_PI * tone.first / rate;
+        }
+    }
+}
+
+/*
+ * Leader, break and leader, followed by the VIS code (8 bits, parity
+ * included, LSB first) with its start and stop bits
+ */
+static std::vector<std::pair<uint32_t, uint32_t>> vis_header(uint8_t code)
+{
+    std::vector<std::pair<uint32_t, uint32_t>> tones = { { 1900, 300 }, { 1200, 10 }, { 1900, 300 }, { 1200, 30 } };
+    for (uint32_t bit = 0; bit < 8; bit ++) {
+        tones.push_back({ ((code >> bit) & 0x1) ? 1100u : 1300u, 30 });
+    }
+    tones.push_back({ 1200, 30 });
+    return tones;
+}
+
+/*
+ * Feed samples to a VIS detector until it finds something; false if it never
+ * does
+ */
+static bool detect_vis(const std::vector<int16_t>& samples, uint32_t rate, sstv_mode_t& mode, uint64_t& sync)
+{
+    void *ctx = nullptr;
+    check(sstv_create_vis_detector(&ctx, rate), "sstv_create_vis_detector()");
+    bool found = false;
+    for (size_t pos = 0; pos < samples.size() && !found; ) {
+        sstv_signal_t signal;
+        uint32_t count = (uint32_t) std::min<size_t>(1000, samples.size() - pos);
+        sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, count, (void *) (samples.data() + pos));
+        signal.count = count;
+        sstv_error_t rc = sstv_detect_vis(ctx, &signal, &mode, &sync);
+        if (rc != SSTV_DETECT_SUCCESSFUL && rc != SSTV_DETECT_FOUND) {
+            std::cerr << "sstv_detect_vis() failed with rc " << rc << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        found = (rc == SSTV_DETECT_FOUND);
+        pos += signal.count;
+    }
+    sstv_delete_vis_detector(ctx);
+    return found;
+}
+
+/*
+ * VIS detection: transmissions padded with silence and noise, with noise over
+ * them too, must be reported with their mode and with the first line starting
+ * right after the 910ms of leader, break, leader and VIS code. Decoding from
+ * there after sstv_decoder_skip_header() must come as close to the source
+ * image as a decoder fed the whole stream does. A leader with no VIS code
+ * after it, and a VIS code with a parity error, must not be reported.
+ */
+static int run_vis()
+{
+    const sstv_mode_t modes[] = { SSTV_MODE_ROBOT_BW8_R, SSTV_MODE_ROBOT_C36, SSTV_MODE_SCOTTIE_S1,
+                                  SSTV_MODE_MARTIN_M1, SSTV_MODE_PD120 };
+    const uint32_t rates[] = { 11025, 44100 };
+    const double max_error = 10.0, max_difference = 0.5;
+    size_t failures = 0;
+
+    for (uint32_t rate : rates) {
+        const size_t slack = rate / 1000; /* 1ms around the line start */
+
+        for (sstv_mode_t mode : modes) {
+            sstv_image_t image = test_image(mode);
+
+            /* silence, noise, transmission, noise; noise over all of it */
+            size_t lead = rate / 4 + rate / 2;
+            std::vector<int16_t> samples(lead, 0);
+            {
+                void *ctx = create_encoder(image, mode, rate);
+                std::vector<int16_t> buffer(4096);
+                sstv_error_t rc;
+                do {
+                    sstv_signal_t signal;
+                    check(sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, 4096, buffer.data()), "sstv_pack_signal()");
+                    rc = sstv_encode(ctx, &signal);
+                    samples.insert(samples.end(), buffer.begin(), buffer.begin() + signal.count);
+                } while (rc != SSTV_ENCODE_END);
+                sstv_delete_encoder(ctx);
+            }
+            samples.resize(samples.size() + rate / 2, 0);
+            uint32_t lcg = rate + mode;
+            for (size_t i = rate / 4; i < samples.size(); i ++) {
+                lcg = lcg * 1664525 + 1013904223;
+                samples[i] = (int16_t) std::max(-32768, std::min(32767, samples[i] + ((int32_t) (lcg >> 16) - 32768) / 16));
+            }
+
+            sstv_mode_t found_mode = SSTV_MODE_FAX480;
+            uint64_t sync = 0;
+            bool found = detect_vis(samples, rate, found_mode, sync);
+            uint64_t expected = lead + (uint64_t) rate * 910 / 1000;
+            bool located = found && found_mode == mode && sync + slack >= expected && sync <= expected + slack;
+
+            /* whole stream vs. from the detected line start */
+            double full_error = 0.0, skipped_error = 0.0;
+            bool decoded = false;
+            if (located) {
+                sstv_image_t full, skipped;
+                check(sstv_create_image_from_mode(&full, mode), "sstv_create_image_from_mode()");
+                check(sstv_create_image_from_mode(&skipped, mode), "sstv_create_image_from_mode()");
+
+                void *ctx = nullptr;
+                check(sstv_create_decoder(&ctx, full, mode, rate), "sstv_create_decoder()");
+                decoded = decode_samples(ctx, samples);
+                sstv_delete_decoder(ctx);
+
+                check(sstv_create_decoder(&ctx, skipped, mode, rate), "sstv_create_decoder()");
+                check(sstv_decoder_skip_header(ctx), "sstv_decoder_skip_header()");
+                std::vector<int16_t> rest(samples.begin() + sync, samples.end());
+                decoded = decode_samples(ctx, rest) && decoded;
+                sstv_delete_decoder(ctx);
+
+                full_error = gradient_error(image, full);
+                skipped_error = gradient_error(image, skipped);
+
+                sstv_delete_image(&skipped);
+                sstv_delete_image(&full);
+            }
+
+            std::cout << std::setw(4) << mode << " at " << rate << " Hz: ";
+            if (!found) {
+                std::cout << "not found";
+            } else {
+                std::cout << found_mode << " at " << sync << " (expected " << expected << ")";
+            }
+            if (located) {
+                std::cout << ", " << (decoded ? "decoded" : "not decoded") << ", mean difference "
+                          << std::fixed << std::setprecision(3) << skipped_error << " (whole stream "
+                          << full_error << ")";
+            }
+            std::cout << std::endl;
+            if (!located || !decoded || skipped_error > max_error
+                || std::abs(skipped_error - full_error) > max_difference) {
+                failures ++;
+            }
+            sstv_delete_image(&image);
+        }
+
+        /* headers built tone by tone: a good code as a control, then a missing
+           code and a parity error */
+        struct {
+            const char *name;
+            std::vector<std::pair<uint32_t, uint32_t>> tones;
+            bool expected;
+        } headers[] = {
+            { "Martin M1 VIS", vis_header(0xac), true },
+            { "leader without VIS", { { 1900, 300 }, { 1200, 10 }, { 1900, 300 } }, false },
+            { "VIS parity error", vis_header(0x2c), false },
+        };
+        for (const auto& h : headers) {
+            std::vector<int16_t> samples(rate / 4, 0);
+            append_tones(samples, rate, h.tones);
+            size_t end = samples.size();
+            append_tones(samples, rate, { { 1500, 1000 } });
+
+            sstv_mode_t found_mode = SSTV_MODE_FAX480;
+            uint64_t sync = 0;
+            bool found = detect_vis(samples, rate, found_mode, sync);
+            bool ok = (found == h.expected);
+            if (ok && found) {
+                ok = (found_mode == SSTV_MODE_MARTIN_M1 && sync + slack >= end && sync <= end + slack);
+            }
+            std::cout << h.name << " at " << rate << " Hz: " << (found ? "found" : "not found")
+                      << (ok ? "" : ", WRONG") << std::endl;
+            failures += !ok;
+        }
+    }
+
+    std::cout << (failures ? "VIS detection failed" : "all VIS codes detected") << std::endl;
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Decoder farm: more channels than workers, of different modes and rates,
+ * fed in interleaved pushes of odd sizes through a small chunk pool, must
+ * give every channel exactly the image a single-threaded decoder gives. The
+ * float demodulator's oscillator steps through each call's input in groups of
+ * 8, so the single-threaded decoder is fed the same pieces. An exception
+ * thrown by the image callback of one channel must come back from drain(),
+ * without deadlocking, while the other channels carry on.
+ */
+static const size_t FARM_CHUNK = 1024;
+
+/* pushes fit in one chunk, so the farm decodes them as they are */
+static size_t farm_push(size_t channel)
+{
+    return 300 + 173 * channel;
+}
+
+struct FarmChannel {
+    sstv_mode_t mode;
+    uint32_t rate;
+    std::vector<int16_t> samples;
+    std::vector<uint8_t> expected;
+};
+
+static bool feed_farm(std::vector<FarmChannel>& channels, size_t workers, std::vector<std::vector<uint8_t>>& images,
+                      std::vector<uint64_t>& counts, size_t failing, std::string& error)
+{
+    DecoderFarm farm(workers, FARM_CHUNK, 16);
+    for (const auto& ch : channels) {
+        farm.add_channel(ch.mode, ch.rate);
+    }
+    images.assign(channels.size(), {});
+    farm.on_image([&](size_t channel, const sstv_image_t& image) {
+        if (channel == failing) {
+            throw std::runtime_error("callback failed on channel " + std::to_string(channel));
+        }
+        images[channel].assign(image.buffer, image.buffer + channels[channel].expected.size());
+    });
+    farm.start();
+
+    /* round robin, a different push size per channel */
+    std::vector<size_t> offsets(channels.size(), 0);
+    for (bool more = true; more; ) {
+        more = false;
+        for (size_t i = 0; i < channels.size(); i ++) {
+            const std::vector<int16_t>& samples = channels[i].samples;
+            size_t count = std::min(farm_push(i), samples.size() - offsets[i]);
+            farm.push(i, samples.data() + offsets[i], count);
+            offsets[i] += count;
+            more |= (offsets[i] < samples.size());
+        }
+    }
+
+    bool thrown = false;
+    try {
+        farm.drain();
+    } catch (const std::runtime_error& e) {
+        thrown = true;
+        error = e.what();
+    }
+    farm.stop();
+
+    counts.clear();
+    for (size_t i = 0; i < channels.size(); i ++) {
+        counts.push_back(farm.stats(i).images);
+    }
+    return thrown;
+}
+
+static int run_farm()
+{
+    const std::pair<sstv_mode_t, uint32_t> setups[] = {
+        { SSTV_MODE_ROBOT_BW8_R, 11025 }, { SSTV_MODE_ROBOT_C36, 11025 }, { SSTV_MODE_MARTIN_M2, 8000 },
+        { SSTV_MODE_ROBOT_BW12_G, 8000 }, { SSTV_MODE_SCOTTIE_S2, 11025 },
+    };
+    const size_t workers = 2;
+    size_t failures = 0;
+
+    /* single-threaded decodes */
+    std::vector<FarmChannel> channels;
+    for (const auto& s : setups) {
+        size_t push = farm_push(channels.size());
+        FarmChannel ch = { s.first, s.second, {}, {} };
+        sstv_image_t image = test_image(ch.mode);
+        ch.samples = encode_padded(image, ch.mode, ch.rate);
+
+        sstv_image_t decoded;
+        check(sstv_create_image_from_mode(&decoded, ch.mode), "sstv_create_image_from_mode()");
+        void *ctx = nullptr;
+        check(sstv_create_decoder(&ctx, decoded, ch.mode, ch.rate), "sstv_create_decoder()");
+        sstv_error_t rc = SSTV_DECODE_SUCCESSFUL;
+        for (size_t pos = 0; pos < ch.samples.size() && rc == SSTV_DECODE_SUCCESSFUL; pos += push) {
+            rc = decode_signal(ctx, SSTV_SAMPLE_INT16, ch.samples.data() + pos,
+                               std::min(push, ch.samples.size() - pos));
+        }
+        sstv_delete_decoder(ctx);
+        if (rc != SSTV_DECODE_END) {
+            std::cerr << ch.mode << ": not decoded single-threaded" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        size_t size = (size_t)image.width * image.height * (image.format == SSTV_FORMAT_Y ? 1 : 3);
+        ch.expected.assign(decoded.buffer, decoded.buffer + size);
+
+        sstv_delete_image(&decoded);
+        sstv_delete_image(&image);
+        channels.push_back(std::move(ch));
+    }
+
+    /* a deadlock fails the test instead of hanging it */
+    auto bounded = [](std::function<bool()> run) {
+        auto result = std::async(std::launch::async, run);
+        if (result.wait_for(std::chrono::seconds(120)) != std::future_status::ready) {
+            std::cout << "farm deadlocked" << std::endl;
+            _exit(EXIT_FAILURE);
+        }
+        return result.get();
+    };
+
+    std::vector<std::vector<uint8_t>> images;
+    std::vector<uint64_t> counts;
+    std::string error;
+    bool thrown = bounded([&] { return feed_farm(channels, workers, images, counts, SIZE_MAX, error); });
+    for (size_t i = 0; i < channels.size(); i ++) {
+        bool ok = (counts[i] == 1 && images[i] == channels[i].expected);
+        std::cout << "channel " << i << " (" << channels[i].mode << " at " << channels[i].rate << " Hz): "
+                  << counts[i] << " images, " << (ok ? "same as single-threaded" : "DIFFERENT") << std::endl;
+        failures += !ok;
+    }
+    if (thrown) {
+        std::cout << "unexpected error: " << error << std::endl;
+        failures ++;
+    }
+
+    /* callback failing on channel 1 */
+    thrown = bounded([&] { return feed_farm(channels, workers, images, counts, 1, error); });
+    bool others = true;
+    for (size_t i = 0; i < channels.size(); i ++) {
+        others = others && (i == 1 || (counts[i] == 1 && images[i] == channels[i].expected));
+    }
+    std::cout << "callback exception: " << (thrown ? "rethrown (" + error + ")" : "NOT RETHROWN")
+              << ", other channels " << (others ? "decoded" : "NOT DECODED") << std::endl;
+    failures += !thrown + !others;
+
+    std::cout << (failures ? "farm decodes differ" : "farm decodes match") << std::endl;
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Trace hooks (TRACE_HOOKS builds only): balanced spans, one per image line
+ */
+struct TraceLog {
+    int depth = 0;
+    bool balanced = true;
+    uint32_t creates = 0, encodes = 0, converts = 0, lines = 0;
+    uint32_t open_line = 0xffffffff;
+};
+
+static void trace_begin(sstv_trace_event_t event, uint32_t arg, void *user)
+{
+    TraceLog *log = (TraceLog *)user;
+    if (event == SSTV_TRACE_LINE) {
+        log->balanced &= (log->open_line == 0xffffffff);
+        log->open_line = arg;
+        return;
+    }
+    log->balanced &= (log->depth == 0);
+    log->depth ++;
+}
+
+static void trace_end(sstv_trace_event_t event, uint32_t arg, void *user)
+{
+    TraceLog *log = (TraceLog *)user;
+    switch (event) {
+        case SSTV_TRACE_LINE:
+            log->balanced &= (log->open_line == arg);
+            log->open_line = 0xffffffff;
+            log->lines ++;
+            return;
+        case SSTV_TRACE_CREATE_ENCODER:
+            log->creates ++;
+            break;
+        case SSTV_TRACE_ENCODE:
+            log->encodes ++;
+            break;
+        case SSTV_TRACE_CONVERT_IMAGE:
+            log->converts ++;
+            break;
+    }
+    log->depth --;
+    log->balanced &= (log->depth == 0);
+}
+
+static int run_trace()
+{
+    TraceLog log;
+    sstv_error_t rc = sstv_set_trace_hooks(trace_begin, trace_end, &log);
+    if (rc == SSTV_UNSUPPORTED_FEATURE) {
+        std::cout << "library built without TRACE_HOOKS, skipped" << std::endl;
+        return 77;
+    }
+    check(rc, "sstv_set_trace_hooks()");
+
+    const sstv_mode_t modes[] = { SSTV_MODE_ROBOT_BW8_R, SSTV_MODE_ROBOT_C36, SSTV_MODE_SCOTTIE_S1,
+                                  SSTV_MODE_MARTIN_M1, SSTV_MODE_PD120 };
+    size_t failures = 0;
+
+    for (sstv_mode_t mode : modes) {
+        log = TraceLog();
+        sstv_image_t image = test_image(mode);
+        check(sstv_convert_image(&image, image.format), "sstv_convert_image()");
+        Hash hash = encode_chunked(image, mode, 11025, SSTV_SAMPLE_INT16, 4096);
+
+        uint32_t lines = (mode == SSTV_MODE_PD120 ? image.height / 2 : image.height);
+        uint32_t encodes = (uint32_t)((hash.count() + 4095) / 4096);
+        bool ok = log.balanced && log.depth == 0 && log.open_line == 0xffffffff && log.creates == 1
+                  && log.encodes == encodes && log.lines == lines
+                  && log.converts == 1;
+        std::cout << std::setw(4) << mode << ": " << log.encodes << " encode calls, " << log.lines << " lines, "
+                  << log.converts << " conversions" << (ok ? "" : " (unexpected)") << std::endl;
+        failures += !ok;
+        sstv_delete_image(&image);
+    }
+
+    sstv_set_trace_hooks(nullptr, nullptr, nullptr);
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static void write_file(const std::string& path, const std::string& header, const std::vector<uint8_t>& data)
+{
+    std::ofstream out(path, std::ios::binary);
+    out << header;
+    out.write((const char *)data.data(), data.size());
+    if (!out) {
+        std::cerr << "cannot write " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+static std::string bmp_header(uint32_t width, int32_t height, uint16_t bpp, uint32_t data_size)
+{
+    uint8_t h[54] = { 'B', 'M' };
+    auto put = [&](size_t pos, uint32_t v, size_t bytes) {
+        for (size_t i = 0; i < bytes; i ++) {
+            h[pos + i] = (uint8_t)(v >> (8 * i));
+        }
+    };
+    put(2, 54 + data_size, 4);
+    put(10, 54, 4);
+    put(14, 40, 4);
+    put(18, width, 4);
+    put(22, (uint32_t)height, 4);
+    put(26, 1, 2);
+    put(28, bpp, 2);
+    put(34, data_size, 4);
+    return std::string((const char *)h, sizeof(h));
+}
+
+/*
+ * Hash of what is left of a transmission, from an encoder already in use
+ */
+static void encode_rest(void *ctx, sstv_sample_type_t type, Hash& hash)
+{
+    std::vector<uint8_t> buffer(4096 * sample_size(type));
+    while (true) {
+        sstv_signal_t signal;
+        check(sstv_pack_signal(&signal, type, 4096, buffer.data()), "sstv_pack_signal()");
+        sstv_error_t rc = sstv_encode(ctx, &signal);
+        if (rc != SSTV_ENCODE_SUCCESSFUL && rc != SSTV_ENCODE_END) {
+            std::cerr << "sstv_encode() failed with rc " << rc << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        hash.add(buffer.data(), signal.count, type);
+        if (rc == SSTV_ENCODE_END) {
+            return;
+        }
+    }
+}
+
+/*
+ * Encodes some samples, to leave an encoder mid-transmission
+ */
+static void encode_some(void *ctx, sstv_sample_type_t type, uint32_t count)
+{
+    std::vector<uint8_t> buffer(count * sample_size(type));
+    sstv_signal_t signal;
+    check(sstv_pack_signal(&signal, type, count, buffer.data()), "sstv_pack_signal()");
+    sstv_error_t rc = sstv_encode(ctx, &signal);
+    if (rc != SSTV_ENCODE_SUCCESSFUL) {
+        std::cerr << "sstv_encode() failed with rc " << rc << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * A reset or rebound encoder must produce the golden signal of its mode, no
+ * matter what it encoded before
+ */
+static int run_rebind(const std::string& path)
+{
+    std::map<std::string, std::string> golden;
+    if (!read_golden(path, golden)) {
+        return EXIT_FAILURE;
+    }
+
+    const sstv_mode_t modes[] = { SSTV_MODE_ROBOT_BW8_R, SSTV_MODE_ROBOT_C36, SSTV_MODE_ROBOT_C72,
+                                  SSTV_MODE_SCOTTIE_S1, SSTV_MODE_MARTIN_M1, SSTV_MODE_PD90 };
+    const uint32_t rate = 11025;
+    const sstv_sample_type_t type = SSTV_SAMPLE_INT16;
+    size_t failures = 0;
+
+    for (sstv_mode_t mode : modes) {
+        std::string name;
+        for (const auto& m : stringToModeMap) {
+            if (m.second == mode) {
+                name = m.first;
+            }
+        }
+        std::string expected = golden[name + " " + std::to_string(rate) + " int16"];
+
+        /* another image of the same mode, and one of another resolution */
+        sstv_image_t image = test_image(mode);
+        sstv_image_t other = test_image(mode);
+        for (uint32_t i = 0; i < other.width * other.height * (other.format == SSTV_FORMAT_Y ? 1 : 3); i ++) {
+            other.buffer[i] = (uint8_t)~other.buffer[i];
+        }
+        sstv_image_t foreign = test_image(mode == SSTV_MODE_ROBOT_BW8_R ? SSTV_MODE_MARTIN_M1 : SSTV_MODE_ROBOT_BW8_R);
+
+        std::vector<std::pair<std::string, Hash>> results;
+
+        /* reset mid-transmission, with and without phase continuity */
+        for (uint8_t keep_phase : { 0, 1 }) {
+            void *ctx = create_encoder(image, mode, rate);
+            if (keep_phase) {
+                check(sstv_encoder_reset(ctx, 1), "sstv_encoder_reset()");
+            } else {
+                encode_some(ctx, type, 20000);
+                check(sstv_encoder_reset(ctx, 0), "sstv_encoder_reset()");
+            }
+            Hash hash;
+            encode_rest(ctx, type, hash);
+            results.push_back({ keep_phase ? "reset of a fresh encoder, keeping phase" : "reset mid-transmission", hash });
+            sstv_delete_encoder(ctx);
+        }
+
+        /* rebind from another image, mid-transmission and after a whole one */
+        for (bool whole : { false, true }) {
+            void *ctx = create_encoder(other, mode, rate);
+            if (whole) {
+                Hash ignored;
+                encode_rest(ctx, type, ignored);
+            } else {
+                encode_some(ctx, type, 20000);
+            }
+            check(sstv_encoder_rebind(ctx, image, 0), "sstv_encoder_rebind()");
+            Hash hash;
+            encode_rest(ctx, type, hash);
+            results.push_back({ whole ? "rebind after a transmission" : "rebind mid-transmission", hash });
+            sstv_delete_encoder(ctx);
+        }
+
+        /* images of another mode are refused, and leave the encoder usable */
+        {
+            void *ctx = create_encoder(other, mode, rate);
+            encode_some(ctx, type, 20000);
+            if (sstv_encoder_rebind(ctx, foreign, 0) == SSTV_OK) {
+                std::cerr << name << ": rebind to an image of another mode accepted" << std::endl;
+                failures ++;
+            }
+            check(sstv_encoder_rebind(ctx, image, 0), "sstv_encoder_rebind()");
+            Hash hash;
+            encode_rest(ctx, type, hash);
+            results.push_back({ "rebind after a refused one", hash });
+            sstv_delete_encoder(ctx);
+        }
+
+        for (const auto& r : results) {
+            std::string value = std::to_string(r.second.count()) + " " + hex(r.second.value());
+            if (value != expected) {
+                std::cerr << name << ": " << r.first << " gives " << value << ", expected " << expected << std::endl;
+                failures ++;
+            }
+        }
+
+        sstv_delete_image(&image);
+        sstv_delete_image(&other);
+        sstv_delete_image(&foreign);
+    }
+
+    std::cout << (failures ? "reset/rebind differ from golden" : "reset/rebind match golden") << std::endl;
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Transmission timing the decoder depends on: leader tones of exactly 300ms at
+ * any sample rate, and PD modes ending with the last line pair of the image
+ */
+static int run_timing()
+{
+    size_t failures = 0;
+
+    /* one work unit for the first state change, then the whole leader; the
+       next unit must go to the break */
+    for (uint32_t rate : { 8000u, 22050u, 44100u, 96000u, 192000u }) {
+        sstv_image_t image = test_image(SSTV_MODE_ROBOT_BW8_R);
+        void *ctx = create_encoder(image, SSTV_MODE_ROBOT_BW8_R, rate);
+        uint32_t leader = rate * 3 / 10;
+        std::vector<int16_t> buffer(leader + 1);
+        sstv_signal_t signal;
+        check(sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, leader + 1, buffer.data()), "sstv_pack_signal()");
+
+        sstv_error_t rc = sstv_encode_budget(ctx, &signal, 1 + leader);
+        uint32_t first = signal.count;
+        rc = (rc == SSTV_ENCODE_BUDGET_EXHAUSTED ? sstv_encode_budget(ctx, &signal, 1) : rc);
+        bool ok = (rc == SSTV_ENCODE_BUDGET_EXHAUSTED && first == leader && signal.count == 0);
+        std::cout << "leader tone at " << rate << " Hz: " << (ok ? "ok" : std::to_string(first) + " samples, expected "
+                                                                         + std::to_string(leader)) << std::endl;
+        failures += !ok;
+
+        sstv_delete_encoder(ctx);
+        sstv_delete_image(&image);
+    }
+
+    /* one sync per line pair, and the last pair carries the bottom line */
+    for (sstv_mode_t mode : { SSTV_MODE_PD50, SSTV_MODE_PD90, SSTV_MODE_PD290 }) {
+        sstv_image_t image = test_image(mode);
+        Hash reference = encode_chunked(image, mode, 11025, SSTV_SAMPLE_INT16, 4096);
+
+        void *ctx = create_encoder(image, mode, 11025);
+        Hash hash;
+        encode_rest(ctx, SSTV_SAMPLE_INT16, hash);
+        sstv_encoder_stats_t stats;
+        check(sstv_encoder_get_stats(ctx, &stats), "sstv_encoder_get_stats()");
+        sstv_delete_encoder(ctx);
+
+        size_t last = (size_t)image.width * (image.height - 1) * 3;
+        for (size_t i = 0; i < (size_t)image.width * 3; i ++) {
+            image.buffer[last + i] = (uint8_t)~image.buffer[last + i];
+        }
+        Hash changed = encode_chunked(image, mode, 11025, SSTV_SAMPLE_INT16, 4096);
+
+        bool ok = (hash == reference && stats.transitions[SSTV_SEGMENT_SYNC] == image.height / 2
+                   && changed.count() == reference.count() && changed != reference);
+        std::cout << "PD mode " << mode << ": " << stats.transitions[SSTV_SEGMENT_SYNC] << " line pairs for "
+                  << image.height << " lines, bottom line " << (changed != reference ? "sent" : "not sent")
+                  << (ok ? "" : " (wrong)") << std::endl;
+        failures += !ok;
+
+        sstv_delete_image(&image);
+    }
+
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Encoder statistics after known encodes: every sample and sstv_encode() call
+ * counted, and as many state changes of each class as the mode's structure
+ * has (3 header tones, 10 VIS bits, one sync per line or line pair and one
+ * segment per pixel of every channel sent). The sample-by-sample path must
+ * count the same, and at any point report exactly the samples played.
+ */
+static int run_stats()
+{
+    struct Case {
+        sstv_mode_t mode;
+        uint64_t syncs;     /* in lines */
+        uint64_t pixels;    /* in pixels of a line, times lines */
+    };
+    const Case cases[] = {
+        { SSTV_MODE_ROBOT_BW8_R, 2, 2 },    /* halved below */
+        { SSTV_MODE_ROBOT_C36, 2, 4 },      /* Y, then R-Y or B-Y at half the pixel time */
+        { SSTV_MODE_SCOTTIE_S1, 2, 6 },
+        { SSTV_MODE_MARTIN_M1, 2, 6 },
+        { SSTV_MODE_PD120, 1, 4 },          /* Y, R-Y, B-Y, Y per line pair */
+    };
+    const uint32_t rate = 11025, chunk = 4096, played = 1000;
+    size_t failures = 0;
+
+    for (const Case& c : cases) {
+        sstv_image_t image = test_image(c.mode);
+        uint64_t predicted = predicted_count(image, c.mode, rate);
+        uint64_t syncs = c.syncs * image.height / 2 + (c.mode == SSTV_MODE_SCOTTIE_S1 ? 1 : 0);
+        uint64_t pixels = c.pixels * image.width * image.height / 2;
+
+        /* sstv_encode() */
+        void *ctx = create_encoder(image, c.mode, rate);
+        std::vector<int16_t> buffer(chunk);
+        uint64_t total = 0, calls = 0;
+        while (true) {
+            sstv_signal_t signal;
+            check(sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, chunk, buffer.data()), "sstv_pack_signal()");
+            sstv_error_t rc = sstv_encode(ctx, &signal);
+            total += signal.count;
+            calls ++;
+            if (rc == SSTV_ENCODE_END) {
+                break;
+            }
+            check(rc == SSTV_ENCODE_SUCCESSFUL ? SSTV_OK : rc, "sstv_encode()");
+        }
+        sstv_encoder_stats_t stats;
+        check(sstv_encoder_get_stats(ctx, &stats), "sstv_encoder_get_stats()");
+        sstv_delete_encoder(ctx);
+
+        uint64_t transitions = 0;
+        for (uint64_t t : stats.transitions) {
+            transitions += t;
+        }
+        bool ok = (stats.samples == total && total == predicted && stats.encode_calls == calls
+                   && stats.transitions[SSTV_SEGMENT_HEADER] == 3 && stats.transitions[SSTV_SEGMENT_VIS] == 10
+                   && stats.transitions[SSTV_SEGMENT_SYNC] == syncs && stats.transitions[SSTV_SEGMENT_PIXEL] == pixels
+                   && stats.segments == transitions);
+
+        /* sstv_encode_refill() and sstv_encode_next_sample() */
+        ctx = create_encoder(image, c.mode, rate);
+        sstv_encoder_stats_t isr_stats, partial;
+        uint64_t isr_total = 0;
+        int16_t sample;
+        while (true) {
+            sstv_error_t rc = sstv_encode_next_sample(ctx, SSTV_SAMPLE_INT16, &sample);
+            if (rc == SSTV_ENCODE_END) {
+                break;
+            } else if (rc == SSTV_ENCODE_UNDERRUN) {
+                rc = sstv_encode_refill(ctx);
+                check(rc == SSTV_ENCODE_SUCCESSFUL || rc == SSTV_ENCODE_END ? SSTV_OK : rc, "sstv_encode_refill()");
+                continue;
+            }
+            check(rc == SSTV_ENCODE_SUCCESSFUL ? SSTV_OK : rc, "sstv_encode_next_sample()");
+            if (++ isr_total == played) {
+                check(sstv_encoder_get_stats(ctx, &partial), "sstv_encoder_get_stats()");
+            }
+        }
+        check(sstv_encoder_get_stats(ctx, &isr_stats), "sstv_encoder_get_stats()");
+        sstv_delete_encoder(ctx);
+
+        ok &= (partial.samples == played && isr_stats.samples == isr_total && isr_total == total
+               && isr_stats.encode_calls == 0 && isr_stats.segments == stats.segments
+               && std::equal(std::begin(stats.transitions), std::end(stats.transitions),
+                             std::begin(isr_stats.transitions)));
+
+        std::cout << std::setw(4) << c.mode << ": " << stats.samples << " samples (" << isr_stats.samples
+                  << " sample by sample, " << partial.samples << " after " << played << "), " << stats.encode_calls
+                  << " calls, " << stats.transitions[SSTV_SEGMENT_SYNC] << " syncs, "
+                  << stats.transitions[SSTV_SEGMENT_PIXEL] << " pixels, " << stats.segments << " segments"
+                  << (ok ? "" : " (wrong)") << std::endl;
+        failures += !ok;
+
+        sstv_delete_image(&image);
+    }
+
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Encodes the first split samples, saves the position, and resumes from it in
+ * a fresh context; the saved record is left in record
+ */
+static Hash encode_resumed(sstv_image_t image, sstv_mode_t mode, uint32_t rate, sstv_sample_type_t type,
+                           uint64_t split, std::vector<uint8_t>& record)
+{
+    std::vector<uint8_t> buffer(4096 * sample_size(type));
+    Hash hash;
+    sstv_error_t rc = SSTV_ENCODE_SUCCESSFUL;
+
+    void *ctx = create_encoder(image, mode, rate);
+    while (hash.count() < split) {
+        sstv_signal_t signal;
+        uint32_t chunk = (uint32_t)std::min<uint64_t>(4096, split - hash.count());
+        check(sstv_pack_signal(&signal, type, chunk, buffer.data()), "sstv_pack_signal()");
+        rc = sstv_encode(ctx, &signal);
+        if (rc != SSTV_ENCODE_SUCCESSFUL) {
+            std::cerr << "sstv_encode() failed with rc " << rc << " before the split" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        hash.add(buffer.data(), signal.count, type);
+    }
+    record.resize(SSTV_ENCODER_STATE_SIZE);
+    check(sstv_encoder_save_state(ctx, record.data(), (uint32_t)record.size()), "sstv_encoder_save_state()");
+    sstv_delete_encoder(ctx);
+
+    ctx = create_encoder(image, mode, rate);
+    check(sstv_encoder_restore_state(ctx, record.data(), (uint32_t)record.size()), "sstv_encoder_restore_state()");
+    while (true) {
+        sstv_signal_t signal;
+        check(sstv_pack_signal(&signal, type, 4096, buffer.data()), "sstv_pack_signal()");
+        rc = sstv_encode(ctx, &signal);
+        if (rc != SSTV_ENCODE_SUCCESSFUL && rc != SSTV_ENCODE_END) {
+            std::cerr << "sstv_encode() failed with rc " << rc << " after restoring" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        hash.add(buffer.data(), signal.count, type);
+        if (rc == SSTV_ENCODE_END) {
+            break;
+        }
+    }
+    sstv_delete_encoder(ctx);
+    return hash;
+}
+
+/*
+ * Saved positions must resume into the exact same signal, and records that
+ * are truncated, foreign or point outside the image must be rejected. Saved
+ * records hold the state at byte 8 and the line and column (little endian) at
+ * bytes 12 and 16.
+ */
+static int run_state()
+{
+    const sstv_mode_t modes[] = { SSTV_MODE_ROBOT_BW8_R, SSTV_MODE_ROBOT_C36, SSTV_MODE_ROBOT_C72,
+                                  SSTV_MODE_SCOTTIE_S1, SSTV_MODE_MARTIN_M1, SSTV_MODE_PD90, SSTV_MODE_FAX480 };
+    const uint32_t rate = 8000;
+    size_t failures = 0;
+
+    auto get_u32 = [](const std::vector<uint8_t>& r, size_t pos) {
+        return (uint32_t)r[pos] | ((uint32_t)r[pos + 1] << 8) | ((uint32_t)r[pos + 2] << 16) | ((uint32_t)r[pos + 3] << 24);
+    };
+    auto put_u32 = [](std::vector<uint8_t>& r, size_t pos, uint32_t v) {
+        for (int i = 0; i < 4; i ++) {
+            r[pos + i] = (uint8_t)(v >> (8 * i));
+        }
+    };
+
+    for (sstv_mode_t mode : modes) {
+        sstv_image_t image = test_image(mode);
+        Hash reference = encode_chunked(image, mode, rate, SSTV_SAMPLE_INT16, 4096);
+
+        /* round trips, mid-scan */
+        std::vector<uint8_t> record;
+        for (uint64_t split : { reference.count() / 3, reference.count() / 2 + 17, reference.count() - 100 }) {
+            Hash resumed = encode_resumed(image, mode, rate, SSTV_SAMPLE_INT16, split, record);
+            bool ok = (resumed == reference && get_u32(record, 12) > 0);
+            if (!ok) {
+                std::cerr << mode << ": resuming at sample " << split << " gives a different signal" << std::endl;
+                failures ++;
+            }
+        }
+
+        /* rejected records; record was saved on the last line (pair) */
+        void *ctx = create_encoder(image, mode, rate);
+        struct {
+            const char *what;
+            std::vector<uint8_t> record;
+            uint32_t len;
+            sstv_error_t rc;
+        } cases[] = {
+            { "truncated", record, SSTV_ENCODER_STATE_SIZE - 1, SSTV_BAD_PARAMETER },
+            { "bad magic", record, SSTV_ENCODER_STATE_SIZE, SSTV_BAD_STATE },
+            { "other mode", record, SSTV_ENCODER_STATE_SIZE, SSTV_BAD_STATE },
+            { "other rate", record, SSTV_ENCODER_STATE_SIZE, SSTV_BAD_STATE },
+            { "unknown state", record, SSTV_ENCODER_STATE_SIZE, SSTV_BAD_STATE },
+            { "line past the image", record, SSTV_ENCODER_STATE_SIZE, SSTV_BAD_STATE },
+            { "column past the image", record, SSTV_ENCODER_STATE_SIZE, SSTV_BAD_STATE },
+        };
+        cases[1].record[0] ^= 0xff;
+        cases[2].record[3] ^= 0x01;
+        put_u32(cases[3].record, 4, rate + 1);
+        cases[4].record[8] = 0xff;
+        put_u32(cases[5].record, 12, image.height);
+        put_u32(cases[6].record, 16, image.width + 1);
+        for (const auto& c : cases) {
+            sstv_error_t rc = sstv_encoder_restore_state(ctx, c.record.data(), c.len);
+            if (rc != c.rc) {
+                std::cerr << mode << ": " << c.what << " record gives rc " << rc << ", expected " << c.rc << std::endl;
+                failures ++;
+            }
+        }
+        sstv_delete_encoder(ctx);
+        sstv_delete_image(&image);
+    }
+
+    /* PD scans read line pairs, so the last line cannot start a pair */
+    {
+        sstv_image_t image = test_image(SSTV_MODE_PD90);
+        Hash reference = encode_chunked(image, SSTV_MODE_PD90, rate, SSTV_SAMPLE_INT16, 4096);
+        std::vector<uint8_t> record;
+        encode_resumed(image, SSTV_MODE_PD90, rate, SSTV_SAMPLE_INT16, reference.count() - 100, record);
+        put_u32(record, 12, image.height - 1);
+
+        void *ctx = create_encoder(image, SSTV_MODE_PD90, rate);
+        sstv_error_t rc = sstv_encoder_restore_state(ctx, record.data(), (uint32_t)record.size());
+        if (rc != SSTV_BAD_STATE) {
+            std::cerr << "PD record on the last line gives rc " << rc << std::endl;
+            failures ++;
+        }
+        sstv_delete_encoder(ctx);
+        sstv_delete_image(&image);
+    }
+
+    /* whatever record is accepted, encoding from it stays within the image;
+       the image ends right before an inaccessible page, so any read past it
+       faults */
+    long page = sysconf(_SC_PAGESIZE);
+    for (sstv_mode_t mode : modes) {
+        sstv_image_t props = test_image(mode);
+        size_t size = (size_t)props.width * props.height * (props.format == SSTV_FORMAT_Y ? 1 : 3);
+        size_t mapped = (size + page - 1) / page * page;
+        uint8_t *map = (uint8_t *)mmap(nullptr, mapped + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED || mprotect(map + mapped, page, PROT_NONE) != 0) {
+            std::cerr << "cannot map a guarded image" << std::endl;
+            return EXIT_FAILURE;
+        }
+        uint8_t *pixels = map + mapped - size;
+        std::memcpy(pixels, props.buffer, size);
+        sstv_image_t image;
+        check(sstv_pack_image(&image, props.width, props.height, props.format, pixels), "sstv_pack_image()");
+
+        void *ctx = create_encoder(image, mode, rate);
+        std::vector<uint8_t> record(SSTV_ENCODER_STATE_SIZE);
+        check(sstv_encoder_save_state(ctx, record.data(), (uint32_t)record.size()), "sstv_encoder_save_state()");
+
+        std::vector<int16_t> samples(4096);
+        size_t accepted = 0;
+        for (uint32_t state = 0; state < 64; state ++) {
+            for (uint32_t line : { 0u, image.height - 3, image.height - 2, image.height - 1, image.height }) {
+                for (uint32_t col : { 0u, 1u, image.width - 1, image.width, image.width + 1 }) {
+                    record[8] = (uint8_t)state;
+                    put_u32(record, 12, line);
+                    put_u32(record, 16, col);
+                    if (sstv_encoder_restore_state(ctx, record.data(), (uint32_t)record.size()) != SSTV_OK) {
+                        continue;
+                    }
+                    accepted ++;
+
+                    /* a line and a half is enough to cross into the next line (pair) */
+                    for (int i = 0; i < 64; i ++) {
+                        sstv_signal_t signal;
+                        check(sstv_pack_signal(&signal, SSTV_SAMPLE_INT16, 4096, samples.data()), "sstv_pack_signal()");
+                        sstv_error_t rc = sstv_encode(ctx, &signal);
+                        if (rc != SSTV_ENCODE_SUCCESSFUL) {
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        if (accepted == 0) {
+            std::cerr << mode << ": no record accepted" << std::endl;
+            failures ++;
+        }
+
+        sstv_delete_encoder(ctx);
+        munmap(map, mapped + page);
+        sstv_delete_image(&props);
+    }
+
+    std::cout << (failures ? "save/restore failed" : "save/restore ok") << std::endl;
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Built-in image loaders must give back the pixels stored in every format,
+ * straight from the file where the layout allows it
+ */
+static int run_images()
+{
+    /* odd width, so BMP rows are padded */
+    const uint32_t w = 5, h = 3;
+    std::vector<uint8_t> rgb(w * h * 3), gray(w * h);
+    for (uint32_t i = 0; i < w * h; i ++) {
+        rgb[3 * i] = (uint8_t)(i * 17);
+        rgb[3 * i + 1] = (uint8_t)(255 - i * 11);
+        rgb[3 * i + 2] = (uint8_t)(i * i);
+        gray[i] = rgb[3 * i + 1];
+    }
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / ("sstv-test-" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+
+    /* PPM with a comment, PGM on one line, raw RGB */
+    write_file(dir / "image.ppm", "P6\n# comment\n5 3\n255\n", rgb);
+    write_file(dir / "image.pgm", "P5 5 3 255\n", gray);
+    write_file(dir / "image.rgb", "", rgb);
+
+    /* 24-bit bottom-up and 32-bit top-down BMP */
+    std::vector<uint8_t> bmp24, bmp32;
+    for (uint32_t y = 0; y < h; y ++) {
+        uint32_t row = h - 1 - y;
+        for (uint32_t x = 0; x < w; x ++) {
+            const uint8_t *p = &rgb[(row * w + x) * 3];
+            bmp24.insert(bmp24.end(), { p[2], p[1], p[0] });
+        }
+        bmp24.push_back(0);
+    }
+    for (uint32_t i = 0; i < w * h; i ++) {
+        bmp32.insert(bmp32.end(), { rgb[3 * i + 2], rgb[3 * i + 1], rgb[3 * i], 0xff });
+    }
+    write_file(dir / "image24.bmp", bmp_header(w, h, 24, (uint32_t)bmp24.size()), bmp24);
+    write_file(dir / "image32.bmp", bmp_header(w, -(int32_t)h, 32, (uint32_t)bmp32.size()), bmp32);
+
+    /* expanded gray, for colour modes */
+    std::vector<uint8_t> gray_rgb;
+    for (uint8_t v : gray) {
+        gray_rgb.insert(gray_rgb.end(), { v, v, v });
+    }
+
+    struct {
+        const char *file;
+        sstv_image_format_t format;
+        const std::vector<uint8_t>& expected;
+        bool direct;
+    } cases[] = {
+        { "image.ppm", SSTV_FORMAT_YCBCR, rgb, true },
+        { "image.rgb", SSTV_FORMAT_YCBCR, rgb, true },
+        { "image.pgm", SSTV_FORMAT_Y, gray, true },
+        { "image.pgm", SSTV_FORMAT_YCBCR, gray_rgb, false },
+        { "image24.bmp", SSTV_FORMAT_YCBCR, rgb, false },
+        { "image32.bmp", SSTV_FORMAT_YCBCR, rgb, false },
+    };
+
+    size_t failures = 0;
+    for (const auto& c : cases) {
+        auto file = ImageFile::open((dir / c.file).string(), w, h);
+        std::vector<uint8_t> pixels;
+        bool ok = file && file->width() == w && file->height() == h && file->direct(w, h, c.format) == c.direct;
+        if (ok) {
+            sstv_image_t image = file->image(w, h, c.format, pixels);
+            ok = std::equal(c.expected.begin(), c.expected.end(), image.buffer)
+                 && (image.buffer == pixels.data()) != c.direct;
+        }
+        std::cout << c.file << " (format " << c.format << "): " << (ok ? "ok" : "wrong pixels") << std::endl;
+        failures += !ok;
+    }
+
+    /* scaling keeps a flat image flat */
+    {
+        std::vector<uint8_t> flat(2 * 2 * 3);
+        for (size_t i = 0; i < flat.size(); i += 3) {
+            flat[i] = 10;
+            flat[i + 1] = 200;
+            flat[i + 2] = 77;
+        }
+        write_file(dir / "flat.ppm", "P6 2 2 255\n", flat);
+        auto file = ImageFile::open((dir / "flat.ppm").string(), 7, 5);
+        std::vector<uint8_t> pixels;
+        bool ok = file && !file->direct(7, 5, SSTV_FORMAT_RGB);
+        if (ok) {
+            sstv_image_t image = file->image(7, 5, SSTV_FORMAT_RGB, pixels);
+            for (uint32_t i = 0; i < 7 * 5 * 3; i ++) {
+                ok = ok && image.buffer[i] == flat[i % 3];
+            }
+        }
+        std::cout << "flat.ppm scaled to 7x5: " << (ok ? "ok" : "wrong pixels") << std::endl;
+        failures += !ok;
+    }
+
+    /* other files are left to ImageMagick, broken ones are reported */
+    {
+        write_file(dir / "text.txt", "not an image\n", {});
+        write_file(dir / "short.ppm", "P6 5 3 255\n", gray);
+        bool other = !ImageFile::open((dir / "text.txt").string(), w, h);
+        bool broken = false;
+        try {
+            ImageFile::open((dir / "short.ppm").string(), w, h);
+        } catch (const std::runtime_error&) {
+            broken = true;
+        }
+        std::cout << "unknown and truncated files: " << (other && broken ? "ok" : "not rejected") << std::endl;
+        failures += !(other && broken);
+    }
+
+    std::filesystem::remove_all(dir);
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Runs a tool to completion, its output discarded; returns its exit status
+ */
+static int run_tool(const std::vector<std::string>& args)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        std::vector<char *> argv;
+        for (const auto& a : args) {
+            argv.push_back((char *) a.c_str());
+        }
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return (WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+}
+
+/*
+ * String values of every "key": "..." in a JSON text, in order; null values
+ * come out empty
+ */
+static std::vector<std::string> json_values(const std::string& text, const std::string& key)
+{
+    std::vector<std::string> values;
+    std::string tag = "\"" + key + "\": ";
+    for (size_t pos = text.find(tag); pos != std::string::npos; pos = text.find(tag, pos + 1)) {
+        size_t begin = pos + tag.size();
+        if (text[begin] == '"') {
+            values.push_back(text.substr(begin + 1, text.find('"', begin + 1) - begin - 1));
+        } else {
+            values.push_back(text.substr(begin, text.find_first_of(",}", begin) - begin));
+            if (values.back() == "null") {
+                values.back().clear();
+            }
+        }
+    }
+    return values;
+}
+
+/*
+ * sstv-decode on a recording of several transmissions, encoded by sstv-encode
+ * and separated by noise, scanned whole and in short segments on one or more
+ * threads: every run must report the transmissions in order, with their modes
+ * and first lines, and images within a small mean pixel error of the source.
+ * Segment boundaries shift the VIS detector's block grid, so the line start
+ * may move by a fraction of a millisecond; the images may differ a little
+ * between runs, but not by more than max_drift.
+ */
+static int run_scan(const std::string& encoder, const std::string& decoder)
+{
+    const sstv_mode_t modes[] = { SSTV_MODE_ROBOT_C36, SSTV_MODE_MARTIN_M2, SSTV_MODE_PD50, SSTV_MODE_ROBOT_C36 };
+    const uint32_t rate = 11025;
+    const double gap = 2.0; /* seconds of noise before every transmission */
+    const double max_start = 0.005, max_error = 8.0, max_drift = 0.5;
+    const std::vector<std::vector<std::string>> runs = {
+        { "-j", "1" },
+        { "--segment", "20", "-j", "1" },
+        { "--segment", "12", "-j", "3" },
+    };
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / ("sstv-test-" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+    size_t failures = 0;
+
+    /* recording */
+    std::vector<int16_t> recording;
+    std::vector<double> starts;
+    std::vector<std::vector<uint8_t>> sources;
+    uint32_t lcg = 1;
+    auto noise = [&](size_t count) {
+        for (size_t i = 0; i < count; i ++) {
+            lcg = lcg * 1664525 + 1013904223;
+            recording.push_back((int16_t) (((int32_t) (lcg >> 16) - 32768) / 32));
+        }
+    };
+    for (size_t i = 0; i < std::size(modes); i ++) {
+        sstv_image_t image = test_image(modes[i]);
+        std::string name;
+        for (const auto& m : stringToModeMap) {
+            if (m.second == modes[i]) {
+                name = m.first;
+            }
+        }
+        std::vector<uint8_t> rgb(image.buffer, image.buffer + (size_t)image.width * image.height * 3);
+        std::string ppm = (dir / ("source" + std::to_string(i) + ".ppm")).string();
+        std::string raw = (dir / ("source" + std::to_string(i) + ".raw")).string();
+        write_file(ppm, "P6 " + std::to_string(image.width) + " " + std::to_string(image.height) + " 255\n", rgb);
+        sstv_delete_image(&image);
+
+        if (run_tool({ encoder, "--raw", name, ppm, raw, std::to_string(rate) }) != 0) {
+            std::cerr << "sstv-encode failed on " << ppm << std::endl;
+            std::filesystem::remove_all(dir);
+            return EXIT_FAILURE;
+        }
+        std::ifstream in(raw, std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        noise((size_t) (gap * rate));
+        starts.push_back((double) recording.size() / rate + 0.910);
+        size_t offset = recording.size();
+        recording.resize(offset + bytes.size() / 2);
+        std::memcpy(recording.data() + offset, bytes.data(), bytes.size() / 2 * 2);
+        sources.push_back(std::move(rgb));
+    }
+    noise((size_t) (gap * rate));
+
+    /* 16-bit mono WAV */
+    {
+        uint32_t data_size = (uint32_t) (recording.size() * 2);
+        std::string header = "RIFF";
+        auto u32 = [&](uint32_t v) { for (int b = 0; b < 4; b ++) header.push_back((char) (v >> (8 * b))); };
+        auto u16 = [&](uint16_t v) { header.push_back((char) v); header.push_back((char) (v >> 8)); };
+        u32(36 + data_size);
+        header += "WAVEfmt ";
+        u32(16);
+        u16(1);
+        u16(1);
+        u32(rate);
+        u32(rate * 2);
+        u16(2);
+        u16(16);
+        header += "data";
+        u32(data_size);
+        std::vector<uint8_t> data(data_size);
+        std::memcpy(data.data(), recording.data(), data_size);
+        write_file(dir / "recording.wav", header, data);
+    }
+
+    std::vector<double> first_errors;
+    for (size_t r = 0; r < runs.size(); r ++) {
+        std::string out = (dir / ("run" + std::to_string(r))).string();
+        std::filesystem::create_directories(out);
+        std::vector<std::string> args = { decoder, "-o", out };
+        args.insert(args.end(), runs[r].begin(), runs[r].end());
+        args.push_back((dir / "recording.wav").string());
+
+        std::string label;
+        for (size_t a = 3; a + 1 < args.size(); a ++) {
+            label += (label.empty() ? "" : " ") + args[a];
+        }
+
+        if (run_tool(args) != 0) {
+            std::cout << label << ": sstv-decode failed" << std::endl;
+            failures ++;
+            continue;
+        }
+        std::ifstream in(out + "/summary.json");
+        std::string summary((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::vector<std::string> found = json_values(summary, "mode");
+        std::vector<std::string> found_starts = json_values(summary, "start");
+        std::vector<std::string> images = json_values(summary, "image");
+
+        bool ok = (found.size() == std::size(modes) && found_starts.size() == found.size()
+                   && images.size() == found.size());
+        std::cout << label << ": " << found.size() << " transmissions" << (ok ? "" : ", EXPECTED 4") << std::endl;
+        failures += !ok;
+
+        for (size_t i = 0; ok && i < found.size(); i ++) {
+            auto it = stringToModeMap.find(found[i]);
+            double start = std::stod(found_starts[i]);
+            bool right = (it != stringToModeMap.end() && it->second == modes[i]
+                          && std::abs(start - starts[i]) <= max_start);
+
+            double error = 1e9;
+            if (right && !images[i].empty()) {
+                auto file = ImageFile::open(images[i], 0, 0);
+                std::vector<uint8_t> pixels;
+                uint32_t width, height;
+                sstv_image_format_t format;
+                check(sstv_get_mode_image_props(modes[i], &width, &height, &format), "sstv_get_mode_image_props()");
+                if (file && file->width() == width && file->height() == height) {
+                    /* in the mode's own format, as transmitted */
+                    sstv_image_t decoded = file->image(width, height, format, pixels);
+                    std::vector<uint8_t> copy(decoded.buffer, decoded.buffer + (size_t)width * height * 3);
+                    std::vector<uint8_t> original = sources[i];
+                    sstv_image_t source;
+                    check(sstv_pack_image(&decoded, width, height, SSTV_FORMAT_RGB, copy.data()), "sstv_pack_image()");
+                    check(sstv_convert_image(&decoded, format), "sstv_convert_image()");
+                    check(sstv_pack_image(&source, width, height, SSTV_FORMAT_RGB, original.data()), "sstv_pack_image()");
+                    check(sstv_convert_image(&source, format), "sstv_convert_image()");
+                    error = gradient_error(source, decoded);
+                }
+            }
+            if (r == 0) {
+                first_errors.push_back(error);
+            }
+            bool close = (error <= max_error && std::abs(error - first_errors[i]) <= max_drift);
+
+            std::cout << "  " << found[i] << " at " << std::fixed << std::setprecision(3) << start << " s (expected "
+                      << starts[i] << "), mean difference " << error << (right ? "" : ", WRONG TRANSMISSION")
+                      << (close ? "" : ", TOO FAR") << std::endl;
+            failures += !(right && close);
+        }
+    }
+
+    std::filesystem::remove_all(dir);
+    std::cout << (failures ? "recording not decoded as expected" : "recording decoded the same in every run")
+              << std::endl;
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Samples sent back by sstv-encoded for pixels sent over its socket must
+ * match a local encode, on the first request and on warm contexts after it.
+ * Bad requests are answered with ERR, and a second daemon must not take over
+ * the socket of a running one.
+ */
+static int run_daemon(const std::string& daemon)
+{
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / ("sstv-test-" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+    std::string socket_path = (dir / "encoded.sock").string();
+
+    /* a daemon hanging up is reported as a write error */
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "fork() failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (pid == 0) {
+        execl(daemon.c_str(), daemon.c_str(), "-j", "2", socket_path.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+
+    /* wait for the daemon to listen */
+    int fd = -1;
+    for (int attempt = 0; attempt < 100 && fd < 0; attempt ++) {
+        try {
+            fd = connect_unix(socket_path);
+        } catch (const std::runtime_error&) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+
+    size_t failures = 0;
+    if (fd < 0) {
+        std::cerr << "cannot connect to " << daemon << std::endl;
+        failures ++;
+    } else {
+        struct {
+            sstv_mode_t mode;
+            const char *name;
+            uint32_t rate;
+            sstv_sample_type_t type;
+            const char *format;
+            uint32_t seed;
+        } cases[] = {
+            { SSTV_MODE_MARTIN_M1, "martin_m1", 8000, SSTV_SAMPLE_INT16, "s16", 1 },
+            { SSTV_MODE_PD90, "pd90", 11025, SSTV_SAMPLE_UINT8, "u8", 2 },
+            { SSTV_MODE_MARTIN_M1, "martin_m1", 8000, SSTV_SAMPLE_INT16, "s16", 3 },
+        };
+
+        SocketReader reader(fd);
+        try {
+            for (const auto& c : cases) {
+                uint32_t width, height;
+                sstv_image_format_t format;
+                check(sstv_get_mode_image_props(c.mode, &width, &height, &format), "sstv_get_mode_image_props()");
+                std::vector<uint8_t> pixels((size_t)width * height * 3);
+                uint32_t lcg = c.seed;
+                for (uint8_t& v : pixels) {
+                    lcg = lcg * 1664525 + 1013904223;
+                    v = (uint8_t)(lcg >> 24);
+                }
+
+                /* local encode */
+                std::vector<uint8_t> local = pixels;
+                sstv_image_t image;
+                check(sstv_pack_image(&image, width, height, SSTV_FORMAT_RGB, local.data()), "sstv_pack_image()");
+                check(sstv_convert_image(&image, format), "sstv_convert_image()");
+                Hash expected = encode_chunked(image, c.mode, c.rate, c.type, 4096);
+
+                /* served */
+                std::string request = format_request({ c.name, c.rate, c.format, "-", "-" });
+                write_all(fd, request.data(), request.size());
+                write_all(fd, pixels.data(), pixels.size());
+
+                std::string reply;
+                Hash served;
+                if (reader.read_line(reply) && reply.compare(0, 3, "OK ") == 0) {
+                    std::vector<uint8_t> samples(std::stoull(reply.substr(3)) * sample_size(c.type));
+                    reader.read_exact(samples.data(), samples.size());
+                    served.add(samples.data(), samples.size() / sample_size(c.type), c.type);
+                }
+
+                bool ok = (served == expected);
+                std::cout << c.name << " at " << c.rate << " Hz (" << c.format << "): "
+                          << (ok ? "ok" : "served " + hex(served.value()) + ", expected " + hex(expected.value()))
+                          << std::endl;
+                failures += !ok;
+            }
+
+            /* errors are replied to, and the connection stays usable */
+            std::string request = format_request({ "no_such_mode", 8000, "s16", "/dev/null", "-" });
+            write_all(fd, request.data(), request.size());
+            std::string reply;
+            bool ok = reader.read_line(reply) && reply.compare(0, 4, "ERR ") == 0;
+            std::cout << "unknown mode: " << (ok ? "ok" : "not rejected") << std::endl;
+            failures += !ok;
+
+            /* rates out of range, on an image that exists */
+            uint32_t width, height;
+            sstv_image_format_t format;
+            check(sstv_get_mode_image_props(SSTV_MODE_ROBOT_BW8_R, &width, &height, &format),
+                  "sstv_get_mode_image_props()");
+            std::vector<uint8_t> pixels((size_t)width * height * 3);
+            for (size_t i = 0; i < pixels.size(); i ++) {
+                pixels[i] = (uint8_t)(i * 7);
+            }
+            std::string ppm = (dir / "bw8.ppm").string();
+            write_file(ppm, "P6 " + std::to_string(width) + " " + std::to_string(height) + " 255\n", pixels);
+            for (uint32_t rate : { 0u, 100u }) {
+                request = format_request({ "robot_bw8_r", rate, "u8", ppm, "-" });
+                write_all(fd, request.data(), request.size());
+                ok = reader.read_line(reply) && reply.compare(0, 4, "ERR ") == 0;
+                std::cout << "sample rate " << rate << ": " << (ok ? "ok" : "not rejected") << std::endl;
+                failures += !ok;
+            }
+
+            /* more rates than a worker keeps warm contexts for, then the
+               first one again, after its context was dropped */
+            std::vector<uint32_t> rates;
+            for (uint32_t k = 0; k < 20; k ++) {
+                rates.push_back(6000 + 500 * k);
+            }
+            rates.push_back(6000);
+            size_t wrong = 0;
+            for (uint32_t rate : rates) {
+                std::vector<uint8_t> local = pixels;
+                sstv_image_t image;
+                check(sstv_pack_image(&image, width, height, SSTV_FORMAT_RGB, local.data()), "sstv_pack_image()");
+                check(sstv_convert_image(&image, format), "sstv_convert_image()");
+                Hash expected = encode_chunked(image, SSTV_MODE_ROBOT_BW8_R, rate, SSTV_SAMPLE_INT16, 4096);
+
+                request = format_request({ "robot_bw8_r", rate, "s16", "-", "-" });
+                write_all(fd, request.data(), request.size());
+                write_all(fd, pixels.data(), pixels.size());
+                Hash served;
+                if (reader.read_line(reply) && reply.compare(0, 3, "OK ") == 0) {
+                    std::vector<uint8_t> samples(std::stoull(reply.substr(3)) * 2);
+                    reader.read_exact(samples.data(), samples.size());
+                    served.add(samples.data(), samples.size() / 2, SSTV_SAMPLE_INT16);
+                }
+                wrong += (served != expected);
+            }
+            std::cout << rates.size() << " sample rates: " << (wrong ? std::to_string(wrong) + " wrong" : "ok")
+                      << std::endl;
+            failures += (wrong != 0);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << std::endl;
+            failures ++;
+        }
+        close(fd);
+
+        /* requests that may be followed by pixels are answered, then the
+           connection is closed */
+        const char *rejected[] = {
+            "martin_m1\t8000x\ts16\t-\t-\n",
+            "martin_m1\t8000\ts16\t-\n",
+            "no_such_mode\t8000\ts16\t-\t-\n",
+            "robot_bw8_r\t0\tu8\t-\t-\n",
+            "robot_bw8_r\t999999999\ts16\t-\t-\n",
+        };
+        for (const char *request : rejected) {
+            bool ok = false;
+            try {
+                int fd = connect_unix(socket_path);
+                struct timeval timeout = { 10, 0 }; /* a daemon waiting for pixels fails the case */
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                SocketReader reader(fd);
+                write_all(fd, request, std::strlen(request));
+                std::string reply;
+                ok = reader.read_line(reply) && reply.compare(0, 4, "ERR ") == 0 && !reader.read_line(reply);
+                close(fd);
+            } catch (const std::runtime_error& e) {
+                std::cerr << e.what() << std::endl;
+            }
+            std::string line(request, std::strlen(request) - 1);
+            std::replace(line.begin(), line.end(), '\t', ' ');
+            std::cout << "'" << line << "': " << (ok ? "ok" : "not rejected") << std::endl;
+            failures += !ok;
+        }
+
+        /* a second daemon refuses the live socket, and the first keeps it */
+        pid_t second = fork();
+        if (second == 0) {
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            execl(daemon.c_str(), daemon.c_str(), "-j", "1", socket_path.c_str(), (char *)nullptr);
+            _exit(127);
+        }
+        int status = 0;
+        bool exited = false;
+        for (int attempt = 0; attempt < 100 && second > 0 && !exited; attempt ++) {
+            exited = (waitpid(second, &status, WNOHANG) == second);
+            if (!exited) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+        }
+        if (second > 0 && !exited) {
+            /* still running: it took the socket over */
+            kill(second, SIGTERM);
+            waitpid(second, &status, 0);
+        }
+        bool refused = (exited && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_FAILURE);
+        try {
+            close(connect_unix(socket_path));
+        } catch (const std::runtime_error&) {
+            refused = false;
+        }
+        std::cout << "live socket kept: " << (refused ? "ok" : "taken over") << std::endl;
+        failures += !refused;
+    }
+
+    /* the daemon removes its socket when stopped */
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+    bool removed = !std::filesystem::exists(socket_path);
+    std::cout << "socket removed on exit: " << (removed ? "ok" : "left behind") << std::endl;
+    failures += !removed;
+
+    std::filesystem::remove_all(dir);
+    return (failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+int main(int argc, char **argv)
+{
+    if (sstv_init(malloc, free) != SSTV_OK) {
+        std::cerr << "sstv_init() failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string test = (argc > 1 ? argv[1] : "");
+    if (test == "golden" && (argc == 3 || (argc == 4 && std::string(argv[3]) == "update"))) {
+        return run_golden(argv[2], argc == 4);
+    } else if (test == "paths" && argc == 2) {
+        return run_paths();
+    } else if (test == "roundtrip" && argc == 2) {
+        return run_roundtrip();
+    } else if (test == "iq" && argc == 2) {
+        return run_iq();
+    } else if (test == "drift" && argc == 2) {
+        return run_drift();
+    } else if (test == "identify" && argc == 2) {
+        return run_identify();
+    } else if (test == "vis" && argc == 2) {
+        return run_vis();
+    } else if (test == "farm" && argc == 2) {
+        return run_farm();
+    } else if (test == "trace" && argc == 2) {
+        return run_trace();
+    } else if (test == "timing" && argc == 2) {
+        return run_timing();
+    } else if (test == "stats" && argc == 2) {
+        return run_stats();
+    } else if (test == "rebind" && argc == 3) {
+        return run_rebind(argv[2]);
+    } else if (test == "state" && argc == 2) {
+        return run_state();
+    } else if (test == "images" && argc == 2) {
+        return run_images();
+    } else if (test == "daemon" && argc == 3) {
+        return run_daemon(argv[2]);
+    } else if (test == "scan" && argc == 4) {
+        return run_scan(argv[2], argv[3]);
+    }
+
+    std::cerr << "usage: " << argv[0] << " golden <file> [update] | paths | roundtrip | iq | drift | identify | vis | farm | trace | timing | stats | rebind <file> | state | images | daemon <sstv-encoded> | scan <sstv-encode> <sstv-decode>" << std::endl;
+    return EXIT_FAILURE;
+}